@@ -0,0 +1,1142 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cvec.h"
+#include "cvec_alloc.h"
+#include "cvec_batch.h"
+#include "cvec_bounds.h"
+#include "cvec_bvh.h"
+#include "cvec_command.h"
+#include "cvec_file.h"
+#include "cvec_fixed.h"
+#include "cvec_lanes.h"
+#include "cvec_morton.h"
+#include "cvec_parallel.h"
+#include "cvec_particle.h"
+#include "cvec_polygon.h"
+#include "cvec_quant.h"
+#include "cvec_query.h"
+#include "cvec_rotation.h"
+#include "cvec_stream.h"
+#include "cvec_voxel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float randf(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void report(const char *name, double seconds, double items, const char *unit)
+{
+    printf("%-32s %10.3f ms %12.2f M%s/s\n", name, seconds * 1e3, items / seconds * 1e-6, unit);
+}
+
+static void bench_bvh(void)
+{
+    enum { N = 500000, RAYS = 200000 };
+    vec3 *verts = malloc(sizeof(vec3) * 3 * N);
+    int threads, i, k, hits = 0;
+    double t0;
+    bvh t;
+
+    srand(1);
+    for (i = 0; i < N; i++) {
+        vec3 c = Vec3(randf(-100, 100), randf(-100, 100), randf(-100, 100));
+        for (k = 0; k < 3; k++) {
+            verts[3*i+k] = vec3_add(c, Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1)));
+        }
+    }
+
+    for (threads = 1; threads <= 8; threads *= 2) {
+        char name[64];
+        t0 = now();
+        bvh_build_triangles(&t, verts, N, threads);
+        sprintf(name, "bvh_build_triangles (%d thr)", threads);
+        report(name, now() - t0, N, "tri");
+        if (threads < 8) {
+            bvh_free(&t);
+        }
+    }
+
+    for (i = 0; i < 3*N; i++) {
+        verts[i] = vec3_add(verts[i], Vec3(randf(-0.1, 0.1), randf(-0.1, 0.1), randf(-0.1, 0.1)));
+    }
+    t0 = now();
+    bvh_refit_triangles(&t, verts);
+    report("bvh_refit_triangles", now() - t0, N, "tri");
+
+    t0 = now();
+    for (i = 0; i < RAYS; i++) {
+        vec3 origin = Vec3(randf(-100, 100), randf(-100, 100), -150);
+        vec3 dir = vec3_normalize(Vec3(randf(-0.3, 0.3), randf(-0.3, 0.3), 1));
+        float d;
+        hits += bvh_intersect_ray(&t, verts, origin, dir, INFINITY, &d) >= 0;
+    }
+    report("bvh_intersect_ray", now() - t0, RAYS, "ray");
+    printf("  (%d/%d rays hit, %d nodes)\n", hits, RAYS, t.num_nodes);
+
+    bvh_free(&t);
+    free(verts);
+}
+
+static void bench_morton(void)
+{
+    enum { N = 4000000 };
+    vec3 *p = malloc(sizeof(vec3) * N);
+    uint32_t *codes30 = malloc(sizeof(uint32_t) * N);
+    uint64_t *codes63 = malloc(sizeof(uint64_t) * N);
+    aabb bounds = Aabb(Vec3(-100, -100, -100), Vec3(100, 100, 100));
+    double t0;
+    int i;
+
+    srand(2);
+    for (i = 0; i < N; i++) {
+        p[i] = Vec3(randf(-100, 100), randf(-100, 100), randf(-100, 100));
+    }
+
+    t0 = now();
+    morton30_encode_batch(p, codes30, N, bounds);
+    report("morton30_encode_batch", now() - t0, N, "pt");
+
+    t0 = now();
+    morton63_encode_batch(p, codes63, N, bounds);
+    report("morton63_encode_batch", now() - t0, N, "pt");
+
+    t0 = now();
+    morton_sort_vec3(p, N, bounds, NULL, 0, NULL, 4);
+    report("morton_sort_vec3", now() - t0, N, "pt");
+
+    free(p);
+    free(codes30);
+    free(codes63);
+}
+
+static void bench_quant(void)
+{
+    enum { N = 4000000 };
+    vec3 *p = malloc(sizeof(vec3) * N);
+    vec3 *out = malloc(sizeof(vec3) * N);
+    uint16_t *h = malloc(sizeof(uint16_t) * 3 * N);
+    uint32_t *oct = malloc(sizeof(uint32_t) * N);
+    aabb bounds = Aabb(Vec3(-100, -100, -100), Vec3(100, 100, 100));
+    mat4 m[1];
+    double t0;
+    int i;
+
+    srand(3);
+    for (i = 0; i < N; i++) {
+        p[i] = Vec3(randf(-100, 100), randf(-100, 100), randf(-100, 100));
+    }
+    mat4_init_rotate(m, Vec3(1, 2, 3), 0.5);
+
+    t0 = now();
+    vec3_encode_half_batch(p, h, N);
+    report("vec3_encode_half_batch", now() - t0, N, "vec");
+
+    t0 = now();
+    vec3_decode_half_batch(h, out, N);
+    report("vec3_decode_half_batch", now() - t0, N, "vec");
+
+    for (i = 0; i < N; i++) {
+        out[i] = vec3_normalize(p[i]);
+    }
+    t0 = now();
+    oct32_encode_batch(out, oct, N);
+    report("oct32_encode_batch", now() - t0, N, "vec");
+
+    t0 = now();
+    oct32_decode_batch(oct, out, N);
+    report("oct32_decode_batch", now() - t0, N, "vec");
+
+    t0 = now();
+    pos16_encode_batch(p, h, N, bounds);
+    report("pos16_encode_batch", now() - t0, N, "vec");
+
+    t0 = now();
+    pos16_decode_batch(h, out, N, bounds);
+    for (i = 0; i < N; i++) {
+        vec4 r = mat4_transform(m, Vec4(out[i].x, out[i].y, out[i].z, 1));
+        out[i] = Vec3(r.x, r.y, r.z);
+    }
+    report("pos16 decode + mat4_transform", now() - t0, N, "vec");
+
+    t0 = now();
+    mat4_transform_pos16_batch(m, h, out, N, bounds);
+    report("mat4_transform_pos16_batch", now() - t0, N, "vec");
+
+    free(p);
+    free(out);
+    free(h);
+    free(oct);
+}
+
+static void bench_file(void)
+{
+    enum { N = 4000000 };
+    const char *path = "bench_cvec_file.bin";
+    vec3 *p = malloc(sizeof(vec3) * N);
+    vec3 sum = Vec3(0, 0, 0);
+    const vec3 *mapped;
+    cvec_file f;
+    FILE *fp;
+    double t0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        p[i] = Vec3(i, -i, 2*i);
+    }
+
+    t0 = now();
+    cvec_file_write(path, CVEC_TYPE_VEC3, CVEC_LAYOUT_AOS, p, N, NULL);
+    report("cvec_file_write", now() - t0, N, "vec");
+
+    t0 = now();
+    fp = fopen(path, "rb");
+    fseek(fp, 64, SEEK_SET);
+    if (fread(p, sizeof(vec3), N, fp) != N) {
+        abort();
+    }
+    fclose(fp);
+    report("fread", now() - t0, N, "vec");
+
+    t0 = now();
+    cvec_file_open(&f, path);
+    mapped = cvec_file_vec3(&f);
+    report("cvec_file_open", now() - t0, N, "vec");
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        sum = vec3_add(sum, mapped[i]);
+    }
+    report("first pass over mapping", now() - t0, N, "vec");
+    printf("  (checksum %g)\n", sum.x + sum.y + sum.z);
+
+    cvec_file_close(&f);
+    remove(path);
+    free(p);
+}
+
+static void bench_stream(void)
+{
+    enum { N = 8000000 };
+    const char *in_path = "bench_cvec_stream_in.bin";
+    const char *out_path = "bench_cvec_stream_out.bin";
+    vec3 *p = malloc(sizeof(vec3) * N);
+    cvec_stream_stats stats;
+    FILE *fp;
+    mat4 m[1];
+    int i;
+
+    for (i = 0; i < N; i++) {
+        p[i] = Vec3(i, -i, 2*i);
+    }
+    fp = fopen(in_path, "wb");
+    fwrite(p, sizeof(vec3), N, fp);
+    fclose(fp);
+    free(p);
+
+    mat4_init_rotate(m, Vec3(1, 2, 3), 0.5);
+    if (cvec_stream_transform_file(in_path, out_path, 1 << 16, m, &stats) < 0) {
+        perror("cvec_stream_transform_file");
+        abort();
+    }
+    report("cvec_stream_transform_file", stats.seconds, stats.points, "vec");
+    printf("  (compute %.1f ms, write %.1f ms, stalled on read %.1f ms)\n",
+           stats.compute_seconds * 1e3, stats.write_seconds * 1e3, stats.stall_seconds * 1e3);
+
+    remove(in_path);
+    remove(out_path);
+}
+
+static void bench_double(void)
+{
+    enum { N = 4000000 };
+    vec3 *p = malloc(sizeof(vec3) * N);
+    dvec3 *d = malloc(sizeof(dvec3) * N);
+    dmat4 dm[1];
+    mat4 m[1];
+    double t0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        d[i] = DVec3(1e7 + i, -i, 2*i);
+    }
+    dmat4_init_rotate(dm, DVec3(1, 2, 3), 0.5);
+    dmat4_to_mat4(dm, m);
+
+    t0 = now();
+    dvec3_to_vec3_relative_batch(d, DVec3(1e7, 0, 0), p, N);
+    report("dvec3_to_vec3_relative_batch", now() - t0, N, "vec");
+
+    t0 = now();
+    mat4_transform_point_batch(m, p, p, N);
+    report("mat4_transform_point_batch", now() - t0, N, "vec");
+
+    t0 = now();
+    dmat4_transform_point_batch(dm, d, d, N);
+    report("dmat4_transform_point_batch", now() - t0, N, "vec");
+
+    free(p);
+    free(d);
+}
+
+static void bench_fixed(void)
+{
+    enum { N = 4000000 };
+    vec3 *p = malloc(sizeof(vec3) * N);
+    q16vec3 *q = malloc(sizeof(q16vec3) * N);
+    q32vec3 *q32p = malloc(sizeof(q32vec3) * N);
+    q16mat4 m16[1];
+    q32mat4 m32[1];
+    mat4 m[1];
+    double t0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        p[i] = Vec3(randf(-100, 100), randf(-100, 100), randf(-100, 100));
+    }
+    mat4_init_rotate(m, Vec3(1, 2, 3), 0.5);
+    q16mat4_from_mat4(m, m16);
+    q32mat4_from_mat4(m, m32);
+    q16vec3_from_vec3_batch(p, q, N);
+    for (i = 0; i < N; i++) {
+        q32p[i] = Q32Vec3(q32_from_float(p[i].x), q32_from_float(p[i].y), q32_from_float(p[i].z));
+    }
+
+    t0 = now();
+    mat4_transform_point_batch(m, p, p, N);
+    report("mat4_transform_point_batch", now() - t0, N, "vec");
+
+    t0 = now();
+    q16mat4_transform_point_batch(m16, q, q, N);
+    report("q16mat4_transform_point_batch", now() - t0, N, "vec");
+
+    t0 = now();
+    q32mat4_transform_point_batch(m32, q32p, q32p, N / 8);
+    report("q32mat4_transform_point_batch", now() - t0, N / 8, "vec");
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        p[i] = vec3_normalize(p[i]);
+    }
+    report("vec3_normalize", now() - t0, N, "vec");
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        q[i] = q16vec3_normalize(q[i]);
+    }
+    report("q16vec3_normalize", now() - t0, N, "vec");
+
+    free(p);
+    free(q);
+    free(q32p);
+}
+
+static void bench_particle(void)
+{
+    enum { N = 4000000 };
+    vec3 *p = malloc(sizeof(vec3) * N);
+    vec3 *v = malloc(sizeof(vec3) * N);
+    vec3 *a = malloc(sizeof(vec3) * N);
+    float *soa = malloc(sizeof(float) * 9 * N);
+    vec3_soa pos = Vec3Soa(soa, soa + N, soa + 2*N);
+    vec3_soa vel = Vec3Soa(soa + 3*N, soa + 4*N, soa + 5*N);
+    vec3_soa acc = Vec3Soa(soa + 6*N, soa + 7*N, soa + 8*N);
+    particle_params params;
+    double t0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        p[i] = Vec3(randf(-10, 10), randf(-10, 10), randf(-10, 10));
+        v[i] = Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1));
+        a[i] = Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1));
+    }
+    vec3_soa_from_aos(p, pos, N);
+    vec3_soa_from_aos(v, vel, N);
+    vec3_soa_from_aos(a, acc, N);
+    params.dt = 0.01f;
+    params.damping = 0.1f;
+    params.gravity = Vec3(0, -9.8f, 0);
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        v[i] = vec3_add(v[i], vec3_scale(vec3_add(a[i], params.gravity), params.dt));
+        v[i] = vec3_scale(v[i], 1 - params.damping * params.dt);
+        p[i] = vec3_add(p[i], vec3_scale(v[i], params.dt));
+    }
+    report("semi-implicit Euler, vec3 ops", now() - t0, N, "particle");
+
+    t0 = now();
+    particle_euler_semi(pos, vel, &acc, N, &params, 1);
+    report("particle_euler_semi (1 thr)", now() - t0, N, "particle");
+
+    t0 = now();
+    particle_euler_semi(pos, vel, &acc, N, &params, 4);
+    report("particle_euler_semi (4 thr)", now() - t0, N, "particle");
+
+    t0 = now();
+    particle_verlet_position(pos, vel, &acc, N, &params, 1);
+    particle_verlet_velocity(vel, &acc, N, &params, 1);
+    report("particle_verlet (1 thr)", now() - t0, N, "particle");
+
+    free(p);
+    free(v);
+    free(a);
+    free(soa);
+}
+
+static void parallel_scale(void *ctx, size_t begin, size_t end)
+{
+    vec4 *v = ctx;
+    size_t i;
+    for (i = begin; i < end; i++) {
+        v[i] = vec4_scale(v[i], 0.999f);
+    }
+}
+
+static void *parallel_spawned(void *arg)
+{
+    vec4 *v = arg;
+    parallel_scale(v, 0, 4096);
+    return NULL;
+}
+
+static void bench_lanes(void)
+{
+    enum { N = 4096, B = CVEC_LANES_BLOCKS(N), REPS = 250 };
+    mat4 *a = malloc(sizeof(mat4) * N);
+    mat4 *b = malloc(sizeof(mat4) * N);
+    mat4 *r = malloc(sizeof(mat4) * N);
+    mat4_lanes *la = malloc(sizeof(mat4_lanes) * B);
+    mat4_lanes *lb = malloc(sizeof(mat4_lanes) * B);
+    mat4_lanes *lr = malloc(sizeof(mat4_lanes) * B);
+    float *det = malloc(sizeof(float) * N);
+    double t0;
+    int i, e, k;
+
+    for (i = 0; i < N; i++) {
+        for (e = 0; e < 16; e++) {
+            a[i].data[e] = randf(-1, 1);
+            b[i].data[e] = randf(-1, 1);
+        }
+    }
+
+    t0 = now();
+    for (k = 0; k < REPS; k++) {
+        for (i = 0; i < N; i++) {
+            mat4_mult(&a[i], &b[i], &r[i]);
+        }
+    }
+    report("mat4_mult", now() - t0, (double)REPS * N, "mat");
+
+    t0 = now();
+    mat4_to_lanes(a, la, N);
+    mat4_to_lanes(b, lb, N);
+    report("mat4_to_lanes (x2)", now() - t0, N, "mat");
+
+    t0 = now();
+    for (k = 0; k < REPS; k++) {
+        mat4_lanes_mult(la, lb, lr, N);
+    }
+    report("mat4_lanes_mult", now() - t0, (double)REPS * N, "mat");
+
+    t0 = now();
+    for (k = 0; k < REPS; k++) {
+        for (i = 0; i < N; i++) {
+            r[i] = a[i];
+            mat4_transpose(&r[i]);
+        }
+    }
+    report("mat4_transpose", now() - t0, (double)REPS * N, "mat");
+
+    t0 = now();
+    for (k = 0; k < REPS; k++) {
+        mat4_lanes_transpose(la, lr, N);
+    }
+    report("mat4_lanes_transpose", now() - t0, (double)REPS * N, "mat");
+
+    t0 = now();
+    for (k = 0; k < REPS; k++) {
+        mat4_lanes_determinant(la, det, N);
+    }
+    report("mat4_lanes_determinant", now() - t0, (double)REPS * N, "mat");
+
+    t0 = now();
+    for (k = 0; k < REPS; k++) {
+        mat4_lanes_inverse(la, lr, N);
+    }
+    report("mat4_lanes_inverse", now() - t0, (double)REPS * N, "mat");
+
+    free(a);
+    free(b);
+    free(r);
+    free(la);
+    free(lb);
+    free(lr);
+    free(det);
+}
+
+static void bench_rotation(void)
+{
+    enum { N = 1000000, STEPS = 4096, M = 100000 };
+    vec3 axis = Vec3(0.3f, 0.4f, 0.5f);
+    vec3 v = Vec3(1, 0, 0), sum = Vec3(0, 0, 0);
+    rot_table t;
+    rot_sweep w;
+    mat3 m;
+    mat3 *drift = malloc(sizeof(mat3) * M), *a = malloc(sizeof(mat3) * M);
+    double t0;
+    int i, j;
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        mat3_init_rotate(&m, axis, 2 * M_PI * (i % STEPS) / STEPS);
+        sum = vec3_add(sum, mat3_transform(&m, v));
+    }
+    report("mat3_init_rotate", now() - t0, N, "rot");
+
+    rot_table_init(&t, axis, STEPS);
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        rot_table_mat3(&t, i, &m);
+        sum = vec3_add(sum, mat3_transform(&m, v));
+    }
+    report("rot_table_mat3", now() - t0, N, "rot");
+    rot_table_free(&t);
+
+    rot_sweep_init(&w, axis, 0, 2 * M_PI / STEPS);
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        rot_sweep_mat3(&w, &m);
+        rot_sweep_next(&w);
+        sum = vec3_add(sum, mat3_transform(&m, v));
+    }
+    report("rot_sweep_mat3", now() - t0, N, "rot");
+
+    /* Re-orthonormalizing M rotations that have drifted by about 1e-4. */
+    for (i = 0; i < M; i++) {
+        mat3_init_rotate(&drift[i], Vec3(randf(-1, 1), randf(-1, 1), 1), randf(-3, 3));
+        for (j = 0; j < 9; j++) {
+            drift[i].data[j] += randf(-1e-4f, 1e-4f);
+        }
+    }
+    memcpy(a, drift, sizeof(mat3) * M);
+    t0 = now();
+    for (i = 0; i < M; i++) {
+        mat3_orthonormalize(&a[i]);
+    }
+    report("mat3_orthonormalize", now() - t0, M, "mat");
+    memcpy(a, drift, sizeof(mat3) * M);
+    t0 = now();
+    mat3_orthonormalize_batch(a, M, 0);
+    report("mat3_orthonormalize_batch", now() - t0, M, "mat");
+    memcpy(a, drift, sizeof(mat3) * M);
+    t0 = now();
+    for (i = 0; i < M; i++) {
+        mat3_orthonormalize_polar(&a[i]);
+    }
+    report("mat3_orthonormalize_polar", now() - t0, M, "mat");
+    memcpy(a, drift, sizeof(mat3) * M);
+    t0 = now();
+    mat3_orthonormalize_polar_batch(a, M, 0);
+    report("mat3_orthonormalize_polar_batch", now() - t0, M, "mat");
+    t0 = now();
+    j = (int)mat3_orthonormalize_polar_batch(a, M, 1e-5f);
+    report("..._polar_batch (none past tol)", now() - t0, M, "mat");
+    sum.x += j + mat3_orthonormal_error(&a[M - 1]);
+    free(drift);
+    free(a);
+
+    printf("  (checksum %g)\n", sum.x + sum.y + sum.z);
+}
+
+static void bench_query(void)
+{
+    enum { N = 1000000 };
+    vec3 *p = malloc(sizeof(vec3) * N);
+    vec3 *prims = malloc(sizeof(vec3) * 3 * N);
+    aabb *boxes = malloc(sizeof(aabb) * N);
+    vec3 *closest = malloc(sizeof(vec3) * N);
+    float *dist2 = malloc(sizeof(float) * N);
+    float *soa = calloc(15 * N, sizeof(float));
+    vec3_soa ps = Vec3Soa(soa, soa + N, soa + 2*N);
+    vec3_soa as = Vec3Soa(soa + 3*N, soa + 4*N, soa + 5*N);
+    vec3_soa bs = Vec3Soa(soa + 6*N, soa + 7*N, soa + 8*N);
+    vec3_soa cs = Vec3Soa(soa + 9*N, soa + 10*N, soa + 11*N);
+    vec3_soa out = Vec3Soa(soa + 12*N, soa + 13*N, soa + 14*N);
+    double t0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        vec3 lo = Vec3(randf(-2, 2), randf(-2, 2), randf(-2, 2));
+        p[i] = Vec3(randf(-3, 3), randf(-3, 3), randf(-3, 3));
+        prims[3*i] = Vec3(randf(-2, 2), randf(-2, 2), randf(-2, 2));
+        prims[3*i+1] = Vec3(randf(-2, 2), randf(-2, 2), randf(-2, 2));
+        prims[3*i+2] = Vec3(randf(-2, 2), randf(-2, 2), randf(-2, 2));
+        boxes[i] = Aabb(lo, vec3_add(lo, Vec3(randf(0, 2), randf(0, 2), randf(0, 2))));
+        vec3_soa_set(ps, i, p[i]);
+        vec3_soa_set(as, i, prims[3*i]);
+        vec3_soa_set(bs, i, prims[3*i+1]);
+        vec3_soa_set(cs, i, prims[3*i+2]);
+    }
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        vec3 a = prims[3*i], ab = vec3_sub(prims[3*i+1], a);
+        float t = vec3_dot(vec3_sub(p[i], a), ab) / vec3_dot(ab, ab);
+        vec3 c;
+        if (t < 0) {
+            t = 0;
+        } else if (t > 1) {
+            t = 1;
+        }
+        c = vec3_add(a, vec3_scale(ab, t));
+        closest[i] = c;
+        dist2[i] = vec3_dot(vec3_sub(p[i], c), vec3_sub(p[i], c));
+    }
+    report("point-segment, vec3 ops", now() - t0, N, "query");
+
+    for (i = 0; i < N; i++) {
+        prims[2*i] = vec3_soa_get(as, i);
+        prims[2*i+1] = vec3_soa_get(bs, i);
+    }
+    t0 = now();
+    closest_point_segment_batch(p, prims, closest, dist2, N);
+    report("closest_point_segment_batch", now() - t0, N, "query");
+
+    t0 = now();
+    closest_point_segment_soa_batch(ps, as, bs, out, dist2, N);
+    report("closest_point_segment_soa_batch", now() - t0, N, "query");
+
+    for (i = 0; i < N; i++) {
+        prims[3*i] = vec3_soa_get(as, i);
+        prims[3*i+1] = vec3_soa_get(bs, i);
+        prims[3*i+2] = vec3_soa_get(cs, i);
+    }
+
+    t0 = now();
+    closest_point_triangle_batch(p, prims, closest, dist2, N);
+    report("closest_point_triangle_batch", now() - t0, N, "query");
+
+    t0 = now();
+    closest_point_triangle_soa_batch(ps, as, bs, cs, out, dist2, N);
+    report("closest_point_triangle_soa_batch", now() - t0, N, "query");
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        vec3 c = vec3_min(vec3_max(p[i], boxes[i].min), boxes[i].max);
+        closest[i] = c;
+        dist2[i] = vec3_dot(vec3_sub(p[i], c), vec3_sub(p[i], c));
+    }
+    report("point-aabb, vec3 ops", now() - t0, N, "query");
+
+    t0 = now();
+    closest_point_aabb_batch(p, boxes, closest, dist2, N);
+    report("closest_point_aabb_batch", now() - t0, N, "query");
+
+    free(p);
+    free(prims);
+    free(boxes);
+    free(closest);
+    free(dist2);
+    free(soa);
+}
+
+/* The box around the 8 transformed corners of b. */
+static aabb corners_aabb(const mat4 *m, aabb b)
+{
+    aabb r = aabb_empty();
+    int k;
+    for (k = 0; k < 8; k++) {
+        vec4 p = Vec4(k & 1 ? b.max.x : b.min.x, k & 2 ? b.max.y : b.min.y,
+                      k & 4 ? b.max.z : b.min.z, 1);
+        p = mat4_transform(m, p);
+        r = aabb_extend(r, Vec3(p.x, p.y, p.z));
+    }
+    return r;
+}
+
+static void bench_bounds(void)
+{
+    enum { N = 1000000 };
+    mat4 *ms = malloc(sizeof(mat4) * N);
+    aabb *boxes = malloc(sizeof(aabb) * N);
+    aabb *out = malloc(sizeof(aabb) * N);
+    sphere *spheres = malloc(sizeof(sphere) * N);
+    sphere *sout = malloc(sizeof(sphere) * N);
+    float *soa = malloc(sizeof(float) * 12 * N);
+    vec3_soa lo = Vec3Soa(soa, soa + N, soa + 2*N);
+    vec3_soa hi = Vec3Soa(soa + 3*N, soa + 4*N, soa + 5*N);
+    vec3_soa olo = Vec3Soa(soa + 6*N, soa + 7*N, soa + 8*N);
+    vec3_soa ohi = Vec3Soa(soa + 9*N, soa + 10*N, soa + 11*N);
+    double t0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        vec3 c = Vec3(randf(-50, 50), randf(-50, 50), randf(-50, 50));
+        vec3 e = Vec3(randf(0, 5), randf(0, 5), randf(0, 5));
+        mat4_init_rotate(&ms[i], Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1)), randf(-3, 3));
+        ms[i].data[12] = randf(-100, 100);
+        boxes[i] = Aabb(vec3_sub(c, e), vec3_add(c, e));
+        spheres[i] = Sphere(c, randf(0, 5));
+        vec3_soa_set(lo, i, boxes[i].min);
+        vec3_soa_set(hi, i, boxes[i].max);
+        vec3_soa_set(olo, i, Vec3(0, 0, 0));
+        vec3_soa_set(ohi, i, Vec3(0, 0, 0));
+        sout[i] = spheres[i];
+    }
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        out[i] = corners_aabb(&ms[0], boxes[i]);
+    }
+    report("aabb, 8 corners", now() - t0, N, "box");
+
+    t0 = now();
+    mat4_transform_aabb_batch(&ms[0], boxes, out, N);
+    report("mat4_transform_aabb_batch", now() - t0, N, "box");
+
+    t0 = now();
+    mat4_transform_aabb_soa_batch(&ms[0], lo, hi, olo, ohi, N);
+    report("mat4_transform_aabb_soa_batch", now() - t0, N, "box");
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        out[i] = corners_aabb(&ms[i], boxes[i]);
+    }
+    report("aabb, 8 corners, each matrix", now() - t0, N, "box");
+
+    t0 = now();
+    mat4_transform_aabb_each_batch(ms, boxes, out, N);
+    report("mat4_transform_aabb_each_batch", now() - t0, N, "box");
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        sout[i] = mat4_transform_sphere(&ms[i], spheres[i]);
+    }
+    report("mat4_transform_sphere", now() - t0, N, "sphere");
+
+    t0 = now();
+    mat4_transform_sphere_batch(&ms[0], spheres, sout, N);
+    report("mat4_transform_sphere_batch", now() - t0, N, "sphere");
+
+    t0 = now();
+    mat4_transform_sphere_each_batch(ms, spheres, sout, N);
+    report("mat4_transform_sphere_each_batch", now() - t0, N, "sphere");
+
+    free(ms);
+    free(boxes);
+    free(out);
+    free(spheres);
+    free(sout);
+    free(soa);
+}
+
+static void bench_trs(void)
+{
+    enum { N = 1000000 };
+    vec3 *t = malloc(sizeof(vec3) * N);
+    vec3 *axis = malloc(sizeof(vec3) * N);
+    vec3 *s = malloc(sizeof(vec3) * N);
+    float *angle = malloc(sizeof(float) * N);
+    vec4 *q = malloc(sizeof(vec4) * N);
+    mat4 *out = malloc(sizeof(mat4) * N);
+    float *soa = malloc(sizeof(float) * 10 * N);
+    vec3_soa ts = Vec3Soa(soa, soa + N, soa + 2*N);
+    vec4_soa qs = Vec4Soa(soa + 3*N, soa + 4*N, soa + 5*N, soa + 6*N);
+    vec3_soa ss = Vec3Soa(soa + 7*N, soa + 8*N, soa + 9*N);
+    double t0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        t[i] = Vec3(randf(-10, 10), randf(-10, 10), randf(-10, 10));
+        axis[i] = Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1));
+        s[i] = Vec3(randf(0.5, 2), randf(0.5, 2), randf(0.5, 2));
+        angle[i] = randf(-M_PI, M_PI);
+        q[i] = quat_from_axis_angle(axis[i], angle[i]);
+        vec3_soa_set(ts, i, t[i]);
+        vec4_soa_set(qs, i, q[i]);
+        vec3_soa_set(ss, i, s[i]);
+    }
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        mat4 tm, rm, sm, tr;
+        mat4_init_translate(&tm, t[i]);
+        mat4_init_rotate(&rm, axis[i], angle[i]);
+        mat4_init(&sm, s[i].x, 0, 0, 0,
+                       0, s[i].y, 0, 0,
+                       0, 0, s[i].z, 0,
+                       0, 0, 0, 1);
+        mat4_mult(&tm, &rm, &tr);
+        mat4_mult(&tr, &sm, &out[i]);
+    }
+    report("translate*rotate*scale", now() - t0, N, "mat");
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        mat4_init_trs(&out[i], t[i], q[i], s[i]);
+    }
+    report("mat4_init_trs", now() - t0, N, "mat");
+
+    t0 = now();
+    mat4_init_trs_batch(ts, qs, ss, out, N);
+    report("mat4_init_trs_batch", now() - t0, N, "mat");
+
+    t0 = now();
+    mat4_decompose_batch(out, ts, qs, ss, N);
+    report("mat4_decompose_batch", now() - t0, N, "mat");
+
+    free(t);
+    free(axis);
+    free(s);
+    free(angle);
+    free(q);
+    free(out);
+    free(soa);
+}
+
+static void bench_parallel(void)
+{
+    enum { CALLS = 2000, N = 16384, THREADS = 4 };
+    vec4 *v = malloc(sizeof(vec4) * N);
+    pthread_t handles[THREADS];
+    double t0;
+    int i, k;
+
+    for (i = 0; i < N; i++) {
+        v[i] = Vec4(randf(-1, 1), randf(-1, 1), randf(-1, 1), randf(-1, 1));
+    }
+
+    /* What cvec_parallel_for used to do: one thread per range per call. */
+    t0 = now();
+    for (i = 0; i < CALLS; i++) {
+        for (k = 1; k < THREADS; k++) {
+            pthread_create(&handles[k], NULL, parallel_spawned, v + k * (N / THREADS));
+        }
+        parallel_scale(v, 0, N / THREADS);
+        for (k = 1; k < THREADS; k++) {
+            pthread_join(handles[k], NULL);
+        }
+    }
+    report("spawn per call (4 thr)", now() - t0, (double)CALLS * N, "vec");
+
+    cvec_parallel_init(THREADS, 0);
+    t0 = now();
+    for (i = 0; i < CALLS; i++) {
+        cvec_parallel_for(N, 1024, THREADS, parallel_scale, v);
+    }
+    report("cvec_parallel_for (4 thr)", now() - t0, (double)CALLS * N, "vec");
+
+    t0 = now();
+    for (i = 0; i < CALLS; i++) {
+        parallel_scale(v, 0, N);
+    }
+    report("single thread", now() - t0, (double)CALLS * N, "vec");
+
+    free(v);
+}
+
+static void bench_blas(void)
+{
+    enum { N = 4000000 };
+    vec4 *a = malloc(sizeof(vec4) * N);
+    vec4 *b = malloc(sizeof(vec4) * N);
+    vec4 *c = malloc(sizeof(vec4) * N);
+    vec4 *out = malloc(sizeof(vec4) * N);
+    const vec4 *arrays[3];
+    float w[3] = { 0.2f, 0.3f, 0.5f };
+    double t0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        a[i] = Vec4(randf(-1, 1), randf(-1, 1), randf(-1, 1), randf(-1, 1));
+        b[i] = Vec4(randf(-1, 1), randf(-1, 1), randf(-1, 1), randf(-1, 1));
+        c[i] = Vec4(randf(-1, 1), randf(-1, 1), randf(-1, 1), randf(-1, 1));
+        out[i] = Vec4(0, 0, 0, 0);
+    }
+    arrays[0] = a;
+    arrays[1] = b;
+    arrays[2] = c;
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        out[i] = vec4_add(a[i], vec4_scale(vec4_sub(b[i], a[i]), 0.3f));
+    }
+    report("lerp, vec4 ops", now() - t0, N, "vec");
+
+    t0 = now();
+    vec4_lerp_batch(a, b, 0.3f, out, N);
+    report("vec4_lerp_batch", now() - t0, N, "vec");
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        out[i] = vec4_add(vec4_add(vec4_scale(a[i], w[0]), vec4_scale(b[i], w[1])), vec4_scale(c[i], w[2]));
+    }
+    report("weighted sum (k=3), vec4 ops", now() - t0, N, "vec");
+
+    t0 = now();
+    vec4_weighted_sum_batch(arrays, w, 3, out, N);
+    report("vec4_weighted_sum_batch (k=3)", now() - t0, N, "vec");
+
+    t0 = now();
+    vec4_axpy_batch(0.5f, a, out, N);
+    report("vec4_axpy_batch", now() - t0, N, "vec");
+
+    free(a);
+    free(b);
+    free(c);
+    free(out);
+}
+
+static void bench_alloc(void)
+{
+    enum { FRAMES = 10000, ALLOCS = 100 };
+    cvec_arena arena;
+    cvec_pool pool;
+    void *ptrs[ALLOCS];
+    double t0;
+    int f, i;
+
+    t0 = now();
+    for (f = 0; f < FRAMES; f++) {
+        for (i = 0; i < ALLOCS; i++) {
+            ptrs[i] = malloc(sizeof(vec4) * (16 + i));
+            ((vec4 *)ptrs[i])[0] = Vec4(f, i, 0, 0);
+        }
+        for (i = 0; i < ALLOCS; i++) {
+            free(ptrs[i]);
+        }
+    }
+    report("malloc/free scratch arrays", now() - t0, FRAMES * ALLOCS, "alloc");
+
+    cvec_arena_init(&arena, ALLOCS * (sizeof(vec4) * (16 + ALLOCS) + CVEC_ALIGN));
+    t0 = now();
+    for (f = 0; f < FRAMES; f++) {
+        for (i = 0; i < ALLOCS; i++) {
+            ptrs[i] = cvec_arena_vec4(&arena, 16 + i);
+            ((vec4 *)ptrs[i])[0] = Vec4(f, i, 0, 0);
+        }
+        cvec_arena_reset(&arena);
+    }
+    report("cvec_arena scratch arrays", now() - t0, FRAMES * ALLOCS, "alloc");
+    cvec_arena_destroy(&arena);
+
+    t0 = now();
+    for (f = 0; f < FRAMES; f++) {
+        for (i = 0; i < ALLOCS; i++) {
+            ptrs[i] = malloc(sizeof(mat4));
+            mat4_init_identity(ptrs[i]);
+        }
+        for (i = 0; i < ALLOCS; i++) {
+            free(ptrs[i]);
+        }
+    }
+    report("malloc/free mat4", now() - t0, FRAMES * ALLOCS, "alloc");
+
+    cvec_pool_init(&pool, sizeof(mat4), 256);
+    t0 = now();
+    for (f = 0; f < FRAMES; f++) {
+        for (i = 0; i < ALLOCS; i++) {
+            ptrs[i] = cvec_pool_alloc(&pool);
+            mat4_init_identity(ptrs[i]);
+        }
+        for (i = 0; i < ALLOCS; i++) {
+            cvec_pool_free(&pool, ptrs[i]);
+        }
+    }
+    report("cvec_pool mat4", now() - t0, FRAMES * ALLOCS, "alloc");
+    cvec_pool_destroy(&pool);
+}
+
+/*
+ * One object per iteration: model = parent * local, p = model * p and
+ * n = normalize(model * n). Each frame records into the same buffer.
+ */
+static void bench_command(void)
+{
+    enum { N = 10000, FRAMES = 20, THREADS = 4 };
+    mat4 *parent = malloc(sizeof(mat4) * N);
+    mat4 *local = malloc(sizeof(mat4) * N);
+    mat4 *model = malloc(sizeof(mat4) * N);
+    vec4 *p = malloc(sizeof(vec4) * N);
+    vec4 *nrm = malloc(sizeof(vec4) * N);
+    cvec_cmdbuf b;
+    double t0, sum = 0;
+    int i, f, threads;
+
+    for (i = 0; i < N; i++) {
+        mat4_init_rotate(&parent[i], Vec3(1, randf(-1, 1), 0), randf(-3, 3));
+        mat4_init_translate(&local[i], Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1)));
+        p[i] = Vec4(randf(-1, 1), randf(-1, 1), randf(-1, 1), 1);
+        nrm[i] = Vec4(randf(-1, 1), randf(-1, 1), randf(-1, 1), 0);
+    }
+
+    t0 = now();
+    for (f = 0; f < FRAMES; f++) {
+        for (i = 0; i < N; i++) {
+            mat4_mult(&parent[i], &local[i], &model[i]);
+            p[i] = mat4_transform(&model[i], p[i]);
+            nrm[i] = vec4_normalize(mat4_transform(&model[i], nrm[i]));
+        }
+    }
+    report("call at a time", now() - t0, (size_t)N * FRAMES, "obj");
+
+    cvec_cmdbuf_init(&b);
+    for (i = 0; i < N; i++) {
+        cvec_cmdbuf_new_mat4(&b, &parent[i]);
+        cvec_cmdbuf_new_mat4(&b, &local[i]);
+        cvec_cmdbuf_new_mat4(&b, &model[i]);
+        cvec_cmdbuf_new_vec4(&b, p[i]);
+        cvec_cmdbuf_new_vec4(&b, nrm[i]);
+    }
+    for (threads = 1; threads <= THREADS; threads += THREADS - 1) {
+        char name[64];
+        t0 = now();
+        for (f = 0; f < FRAMES; f++) {
+            for (i = 0; i < N; i++) {
+                cvec_handle m = 3*i, v = 2*i;
+                cvec_cmd_mat4_mult(&b, m, m + 1, m + 2);
+                cvec_cmd_mat4_transform(&b, m + 2, v, v);
+                cvec_cmd_mat4_transform(&b, m + 2, v + 1, v + 1);
+                cvec_cmd_vec4_normalize(&b, v + 1, v + 1);
+            }
+            cvec_cmdbuf_execute(&b, threads);
+        }
+        sprintf(name, "cvec_cmdbuf (%d thr)", threads);
+        report(name, now() - t0, (size_t)N * FRAMES, "obj");
+    }
+    for (i = 0; i < N; i++) {
+        sum += cvec_cmdbuf_vec4(&b, 2*i)->x + p[i].x;
+    }
+    printf("  (checksum %g)\n", sum);
+    cvec_cmdbuf_free(&b);
+
+    free(parent);
+    free(local);
+    free(model);
+    free(p);
+    free(nrm);
+}
+
+static void bench_polygon(void)
+{
+    enum { N = 1000000, M = 64, THREADS = 4 };
+    vec2 *p = malloc(sizeof(vec2) * N);
+    vec2 *out = malloc(sizeof(vec2) * N);
+    uint8_t *inside = malloc(N);
+    vec2 poly[M];
+    mat2 m[1];
+    size_t k;
+    double t0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        p[i] = Vec2(randf(-1, 1), randf(-1, 1));
+    }
+    /* A star, so that rays cross several edges. */
+    for (i = 0; i < M; i++) {
+        float a = 2 * M_PI * i / M, r = i % 2 ? 0.5f : 1.0f;
+        poly[i] = Vec2(r * cosf(a), r * sinf(a));
+    }
+
+    mat2_init_rotate(m, 0.3f);
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        out[i] = mat2_transform(m, p[i]);
+    }
+    report("mat2_transform", now() - t0, N, "vec");
+    t0 = now();
+    mat2_transform_batch(m, p, out, N);
+    report("mat2_transform_batch", now() - t0, N, "vec");
+
+    t0 = now();
+    for (i = 0; i < N; i++) {
+        inside[i] = point_in_polygon(poly, M, p[i]);
+    }
+    report("point_in_polygon (64 edges)", now() - t0, N, "point");
+    t0 = now();
+    point_in_polygon_batch(poly, M, p, inside, N);
+    report("point_in_polygon_batch", now() - t0, N, "point");
+
+    t0 = now();
+    convex_hull_vec2(p, N, out, &k, 1);
+    report("convex_hull_vec2", now() - t0, N, "point");
+    t0 = now();
+    convex_hull_vec2(p, N, out, &k, THREADS);
+    report("convex_hull_vec2 (4 thr)", now() - t0, N, "point");
+
+    free(p);
+    free(out);
+    free(inside);
+}
+
+static void bench_voxel(void)
+{
+    enum { N = 4000000, THREADS = 4 };
+    vec3 *p = malloc(sizeof(vec3) * N);
+    voxel_grid g;
+    voxel_hash h;
+    double t0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        p[i] = Vec3(randf(0, 64), randf(0, 64), randf(0, 16));
+    }
+
+    voxel_grid_init(&g, Vec3(0, 0, 0), 0.25f, 256, 256, 64);
+    t0 = now();
+    voxel_grid_bin(&g, p, N, 1);
+    report("voxel_grid_bin", now() - t0, N, "point");
+    voxel_grid_clear(&g);
+    t0 = now();
+    voxel_grid_bin(&g, p, N, THREADS);
+    report("voxel_grid_bin (4 thr)", now() - t0, N, "point");
+    voxel_grid_free(&g);
+
+    voxel_hash_init(&h, Vec3(0, 0, 0), 1);
+    t0 = now();
+    voxel_hash_bin(&h, p, N, 1);
+    report("voxel_hash_bin", now() - t0, N, "point");
+    voxel_hash_free(&h);
+    voxel_hash_init(&h, Vec3(0, 0, 0), 1);
+    t0 = now();
+    voxel_hash_bin(&h, p, N, THREADS);
+    report("voxel_hash_bin (4 thr)", now() - t0, N, "point");
+    voxel_hash_free(&h);
+
+    free(p);
+}
+
+int main(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+    bench_double();
+    bench_fixed();
+    bench_particle();
+    bench_parallel();
+    bench_command();
+    bench_trs();
+    bench_lanes();
+    bench_rotation();
+    bench_query();
+    bench_bounds();
+    bench_polygon();
+    bench_voxel();
+    bench_blas();
+    bench_alloc();
+    bench_bvh();
+    bench_morton();
+    bench_quant();
+    bench_file();
+    bench_stream();
+    return 0;
+}
@@ -35,551 +35,274 @@
  *
  * The mat4 translate/rotate/scale functions are intended to be used with
  * homogeneous coordinates.
+ *
+ * Every vector and matrix type exists in float and double precision. The
+ * double versions carry a "d" prefix (dvec3, dmat4_mult, DVec3) and have
+ * the same API. Both are generated from cvec_template.h.
+ *
+ * Defining CVEC_PROFILE before including any cvec header turns on call
+ * counting and timing for the library's entry points; see cvec_profile.h.
+ *
+ * Everything is static inline by default. The larger kernels (BVH build
+ * and queries, batch transforms, polygon kernels, command buffer
+ * execution) are marked CVEC_KERNEL instead, and can be compiled once
+ * rather than into every translation unit that uses them:
+ *
+ *  - Define CVEC_EXTERN before including cvec headers to get only
+ *    declarations of the kernels, and link with libcvec (built from
+ *    cvec.c by the Makefile).
+ *  - Or define CVEC_IMPLEMENTATION in exactly one source file of the
+ *    program, before including the headers, to define them there.
+ *
+ * libcvec is built with the default values of the tuning macros. Some of
+ * them change struct layouts or kernel results: CVEC_BVH_WIDTH,
+ * CVEC_CMDBUF_CHUNK, CVEC_ROTATION_POLAR_STEPS and CVEC_BOUNDS_PAD. A
+ * program that set one of these with CVEC_EXTERN would silently
+ * disagree with the library, so the headers reject that with #error.
+ * Use CVEC_IMPLEMENTATION to build the kernels with other values.
+ * Likewise, CVEC_PROFILE counts the kernels only where they are
+ * compiled, so it does not see the calls into libcvec.
+ *
+ * The kernels loop over whole arrays, so an out-of-line call costs little
+ * next to the work. Building with -flto lets the linker inline them back
+ * where that pays off.
  */
 
+#include <errno.h>
 #include <math.h>
+#include "cvec_profile.h"
+
+/*
+ * Linkage of the CVEC_KERNEL functions. _CVEC_KERNEL_BODY is whether this
+ * translation unit sees their definitions.
+ */
+#if defined(CVEC_IMPLEMENTATION) || defined(CVEC_EXTERN)
+#define CVEC_KERNEL extern
+#if defined(CVEC_IMPLEMENTATION)
+#define _CVEC_KERNEL_BODY 1
+#else
+#define _CVEC_KERNEL_BODY 0
+#endif
+#else
+#define CVEC_KERNEL static inline
+#define _CVEC_KERNEL_BODY 1
+#endif
 
 #ifndef M_PI
 /* C99 removed M_PI */
 #define M_PI 3.14159265358979323846264338327
 #endif
 
-/* types */
-
-typedef struct vec2 {
-    float x;
-    float y;
-} vec2;
-
-typedef struct vec3 {
-    float x;
-    float y;
-    float z;
-} vec3;
-
-typedef struct vec4 {
-    float x;
-    float y;
-    float z;
-    float w;
-} vec4;
-
-typedef struct mat2 {
-    float data[4];
-} mat2;
-
-typedef struct mat3 {
-    float data[9];
-} mat3;
-
-typedef struct mat4 {
-    float data[16];
-} mat4;
-
-
-/* vec2 functions */
-
-static inline vec2 Vec2(float x, float y)
-{
-    vec2 r;
-    r.x = x;
-    r.y = y;
-    return r;
-}
-
-static inline vec2 vec2_add(vec2 a, vec2 b)
-{
-    return Vec2(a.x+b.x, a.y+b.y);
-}
-
-static inline vec2 vec2_sub(vec2 a, vec2 b)
-{
-    return Vec2(a.x-b.x, a.y-b.y);
-}
-
-static inline vec2 vec2_scale(vec2 a, float c)
-{
-    return Vec2(a.x*c, a.y*c);
-}
-
-static inline float vec2_dot(vec2 a, vec2 b)
-{
-    return a.x*b.x + a.y*b.y;
-}
-
-static inline float vec2_length(vec2 a)
-{
-    return sqrtf(a.x*a.x + a.y*a.y);
-}
-
-static inline float vec2_distance(vec2 a, vec2 b)
-{
-    return vec2_length(vec2_sub(a, b));
-}
-
-static inline vec2 vec2_normalize(vec2 a)
-{
-    float len = vec2_length(a);
-    return Vec2(a.x/len, a.y/len);
-}
-
-
-/* vec3 functions */
-
-static inline vec3 Vec3(float x, float y, float z)
-{
-    vec3 r;
-    r.x = x;
-    r.y = y;
-    r.z = z;
-    return r;
-}
-
-static inline vec3 vec3_add(vec3 a, vec3 b)
-{
-    return Vec3(a.x+b.x, a.y+b.y, a.z+b.z);
-}
-
-static inline vec3 vec3_sub(vec3 a, vec3 b)
-{
-    return Vec3(a.x-b.x, a.y-b.y, a.z-b.z);
-}
-
-static inline vec3 vec3_scale(vec3 a, float c)
-{
-    return Vec3(a.x*c, a.y*c, a.z*c);
-}
-
-static inline float vec3_dot(vec3 a, vec3 b)
-{
-    return a.x*b.x + a.y*b.y + a.z*b.z;
-}
-
-static inline float vec3_length(vec3 a)
-{
-    return sqrtf(a.x*a.x + a.y*a.y + a.z*a.z);
-}
-
-static inline float vec3_distance(vec3 a, vec3 b)
-{
-    return vec3_length(vec3_sub(a, b));
-}
-
-static inline vec3 vec3_normalize(vec3 a)
-{
-    float len = vec3_length(a);
-    return Vec3(a.x/len, a.y/len, a.z/len);
-}
-
+/* vector and matrix types and functions */
+
+#define CVEC_T float
+#define CVEC_(name) name
+#define CVEC_C_(name) name
+#define CVEC_SQRT sqrtf
+#define CVEC_SIN sinf
+#define CVEC_COS cosf
+#include "cvec_template.h"
+#undef CVEC_T
+#undef CVEC_
+#undef CVEC_C_
+#undef CVEC_SQRT
+#undef CVEC_SIN
+#undef CVEC_COS
+
+#define CVEC_T double
+#define CVEC_(name) d##name
+#define CVEC_C_(name) D##name
+#define CVEC_SQRT sqrt
+#define CVEC_SIN sin
+#define CVEC_COS cos
+#include "cvec_template.h"
+#undef CVEC_T
+#undef CVEC_
+#undef CVEC_C_
+#undef CVEC_SQRT
+#undef CVEC_SIN
+#undef CVEC_COS
 
-/* vec4 functions */
 
-static inline vec4 Vec4(float x, float y, float z, float w)
-{
-    vec4 r;
-    r.x = x;
-    r.y = y;
-    r.z = z;
-    r.w = w;
-    return r;
-}
-
-static inline vec4 vec4_add(vec4 a, vec4 b)
-{
-    return Vec4(a.x+b.x, a.y+b.y, a.z+b.z, a.w+b.w);
-}
-
-static inline vec4 vec4_sub(vec4 a, vec4 b)
-{
-    return Vec4(a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w);
-}
-
-static inline vec4 vec4_scale(vec4 a, float c)
-{
-    return Vec4(a.x*c, a.y*c, a.z*c, a.w*c);
-}
-
-static inline float vec4_dot(vec4 a, vec4 b)
-{
-    return a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w;
-}
-
-static inline float vec4_length(vec4 a)
-{
-    return sqrtf(a.x*a.x + a.y*a.y + a.z*a.z + a.w*a.w);
-}
-
-static inline float vec4_distance(vec4 a, vec4 b)
-{
-    return vec4_length(vec4_sub(a, b));
-}
-
-static inline vec4 vec4_normalize(vec4 a)
-{
-    float len = vec4_length(a);
-    return Vec4(a.x/len, a.y/len, a.z/len, a.w/len);
-}
-
-
-/* 
- * Generic (square) matrix functions
+/*
+ * float/double conversion
  *
- * The compiler is expected to inline these into the caller and
- * optimize away the generic loops. Once the library is stable
- * we could inline and optimize them by hand to save the
- * compiler some work.
+ * Converting a large world-space double value straight to float loses
+ * the low bits. Subtract a nearby origin in double first; see
+ * dmat4_to_mat4_relative() in cvec_batch.h.
  */
 
-
-static inline float mat_get(const float *a, int i, int j, int n)
+static inline vec2 dvec2_to_vec2(dvec2 a)
 {
-    return a[i + n*j];
+    return Vec2(a.x, a.y);
 }
 
-static inline void mat_set(float *a, int i, int j, float value, int n)
+static inline vec3 dvec3_to_vec3(dvec3 a)
 {
-    a[i + n*j] = value;
+    return Vec3(a.x, a.y, a.z);
 }
 
-static inline void mat_init_zero(float *a, int n)
+static inline vec4 dvec4_to_vec4(dvec4 a)
 {
-    int i;
-    for (i = 0; i < n*n; i++) {
-        a[i] = 0.0f;
-    }
+    return Vec4(a.x, a.y, a.z, a.w);
 }
 
-static inline void mat_init_identity(float *a, int n)
+static inline dvec2 vec2_to_dvec2(vec2 a)
 {
-    int i, j;
-    for (j = 0; j < n; j++) {
-        for (i = 0; i < n; i++) {
-            float value = i == j ? 1.0f : 0.0f;
-            mat_set(a, i, j, value, n);
-        }
-    }
+    return DVec2(a.x, a.y);
 }
 
-static inline void mat_init_scale(float *a, float value, int n)
+static inline dvec3 vec3_to_dvec3(vec3 a)
 {
-    int i, j;
-    for (j = 0; j < n; j++) {
-        for (i = 0; i < n; i++) {
-            float _value = i == j ? value : 0.0f;
-            mat_set(a, i, j, _value, n);
-        }
-    }
+    return DVec3(a.x, a.y, a.z);
 }
 
-static inline void mat_transpose(float *a, int n)
+static inline dvec4 vec4_to_dvec4(vec4 a)
 {
-    int i, j;
-    for (j = 0; j < n; j++) {
-        for (i = 0; i < n; i++) {
-            if (i < j) {
-                float value1 = mat_get(a, i, j, n);
-                float value2 = mat_get(a, j, i, n);
-                mat_set(a, i, j, value2, n);
-                mat_set(a, j, i, value1, n);
-            }
-        }
-    }
+    return DVec4(a.x, a.y, a.z, a.w);
 }
 
-static inline void mat_transform(const float *m, const float *v, float *r, int n)
+static inline void dmat_to_mat(const double *a, float *r, int n)
 {
-    int i, j;
-    for (i = 0; i < n; i++) {
-        float sum = 0.0f;
-        for (j = 0; j < n; j++) {
-            sum += v[j] * mat_get(m, i, j, n);
-        }
-        r[i] = sum;
+    int i;
+    for (i = 0; i < n*n; i++) {
+        r[i] = a[i];
     }
 }
 
-static inline void mat_mult(const float *a, const float *b, float *r, int n)
+static inline void mat_to_dmat(const float *a, double *r, int n)
 {
-    int i, j, k;
-    for (j = 0; j < n; j++) {
-        for (i = 0; i < n; i++) {
-            float sum = 0.0f;
-            for (k = 0; k < n; k++) {
-                sum += mat_get(a, i, k, n) * mat_get(b, k, j, n);
-            }
-            mat_set(r, i, j, sum, n);
-        }
+    int i;
+    for (i = 0; i < n*n; i++) {
+        r[i] = a[i];
     }
 }
 
-
-/* mat2 functions */
-
-static inline float mat2_get(const mat2 *a, int i, int j)
-{
-    return mat_get(a->data, i, j, 2);
-}
-
-static inline void mat2_set(mat2 *a, int i, int j, float value)
-{
-    mat_set(a->data, i, j, value, 2);
-}
-
-static inline vec2 mat2_row(const mat2 *a, int i)
-{
-    return Vec2(mat2_get(a, i, 0), mat2_get(a, i, 1));
-}
-
-static inline vec2 mat2_col(const mat2 *a, int j)
-{
-    return Vec2(mat2_get(a, 0, j), mat2_get(a, 1, j));
-}
-
-static inline void mat2_init(mat2 *a, float v00, float v01, float v10, float v11)
-{
-    mat2_set(a, 0, 0, v00);
-    mat2_set(a, 0, 1, v01);
-    mat2_set(a, 1, 0, v10);
-    mat2_set(a, 1, 1, v11);
-}
-
-static inline void mat2_init_zero(mat2 *a)
-{
-    mat_init_zero(a->data, 2);
-}
-
-static inline void mat2_init_identity(mat2 *a)
-{
-    mat_init_identity(a->data, 2);
-}
-
-static inline void mat2_init_scale(mat2 *a, float value)
+static inline void dmat2_to_mat2(const dmat2 *a, mat2 *r)
 {
-    mat_init_scale(a->data, value, 2);
+    dmat_to_mat(a->data, r->data, 2);
 }
 
-static inline void mat2_init_rotate(mat2 *a, float angle)
+static inline void dmat3_to_mat3(const dmat3 *a, mat3 *r)
 {
-    mat2_init(a, cos(angle), -sin(angle),
-                 sin(angle), cos(angle));
+    dmat_to_mat(a->data, r->data, 3);
 }
 
-static inline void mat2_transpose(mat2 *a)
+static inline void dmat4_to_mat4(const dmat4 *a, mat4 *r)
 {
-    mat_transpose(a->data, 2);
+    dmat_to_mat(a->data, r->data, 4);
 }
 
-static inline vec2 mat2_transform(const mat2 *m, vec2 v)
+static inline void mat2_to_dmat2(const mat2 *a, dmat2 *r)
 {
-    vec2 r;
-    mat_transform(m->data, (float *)&v, (float *)&r, 2);
-    return r;
+    mat_to_dmat(a->data, r->data, 2);
 }
 
-static inline void mat2_mult(const mat2 *a, const mat2 *b, mat2 *r)
+static inline void mat3_to_dmat3(const mat3 *a, dmat3 *r)
 {
-    mat_mult(a->data, b->data, r->data, 2);
+    mat_to_dmat(a->data, r->data, 3);
 }
 
-
-/* mat3 functions */
-
-static inline float mat3_get(const mat3 *a, int i, int j)
+static inline void mat4_to_dmat4(const mat4 *a, dmat4 *r)
 {
-    return mat_get(a->data, i, j, 3);
+    mat_to_dmat(a->data, r->data, 4);
 }
 
-static inline void mat3_set(mat3 *a, int i, int j, float value)
-{
-    mat_set(a->data, i, j, value, 3);
-}
 
-static inline vec3 mat3_row(const mat3 *a, int i)
-{
-    return Vec3(mat3_get(a, i, 0), mat3_get(a, i, 1), mat3_get(a, i, 2));
-}
+typedef struct aabb {
+    vec3 min;
+    vec3 max;
+} aabb;
 
-static inline vec3 mat3_col(const mat3 *a, int j)
-{
-    return Vec3(mat3_get(a, 0, j), mat3_get(a, 1, j), mat3_get(a, 2, j));
-}
 
-static inline void mat3_init(mat3 *a, float v00, float v01, float v02,
-                                      float v10, float v11, float v12,
-                                      float v20, float v21, float v22)
-{
-    mat3_set(a, 0, 0, v00);
-    mat3_set(a, 0, 1, v01);
-    mat3_set(a, 0, 2, v02);
-    mat3_set(a, 1, 0, v10);
-    mat3_set(a, 1, 1, v11);
-    mat3_set(a, 1, 2, v12);
-    mat3_set(a, 2, 0, v20);
-    mat3_set(a, 2, 1, v21);
-    mat3_set(a, 2, 2, v22);
-}
-
-static inline void mat3_init_zero(mat3 *a)
-{
-    mat_init_zero(a->data, 3);
-}
-
-static inline void mat3_init_identity(mat3 *a)
-{
-    mat_init_identity(a->data, 3);
-}
-
-static inline void mat3_init_scale(mat3 *a, float value)
-{
-    mat_init_scale(a->data, value, 3);
-}
-
-static inline void mat3_init_rotate(mat3 *a, vec3 axis, float angle)
-{
-    if (vec3_length(axis) == 0) {
-        mat3_init_identity(a);
-        return;
-    }
-
-    axis = vec3_normalize(axis);
-
-    float x = axis.x;
-    float y = axis.y;
-    float z = axis.z;
-    float s = sinf(angle);
-    float c = cosf(angle);
-    float t = 1.0f - c;
-
-    mat3_init(a, t*x*x + c,   t*y*x - s*z, t*z*x + s*y,
-                 t*x*y + s*z, t*y*y + c,   t*z*y - s*x,
-                 t*x*z - s*y, t*y*z + s*x, t*z*z + c);
-}
-
-static inline void mat3_transpose(mat3 *a)
-{
-    mat_transpose(a->data, 3);
-}
+/*
+ * aabb functions
+ *
+ * aabb_empty() returns an inverted box (min = +inf, max = -inf) which is
+ * the identity for aabb_union() and aabb_extend().
+ */
 
-static inline vec3 mat3_transform(const mat3 *m, vec3 v)
+static inline aabb Aabb(vec3 min, vec3 max)
 {
-    vec3 r;
-    mat_transform(m->data, (float *)&v, (float *)&r, 3);
+    aabb r;
+    r.min = min;
+    r.max = max;
     return r;
 }
 
-static inline void mat3_mult(const mat3 *a, const mat3 *b, mat3 *r)
+static inline aabb aabb_empty(void)
 {
-    mat_mult(a->data, b->data, r->data, 3);
+    return Aabb(Vec3(INFINITY, INFINITY, INFINITY),
+                Vec3(-INFINITY, -INFINITY, -INFINITY));
 }
 
-
-/* mat4 functions */
-
-static inline float mat4_get(const mat4 *a, int i, int j)
+static inline aabb aabb_union(aabb a, aabb b)
 {
-    return mat_get(a->data, i, j, 4);
+    return Aabb(vec3_min(a.min, b.min), vec3_max(a.max, b.max));
 }
 
-static inline void mat4_set(mat4 *a, int i, int j, float value)
+static inline aabb aabb_extend(aabb a, vec3 p)
 {
-    mat_set(a->data, i, j, value, 4);
+    return Aabb(vec3_min(a.min, p), vec3_max(a.max, p));
 }
 
-static inline vec4 mat4_row(const mat4 *a, int i)
+static inline vec3 aabb_center(aabb a)
 {
-    return Vec4(mat4_get(a, i, 0), mat4_get(a, i, 1), mat4_get(a, i, 2), mat4_get(a, i, 3));
+    return vec3_scale(vec3_add(a.min, a.max), 0.5f);
 }
 
-static inline vec4 mat4_col(const mat4 *a, int j)
+static inline vec3 aabb_size(aabb a)
 {
-    return Vec4(mat4_get(a, 0, j), mat4_get(a, 1, j), mat4_get(a, 2, j), mat4_get(a, 3, j));
+    return vec3_sub(a.max, a.min);
 }
 
-static inline void mat4_init(mat4 *a, float v00, float v01, float v02, float v03,
-                                      float v10, float v11, float v12, float v13,
-                                      float v20, float v21, float v22, float v23,
-                                      float v30, float v31, float v32, float v33)
+static inline float aabb_surface_area(aabb a)
 {
-    mat4_set(a, 0, 0, v00);
-    mat4_set(a, 0, 1, v01);
-    mat4_set(a, 0, 2, v02);
-    mat4_set(a, 0, 3, v03);
-    mat4_set(a, 1, 0, v10);
-    mat4_set(a, 1, 1, v11);
-    mat4_set(a, 1, 2, v12);
-    mat4_set(a, 1, 3, v13);
-    mat4_set(a, 2, 0, v20);
-    mat4_set(a, 2, 1, v21);
-    mat4_set(a, 2, 2, v22);
-    mat4_set(a, 2, 3, v23);
-    mat4_set(a, 3, 0, v30);
-    mat4_set(a, 3, 1, v31);
-    mat4_set(a, 3, 2, v32);
-    mat4_set(a, 3, 3, v33);
+    vec3 d = aabb_size(a);
+    return 2.0f * (d.x*d.y + d.y*d.z + d.z*d.x);
 }
 
-static inline void mat4_init_zero(mat4 *a)
+static inline int aabb_overlaps(aabb a, aabb b)
 {
-    mat_init_zero(a->data, 4);
+    return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+           a.min.y <= b.max.y && a.max.y >= b.min.y &&
+           a.min.z <= b.max.z && a.max.z >= b.min.z;
 }
 
-static inline void mat4_init_identity(mat4 *a)
-{
-    mat_init_identity(a->data, 4);
-}
 
-static inline void mat4_init_scale(mat4 *a, float value)
-{
-    mat_init_scale(a->data, value, 4);
-    mat4_set(a, 3, 3, 1);
-}
+/*
+ * C11 type-generic front-ends
+ *
+ * vec_add(a, b) and friends dispatch on the argument type at compile
+ * time, so they cost the same as calling vec3_add() or dvec3_add()
+ * directly. The matrix versions are named matrix_* to stay clear of the
+ * mat_* helpers above.
+ */
 
-/* Only supports rotation in 3 dimensions, not 4. */
-static inline void mat4_init_rotate(mat4 *a, vec3 axis, float angle)
-{
-    if (vec3_length(axis) == 0) {
-        mat4_init_identity(a);
-        return;
-    }
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
 
-    axis = vec3_normalize(axis);
+#define _CVEC_VEC_GENERIC(a, op) _Generic((a), \
+    vec2: vec2_##op, vec3: vec3_##op, vec4: vec4_##op, \
+    dvec2: dvec2_##op, dvec3: dvec3_##op, dvec4: dvec4_##op)
 
-    float x = axis.x;
-    float y = axis.y;
-    float z = axis.z;
-    float s = sinf(angle);
-    float c = cosf(angle);
-    float t = 1.0f - c;
+#define _CVEC_MAT_GENERIC(m, op) _Generic(*(m), \
+    mat2: mat2_##op, mat3: mat3_##op, mat4: mat4_##op, \
+    dmat2: dmat2_##op, dmat3: dmat3_##op, dmat4: dmat4_##op)
 
-    mat4_init(a, t*x*x + c,   t*y*x - s*z, t*z*x + s*y, 0,
-                 t*x*y + s*z, t*y*y + c,   t*z*y - s*x, 0,
-                 t*x*z - s*y, t*y*z + s*x, t*z*z + c,   0,
-                 0,           0,           0,           1);
-}
+#define vec_add(a, b) _CVEC_VEC_GENERIC(a, add)(a, b)
+#define vec_sub(a, b) _CVEC_VEC_GENERIC(a, sub)(a, b)
+#define vec_scale(a, c) _CVEC_VEC_GENERIC(a, scale)(a, c)
+#define vec_dot(a, b) _CVEC_VEC_GENERIC(a, dot)(a, b)
+#define vec_length(a) _CVEC_VEC_GENERIC(a, length)(a)
+#define vec_distance(a, b) _CVEC_VEC_GENERIC(a, distance)(a, b)
+#define vec_normalize(a) _CVEC_VEC_GENERIC(a, normalize)(a)
+#define vec_cross(a, b) _Generic((a), vec3: vec3_cross, dvec3: dvec3_cross)(a, b)
 
-static inline void mat4_init_translate(mat4 *m, vec3 v)
-{
-    mat4_init(m, 1, 0, 0, v.x,
-                 0, 1, 0, v.y,
-                 0, 0, 1, v.z,
-                 0, 0, 0, 1);
-}
-
-static inline void mat4_transpose(mat4 *a)
-{
-    mat_transpose(a->data, 4);
-}
+#define matrix_init_identity(m) _CVEC_MAT_GENERIC(m, init_identity)(m)
+#define matrix_transpose(m) _CVEC_MAT_GENERIC(m, transpose)(m)
+#define matrix_transform(m, v) _CVEC_MAT_GENERIC(m, transform)(m, v)
+#define matrix_mult(a, b, r) _CVEC_MAT_GENERIC(a, mult)(a, b, r)
 
-static inline vec4 mat4_transform(const mat4 *m, vec4 v)
-{
-    vec4 r;
-    mat_transform(m->data, (float *)&v, (float *)&r, 4);
-    return r;
-}
-
-static inline void mat4_mult(const mat4 *a, const mat4 *b, mat4 *r)
-{
-    mat_mult(a->data, b->data, r->data, 4);
-}
+#endif
 
 #endif
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_HPP
+#define CVEC_HPP
+
+/*
+ * C++ wrapper for cvec.h.
+ *
+ * cvec::Vec2/Vec3/Vec4 and cvec::Mat2/Mat3/Mat4 derive from the C structs
+ * without adding members, so they have the same layout and can be passed
+ * anywhere the C types are expected (and a C array reinterpreted as an
+ * array of them). Operators forward to the C functions:
+ *
+ *   cvec::Vec3 v = a*2 + (b - c);
+ *   cvec::Mat4 m = cvec::Mat4::translate(t) * cvec::Mat4::rotate(axis, angle);
+ *   cvec::Vec4 r = m * v4;
+ *
+ * The identity, scale and translate factories are constexpr, so constant
+ * matrices built from them are folded at compile time.
+ *
+ * cvec::Span<T> views an array of vectors. Arithmetic on spans builds an
+ * expression template instead of temporaries, and assigning it to a span
+ * evaluates the whole expression in one loop over the float components:
+ *
+ *   cvec::span(out, n) = cvec::span(a, n) * 2 + (cvec::span(b, n) - cvec::span(c, n));
+ *
+ * All spans in an expression must have the same length. Requires C++11.
+ */
+
+#include <cassert>
+#include <cstddef>
+#include "cvec.h"
+
+namespace cvec {
+
+/* Vectors */
+
+struct Vec2 : vec2 {
+    Vec2() : vec2() {}
+    constexpr Vec2(float x, float y) : vec2{x, y} {}
+    Vec2(const vec2 &v) : vec2(v) {}
+};
+
+struct Vec3 : vec3 {
+    Vec3() : vec3() {}
+    constexpr Vec3(float x, float y, float z) : vec3{x, y, z} {}
+    Vec3(const vec3 &v) : vec3(v) {}
+};
+
+struct Vec4 : vec4 {
+    Vec4() : vec4() {}
+    constexpr Vec4(float x, float y, float z, float w) : vec4{x, y, z, w} {}
+    Vec4(const vec4 &v) : vec4(v) {}
+};
+
+#define _CVEC_HPP_VEC_OPS(V, c)                                                     \
+    inline V operator+(V a, V b) { return c##_add(a, b); }                          \
+    inline V operator-(V a, V b) { return c##_sub(a, b); }                          \
+    inline V operator-(V a) { return c##_scale(a, -1); }                            \
+    inline V operator*(V a, float s) { return c##_scale(a, s); }                    \
+    inline V operator*(float s, V a) { return c##_scale(a, s); }                    \
+    inline V operator/(V a, float s) { return c##_scale(a, 1 / s); }               \
+    inline V &operator+=(V &a, V b) { return a = a + b; }                           \
+    inline V &operator-=(V &a, V b) { return a = a - b; }                           \
+    inline V &operator*=(V &a, float s) { return a = a * s; }                       \
+    inline float dot(V a, V b) { return c##_dot(a, b); }                            \
+    inline float length(V a) { return c##_length(a); }                              \
+    inline float distance(V a, V b) { return c##_distance(a, b); }                  \
+    inline V normalize(V a) { return c##_normalize(a); }
+
+_CVEC_HPP_VEC_OPS(Vec2, vec2)
+_CVEC_HPP_VEC_OPS(Vec3, vec3)
+_CVEC_HPP_VEC_OPS(Vec4, vec4)
+
+#undef _CVEC_HPP_VEC_OPS
+
+inline Vec3 cross(Vec3 a, Vec3 b) { return vec3_cross(a, b); }
+
+
+/* Matrices (column-major, like the C types) */
+
+struct Mat2 : mat2 {
+    Mat2() : mat2() {}
+    constexpr Mat2(float a0, float a1, float a2, float a3) : mat2{{a0, a1, a2, a3}} {}
+    Mat2(const mat2 &m) : mat2(m) {}
+
+    static constexpr Mat2 identity() { return scale(1); }
+    static constexpr Mat2 scale(float s) { return Mat2(s, 0, 0, s); }
+    static Mat2 rotate(float angle) { Mat2 r; mat2_init_rotate(&r, angle); return r; }
+
+    float operator()(int i, int j) const { return mat2_get(this, i, j); }
+};
+
+struct Mat3 : mat3 {
+    Mat3() : mat3() {}
+    constexpr Mat3(float a0, float a1, float a2, float a3, float a4, float a5,
+                   float a6, float a7, float a8)
+        : mat3{{a0, a1, a2, a3, a4, a5, a6, a7, a8}} {}
+    Mat3(const mat3 &m) : mat3(m) {}
+
+    static constexpr Mat3 identity() { return scale(1); }
+    static constexpr Mat3 scale(float s) { return Mat3(s, 0, 0, 0, s, 0, 0, 0, s); }
+    static Mat3 rotate(Vec3 axis, float angle) { Mat3 r; mat3_init_rotate(&r, axis, angle); return r; }
+
+    float operator()(int i, int j) const { return mat3_get(this, i, j); }
+};
+
+struct Mat4 : mat4 {
+    Mat4() : mat4() {}
+    constexpr Mat4(float a0, float a1, float a2, float a3, float a4, float a5, float a6, float a7,
+                   float a8, float a9, float a10, float a11, float a12, float a13, float a14, float a15)
+        : mat4{{a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15}} {}
+    Mat4(const mat4 &m) : mat4(m) {}
+
+    static constexpr Mat4 identity() { return scale(1); }
+    static constexpr Mat4 scale(float s)
+    {
+        return Mat4(s, 0, 0, 0,  0, s, 0, 0,  0, 0, s, 0,  0, 0, 0, 1);
+    }
+    static constexpr Mat4 translate(float x, float y, float z)
+    {
+        return Mat4(1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  x, y, z, 1);
+    }
+    static constexpr Mat4 translate(const Vec3 &v) { return translate(v.x, v.y, v.z); }
+    static Mat4 rotate(Vec3 axis, float angle) { Mat4 r; mat4_init_rotate(&r, axis, angle); return r; }
+
+    float operator()(int i, int j) const { return mat4_get(this, i, j); }
+};
+
+inline Vec2 operator*(const Mat2 &m, Vec2 v) { return mat2_transform(&m, v); }
+inline Vec3 operator*(const Mat3 &m, Vec3 v) { return mat3_transform(&m, v); }
+inline Vec4 operator*(const Mat4 &m, Vec4 v) { return mat4_transform(&m, v); }
+inline Mat2 operator*(const Mat2 &a, const Mat2 &b) { Mat2 r; mat2_mult(&a, &b, &r); return r; }
+inline Mat3 operator*(const Mat3 &a, const Mat3 &b) { Mat3 r; mat3_mult(&a, &b, &r); return r; }
+inline Mat4 operator*(const Mat4 &a, const Mat4 &b) { Mat4 r; mat4_mult(&a, &b, &r); return r; }
+
+inline Mat2 transpose(Mat2 m) { mat2_transpose(&m); return m; }
+inline Mat3 transpose(Mat3 m) { mat3_transpose(&m); return m; }
+inline Mat4 transpose(Mat4 m) { mat4_transpose(&m); return m; }
+
+
+/*
+ * Span expression templates
+ *
+ * Every node evaluates one float component at a time: element j of an
+ * expression over spans of n vec3s is component j % 3 of vector j / 3.
+ * That keeps the generated loop free of struct shuffling, so it
+ * vectorizes like a plain float loop.
+ */
+
+template <class E>
+struct Expr {
+    const E &self() const { return static_cast<const E &>(*this); }
+};
+
+template <class T>
+struct Span : Expr<Span<T> > {
+    T *data;
+    std::size_t count;
+
+    Span(T *data, std::size_t count) : data(data), count(count) {}
+    Span(const Span &other) = default;
+
+    std::size_t size() const { return count * (sizeof(T) / sizeof(float)); }
+    float operator[](std::size_t j) const { return reinterpret_cast<const float *>(data)[j]; }
+    T &at(std::size_t i) const { return data[i]; }
+
+    template <class E>
+    Span &operator=(const Expr<E> &expr)
+    {
+        const E &e = expr.self();
+        float *out = reinterpret_cast<float *>(data);
+        std::size_t n = size();
+        assert(e.size() == n);
+        for (std::size_t j = 0; j < n; j++) {
+            out[j] = e[j];
+        }
+        return *this;
+    }
+
+    Span &operator=(const Span &other)
+    {
+        return *this = static_cast<const Expr<Span> &>(other);
+    }
+};
+
+template <class T>
+inline Span<T> span(T *data, std::size_t count) { return Span<T>(data, count); }
+
+template <class T>
+inline Span<const T> span(const T *data, std::size_t count) { return Span<const T>(data, count); }
+
+template <class L, class R, class Op>
+struct BinaryExpr : Expr<BinaryExpr<L, R, Op> > {
+    L l;
+    R r;
+    BinaryExpr(const L &l, const R &r) : l(l), r(r) { assert(l.size() == r.size()); }
+    std::size_t size() const { return l.size(); }
+    float operator[](std::size_t j) const { return Op::apply(l[j], r[j]); }
+};
+
+template <class E>
+struct ScaleExpr : Expr<ScaleExpr<E> > {
+    E e;
+    float s;
+    ScaleExpr(const E &e, float s) : e(e), s(s) {}
+    std::size_t size() const { return e.size(); }
+    float operator[](std::size_t j) const { return e[j] * s; }
+};
+
+struct _AddOp { static float apply(float a, float b) { return a + b; } };
+struct _SubOp { static float apply(float a, float b) { return a - b; } };
+struct _MulOp { static float apply(float a, float b) { return a * b; } };
+
+template <class L, class R>
+inline BinaryExpr<L, R, _AddOp> operator+(const Expr<L> &l, const Expr<R> &r)
+{
+    return BinaryExpr<L, R, _AddOp>(l.self(), r.self());
+}
+
+template <class L, class R>
+inline BinaryExpr<L, R, _SubOp> operator-(const Expr<L> &l, const Expr<R> &r)
+{
+    return BinaryExpr<L, R, _SubOp>(l.self(), r.self());
+}
+
+/* Component-wise product. */
+template <class L, class R>
+inline BinaryExpr<L, R, _MulOp> operator*(const Expr<L> &l, const Expr<R> &r)
+{
+    return BinaryExpr<L, R, _MulOp>(l.self(), r.self());
+}
+
+template <class E>
+inline ScaleExpr<E> operator*(const Expr<E> &e, float s) { return ScaleExpr<E>(e.self(), s); }
+
+template <class E>
+inline ScaleExpr<E> operator*(float s, const Expr<E> &e) { return ScaleExpr<E>(e.self(), s); }
+
+template <class E>
+inline ScaleExpr<E> operator-(const Expr<E> &e) { return ScaleExpr<E>(e.self(), -1); }
+
+} /* namespace cvec */
+
+#endif
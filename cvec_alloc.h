@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_ALLOC_H
+#define CVEC_ALLOC_H
+
+/*
+ * Allocators for vector and matrix arrays.
+ *
+ * cvec_aligned_alloc() returns memory aligned for SIMD loads and stores.
+ *
+ * cvec_arena is a bump allocator over one aligned block: allocation is a
+ * pointer increment, and cvec_arena_reset() frees everything at once,
+ * e.g. at the end of a frame. cvec_arena_mark() and cvec_arena_rewind()
+ * free everything allocated after a point. An arena does not grow;
+ * allocation returns NULL when it is full.
+ *
+ * cvec_pool hands out fixed-size blocks (e.g. one mat4 each) from a free
+ * list, allocating more blocks a chunk at a time when it runs out.
+ *
+ * vec2_soa_alloc(), vec3_soa_alloc() and vec4_soa_alloc() allocate all
+ * the streams of a SoA in one block, each stream aligned and padded to
+ * CVEC_ALIGN bytes so that kernels can process whole SIMD registers at
+ * the tail.
+ *
+ * Arenas and pools are not thread-safe. cvec_thread_arena() returns an
+ * arena private to the calling thread, created on first use and freed
+ * when the thread exits.
+ *
+ * All functions that allocate return NULL (or -1) and set errno to
+ * ENOMEM on failure.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "cvec.h"
+#include "cvec_batch.h"
+
+#ifndef CVEC_ALIGN
+#define CVEC_ALIGN 64
+#endif
+
+#ifndef CVEC_THREAD_ARENA_SIZE
+#define CVEC_THREAD_ARENA_SIZE (1 << 20)
+#endif
+
+/* Shared between translation units where the compiler supports it. */
+#if defined(__GNUC__)
+#define _CVEC_ALLOC_SHARED __attribute__((weak))
+#else
+#define _CVEC_ALLOC_SHARED static
+#endif
+
+static inline size_t _cvec_align_up(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+
+/* Aligned allocation */
+
+/* 'align' must be a power of two. Free with cvec_aligned_free(). */
+static inline void *cvec_aligned_alloc(size_t size, size_t align)
+{
+    char *raw, *p;
+
+    if (align < sizeof(void *)) {
+        align = sizeof(void *);
+    }
+    if (size > SIZE_MAX - align - sizeof(void *)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    raw = malloc(size + align + sizeof(void *));
+    if (!raw) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    p = (char *)_cvec_align_up((uintptr_t)(raw + sizeof(void *)), align);
+    ((void **)p)[-1] = raw;
+    return p;
+}
+
+static inline void cvec_aligned_free(void *p)
+{
+    if (p) {
+        free(((void **)p)[-1]);
+    }
+}
+
+
+/* Arena */
+
+typedef struct cvec_arena {
+    char *base;
+    size_t size;
+    size_t used;
+} cvec_arena;
+
+static inline int cvec_arena_init(cvec_arena *a, size_t size)
+{
+    a->base = cvec_aligned_alloc(size, CVEC_ALIGN);
+    a->size = a->base ? size : 0;
+    a->used = 0;
+    return a->base ? 0 : -1;
+}
+
+static inline void cvec_arena_destroy(cvec_arena *a)
+{
+    cvec_aligned_free(a->base);
+    a->base = NULL;
+    a->size = a->used = 0;
+}
+
+/* 'align' must be a power of two no larger than CVEC_ALIGN. */
+static inline void *cvec_arena_alloc(cvec_arena *a, size_t size, size_t align)
+{
+    size_t offset = _cvec_align_up(a->used, align);
+
+    if (offset > a->size || size > a->size - offset) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    a->used = offset + size;
+    return a->base + offset;
+}
+
+/* Allocates an array of n elements, checking n*size for overflow. */
+static inline void *cvec_arena_array(cvec_arena *a, size_t n, size_t size)
+{
+    if (size && n > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return cvec_arena_alloc(a, n * size, CVEC_ALIGN);
+}
+
+static inline void cvec_arena_reset(cvec_arena *a)
+{
+    a->used = 0;
+}
+
+static inline size_t cvec_arena_mark(const cvec_arena *a)
+{
+    return a->used;
+}
+
+static inline void cvec_arena_rewind(cvec_arena *a, size_t mark)
+{
+    a->used = mark;
+}
+
+static inline vec2 *cvec_arena_vec2(cvec_arena *a, size_t n) { return cvec_arena_array(a, n, sizeof(vec2)); }
+static inline vec3 *cvec_arena_vec3(cvec_arena *a, size_t n) { return cvec_arena_array(a, n, sizeof(vec3)); }
+static inline vec4 *cvec_arena_vec4(cvec_arena *a, size_t n) { return cvec_arena_array(a, n, sizeof(vec4)); }
+static inline mat2 *cvec_arena_mat2(cvec_arena *a, size_t n) { return cvec_arena_array(a, n, sizeof(mat2)); }
+static inline mat3 *cvec_arena_mat3(cvec_arena *a, size_t n) { return cvec_arena_array(a, n, sizeof(mat3)); }
+static inline mat4 *cvec_arena_mat4(cvec_arena *a, size_t n) { return cvec_arena_array(a, n, sizeof(mat4)); }
+
+
+/* Per-thread arenas */
+
+_CVEC_ALLOC_SHARED pthread_once_t _cvec_arena_once = PTHREAD_ONCE_INIT;
+_CVEC_ALLOC_SHARED pthread_key_t _cvec_arena_key;
+
+static inline void _cvec_thread_arena_free(void *p)
+{
+    cvec_arena_destroy(p);
+    free(p);
+}
+
+static inline void _cvec_thread_arena_key_init(void)
+{
+    pthread_key_create(&_cvec_arena_key, _cvec_thread_arena_free);
+}
+
+/* Returns the calling thread's arena of CVEC_THREAD_ARENA_SIZE bytes. */
+static inline cvec_arena *cvec_thread_arena(void)
+{
+    cvec_arena *a;
+
+    pthread_once(&_cvec_arena_once, _cvec_thread_arena_key_init);
+    a = pthread_getspecific(_cvec_arena_key);
+    if (!a) {
+        a = malloc(sizeof(*a));
+        if (!a || cvec_arena_init(a, CVEC_THREAD_ARENA_SIZE) < 0) {
+            free(a);
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (pthread_setspecific(_cvec_arena_key, a) != 0) {
+            _cvec_thread_arena_free(a);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    return a;
+}
+
+
+/* Pool */
+
+typedef struct cvec_pool {
+    size_t block_size;
+    size_t blocks_per_chunk;
+    void *free_list;
+    void *chunks;
+} cvec_pool;
+
+/*
+ * Blocks are block_size bytes rounded up to a multiple of CVEC_ALIGN and
+ * aligned to CVEC_ALIGN.
+ */
+static inline void cvec_pool_init(cvec_pool *p, size_t block_size, size_t blocks_per_chunk)
+{
+    p->block_size = _cvec_align_up(block_size > 0 ? block_size : 1, CVEC_ALIGN);
+    p->blocks_per_chunk = blocks_per_chunk > 0 ? blocks_per_chunk : 1;
+    p->free_list = NULL;
+    p->chunks = NULL;
+}
+
+/* Each chunk starts with a CVEC_ALIGN-sized header linking it to the next. */
+static inline int _cvec_pool_grow(cvec_pool *p)
+{
+    size_t i;
+    char *chunk;
+
+    if (p->blocks_per_chunk > (SIZE_MAX - CVEC_ALIGN) / p->block_size) {
+        errno = ENOMEM;
+        return -1;
+    }
+    chunk = cvec_aligned_alloc(CVEC_ALIGN + p->block_size * p->blocks_per_chunk, CVEC_ALIGN);
+    if (!chunk) {
+        return -1;
+    }
+    *(void **)chunk = p->chunks;
+    p->chunks = chunk;
+    for (i = p->blocks_per_chunk; i-- > 0;) {
+        void **block = (void **)(chunk + CVEC_ALIGN + i * p->block_size);
+        *block = p->free_list;
+        p->free_list = block;
+    }
+    return 0;
+}
+
+static inline void *cvec_pool_alloc(cvec_pool *p)
+{
+    void **block;
+
+    if (!p->free_list && _cvec_pool_grow(p) < 0) {
+        return NULL;
+    }
+    block = p->free_list;
+    p->free_list = *block;
+    return block;
+}
+
+static inline void cvec_pool_free(cvec_pool *p, void *block)
+{
+    if (block) {
+        *(void **)block = p->free_list;
+        p->free_list = block;
+    }
+}
+
+/* Frees every chunk, including blocks that are still allocated. */
+static inline void cvec_pool_destroy(cvec_pool *p)
+{
+    void *chunk = p->chunks;
+    while (chunk) {
+        void *next = *(void **)chunk;
+        cvec_aligned_free(chunk);
+        chunk = next;
+    }
+    p->free_list = NULL;
+    p->chunks = NULL;
+}
+
+
+/* SoA buffers */
+
+/*
+ * Floats per stream for n elements, padded to a multiple of CVEC_ALIGN
+ * bytes. Returns SIZE_MAX if that does not fit in a size_t.
+ */
+static inline size_t _cvec_soa_stride(size_t n)
+{
+    size_t align = CVEC_ALIGN / sizeof(float);
+
+    if (n > SIZE_MAX - (align - 1)) {
+        return SIZE_MAX;
+    }
+    return _cvec_align_up(n, align);
+}
+
+static inline size_t vec2_soa_stride(size_t n) { return _cvec_soa_stride(n); }
+static inline size_t vec3_soa_stride(size_t n) { return _cvec_soa_stride(n); }
+static inline size_t vec4_soa_stride(size_t n) { return _cvec_soa_stride(n); }
+
+/* One block of 'streams' streams for n elements, from a if not NULL. */
+static inline float *_cvec_soa_alloc(cvec_arena *a, size_t n, size_t streams, size_t *stride)
+{
+    size_t bytes;
+
+    *stride = _cvec_soa_stride(n);
+    if (*stride > SIZE_MAX / (streams * sizeof(float))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    bytes = streams * *stride * sizeof(float);
+    return a ? cvec_arena_alloc(a, bytes, CVEC_ALIGN) : cvec_aligned_alloc(bytes, CVEC_ALIGN);
+}
+
+/* Allocates all the streams in one block; free with vec2_soa_free() etc. */
+static inline int vec2_soa_alloc(vec2_soa *s, size_t n)
+{
+    size_t stride;
+    float *block = _cvec_soa_alloc(NULL, n, 2, &stride);
+
+    if (!block) {
+        return -1;
+    }
+    *s = Vec2Soa(block, block + stride);
+    return 0;
+}
+
+static inline int vec3_soa_alloc(vec3_soa *s, size_t n)
+{
+    size_t stride;
+    float *block = _cvec_soa_alloc(NULL, n, 3, &stride);
+
+    if (!block) {
+        return -1;
+    }
+    *s = Vec3Soa(block, block + stride, block + 2*stride);
+    return 0;
+}
+
+static inline int vec4_soa_alloc(vec4_soa *s, size_t n)
+{
+    size_t stride;
+    float *block = _cvec_soa_alloc(NULL, n, 4, &stride);
+
+    if (!block) {
+        return -1;
+    }
+    *s = Vec4Soa(block, block + stride, block + 2*stride, block + 3*stride);
+    return 0;
+}
+
+static inline void vec2_soa_free(vec2_soa *s)
+{
+    cvec_aligned_free(s->x);
+    *s = Vec2Soa(NULL, NULL);
+}
+
+static inline void vec3_soa_free(vec3_soa *s)
+{
+    cvec_aligned_free(s->x);
+    *s = Vec3Soa(NULL, NULL, NULL);
+}
+
+static inline void vec4_soa_free(vec4_soa *s)
+{
+    cvec_aligned_free(s->x);
+    *s = Vec4Soa(NULL, NULL, NULL, NULL);
+}
+
+/* Arena versions of the above; released with the arena. */
+static inline int cvec_arena_vec2_soa(cvec_arena *a, vec2_soa *s, size_t n)
+{
+    size_t stride;
+    float *block = _cvec_soa_alloc(a, n, 2, &stride);
+
+    if (!block) {
+        return -1;
+    }
+    *s = Vec2Soa(block, block + stride);
+    return 0;
+}
+
+static inline int cvec_arena_vec3_soa(cvec_arena *a, vec3_soa *s, size_t n)
+{
+    size_t stride;
+    float *block = _cvec_soa_alloc(a, n, 3, &stride);
+
+    if (!block) {
+        return -1;
+    }
+    *s = Vec3Soa(block, block + stride, block + 2*stride);
+    return 0;
+}
+
+static inline int cvec_arena_vec4_soa(cvec_arena *a, vec4_soa *s, size_t n)
+{
+    size_t stride;
+    float *block = _cvec_soa_alloc(a, n, 4, &stride);
+
+    if (!block) {
+        return -1;
+    }
+    *s = Vec4Soa(block, block + stride, block + 2*stride, block + 3*stride);
+    return 0;
+}
+
+#endif
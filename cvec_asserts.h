@@ -2,6 +2,8 @@
 #define _TEST_H
 
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include "cvec.h"
 
 static const double epsilon = 1.0e-6;
@@ -21,6 +23,15 @@ static inline bool approx_equal(double a, double b)
         } \
     } while (0)
 
+/* Unlike assert(), always evaluates cond, so it may hold calls under test. */
+#define assert_true(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
 static inline void _assert_vec2_equal(vec2 expected, vec2 value, const char *file, int line)
 {
     if (!approx_equal(expected.x, value.x) ||
@@ -91,4 +102,33 @@ static inline void _assert_mat3_equal(const mat3 *expected, const mat3 *value, c
 
 #define assert_mat3_equal(expected, value) _assert_mat3_equal(expected, value, __FILE__, __LINE__)
 
+static inline void _assert_mat4_equal(const mat4 *expected, const mat4 *value, const char *file, int line)
+{
+    int i, j;
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            double e = mat4_get(expected, i, j);
+            double v = mat4_get(value, i, j);
+            if (!approx_equal(e, v)) {
+                fprintf(stderr, "%s:%d expected %g, got %g at (%d, %d)\n", file, line, e, v, i, j);
+                abort();
+            }
+        }
+    }
+}
+
+#define assert_mat4_equal(expected, value) _assert_mat4_equal(expected, value, __FILE__, __LINE__)
+
+static inline void _assert_dvec3_equal(dvec3 expected, dvec3 value, const char *file, int line)
+{
+    if (!approx_equal(expected.x, value.x) ||
+        !approx_equal(expected.y, value.y) ||
+        !approx_equal(expected.z, value.z)) {
+        fprintf(stderr, "%s:%d expected (%.17g, %.17g, %.17g), got (%.17g, %.17g, %.17g)\n", file, line, expected.x, expected.y, expected.z, value.x, value.y, value.z);
+        abort();
+    }
+}
+
+#define assert_dvec3_equal(expected, value) _assert_dvec3_equal(expected, value, __FILE__, __LINE__)
+
 #endif
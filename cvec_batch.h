@@ -0,0 +1,804 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_BATCH_H
+#define CVEC_BATCH_H
+
+/*
+ * Batch kernels over arrays of vectors.
+ *
+ * These are plain loops written so that the compiler can vectorize them:
+ * matrix entries are hoisted into locals and each element is loaded
+ * before anything is stored, which also makes it safe for 'in' and 'out'
+ * to be the same array.
+ *
+ * The double precision transforms use AVX when the compiler targets it,
+ * since a dvec4 fills exactly one 256-bit register.
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "cvec.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#if defined(__FMA__)
+#define _CVEC_FMADD_PD(a, b, c) _mm256_fmadd_pd(a, b, c)
+#else
+#define _CVEC_FMADD_PD(a, b, c) _mm256_add_pd(_mm256_mul_pd(a, b), c)
+#endif
+#endif
+
+/*
+ * Fused multiply-add for the float kernels. Only uses fmaf() when the
+ * target has it in hardware; otherwise the library call would be far
+ * slower than a separate multiply and add.
+ */
+#if defined(__FP_FAST_FMAF)
+#define _CVEC_FMAF(a, b, c) fmaf(a, b, c)
+#else
+#define _CVEC_FMAF(a, b, c) ((a)*(b) + (c))
+#endif
+
+/*
+ * Structure-of-arrays vec3: three separate component arrays. Kernels that
+ * touch every element with the same arithmetic vectorize better over this
+ * layout than over an array of vec3.
+ */
+typedef struct vec3_soa {
+    float *x;
+    float *y;
+    float *z;
+} vec3_soa;
+
+static inline vec3_soa Vec3Soa(float *x, float *y, float *z)
+{
+    vec3_soa r;
+    r.x = x;
+    r.y = y;
+    r.z = z;
+    return r;
+}
+
+static inline vec3 vec3_soa_get(vec3_soa a, size_t i)
+{
+    return Vec3(a.x[i], a.y[i], a.z[i]);
+}
+
+static inline void vec3_soa_set(vec3_soa a, size_t i, vec3 v)
+{
+    a.x[i] = v.x;
+    a.y[i] = v.y;
+    a.z[i] = v.z;
+}
+
+static inline void vec3_soa_from_aos(const vec3 *restrict in, vec3_soa out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out.x[i] = in[i].x;
+        out.y[i] = in[i].y;
+        out.z[i] = in[i].z;
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec3_soa_to_aos(vec3_soa in, vec3 *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = Vec3(in.x[i], in.y[i], in.z[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/* Structure-of-arrays vec4, e.g. a stream of quaternions. */
+typedef struct vec4_soa {
+    float *x;
+    float *y;
+    float *z;
+    float *w;
+} vec4_soa;
+
+static inline vec4_soa Vec4Soa(float *x, float *y, float *z, float *w)
+{
+    vec4_soa r;
+    r.x = x;
+    r.y = y;
+    r.z = z;
+    r.w = w;
+    return r;
+}
+
+static inline vec4 vec4_soa_get(vec4_soa a, size_t i)
+{
+    return Vec4(a.x[i], a.y[i], a.z[i], a.w[i]);
+}
+
+static inline void vec4_soa_set(vec4_soa a, size_t i, vec4 v)
+{
+    a.x[i] = v.x;
+    a.y[i] = v.y;
+    a.z[i] = v.z;
+    a.w[i] = v.w;
+}
+
+/* Structure-of-arrays vec2. */
+typedef struct vec2_soa {
+    float *x;
+    float *y;
+} vec2_soa;
+
+static inline vec2_soa Vec2Soa(float *x, float *y)
+{
+    vec2_soa r;
+    r.x = x;
+    r.y = y;
+    return r;
+}
+
+static inline vec2 vec2_soa_get(vec2_soa a, size_t i)
+{
+    return Vec2(a.x[i], a.y[i]);
+}
+
+static inline void vec2_soa_set(vec2_soa a, size_t i, vec2 v)
+{
+    a.x[i] = v.x;
+    a.y[i] = v.y;
+}
+
+/* Transform kernels, defined below or in libcvec; see CVEC_KERNEL in cvec.h. */
+
+CVEC_KERNEL void mat4_transform_point_batch(const mat4 *m, const vec3 *in, vec3 *out, size_t n);
+CVEC_KERNEL void mat4_transform_batch(const mat4 *m, const vec4 *in, vec4 *out, size_t n);
+CVEC_KERNEL void mat3_transform_batch(const mat3 *m, const vec3 *in, vec3 *out, size_t n);
+CVEC_KERNEL void mat2_transform_batch(const mat2 *m, const vec2 *in, vec2 *out, size_t n);
+CVEC_KERNEL void dmat4_transform_point_batch(const dmat4 *m, const dvec3 *in, dvec3 *out, size_t n);
+CVEC_KERNEL void dmat4_transform_batch(const dmat4 *m, const dvec4 *in, dvec4 *out, size_t n);
+
+#if _CVEC_KERNEL_BODY
+
+/* Transforms points as (x, y, z, 1) by an affine matrix, dropping w. */
+CVEC_KERNEL void mat4_transform_point_batch(const mat4 *m, const vec3 *in, vec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    const float *a = m->data;
+    float m00 = a[0], m10 = a[1], m20 = a[2];
+    float m01 = a[4], m11 = a[5], m21 = a[6];
+    float m02 = a[8], m12 = a[9], m22 = a[10];
+    float m03 = a[12], m13 = a[13], m23 = a[14];
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        float x = in[i].x, y = in[i].y, z = in[i].z;
+        out[i].x = m00*x + m01*y + m02*z + m03;
+        out[i].y = m10*x + m11*y + m12*z + m13;
+        out[i].z = m20*x + m21*y + m22*z + m23;
+    }
+    CVEC_PROFILE_END(n);
+}
+
+CVEC_KERNEL void mat4_transform_batch(const mat4 *m, const vec4 *in, vec4 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = mat4_transform(m, in[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+CVEC_KERNEL void mat3_transform_batch(const mat3 *m, const vec3 *in, vec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = mat3_transform(m, in[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/* E.g. rotating and scaling polyline vertices. */
+CVEC_KERNEL void mat2_transform_batch(const mat2 *m, const vec2 *in, vec2 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    const float *a = m->data;
+    float m00 = a[0], m10 = a[1];
+    float m01 = a[2], m11 = a[3];
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        float x = in[i].x, y = in[i].y;
+        out[i].x = m00*x + m01*y;
+        out[i].y = m10*x + m11*y;
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/* Double precision version of mat4_transform_point_batch(). */
+CVEC_KERNEL void dmat4_transform_point_batch(const dmat4 *m, const dvec3 *in, dvec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+#if defined(__AVX__)
+    __m256d c0 = _mm256_loadu_pd(m->data);
+    __m256d c1 = _mm256_loadu_pd(m->data + 4);
+    __m256d c2 = _mm256_loadu_pd(m->data + 8);
+    __m256d c3 = _mm256_loadu_pd(m->data + 12);
+    __m256i xyz = _mm256_set_epi64x(0, -1, -1, -1);
+
+    for (i = 0; i < n; i++) {
+        __m256d r = _CVEC_FMADD_PD(c0, _mm256_set1_pd(in[i].x), c3);
+        r = _CVEC_FMADD_PD(c1, _mm256_set1_pd(in[i].y), r);
+        r = _CVEC_FMADD_PD(c2, _mm256_set1_pd(in[i].z), r);
+        _mm256_maskstore_pd(&out[i].x, xyz, r);
+    }
+#else
+    for (i = 0; i < n; i++) {
+        dvec4 r = dmat4_transform(m, DVec4(in[i].x, in[i].y, in[i].z, 1));
+        out[i] = DVec3(r.x, r.y, r.z);
+    }
+#endif
+    CVEC_PROFILE_END(n);
+}
+
+CVEC_KERNEL void dmat4_transform_batch(const dmat4 *m, const dvec4 *in, dvec4 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+#if defined(__AVX__)
+    __m256d c0 = _mm256_loadu_pd(m->data);
+    __m256d c1 = _mm256_loadu_pd(m->data + 4);
+    __m256d c2 = _mm256_loadu_pd(m->data + 8);
+    __m256d c3 = _mm256_loadu_pd(m->data + 12);
+
+    for (i = 0; i < n; i++) {
+        __m256d r = _mm256_mul_pd(c0, _mm256_set1_pd(in[i].x));
+        r = _CVEC_FMADD_PD(c1, _mm256_set1_pd(in[i].y), r);
+        r = _CVEC_FMADD_PD(c2, _mm256_set1_pd(in[i].z), r);
+        r = _CVEC_FMADD_PD(c3, _mm256_set1_pd(in[i].w), r);
+        _mm256_storeu_pd(&out[i].x, r);
+    }
+#else
+    for (i = 0; i < n; i++) {
+        out[i] = dmat4_transform(m, in[i]);
+    }
+#endif
+    CVEC_PROFILE_END(n);
+}
+
+#endif /* _CVEC_KERNEL_BODY */
+
+
+/* Mixed precision */
+
+/*
+ * Converts double points to float points relative to 'origin'. The
+ * subtraction happens in double, so points near the origin keep full
+ * float precision however far the origin is from zero.
+ */
+static inline void dvec3_to_vec3_relative_batch(const dvec3 *restrict in, dvec3 origin,
+                                                vec3 *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i].x = (float)(in[i].x - origin.x);
+        out[i].y = (float)(in[i].y - origin.y);
+        out[i].z = (float)(in[i].z - origin.z);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/*
+ * Converts a double model-to-world transform into a float transform from
+ * model space to world space relative to 'origin' (typically the camera
+ * position), i.e. translate(-origin) * m computed in double.
+ */
+static inline void dmat4_to_mat4_relative(const dmat4 *m, dvec3 origin, mat4 *r)
+{
+    int j;
+    for (j = 0; j < 4; j++) {
+        double w = dmat4_get(m, 3, j);
+        mat4_set(r, 0, j, dmat4_get(m, 0, j) - origin.x * w);
+        mat4_set(r, 1, j, dmat4_get(m, 1, j) - origin.y * w);
+        mat4_set(r, 2, j, dmat4_get(m, 2, j) - origin.z * w);
+        mat4_set(r, 3, j, w);
+    }
+}
+
+static inline void dmat4_to_mat4_relative_batch(const dmat4 *restrict in, dvec3 origin,
+                                                mat4 *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        dmat4_to_mat4_relative(&in[i], origin, &out[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/*
+ * Fused BLAS-1 style kernels
+ *
+ * Each kernel reads its inputs and writes its output in a single pass,
+ * with multiply-adds fused when the target has FMA. They work on the
+ * float components directly, so the vec2, vec3 and vec4 versions share
+ * one implementation.
+ *
+ * The work is done in blocks of _CVEC_BATCH_BLOCK floats. When the output
+ * is at least CVEC_BATCH_STREAM_BYTES long, each block is computed into a
+ * buffer on the stack and copied out with non-temporal stores, so that a
+ * large result does not evict the inputs (or everything else) from the
+ * cache. Outputs may be the same array as an input.
+ */
+
+#ifndef CVEC_BATCH_STREAM_BYTES
+#define CVEC_BATCH_STREAM_BYTES (4 << 20)
+#endif
+
+/* A multiple of 2, 3 and 4 so that blocks hold whole vectors. */
+#define _CVEC_BATCH_BLOCK 768
+
+struct _cvec_batch_args {
+    const float *a;
+    const float *b;
+    const float *c;
+    const float *t;
+    float s;
+    float lo[4];
+    float hi[4];
+    const float *const *arrays;
+    const float *weights;
+    int k;
+    int dim;
+};
+
+typedef void (*_cvec_batch_fn)(const struct _cvec_batch_args *args, size_t begin, size_t end, float *out);
+
+static inline void _cvec_stream_store(float *restrict dst, const float *restrict src, size_t n)
+{
+#if defined(__SSE__)
+    size_t i = 0;
+    for (; i < n && ((uintptr_t)(dst + i) & 15); i++) {
+        dst[i] = src[i];
+    }
+    for (; i + 4 <= n; i += 4) {
+        _mm_stream_ps(dst + i, _mm_loadu_ps(src + i));
+    }
+    for (; i < n; i++) {
+        dst[i] = src[i];
+    }
+#else
+    memcpy(dst, src, n * sizeof(float));
+#endif
+}
+
+/* Runs fn over [0, n) floats of 'out' block by block. */
+static inline void _cvec_batch_run(_cvec_batch_fn fn, const struct _cvec_batch_args *args,
+                                   float *out, size_t n)
+{
+    float buf[_CVEC_BATCH_BLOCK];
+    size_t i, len;
+#if defined(__SSE__)
+    int stream = n * sizeof(float) >= CVEC_BATCH_STREAM_BYTES;
+#else
+    int stream = 0;
+#endif
+
+    for (i = 0; i < n; i += len) {
+        len = n - i < _CVEC_BATCH_BLOCK ? n - i : _CVEC_BATCH_BLOCK;
+        if (stream) {
+            fn(args, i, i + len, buf);
+            _cvec_stream_store(out + i, buf, len);
+        } else {
+            fn(args, i, i + len, out + i);
+        }
+    }
+#if defined(__SSE__)
+    if (stream) {
+        _mm_sfence();
+    }
+#endif
+}
+
+/* out = s*a + b */
+static inline void _cvec_axpy_block(const struct _cvec_batch_args *args, size_t begin, size_t end, float *out)
+{
+    const float *a = args->a, *b = args->b;
+    float s = args->s;
+    size_t j;
+    for (j = begin; j < end; j++) {
+        out[j - begin] = _CVEC_FMAF(s, a[j], b[j]);
+    }
+}
+
+/* out = a + s*(b - a) */
+static inline void _cvec_lerp_block(const struct _cvec_batch_args *args, size_t begin, size_t end, float *out)
+{
+    const float *a = args->a, *b = args->b;
+    float s = args->s;
+    size_t j;
+    for (j = begin; j < end; j++) {
+        out[j - begin] = _CVEC_FMAF(s, b[j] - a[j], a[j]);
+    }
+}
+
+/* out = a + t*(b - a) with one t per vector */
+static inline void _cvec_lerp_each_block(const struct _cvec_batch_args *args, size_t begin, size_t end, float *out)
+{
+    const float *a = args->a, *b = args->b, *t = args->t;
+    int dim = args->dim;
+    size_t v;
+    int c;
+    for (v = begin / dim; v < end / dim; v++) {
+        for (c = 0; c < dim; c++) {
+            size_t j = v * dim + c;
+            out[j - begin] = _CVEC_FMAF(t[v], b[j] - a[j], a[j]);
+        }
+    }
+}
+
+/* out = a*b + c */
+static inline void _cvec_madd_block(const struct _cvec_batch_args *args, size_t begin, size_t end, float *out)
+{
+    const float *a = args->a, *b = args->b, *c = args->c;
+    size_t j;
+    for (j = begin; j < end; j++) {
+        out[j - begin] = _CVEC_FMAF(a[j], b[j], c[j]);
+    }
+}
+
+static inline void _cvec_clamp_block(const struct _cvec_batch_args *args, size_t begin, size_t end, float *out)
+{
+    const float *a = args->a;
+    int dim = args->dim;
+    size_t v;
+    int c;
+    for (v = begin / dim; v < end / dim; v++) {
+        for (c = 0; c < dim; c++) {
+            size_t j = v * dim + c;
+            float x = a[j];
+            x = x < args->lo[c] ? args->lo[c] : x;
+            x = x > args->hi[c] ? args->hi[c] : x;
+            out[j - begin] = x;
+        }
+    }
+}
+
+/*
+ * out (+)= up to four weighted arrays in one pass. Folding several arrays
+ * into each pass keeps the common small-k cases to a single read of out.
+ */
+static inline void _cvec_weighted_sum_pass(const float *const *arrays, const float *weights, int m,
+                                           int first, size_t begin, size_t n, float *out)
+{
+    const float *a0 = arrays[0] + begin, *a1 = NULL, *a2 = NULL, *a3 = NULL;
+    float w0 = weights[0], w1 = 0, w2 = 0, w3 = 0;
+    size_t j;
+
+    if (m > 1) { a1 = arrays[1] + begin; w1 = weights[1]; }
+    if (m > 2) { a2 = arrays[2] + begin; w2 = weights[2]; }
+    if (m > 3) { a3 = arrays[3] + begin; w3 = weights[3]; }
+
+    switch (m) {
+    case 1:
+        for (j = 0; j < n; j++) {
+            out[j] = _CVEC_FMAF(w0, a0[j], first ? 0 : out[j]);
+        }
+        break;
+    case 2:
+        for (j = 0; j < n; j++) {
+            float x = _CVEC_FMAF(w0, a0[j], first ? 0 : out[j]);
+            out[j] = _CVEC_FMAF(w1, a1[j], x);
+        }
+        break;
+    case 3:
+        for (j = 0; j < n; j++) {
+            float x = _CVEC_FMAF(w0, a0[j], first ? 0 : out[j]);
+            x = _CVEC_FMAF(w1, a1[j], x);
+            out[j] = _CVEC_FMAF(w2, a2[j], x);
+        }
+        break;
+    default:
+        for (j = 0; j < n; j++) {
+            float x = _CVEC_FMAF(w0, a0[j], first ? 0 : out[j]);
+            x = _CVEC_FMAF(w1, a1[j], x);
+            x = _CVEC_FMAF(w2, a2[j], x);
+            out[j] = _CVEC_FMAF(w3, a3[j], x);
+        }
+        break;
+    }
+}
+
+/* out = sum of weights[i]*arrays[i]; the block stays in L1 across passes. */
+static inline void _cvec_weighted_sum_block(const struct _cvec_batch_args *args, size_t begin, size_t end, float *out)
+{
+    int i, m;
+
+    if (args->k <= 0) {
+        memset(out, 0, (end - begin) * sizeof(float));
+        return;
+    }
+    for (i = 0; i < args->k; i += m) {
+        m = args->k - i < 4 ? args->k - i : 4;
+        _cvec_weighted_sum_pass(args->arrays + i, args->weights + i, m, i == 0, begin, end - begin, out);
+    }
+}
+
+static inline void _cvec_axpy(float s, const float *x, float *y, size_t n)
+{
+    struct _cvec_batch_args args;
+    args.a = x;
+    args.b = y;
+    args.s = s;
+    _cvec_batch_run(_cvec_axpy_block, &args, y, n);
+}
+
+static inline void _cvec_lerp(const float *a, const float *b, float t, float *out, size_t n)
+{
+    struct _cvec_batch_args args;
+    args.a = a;
+    args.b = b;
+    args.s = t;
+    _cvec_batch_run(_cvec_lerp_block, &args, out, n);
+}
+
+static inline void _cvec_lerp_each(const float *a, const float *b, const float *t, float *out,
+                                   size_t n, int dim)
+{
+    struct _cvec_batch_args args;
+    args.a = a;
+    args.b = b;
+    args.t = t;
+    args.dim = dim;
+    _cvec_batch_run(_cvec_lerp_each_block, &args, out, n * dim);
+}
+
+static inline void _cvec_madd(const float *a, const float *b, const float *c, float *out, size_t n)
+{
+    struct _cvec_batch_args args;
+    args.a = a;
+    args.b = b;
+    args.c = c;
+    _cvec_batch_run(_cvec_madd_block, &args, out, n);
+}
+
+static inline void _cvec_clamp(const float *in, const float *lo, const float *hi, float *out,
+                               size_t n, int dim)
+{
+    struct _cvec_batch_args args;
+    int c;
+    args.a = in;
+    args.dim = dim;
+    for (c = 0; c < dim; c++) {
+        args.lo[c] = lo[c];
+        args.hi[c] = hi[c];
+    }
+    _cvec_batch_run(_cvec_clamp_block, &args, out, n * dim);
+}
+
+static inline void _cvec_weighted_sum(const float *const *arrays, const float *weights, int k,
+                                      float *out, size_t n)
+{
+    struct _cvec_batch_args args;
+    args.arrays = arrays;
+    args.weights = weights;
+    args.k = k;
+    _cvec_batch_run(_cvec_weighted_sum_block, &args, out, n);
+}
+
+/* y = a*x + y */
+static inline void vec2_axpy_batch(float a, const vec2 *x, vec2 *y, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_axpy(a, (const float *)x, (float *)y, 2*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec3_axpy_batch(float a, const vec3 *x, vec3 *y, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_axpy(a, (const float *)x, (float *)y, 3*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec4_axpy_batch(float a, const vec4 *x, vec4 *y, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_axpy(a, (const float *)x, (float *)y, 4*n);
+    CVEC_PROFILE_END(n);
+}
+
+/* out = a + t*(b - a) */
+static inline void vec2_lerp_batch(const vec2 *a, const vec2 *b, float t, vec2 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_lerp((const float *)a, (const float *)b, t, (float *)out, 2*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec3_lerp_batch(const vec3 *a, const vec3 *b, float t, vec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_lerp((const float *)a, (const float *)b, t, (float *)out, 3*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec4_lerp_batch(const vec4 *a, const vec4 *b, float t, vec4 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_lerp((const float *)a, (const float *)b, t, (float *)out, 4*n);
+    CVEC_PROFILE_END(n);
+}
+
+/* out[i] = a[i] + t[i]*(b[i] - a[i]) */
+static inline void vec2_lerp_each_batch(const vec2 *a, const vec2 *b, const float *t, vec2 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_lerp_each((const float *)a, (const float *)b, t, (float *)out, n, 2);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec3_lerp_each_batch(const vec3 *a, const vec3 *b, const float *t, vec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_lerp_each((const float *)a, (const float *)b, t, (float *)out, n, 3);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec4_lerp_each_batch(const vec4 *a, const vec4 *b, const float *t, vec4 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_lerp_each((const float *)a, (const float *)b, t, (float *)out, n, 4);
+    CVEC_PROFILE_END(n);
+}
+
+/* out = a*b + c, component-wise */
+static inline void vec2_madd_batch(const vec2 *a, const vec2 *b, const vec2 *c, vec2 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_madd((const float *)a, (const float *)b, (const float *)c, (float *)out, 2*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec3_madd_batch(const vec3 *a, const vec3 *b, const vec3 *c, vec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_madd((const float *)a, (const float *)b, (const float *)c, (float *)out, 3*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec4_madd_batch(const vec4 *a, const vec4 *b, const vec4 *c, vec4 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_madd((const float *)a, (const float *)b, (const float *)c, (float *)out, 4*n);
+    CVEC_PROFILE_END(n);
+}
+
+/* Clamps each component to [lo, hi]. */
+static inline void vec2_clamp_batch(const vec2 *in, vec2 lo, vec2 hi, vec2 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_clamp((const float *)in, (const float *)&lo, (const float *)&hi, (float *)out, n, 2);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec3_clamp_batch(const vec3 *in, vec3 lo, vec3 hi, vec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_clamp((const float *)in, (const float *)&lo, (const float *)&hi, (float *)out, n, 3);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec4_clamp_batch(const vec4 *in, vec4 lo, vec4 hi, vec4 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_clamp((const float *)in, (const float *)&lo, (const float *)&hi, (float *)out, n, 4);
+    CVEC_PROFILE_END(n);
+}
+
+/*
+ * out = weights[0]*arrays[0] + ... + weights[k-1]*arrays[k-1], or zeros
+ * if k <= 0. 'out' may be one of the first four input arrays, but not a
+ * later one.
+ */
+static inline void vec2_weighted_sum_batch(const vec2 *const *arrays, const float *weights, int k,
+                                           vec2 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_weighted_sum((const float *const *)arrays, weights, k, (float *)out, 2*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec3_weighted_sum_batch(const vec3 *const *arrays, const float *weights, int k,
+                                           vec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_weighted_sum((const float *const *)arrays, weights, k, (float *)out, 3*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec4_weighted_sum_batch(const vec4 *const *arrays, const float *weights, int k,
+                                           vec4 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _cvec_weighted_sum((const float *const *)arrays, weights, k, (float *)out, 4*n);
+    CVEC_PROFILE_END(n);
+}
+
+/* Translation/rotation/scale */
+
+/* mat4_init_trs() for n bones, e.g. an animation pose. */
+static inline void mat4_init_trs_batch(vec3_soa t, vec4_soa q, vec3_soa s, mat4 *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        _mat4_trs(out[i].data, t.x[i], t.y[i], t.z[i], q.x[i], q.y[i], q.z[i], q.w[i],
+                  s.x[i], s.y[i], s.z[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/*
+ * mat4_decompose() for n matrices. Matrices that cannot be decomposed
+ * get an identity rotation and zero scale; the return value is -1 (with
+ * errno set to EDOM) if there were any.
+ */
+static inline int mat4_decompose_batch(const mat4 *in, vec3_soa t, vec4_soa q, vec3_soa s, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    vec3 ti, si;
+    vec4 qi;
+    size_t i;
+    int ret = 0;
+
+    for (i = 0; i < n; i++) {
+        if (mat4_decompose(&in[i], &ti, &qi, &si) != 0) {
+            ti = Vec3(in[i].data[12], in[i].data[13], in[i].data[14]);
+            qi = Vec4(0, 0, 0, 1);
+            si = Vec3(0, 0, 0);
+            ret = -1;
+        }
+        vec3_soa_set(t, i, ti);
+        vec4_soa_set(q, i, qi);
+        vec3_soa_set(s, i, si);
+    }
+    if (ret != 0) {
+        errno = EDOM;
+    }
+    CVEC_PROFILE_END(n);
+    return ret;
+}
+
+#endif
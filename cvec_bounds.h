@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_BOUNDS_H
+#define CVEC_BOUNDS_H
+
+/*
+ * Conservative transforms of bounding boxes and spheres.
+ *
+ * mat4_transform_aabb() bounds a box under an affine matrix without
+ * transforming its 8 corners. It follows Arvo: the center goes through
+ * the matrix, and the half extent goes through the matrix of absolute
+ * values. The result is the tightest box around the transformed
+ * corners, up to rounding. mat4_transform_sphere() moves the center and
+ * multiplies the radius by the largest stretch of the matrix.
+ *
+ * The mat4 versions treat the matrix as affine. They ignore the bottom
+ * row, so a projective matrix is not handled. The mat3 versions have no
+ * translation.
+ *
+ * The results are conservative in float arithmetic too. Every bound
+ * grows by CVEC_BOUNDS_PAD times the magnitude of the terms summed into
+ * it, which covers the rounding of the computation. Without that, a
+ * point on a face of the input could be transformed by mat4_transform()
+ * to just outside the output. The padding is a few ulp of the
+ * coordinates, far below what a broad phase notices.
+ *
+ * The stretch bound for spheres is the square root of the largest row
+ * sum of |A^T A|, where A is the upper-left 3x3. It needs no eigenvalue
+ * solve. It is exact for a rotation times a uniform scale, and for a
+ * rotation times an axis-aligned scale. Shear makes it larger than the
+ * true stretch, by at most a factor sqrt(3).
+ *
+ * An empty box (see aabb_empty()) gives NaN bounds; test for it first.
+ *
+ * The _batch versions transform n boxes or spheres by one matrix. The
+ * _each_batch versions pair matrix i with box or sphere i. The AoS box
+ * version transposes blocks of boxes into stack buffers, as cvec_query.h
+ * does, and the SoA version runs on the caller's arrays directly. With
+ * one matrix, bench measures them at about 4x (AoS) and 10x (SoA) the
+ * speed of transforming the 8 corners. With a matrix per box the gain
+ * is about 2.5x, as loading the matrices takes most of the time.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include "cvec.h"
+#include "cvec_batch.h"
+
+#ifndef CVEC_BOUNDS_PAD
+#define CVEC_BOUNDS_PAD (8 * FLT_EPSILON)
+#elif !_CVEC_KERNEL_BODY
+#error "CVEC_BOUNDS_PAD must match libcvec, which uses the default; see CVEC_EXTERN in cvec.h"
+#endif
+
+#define _CVEC_BOUNDS_BLOCK 256
+
+/* As in cvec_query.h, the batch loops only vectorize if these inline. */
+#if defined(__GNUC__)
+#define _CVEC_BOUNDS_KERNEL static inline __attribute__((always_inline))
+#else
+#define _CVEC_BOUNDS_KERNEL static inline
+#endif
+
+typedef struct sphere {
+    vec3 center;
+    float radius;
+} sphere;
+
+static inline sphere Sphere(vec3 center, float radius)
+{
+    sphere r;
+    r.center = center;
+    r.radius = radius;
+    return r;
+}
+
+/*
+ * The matrix as 12 floats: entry (i, j) of the 3x3 part at a[i + 3*j],
+ * then the translation at a[9..11]. d is 3 or 4.
+ */
+_CVEC_BOUNDS_KERNEL void _bounds_affine(const float *data, int d, float *a)
+{
+    int i, j;
+    for (j = 0; j < 3; j++) {
+        for (i = 0; i < 3; i++) {
+            a[i + 3*j] = data[i + d*j];
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        a[9 + i] = d == 4 ? data[12 + i] : 0;
+    }
+}
+
+_CVEC_BOUNDS_KERNEL float _bounds_abs_max(float a, float b)
+{
+    a = fabsf(a);
+    b = fabsf(b);
+    return a > b ? a : b;
+}
+
+/*
+ * One output axis of the box transform, from row (a0, a1, a2) and
+ * translation t. c is the center, e the half extent and m the largest
+ * magnitude of the input box on each axis.
+ */
+_CVEC_BOUNDS_KERNEL void _bounds_aabb_axis(float a0, float a1, float a2, float t,
+                                           float cx, float cy, float cz,
+                                           float ex, float ey, float ez,
+                                           float mx, float my, float mz,
+                                           float *lo, float *hi)
+{
+    float c = a0*cx + a1*cy + a2*cz + t;
+    float e = fabsf(a0)*ex + fabsf(a1)*ey + fabsf(a2)*ez;
+    float pad = (fabsf(a0)*mx + fabsf(a1)*my + fabsf(a2)*mz + fabsf(t)) * CVEC_BOUNDS_PAD;
+
+    e += pad;
+    *lo = c - e;
+    *hi = c + e;
+}
+
+_CVEC_BOUNDS_KERNEL void _bounds_aabb(const float *a,
+                                      float lx, float ly, float lz,
+                                      float hx, float hy, float hz,
+                                      float *olx, float *oly, float *olz,
+                                      float *ohx, float *ohy, float *ohz)
+{
+    float cx = (lx + hx) * 0.5f, cy = (ly + hy) * 0.5f, cz = (lz + hz) * 0.5f;
+    float ex = (hx - lx) * 0.5f, ey = (hy - ly) * 0.5f, ez = (hz - lz) * 0.5f;
+    float mx = _bounds_abs_max(lx, hx);
+    float my = _bounds_abs_max(ly, hy);
+    float mz = _bounds_abs_max(lz, hz);
+
+    _bounds_aabb_axis(a[0], a[3], a[6], a[9], cx, cy, cz, ex, ey, ez, mx, my, mz, olx, ohx);
+    _bounds_aabb_axis(a[1], a[4], a[7], a[10], cx, cy, cz, ex, ey, ez, mx, my, mz, oly, ohy);
+    _bounds_aabb_axis(a[2], a[5], a[8], a[11], cx, cy, cz, ex, ey, ez, mx, my, mz, olz, ohz);
+}
+
+/* The square of the stretch bound: the largest row sum of |A^T A|. */
+_CVEC_BOUNDS_KERNEL float _bounds_scale2(const float *a)
+{
+    float g00 = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
+    float g11 = a[3]*a[3] + a[4]*a[4] + a[5]*a[5];
+    float g22 = a[6]*a[6] + a[7]*a[7] + a[8]*a[8];
+    float g01 = fabsf(a[0]*a[3] + a[1]*a[4] + a[2]*a[5]);
+    float g02 = fabsf(a[0]*a[6] + a[1]*a[7] + a[2]*a[8]);
+    float g12 = fabsf(a[3]*a[6] + a[4]*a[7] + a[5]*a[8]);
+    float r0 = g00 + g01 + g02;
+    float r1 = g01 + g11 + g12;
+    float r2 = g02 + g12 + g22;
+    float r = r0 > r1 ? r0 : r1;
+
+    return r > r2 ? r : r2;
+}
+
+/* scale is sqrtf(_bounds_scale2(a)). */
+_CVEC_BOUNDS_KERNEL void _bounds_sphere(const float *a, float scale,
+                                        float cx, float cy, float cz, float r,
+                                        float *ox, float *oy, float *oz, float *orad)
+{
+    float ax = fabsf(cx), ay = fabsf(cy), az = fabsf(cz);
+    float pad = fabsf(a[0])*ax + fabsf(a[3])*ay + fabsf(a[6])*az + fabsf(a[9]) +
+                fabsf(a[1])*ax + fabsf(a[4])*ay + fabsf(a[7])*az + fabsf(a[10]) +
+                fabsf(a[2])*ax + fabsf(a[5])*ay + fabsf(a[8])*az + fabsf(a[11]);
+
+    *ox = a[0]*cx + a[3]*cy + a[6]*cz + a[9];
+    *oy = a[1]*cx + a[4]*cy + a[7]*cz + a[10];
+    *oz = a[2]*cx + a[5]*cy + a[8]*cz + a[11];
+    *orad = (r*scale + pad*CVEC_BOUNDS_PAD) * (1 + CVEC_BOUNDS_PAD);
+}
+
+static inline aabb _bounds_transform_aabb(const float *data, int d, aabb box)
+{
+    float a[12];
+    aabb r;
+
+    _bounds_affine(data, d, a);
+    _bounds_aabb(a, box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z,
+                 &r.min.x, &r.min.y, &r.min.z, &r.max.x, &r.max.y, &r.max.z);
+    return r;
+}
+
+static inline sphere _bounds_transform_sphere(const float *data, int d, sphere s)
+{
+    float a[12];
+    sphere r;
+
+    _bounds_affine(data, d, a);
+    _bounds_sphere(a, sqrtf(_bounds_scale2(a)), s.center.x, s.center.y, s.center.z, s.radius,
+                   &r.center.x, &r.center.y, &r.center.z, &r.radius);
+    return r;
+}
+
+/* A box containing m applied to every point of box. */
+static inline aabb mat4_transform_aabb(const mat4 *m, aabb box)
+{
+    CVEC_PROFILE_CALL();
+    return _bounds_transform_aabb(m->data, 4, box);
+}
+
+static inline aabb mat3_transform_aabb(const mat3 *m, aabb box)
+{
+    CVEC_PROFILE_CALL();
+    return _bounds_transform_aabb(m->data, 3, box);
+}
+
+/* A sphere containing m applied to every point of s. */
+static inline sphere mat4_transform_sphere(const mat4 *m, sphere s)
+{
+    CVEC_PROFILE_CALL();
+    return _bounds_transform_sphere(m->data, 4, s);
+}
+
+static inline sphere mat3_transform_sphere(const mat3 *m, sphere s)
+{
+    CVEC_PROFILE_CALL();
+    return _bounds_transform_sphere(m->data, 3, s);
+}
+
+/* Kernels, defined below or in libcvec; see CVEC_KERNEL in cvec.h. */
+
+CVEC_KERNEL void mat4_transform_aabb_batch(const mat4 *m, const aabb *in, aabb *out, size_t n);
+CVEC_KERNEL void mat3_transform_aabb_batch(const mat3 *m, const aabb *in, aabb *out, size_t n);
+CVEC_KERNEL void mat4_transform_aabb_soa_batch(const mat4 *m, vec3_soa min, vec3_soa max,
+                                               vec3_soa out_min, vec3_soa out_max, size_t n);
+CVEC_KERNEL void mat4_transform_aabb_each_batch(const mat4 *m, const aabb *in, aabb *out, size_t n);
+CVEC_KERNEL void mat4_transform_sphere_batch(const mat4 *m, const sphere *in, sphere *out, size_t n);
+CVEC_KERNEL void mat3_transform_sphere_batch(const mat3 *m, const sphere *in, sphere *out, size_t n);
+CVEC_KERNEL void mat4_transform_sphere_each_batch(const mat4 *m, const sphere *in, sphere *out, size_t n);
+
+#if _CVEC_KERNEL_BODY
+
+/*
+ * The matrix entries are copied to locals first: the outputs are plain
+ * float pointers, and without the copies GCC would reload the matrix
+ * after every store.
+ */
+static inline void _bounds_aabb_soa(const float *m,
+                                    const float *restrict lx, const float *restrict ly, const float *restrict lz,
+                                    const float *restrict hx, const float *restrict hy, const float *restrict hz,
+                                    float *restrict olx, float *restrict oly, float *restrict olz,
+                                    float *restrict ohx, float *restrict ohy, float *restrict ohz,
+                                    size_t n)
+{
+    float a[12];
+    size_t i;
+    int k;
+
+    for (k = 0; k < 12; k++) {
+        a[k] = m[k];
+    }
+    for (i = 0; i < n; i++) {
+        _bounds_aabb(a, lx[i], ly[i], lz[i], hx[i], hy[i], hz[i],
+                     &olx[i], &oly[i], &olz[i], &ohx[i], &ohy[i], &ohz[i]);
+    }
+}
+
+static inline void _bounds_gather(const aabb *in, float (*restrict x)[_CVEC_BOUNDS_BLOCK], size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        x[0][i] = in[i].min.x;
+        x[1][i] = in[i].min.y;
+        x[2][i] = in[i].min.z;
+        x[3][i] = in[i].max.x;
+        x[4][i] = in[i].max.y;
+        x[5][i] = in[i].max.z;
+    }
+}
+
+static inline void _bounds_scatter(float (*restrict x)[_CVEC_BOUNDS_BLOCK], aabb *out, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = Aabb(Vec3(x[0][i], x[1][i], x[2][i]), Vec3(x[3][i], x[4][i], x[5][i]));
+    }
+}
+
+static inline void _bounds_transform_aabb_batch(const float *data, int d,
+                                                const aabb *in, aabb *out, size_t n)
+{
+    float buf[12][_CVEC_BOUNDS_BLOCK];
+    float a[12];
+    size_t base, len;
+
+    _bounds_affine(data, d, a);
+    for (base = 0; base < n; base += len) {
+        len = n - base < _CVEC_BOUNDS_BLOCK ? n - base : _CVEC_BOUNDS_BLOCK;
+        _bounds_gather(in + base, buf, len);
+        _bounds_aabb_soa(a, buf[0], buf[1], buf[2], buf[3], buf[4], buf[5],
+                         buf[6], buf[7], buf[8], buf[9], buf[10], buf[11], len);
+        _bounds_scatter(buf + 6, out + base, len);
+    }
+}
+
+static inline void _bounds_transform_sphere_batch(const float *data, int d,
+                                                  const sphere *in, sphere *out, size_t n)
+{
+    float a[12];
+    float scale;
+    size_t i;
+
+    _bounds_affine(data, d, a);
+    scale = sqrtf(_bounds_scale2(a));
+    for (i = 0; i < n; i++) {
+        sphere s = in[i];
+        _bounds_sphere(a, scale, s.center.x, s.center.y, s.center.z, s.radius,
+                       &out[i].center.x, &out[i].center.y, &out[i].center.z, &out[i].radius);
+    }
+}
+
+/* out may be in. */
+CVEC_KERNEL void mat4_transform_aabb_batch(const mat4 *m, const aabb *in, aabb *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _bounds_transform_aabb_batch(m->data, 4, in, out, n);
+    CVEC_PROFILE_END(n);
+}
+
+CVEC_KERNEL void mat3_transform_aabb_batch(const mat3 *m, const aabb *in, aabb *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _bounds_transform_aabb_batch(m->data, 3, in, out, n);
+    CVEC_PROFILE_END(n);
+}
+
+/* The outputs must not overlap the inputs. */
+CVEC_KERNEL void mat4_transform_aabb_soa_batch(const mat4 *m, vec3_soa min, vec3_soa max,
+                                               vec3_soa out_min, vec3_soa out_max, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    float a[12];
+
+    _bounds_affine(m->data, 4, a);
+    _bounds_aabb_soa(a, min.x, min.y, min.z, max.x, max.y, max.z,
+                     out_min.x, out_min.y, out_min.z, out_max.x, out_max.y, out_max.z, n);
+    CVEC_PROFILE_END(n);
+}
+
+/* Box i by matrix i. out may be in. */
+CVEC_KERNEL void mat4_transform_aabb_each_batch(const mat4 *m, const aabb *in, aabb *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = _bounds_transform_aabb(m[i].data, 4, in[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/* out may be in. */
+CVEC_KERNEL void mat4_transform_sphere_batch(const mat4 *m, const sphere *in, sphere *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _bounds_transform_sphere_batch(m->data, 4, in, out, n);
+    CVEC_PROFILE_END(n);
+}
+
+CVEC_KERNEL void mat3_transform_sphere_batch(const mat3 *m, const sphere *in, sphere *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _bounds_transform_sphere_batch(m->data, 3, in, out, n);
+    CVEC_PROFILE_END(n);
+}
+
+/*
+ * Sphere i by matrix i. The stretch bounds of a block are computed
+ * first, so that the loop without the sqrtf calls vectorizes.
+ */
+CVEC_KERNEL void mat4_transform_sphere_each_batch(const mat4 *m, const sphere *in, sphere *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    float scale[_CVEC_BOUNDS_BLOCK];
+    size_t base, len, i;
+
+    for (base = 0; base < n; base += len) {
+        len = n - base < _CVEC_BOUNDS_BLOCK ? n - base : _CVEC_BOUNDS_BLOCK;
+        for (i = 0; i < len; i++) {
+            float a[12];
+            _bounds_affine(m[base + i].data, 4, a);
+            scale[i] = _bounds_scale2(a);
+        }
+        for (i = 0; i < len; i++) {
+            scale[i] = sqrtf(scale[i]);
+        }
+        for (i = 0; i < len; i++) {
+            float a[12];
+            sphere s = in[base + i];
+            _bounds_affine(m[base + i].data, 4, a);
+            _bounds_sphere(a, scale[i], s.center.x, s.center.y, s.center.z, s.radius,
+                           &out[base + i].center.x, &out[base + i].center.y,
+                           &out[base + i].center.z, &out[base + i].radius);
+        }
+    }
+    CVEC_PROFILE_END(n);
+}
+
+#endif /* _CVEC_KERNEL_BODY */
+
+#endif
@@ -0,0 +1,695 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_BVH_H
+#define CVEC_BVH_H
+
+/*
+ * Bounding volume hierarchy over arrays of AABBs or triangles.
+ *
+ * The builder bins primitive centroids and picks splits with the surface
+ * area heuristic (SAH), producing a binary tree which is then collapsed
+ * into CVEC_BVH_WIDTH-wide nodes. A wide node stores the bounds of all of
+ * its children in SoA form so that traversal tests every child in one
+ * loop the compiler can vectorize.
+ *
+ * Nodes live in a single array in depth-first order, so a parent always
+ * precedes its children. bvh_refit() relies on this and walks the array
+ * backwards.
+ *
+ * Triangles are given as a "soup": triangle i is verts[3*i+0..3*i+2].
+ *
+ * Functions returning int return 0 on success and -1 if memory could not
+ * be allocated.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cvec.h"
+
+#ifndef CVEC_BVH_WIDTH
+#define CVEC_BVH_WIDTH 4
+#elif !_CVEC_KERNEL_BODY
+#error "CVEC_BVH_WIDTH must match libcvec, which uses the default; see CVEC_EXTERN in cvec.h"
+#endif
+
+/* Number of centroid bins per axis evaluated by the SAH. */
+#define CVEC_BVH_BINS 16
+
+/* Ranges of at most this many primitives become leaves. */
+#define CVEC_BVH_LEAF_SIZE 4
+
+/* Below this depth SAH splits are replaced by median splits. */
+#define CVEC_BVH_MAX_DEPTH 32
+
+/* Subtrees smaller than this are never handed to another thread. */
+#define CVEC_BVH_PARALLEL_MIN 4096
+
+/* Traversal stack size, enough for the depth bound above. */
+#define CVEC_BVH_STACK_SIZE (2 * CVEC_BVH_MAX_DEPTH * CVEC_BVH_WIDTH)
+
+/*
+ * Child slot k of a node is one of:
+ *  - empty: child[k] == -1, bounds inverted.
+ *  - inner: count[k] == 0, child[k] is a node index.
+ *  - leaf: count[k] > 0, child[k] is the first entry in bvh.prims.
+ */
+typedef struct bvh_node {
+    float min_x[CVEC_BVH_WIDTH];
+    float min_y[CVEC_BVH_WIDTH];
+    float min_z[CVEC_BVH_WIDTH];
+    float max_x[CVEC_BVH_WIDTH];
+    float max_y[CVEC_BVH_WIDTH];
+    float max_z[CVEC_BVH_WIDTH];
+    int child[CVEC_BVH_WIDTH];
+    int count[CVEC_BVH_WIDTH];
+} bvh_node;
+
+typedef struct bvh {
+    bvh_node *nodes;
+    int num_nodes;
+    int *prims;
+    int num_prims;
+    aabb bounds;
+} bvh;
+
+
+/*
+ * Moller-Trumbore ray/triangle test. Returns the distance along dir, or
+ * INFINITY on a miss.
+ */
+static inline float _bvh_ray_triangle(vec3 origin, vec3 dir, vec3 v0, vec3 v1, vec3 v2)
+{
+    vec3 e1 = vec3_sub(v1, v0);
+    vec3 e2 = vec3_sub(v2, v0);
+    vec3 p = vec3_cross(dir, e2);
+    float det = vec3_dot(e1, p);
+    float inv, u, v, t;
+    vec3 s, q;
+
+    if (det == 0.0f) {
+        return INFINITY;
+    }
+    inv = 1.0f / det;
+    s = vec3_sub(origin, v0);
+    u = vec3_dot(s, p) * inv;
+    if (u < 0.0f || u > 1.0f) {
+        return INFINITY;
+    }
+    q = vec3_cross(s, e1);
+    v = vec3_dot(dir, q) * inv;
+    if (v < 0.0f || u + v > 1.0f) {
+        return INFINITY;
+    }
+    t = vec3_dot(e2, q) * inv;
+    return t >= 0.0f ? t : INFINITY;
+}
+
+/* Kernels, defined below or in libcvec; see CVEC_KERNEL in cvec.h. */
+
+CVEC_KERNEL void bvh_free(bvh *t);
+CVEC_KERNEL int bvh_build(bvh *t, const aabb *boxes, int n, int threads);
+CVEC_KERNEL int bvh_build_triangles(bvh *t, const vec3 *verts, int num_tris, int threads);
+CVEC_KERNEL void bvh_refit(bvh *t, const aabb *boxes);
+CVEC_KERNEL int bvh_refit_triangles(bvh *t, const vec3 *verts);
+CVEC_KERNEL int bvh_query_aabb(const bvh *t, const aabb *boxes, aabb box, int *out, int max_out);
+CVEC_KERNEL int bvh_intersect_ray(const bvh *t, const vec3 *verts, vec3 origin, vec3 dir,
+                                  float tmax, float *t_out);
+
+#if _CVEC_KERNEL_BODY
+
+/* Internal helpers */
+
+struct _bvh_bnode {
+    aabb bounds;
+    int right;
+    int first;
+    int count;
+};
+
+struct _bvh_builder {
+    const aabb *boxes;
+    vec3 *centroids;
+    int *prims;
+    struct _bvh_bnode *bnodes;
+    int spawn_depth;
+    bvh_node *nodes;
+    int num_nodes;
+};
+
+struct _bvh_task {
+    struct _bvh_builder *b;
+    int node;
+    int begin;
+    int end;
+    int depth;
+};
+
+static inline void _bvh_node_set(bvh_node *n, int k, aabb box, int child, int count)
+{
+    n->min_x[k] = box.min.x;
+    n->min_y[k] = box.min.y;
+    n->min_z[k] = box.min.z;
+    n->max_x[k] = box.max.x;
+    n->max_y[k] = box.max.y;
+    n->max_z[k] = box.max.z;
+    n->child[k] = child;
+    n->count[k] = count;
+}
+
+static inline aabb _bvh_node_get(const bvh_node *n, int k)
+{
+    return Aabb(Vec3(n->min_x[k], n->min_y[k], n->min_z[k]),
+                Vec3(n->max_x[k], n->max_y[k], n->max_z[k]));
+}
+
+static inline aabb _bvh_node_bounds(const bvh_node *n)
+{
+    aabb r = aabb_empty();
+    int k;
+    for (k = 0; k < CVEC_BVH_WIDTH; k++) {
+        r = aabb_union(r, _bvh_node_get(n, k));
+    }
+    return r;
+}
+
+static inline float _bvh_axis(vec3 v, int axis)
+{
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+/*
+ * Finds the best binned SAH split of prims[begin, end) and partitions the
+ * range around it. Returns the split point, or -1 if every candidate
+ * leaves one side empty.
+ */
+static inline int _bvh_split_sah(struct _bvh_builder *b, int begin, int end)
+{
+    aabb cbounds = aabb_empty();
+    float best_cost = INFINITY;
+    int best_axis = -1, best_bin = 0;
+    float best_scale = 0, best_min = 0;
+    int axis, i, mid;
+
+    for (i = begin; i < end; i++) {
+        cbounds = aabb_extend(cbounds, b->centroids[b->prims[i]]);
+    }
+
+    for (axis = 0; axis < 3; axis++) {
+        aabb bin_bounds[CVEC_BVH_BINS];
+        int bin_count[CVEC_BVH_BINS];
+        float right_area[CVEC_BVH_BINS];
+        int right_count[CVEC_BVH_BINS];
+        float cmin = _bvh_axis(cbounds.min, axis);
+        float extent = _bvh_axis(cbounds.max, axis) - cmin;
+        float scale;
+        aabb acc;
+        int n;
+
+        if (!(extent > 0)) {
+            continue;
+        }
+        scale = CVEC_BVH_BINS * (1.0f - 1e-6f) / extent;
+
+        for (i = 0; i < CVEC_BVH_BINS; i++) {
+            bin_bounds[i] = aabb_empty();
+            bin_count[i] = 0;
+        }
+
+        for (i = begin; i < end; i++) {
+            int prim = b->prims[i];
+            int bin = (int)((_bvh_axis(b->centroids[prim], axis) - cmin) * scale);
+            if (bin >= CVEC_BVH_BINS) {
+                bin = CVEC_BVH_BINS - 1;
+            }
+            bin_bounds[bin] = aabb_union(bin_bounds[bin], b->boxes[prim]);
+            bin_count[bin]++;
+        }
+
+        /* Sweep from the right, then from the left evaluating each plane. */
+        acc = aabb_empty();
+        n = 0;
+        for (i = CVEC_BVH_BINS - 1; i > 0; i--) {
+            acc = aabb_union(acc, bin_bounds[i]);
+            n += bin_count[i];
+            right_area[i] = aabb_surface_area(acc);
+            right_count[i] = n;
+        }
+
+        acc = aabb_empty();
+        n = 0;
+        for (i = 0; i < CVEC_BVH_BINS - 1; i++) {
+            float cost;
+            acc = aabb_union(acc, bin_bounds[i]);
+            n += bin_count[i];
+            if (n == 0 || right_count[i + 1] == 0) {
+                continue;
+            }
+            cost = aabb_surface_area(acc) * n + right_area[i + 1] * right_count[i + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = i;
+                best_scale = scale;
+                best_min = cmin;
+            }
+        }
+    }
+
+    if (best_axis < 0) {
+        return -1;
+    }
+
+    mid = begin;
+    for (i = begin; i < end; i++) {
+        int prim = b->prims[i];
+        int bin = (int)((_bvh_axis(b->centroids[prim], best_axis) - best_min) * best_scale);
+        if (bin <= best_bin) {
+            b->prims[i] = b->prims[mid];
+            b->prims[mid] = prim;
+            mid++;
+        }
+    }
+
+    return mid;
+}
+
+static inline void _bvh_build_range(struct _bvh_builder *b, int node, int begin, int end, int depth);
+
+static inline void *_bvh_build_thread(void *arg)
+{
+    struct _bvh_task *t = arg;
+    _bvh_build_range(t->b, t->node, t->begin, t->end, t->depth);
+    return NULL;
+}
+
+/*
+ * Binary nodes are indexed so that concurrent subtrees never touch the
+ * same slot: a subtree over k primitives uses at most 2k-1 nodes, so the
+ * left child of node i over [begin, mid) is i+1 and the right child is
+ * i + 2*(mid-begin).
+ */
+static inline void _bvh_build_range(struct _bvh_builder *b, int node, int begin, int end, int depth)
+{
+    struct _bvh_bnode *bn = &b->bnodes[node];
+    aabb bounds = aabb_empty();
+    int i, mid, left, right;
+
+    for (i = begin; i < end; i++) {
+        bounds = aabb_union(bounds, b->boxes[b->prims[i]]);
+    }
+    bn->bounds = bounds;
+
+    if (end - begin <= CVEC_BVH_LEAF_SIZE) {
+        bn->right = -1;
+        bn->first = begin;
+        bn->count = end - begin;
+        return;
+    }
+
+    mid = depth < CVEC_BVH_MAX_DEPTH ? _bvh_split_sah(b, begin, end) : -1;
+    if (mid <= begin || mid >= end) {
+        mid = begin + (end - begin) / 2;
+    }
+
+    left = node + 1;
+    right = node + 2 * (mid - begin);
+    bn->right = right;
+    bn->first = begin;
+    bn->count = 0;
+
+    if (depth < b->spawn_depth && end - begin >= CVEC_BVH_PARALLEL_MIN) {
+        struct _bvh_task task;
+        pthread_t thread;
+        task.b = b;
+        task.node = left;
+        task.begin = begin;
+        task.end = mid;
+        task.depth = depth + 1;
+        if (pthread_create(&thread, NULL, _bvh_build_thread, &task) == 0) {
+            _bvh_build_range(b, right, mid, end, depth + 1);
+            pthread_join(thread, NULL);
+            return;
+        }
+    }
+
+    _bvh_build_range(b, left, begin, mid, depth + 1);
+    _bvh_build_range(b, right, mid, end, depth + 1);
+}
+
+/*
+ * Collapses the binary subtree below bnode into wide node out. Slots are
+ * filled by repeatedly opening the inner child with the largest surface
+ * area until the node is full.
+ */
+static inline void _bvh_collapse(struct _bvh_builder *b, int bnode, int out)
+{
+    int slots[CVEC_BVH_WIDTH];
+    int num_slots = 2;
+    int k;
+
+    slots[0] = bnode + 1;
+    slots[1] = b->bnodes[bnode].right;
+
+    while (num_slots < CVEC_BVH_WIDTH) {
+        int best = -1;
+        float best_area = -1;
+        for (k = 0; k < num_slots; k++) {
+            const struct _bvh_bnode *c = &b->bnodes[slots[k]];
+            float area = aabb_surface_area(c->bounds);
+            if (c->count == 0 && area > best_area) {
+                best = k;
+                best_area = area;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        slots[num_slots++] = b->bnodes[slots[best]].right;
+        slots[best] = slots[best] + 1;
+    }
+
+    for (k = 0; k < CVEC_BVH_WIDTH; k++) {
+        if (k < num_slots) {
+            const struct _bvh_bnode *c = &b->bnodes[slots[k]];
+            if (c->count > 0) {
+                _bvh_node_set(&b->nodes[out], k, c->bounds, c->first, c->count);
+            } else {
+                int child = b->num_nodes++;
+                _bvh_node_set(&b->nodes[out], k, c->bounds, child, 0);
+                _bvh_collapse(b, slots[k], child);
+            }
+        } else {
+            _bvh_node_set(&b->nodes[out], k, aabb_empty(), -1, 0);
+        }
+    }
+}
+
+
+/* Public API */
+
+CVEC_KERNEL void bvh_free(bvh *t)
+{
+    free(t->nodes);
+    free(t->prims);
+    t->nodes = NULL;
+    t->prims = NULL;
+    t->num_nodes = 0;
+    t->num_prims = 0;
+}
+
+/*
+ * Builds a BVH over n boxes using up to 'threads' threads. The tree refers
+ * to primitives by their index in 'boxes'.
+ */
+CVEC_KERNEL int bvh_build(bvh *t, const aabb *boxes, int n, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    struct _bvh_builder b;
+    int i, k;
+
+    memset(t, 0, sizeof(*t));
+    memset(&b, 0, sizeof(b));
+
+    b.boxes = boxes;
+    b.prims = malloc(sizeof(int) * (n > 0 ? n : 1));
+    b.centroids = malloc(sizeof(vec3) * (n > 0 ? n : 1));
+    b.bnodes = malloc(sizeof(struct _bvh_bnode) * (n > 0 ? 2*n : 1));
+    b.nodes = malloc(sizeof(bvh_node) * (n > 0 ? n : 1));
+    if (!b.prims || !b.centroids || !b.bnodes || !b.nodes) {
+        free(b.prims);
+        free(b.centroids);
+        free(b.bnodes);
+        free(b.nodes);
+        CVEC_PROFILE_END(n);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        b.prims[i] = i;
+        b.centroids[i] = aabb_center(boxes[i]);
+    }
+
+    for (b.spawn_depth = 0; (1 << b.spawn_depth) < threads; b.spawn_depth++);
+
+    b.num_nodes = 1;
+    if (n == 0) {
+        for (k = 0; k < CVEC_BVH_WIDTH; k++) {
+            _bvh_node_set(&b.nodes[0], k, aabb_empty(), -1, 0);
+        }
+    } else {
+        _bvh_build_range(&b, 0, 0, n, 0);
+        if (b.bnodes[0].count > 0) {
+            /* The whole input fits in one leaf. */
+            _bvh_node_set(&b.nodes[0], 0, b.bnodes[0].bounds, 0, n);
+            for (k = 1; k < CVEC_BVH_WIDTH; k++) {
+                _bvh_node_set(&b.nodes[0], k, aabb_empty(), -1, 0);
+            }
+        } else {
+            _bvh_collapse(&b, 0, 0);
+        }
+    }
+
+    free(b.centroids);
+    free(b.bnodes);
+
+    t->nodes = realloc(b.nodes, sizeof(bvh_node) * b.num_nodes);
+    if (!t->nodes) {
+        t->nodes = b.nodes;
+    }
+    t->num_nodes = b.num_nodes;
+    t->prims = b.prims;
+    t->num_prims = n;
+    t->bounds = _bvh_node_bounds(&t->nodes[0]);
+    CVEC_PROFILE_END(n);
+    return 0;
+}
+
+static inline aabb _bvh_triangle_bounds(const vec3 *verts, int i)
+{
+    return aabb_extend(aabb_extend(Aabb(verts[3*i], verts[3*i]), verts[3*i+1]), verts[3*i+2]);
+}
+
+CVEC_KERNEL int bvh_build_triangles(bvh *t, const vec3 *verts, int num_tris, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    aabb *boxes = malloc(sizeof(aabb) * (num_tris > 0 ? num_tris : 1));
+    int i, ret;
+
+    if (!boxes) {
+        CVEC_PROFILE_END(num_tris);
+        return -1;
+    }
+    for (i = 0; i < num_tris; i++) {
+        boxes[i] = _bvh_triangle_bounds(verts, i);
+    }
+    ret = bvh_build(t, boxes, num_tris, threads);
+    free(boxes);
+    CVEC_PROFILE_END(num_tris);
+    return ret;
+}
+
+/*
+ * Recomputes all bounds from updated primitive boxes, keeping the tree
+ * topology. Much cheaper than a rebuild, but the tree quality degrades if
+ * primitives move far from where they were at build time.
+ */
+CVEC_KERNEL void bvh_refit(bvh *t, const aabb *boxes)
+{
+    CVEC_PROFILE_BEGIN();
+    int i, k, j;
+
+    for (i = t->num_nodes - 1; i >= 0; i--) {
+        bvh_node *n = &t->nodes[i];
+        for (k = 0; k < CVEC_BVH_WIDTH; k++) {
+            aabb box;
+            if (n->child[k] < 0) {
+                continue;
+            } else if (n->count[k] > 0) {
+                box = aabb_empty();
+                for (j = n->child[k]; j < n->child[k] + n->count[k]; j++) {
+                    box = aabb_union(box, boxes[t->prims[j]]);
+                }
+            } else {
+                box = _bvh_node_bounds(&t->nodes[n->child[k]]);
+            }
+            _bvh_node_set(n, k, box, n->child[k], n->count[k]);
+        }
+    }
+
+    t->bounds = _bvh_node_bounds(&t->nodes[0]);
+    CVEC_PROFILE_END(t->num_prims);
+}
+
+CVEC_KERNEL int bvh_refit_triangles(bvh *t, const vec3 *verts)
+{
+    CVEC_PROFILE_BEGIN();
+    aabb *boxes = malloc(sizeof(aabb) * (t->num_prims > 0 ? t->num_prims : 1));
+    int i;
+
+    if (!boxes) {
+        CVEC_PROFILE_END(t->num_prims);
+        return -1;
+    }
+    for (i = 0; i < t->num_prims; i++) {
+        boxes[i] = _bvh_triangle_bounds(verts, i);
+    }
+    bvh_refit(t, boxes);
+    free(boxes);
+    CVEC_PROFILE_END(t->num_prims);
+    return 0;
+}
+
+/*
+ * Finds primitives whose boxes overlap 'box'. Up to max_out indices are
+ * written to 'out'; the return value is the total number found. If
+ * 'boxes' is NULL every primitive in an overlapping leaf is reported,
+ * which callers doing their own exact test may prefer.
+ */
+CVEC_KERNEL int bvh_query_aabb(const bvh *t, const aabb *boxes, aabb box, int *out, int max_out)
+{
+    CVEC_PROFILE_BEGIN();
+    int stack[CVEC_BVH_STACK_SIZE];
+    int sp = 0, found = 0;
+    int k, j;
+
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const bvh_node *n = &t->nodes[stack[--sp]];
+        int hit[CVEC_BVH_WIDTH];
+
+        for (k = 0; k < CVEC_BVH_WIDTH; k++) {
+            hit[k] = n->min_x[k] <= box.max.x && n->max_x[k] >= box.min.x &&
+                     n->min_y[k] <= box.max.y && n->max_y[k] >= box.min.y &&
+                     n->min_z[k] <= box.max.z && n->max_z[k] >= box.min.z;
+        }
+
+        for (k = 0; k < CVEC_BVH_WIDTH; k++) {
+            if (!hit[k]) {
+                continue;
+            } else if (n->count[k] > 0) {
+                for (j = n->child[k]; j < n->child[k] + n->count[k]; j++) {
+                    if (boxes && !aabb_overlaps(boxes[t->prims[j]], box)) {
+                        continue;
+                    }
+                    if (found < max_out) {
+                        out[found] = t->prims[j];
+                    }
+                    found++;
+                }
+            } else {
+                stack[sp++] = n->child[k];
+            }
+        }
+    }
+
+    CVEC_PROFILE_END(1);
+    return found;
+}
+
+/*
+ * Finds the nearest triangle hit by the ray origin + t*dir with
+ * 0 <= t < tmax. Returns the triangle index and stores t in *t_out, or
+ * returns -1 if nothing was hit.
+ */
+CVEC_KERNEL int bvh_intersect_ray(const bvh *t, const vec3 *verts, vec3 origin, vec3 dir,
+                                  float tmax, float *t_out)
+{
+    CVEC_PROFILE_BEGIN();
+    int stack[CVEC_BVH_STACK_SIZE];
+    int sp = 0, best = -1;
+    float best_t = tmax;
+    vec3 inv = Vec3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+    int k, j;
+
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const bvh_node *n = &t->nodes[stack[--sp]];
+        float tnear[CVEC_BVH_WIDTH];
+        int hit[CVEC_BVH_WIDTH];
+        int order[CVEC_BVH_WIDTH];
+        int num_hit = 0;
+
+        for (k = 0; k < CVEC_BVH_WIDTH; k++) {
+            float tx0 = (n->min_x[k] - origin.x) * inv.x;
+            float tx1 = (n->max_x[k] - origin.x) * inv.x;
+            float ty0 = (n->min_y[k] - origin.y) * inv.y;
+            float ty1 = (n->max_y[k] - origin.y) * inv.y;
+            float tz0 = (n->min_z[k] - origin.z) * inv.z;
+            float tz1 = (n->max_z[k] - origin.z) * inv.z;
+            float t0 = fmaxf(fmaxf(fminf(tx0, tx1), fminf(ty0, ty1)), fmaxf(fminf(tz0, tz1), 0.0f));
+            float t1 = fminf(fminf(fmaxf(tx0, tx1), fmaxf(ty0, ty1)), fminf(fmaxf(tz0, tz1), best_t));
+            tnear[k] = t0;
+            hit[k] = t0 <= t1 && n->child[k] >= 0;
+        }
+
+        /* Sort the children hit far to near. */
+        for (k = 0; k < CVEC_BVH_WIDTH; k++) {
+            if (hit[k]) {
+                int m = num_hit++;
+                while (m > 0 && tnear[order[m-1]] < tnear[k]) {
+                    order[m] = order[m-1];
+                    m--;
+                }
+                order[m] = k;
+            }
+        }
+
+        /*
+         * Test leaves nearest first, so that a close hit shrinks best_t
+         * before the farther leaves are reached, and skip those beyond it.
+         */
+        for (j = num_hit - 1; j >= 0; j--) {
+            k = order[j];
+            if (n->count[k] > 0 && tnear[k] <= best_t) {
+                int p;
+                for (p = n->child[k]; p < n->child[k] + n->count[k]; p++) {
+                    int tri = t->prims[p];
+                    float d = _bvh_ray_triangle(origin, dir, verts[3*tri], verts[3*tri+1], verts[3*tri+2]);
+                    if (d < best_t) {
+                        best_t = d;
+                        best = tri;
+                    }
+                }
+            }
+        }
+
+        /* Push inner children far first so the nearest is popped next. */
+        for (j = 0; j < num_hit; j++) {
+            k = order[j];
+            if (n->count[k] == 0 && tnear[k] <= best_t) {
+                stack[sp++] = n->child[k];
+            }
+        }
+    }
+
+    if (best >= 0 && t_out) {
+        *t_out = best_t;
+    }
+    CVEC_PROFILE_END(1);
+    return best;
+}
+
+#endif /* _CVEC_KERNEL_BODY */
+
+#endif
@@ -0,0 +1,450 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_COMMAND_H
+#define CVEC_COMMAND_H
+
+/*
+ * Command buffers: record many small vector and matrix operations one
+ * call at a time and run them later as batches.
+ *
+ * The operands live in the buffer and are named by handles, which are
+ * indices into its mat4 and vec4 arrays. Recording a command only
+ * appends it. cvec_cmdbuf_execute() then groups the commands by
+ * operation and runs each group as one tight loop, with no dispatch or
+ * dependency checks between commands. It spreads the groups, in chunks
+ * of CVEC_CMDBUF_CHUNK commands, over up to 'threads' threads.
+ *
+ * Results are the same as running the commands in the order they were
+ * recorded. Each command is put on a level just after the last command
+ * it depends on: the last write of a handle it reads, and the last read
+ * or write of the handle it writes. Commands on one level are
+ * independent, so they can be reordered freely. Levels run in order.
+ *
+ *   cvec_cmdbuf b;
+ *   cvec_cmdbuf_init(&b);
+ *   m = cvec_cmdbuf_new_mat4(&b, &model);
+ *   v = cvec_cmdbuf_new_vec4(&b, Vec4(0, 0, 0, 1));
+ *   cvec_cmd_mat4_mult(&b, view, m, m);
+ *   cvec_cmd_mat4_transform(&b, m, v, v);
+ *   ...
+ *   cvec_cmdbuf_execute(&b, 4);
+ *   p = *cvec_cmdbuf_vec4(&b, v);
+ *
+ * Functions returning int return 0 on success, or -1 with errno set to
+ * EINVAL for a bad handle or ENOMEM.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cvec.h"
+#include "cvec_parallel.h"
+
+/* Commands per task. */
+#ifndef CVEC_CMDBUF_CHUNK
+#define CVEC_CMDBUF_CHUNK 64
+#elif !_CVEC_KERNEL_BODY
+#error "CVEC_CMDBUF_CHUNK must match libcvec, which uses the default; see CVEC_EXTERN in cvec.h"
+#endif
+
+#define CVEC_HANDLE_NONE UINT32_MAX
+
+typedef uint32_t cvec_handle;
+
+enum {
+    _CVEC_CMD_MAT4_MULT,
+    _CVEC_CMD_MAT4_TRANSFORM,
+    _CVEC_CMD_VEC4_NORMALIZE,
+    _CVEC_CMD_NUM_OPS,
+};
+
+/* key is level * _CVEC_CMD_NUM_OPS + op, the order commands run in. */
+struct _cvec_cmd {
+    uint32_t key;
+    cvec_handle a, b, r;
+};
+
+/* Commands [begin, end) of the sorted array, all with the same op. */
+struct _cvec_cmd_task {
+    size_t begin, end;
+};
+
+/*
+ * Per handle: the level after its last write and after its last read.
+ * Levels are counted across executions, from the buffer's base.
+ */
+struct _cvec_cmd_deps {
+    uint32_t written;
+    uint32_t read;
+};
+
+typedef struct cvec_cmdbuf {
+    mat4 *mats;
+    struct _cvec_cmd_deps *mat_deps;
+    size_t num_mats, mats_cap;
+    vec4 *vecs;
+    struct _cvec_cmd_deps *vec_deps;
+    size_t num_vecs, vecs_cap;
+    struct _cvec_cmd *cmds;
+    size_t num_cmds, cmds_cap;
+    /* Levels below base were executed; recorded commands use base + [0, levels). */
+    uint32_t base, levels;
+    /* Scratch for cvec_cmdbuf_execute(), kept to avoid reallocating. */
+    struct _cvec_cmd *sorted;
+    size_t sorted_cap;
+    size_t *start;
+    size_t start_cap;
+    struct _cvec_cmd_task *tasks;
+    size_t tasks_cap;
+} cvec_cmdbuf;
+
+static inline int _cvec_cmd_grow(void **p, size_t *cap, size_t need, size_t size)
+{
+    size_t n = *cap ? *cap : 64;
+    void *q;
+
+    if (need <= *cap) {
+        return 0;
+    }
+    while (n < need) {
+        n *= 2;
+    }
+    q = realloc(*p, n * size);
+    if (!q) {
+        errno = ENOMEM;
+        return -1;
+    }
+    *p = q;
+    *cap = n;
+    return 0;
+}
+
+static inline void cvec_cmdbuf_init(cvec_cmdbuf *b)
+{
+    memset(b, 0, sizeof(*b));
+}
+
+static inline void cvec_cmdbuf_free(cvec_cmdbuf *b)
+{
+    free(b->mats);
+    free(b->mat_deps);
+    free(b->vecs);
+    free(b->vec_deps);
+    free(b->cmds);
+    free(b->sorted);
+    free(b->start);
+    free(b->tasks);
+    cvec_cmdbuf_init(b);
+}
+
+/* Handles */
+
+/* A new mat4 operand; CVEC_HANDLE_NONE if memory ran out. */
+static inline cvec_handle cvec_cmdbuf_new_mat4(cvec_cmdbuf *b, const mat4 *value)
+{
+    size_t cap = b->mats_cap;
+    if (b->num_mats >= CVEC_HANDLE_NONE ||
+        _cvec_cmd_grow((void **)&b->mats, &cap, b->num_mats + 1, sizeof(mat4)) < 0 ||
+        _cvec_cmd_grow((void **)&b->mat_deps, &b->mats_cap, b->num_mats + 1,
+                       sizeof(struct _cvec_cmd_deps)) < 0) {
+        errno = ENOMEM;
+        return CVEC_HANDLE_NONE;
+    }
+    b->mats[b->num_mats] = *value;
+    b->mat_deps[b->num_mats].written = 0;
+    b->mat_deps[b->num_mats].read = 0;
+    return (cvec_handle)b->num_mats++;
+}
+
+/* A new vec4 operand; CVEC_HANDLE_NONE if memory ran out. */
+static inline cvec_handle cvec_cmdbuf_new_vec4(cvec_cmdbuf *b, vec4 value)
+{
+    size_t cap = b->vecs_cap;
+    if (b->num_vecs >= CVEC_HANDLE_NONE ||
+        _cvec_cmd_grow((void **)&b->vecs, &cap, b->num_vecs + 1, sizeof(vec4)) < 0 ||
+        _cvec_cmd_grow((void **)&b->vec_deps, &b->vecs_cap, b->num_vecs + 1,
+                       sizeof(struct _cvec_cmd_deps)) < 0) {
+        errno = ENOMEM;
+        return CVEC_HANDLE_NONE;
+    }
+    b->vecs[b->num_vecs] = value;
+    b->vec_deps[b->num_vecs].written = 0;
+    b->vec_deps[b->num_vecs].read = 0;
+    return (cvec_handle)b->num_vecs++;
+}
+
+/*
+ * The operand's storage, to read results after cvec_cmdbuf_execute() or
+ * to set inputs before it. Valid until the next handle is created.
+ */
+static inline mat4 *cvec_cmdbuf_mat4(const cvec_cmdbuf *b, cvec_handle h)
+{
+    return &b->mats[h];
+}
+
+static inline vec4 *cvec_cmdbuf_vec4(const cvec_cmdbuf *b, cvec_handle h)
+{
+    return &b->vecs[h];
+}
+
+/* Recording */
+
+static inline uint32_t _cvec_cmd_max(uint32_t a, uint32_t b)
+{
+    return a > b ? a : b;
+}
+
+/* Appends a command reading x (and y) and writing r; NULL deps are unused. */
+static inline int _cvec_cmd_record(cvec_cmdbuf *b, uint32_t op, cvec_handle x, cvec_handle y,
+                                   cvec_handle r, struct _cvec_cmd_deps *dx,
+                                   struct _cvec_cmd_deps *dy, struct _cvec_cmd_deps *dr)
+{
+    struct _cvec_cmd *c;
+    uint32_t level;
+
+    if (_cvec_cmd_grow((void **)&b->cmds, &b->cmds_cap, b->num_cmds + 1, sizeof(*c)) < 0) {
+        return -1;
+    }
+    level = _cvec_cmd_max(dx->written, _cvec_cmd_max(dr->written, dr->read));
+    if (dy) {
+        level = _cvec_cmd_max(level, dy->written);
+    }
+    level = _cvec_cmd_max(level, b->base);
+    if (level - b->base >= UINT32_MAX / _CVEC_CMD_NUM_OPS) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    dx->read = _cvec_cmd_max(dx->read, level + 1);
+    if (dy) {
+        dy->read = _cvec_cmd_max(dy->read, level + 1);
+    }
+    dr->written = level + 1;
+    b->levels = _cvec_cmd_max(b->levels, level + 1 - b->base);
+
+    c = &b->cmds[b->num_cmds++];
+    c->key = (level - b->base) * _CVEC_CMD_NUM_OPS + op;
+    c->a = x;
+    c->b = y;
+    c->r = r;
+    return 0;
+}
+
+static inline int _cvec_cmd_check(size_t count, cvec_handle h)
+{
+    if (h >= count) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* r = a * c. r may be a or c. */
+static inline int cvec_cmd_mat4_mult(cvec_cmdbuf *b, cvec_handle a, cvec_handle c, cvec_handle r)
+{
+    if (_cvec_cmd_check(b->num_mats, a) < 0 || _cvec_cmd_check(b->num_mats, c) < 0 ||
+        _cvec_cmd_check(b->num_mats, r) < 0) {
+        return -1;
+    }
+    return _cvec_cmd_record(b, _CVEC_CMD_MAT4_MULT, a, c, r,
+                            &b->mat_deps[a], &b->mat_deps[c], &b->mat_deps[r]);
+}
+
+/* Vector r = m * vector v. r may be v. */
+static inline int cvec_cmd_mat4_transform(cvec_cmdbuf *b, cvec_handle m, cvec_handle v, cvec_handle r)
+{
+    if (_cvec_cmd_check(b->num_mats, m) < 0 || _cvec_cmd_check(b->num_vecs, v) < 0 ||
+        _cvec_cmd_check(b->num_vecs, r) < 0) {
+        return -1;
+    }
+    return _cvec_cmd_record(b, _CVEC_CMD_MAT4_TRANSFORM, m, v, r,
+                            &b->mat_deps[m], &b->vec_deps[v], &b->vec_deps[r]);
+}
+
+/* r = vec4_normalize(v). r may be v. */
+static inline int cvec_cmd_vec4_normalize(cvec_cmdbuf *b, cvec_handle v, cvec_handle r)
+{
+    if (_cvec_cmd_check(b->num_vecs, v) < 0 || _cvec_cmd_check(b->num_vecs, r) < 0) {
+        return -1;
+    }
+    return _cvec_cmd_record(b, _CVEC_CMD_VEC4_NORMALIZE, v, CVEC_HANDLE_NONE, r,
+                            &b->vec_deps[v], NULL, &b->vec_deps[r]);
+}
+
+/* Execution */
+
+/* Defined below or in libcvec; see CVEC_KERNEL in cvec.h. */
+CVEC_KERNEL int cvec_cmdbuf_execute(cvec_cmdbuf *b, int threads);
+
+#if _CVEC_KERNEL_BODY
+
+struct _cvec_cmd_ctx {
+    cvec_cmdbuf *buf;
+    const struct _cvec_cmd *cmds;
+    const struct _cvec_cmd_task *tasks;
+};
+
+/* Column j of r is a times column j of c: four-wide, so it vectorizes. */
+static inline void _cvec_cmd_mult4(const float *restrict a, const float *restrict c, float *restrict r)
+{
+    int i, j, k;
+    for (j = 0; j < 4; j++) {
+        for (i = 0; i < 4; i++) {
+            r[i + 4*j] = a[i] * c[4*j];
+        }
+        for (k = 1; k < 4; k++) {
+            for (i = 0; i < 4; i++) {
+                r[i + 4*j] += a[i + 4*k] * c[k + 4*j];
+            }
+        }
+    }
+}
+
+static inline void _cvec_cmd_mat4_mult(cvec_cmdbuf *b, const struct _cvec_cmd *cmds, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        mat4 r;
+        _cvec_cmd_mult4(b->mats[cmds[i].a].data, b->mats[cmds[i].b].data, r.data);
+        b->mats[cmds[i].r] = r;
+    }
+}
+
+static inline void _cvec_cmd_mat4_transform(cvec_cmdbuf *b, const struct _cvec_cmd *cmds, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        b->vecs[cmds[i].r] = mat4_transform(&b->mats[cmds[i].a], b->vecs[cmds[i].b]);
+    }
+}
+
+static inline void _cvec_cmd_vec4_normalize(cvec_cmdbuf *b, const struct _cvec_cmd *cmds, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        b->vecs[cmds[i].r] = vec4_normalize(b->vecs[cmds[i].a]);
+    }
+}
+
+static inline void _cvec_cmd_run(void *arg, size_t begin, size_t end)
+{
+    struct _cvec_cmd_ctx *c = arg;
+    size_t t;
+
+    for (t = begin; t < end; t++) {
+        const struct _cvec_cmd *cmds = c->cmds + c->tasks[t].begin;
+        size_t n = c->tasks[t].end - c->tasks[t].begin;
+        switch (cmds[0].key % _CVEC_CMD_NUM_OPS) {
+        case _CVEC_CMD_MAT4_MULT:
+            _cvec_cmd_mat4_mult(c->buf, cmds, n);
+            break;
+        case _CVEC_CMD_MAT4_TRANSFORM:
+            _cvec_cmd_mat4_transform(c->buf, cmds, n);
+            break;
+        case _CVEC_CMD_VEC4_NORMALIZE:
+            _cvec_cmd_vec4_normalize(c->buf, cmds, n);
+            break;
+        }
+    }
+}
+
+/*
+ * Runs and then clears the recorded commands, using up to 'threads'
+ * threads. Handles and their values are kept. On failure nothing has
+ * run and the commands stay recorded.
+ */
+CVEC_KERNEL int cvec_cmdbuf_execute(cvec_cmdbuf *b, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t n = b->num_cmds, buckets = (size_t)b->levels * _CVEC_CMD_NUM_OPS;
+    const struct _cvec_cmd *cmds = b->cmds;
+    size_t *start;
+    struct _cvec_cmd *sorted;
+    struct _cvec_cmd_task *tasks;
+    struct _cvec_cmd_ctx ctx;
+    size_t i, k, num_tasks = 0;
+    uint32_t level;
+
+    if (_cvec_cmd_grow((void **)&b->start, &b->start_cap, buckets + 1, sizeof(size_t)) < 0 ||
+        _cvec_cmd_grow((void **)&b->sorted, &b->sorted_cap, n, sizeof(*sorted)) < 0 ||
+        _cvec_cmd_grow((void **)&b->tasks, &b->tasks_cap, n + buckets, sizeof(*tasks)) < 0) {
+        CVEC_PROFILE_END(n);
+        return -1;
+    }
+    start = b->start;
+    sorted = b->sorted;
+    tasks = b->tasks;
+    memset(start, 0, sizeof(size_t) * (buckets + 1));
+
+    /* Stable counting sort by (level, op). */
+    for (i = 0; i < n; i++) {
+        start[cmds[i].key + 1]++;
+    }
+    for (k = 0; k < buckets; k++) {
+        start[k + 1] += start[k];
+    }
+    for (i = 0; i < n; i++) {
+        sorted[start[cmds[i].key]++] = cmds[i];
+    }
+    /* start[k] is now the end of bucket k. */
+
+    ctx.buf = b;
+    ctx.cmds = sorted;
+    ctx.tasks = tasks;
+    for (level = 0; level < b->levels; level++) {
+        size_t first = num_tasks;
+        for (k = level * _CVEC_CMD_NUM_OPS; k < (level + 1) * (size_t)_CVEC_CMD_NUM_OPS; k++) {
+            size_t begin = k ? start[k - 1] : 0;
+            for (i = begin; i < start[k]; i += CVEC_CMDBUF_CHUNK) {
+                tasks[num_tasks].begin = i;
+                tasks[num_tasks].end = start[k] - i < CVEC_CMDBUF_CHUNK ? start[k] : i + CVEC_CMDBUF_CHUNK;
+                num_tasks++;
+            }
+        }
+        ctx.tasks = tasks + first;
+        cvec_parallel_for(num_tasks - first, 1, threads, _cvec_cmd_run, &ctx);
+    }
+
+    /* Older levels compare below the new base, so no per-handle reset. */
+    b->base += b->levels;
+    if (b->base >= UINT32_MAX / 2) {
+        for (i = 0; i < b->num_mats; i++) {
+            b->mat_deps[i].written = b->mat_deps[i].read = 0;
+        }
+        for (i = 0; i < b->num_vecs; i++) {
+            b->vec_deps[i].written = b->vec_deps[i].read = 0;
+        }
+        b->base = 0;
+    }
+    b->num_cmds = 0;
+    b->levels = 0;
+
+    CVEC_PROFILE_END(n);
+    return 0;
+}
+
+#endif /* _CVEC_KERNEL_BODY */
+
+#endif
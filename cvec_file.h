@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_FILE_H
+#define CVEC_FILE_H
+
+/*
+ * Binary container for arrays of cvec types, designed to be mmapped.
+ *
+ * A file is a 64 byte header followed by the element data, which starts
+ * at header_size bytes (a multiple of CVEC_FILE_ALIGN). In AoS layout the
+ * data is simply count elements back to back. In SoA layout it is one
+ * stream of count floats per component (x, y, z, w for vectors, the
+ * column-major data[] index for matrices), each stream starting at a
+ * multiple of CVEC_FILE_ALIGN bytes, stream_stride bytes apart.
+ *
+ * Files are written in native byte order. A reader on a machine with the
+ * other byte order sees a wrong version number and rejects the file.
+ *
+ * cvec_file_open() maps the file read-only and validates the header. The
+ * accessors then return pointers straight into the mapping, so opening a
+ * file costs the same regardless of its size and pages are read in as
+ * the batch kernels touch them.
+ *
+ * Functions returning int return 0 on success and -1 with errno set on
+ * failure (EINVAL for a malformed file or mismatched type).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cvec.h"
+
+#define CVEC_FILE_MAGIC "CVECARR"
+#define CVEC_FILE_VERSION 1
+#define CVEC_FILE_ALIGN 64
+
+enum cvec_type {
+    CVEC_TYPE_VEC2 = 1,
+    CVEC_TYPE_VEC3 = 2,
+    CVEC_TYPE_VEC4 = 3,
+    CVEC_TYPE_MAT2 = 4,
+    CVEC_TYPE_MAT3 = 5,
+    CVEC_TYPE_MAT4 = 6,
+};
+
+enum cvec_layout {
+    CVEC_LAYOUT_AOS = 0,
+    CVEC_LAYOUT_SOA = 1,
+};
+
+typedef struct cvec_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t type;
+    uint32_t layout;
+    uint32_t header_size;
+    uint64_t count;
+    uint64_t stream_stride;
+    float bounds_min[3];
+    float bounds_max[3];
+} cvec_file_header;
+
+typedef struct cvec_file {
+    cvec_file_header header;
+    void *map;
+    size_t map_size;
+    const unsigned char *data;
+} cvec_file;
+
+/* Number of floats in one element of the given type, or 0 if unknown. */
+static inline int cvec_type_components(int type)
+{
+    switch (type) {
+    case CVEC_TYPE_VEC2: return 2;
+    case CVEC_TYPE_VEC3: return 3;
+    case CVEC_TYPE_VEC4: return 4;
+    case CVEC_TYPE_MAT2: return 4;
+    case CVEC_TYPE_MAT3: return 9;
+    case CVEC_TYPE_MAT4: return 16;
+    default: return 0;
+    }
+}
+
+static inline uint64_t _cvec_file_align(uint64_t n)
+{
+    return (n + CVEC_FILE_ALIGN - 1) & ~(uint64_t)(CVEC_FILE_ALIGN - 1);
+}
+
+static inline int _cvec_file_pad(FILE *fp, uint64_t n)
+{
+    static const unsigned char zero[CVEC_FILE_ALIGN];
+    return n == 0 || fwrite(zero, n, 1, fp) == 1 ? 0 : -1;
+}
+
+/*
+ * Writes count elements of 'type' from the AoS array 'data' to 'path' in
+ * the requested layout. If bounds is NULL the bounds of vector elements
+ * are computed (z = 0 for vec2); matrix files get empty bounds.
+ */
+static inline int cvec_file_write(const char *path, int type, int layout,
+                                  const void *data, size_t count, const aabb *bounds)
+{
+    const float *src = data;
+    int ncomp = cvec_type_components(type);
+    cvec_file_header h;
+    aabb b = aabb_empty();
+    FILE *fp;
+    size_t i;
+    int c, err = 0;
+
+    if (ncomp == 0 || (layout != CVEC_LAYOUT_AOS && layout != CVEC_LAYOUT_SOA)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (bounds) {
+        b = *bounds;
+    } else if (type == CVEC_TYPE_VEC2 || type == CVEC_TYPE_VEC3 || type == CVEC_TYPE_VEC4) {
+        for (i = 0; i < count; i++) {
+            const float *e = src + i * ncomp;
+            b = aabb_extend(b, Vec3(e[0], e[1], ncomp > 2 ? e[2] : 0.0f));
+        }
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CVEC_FILE_MAGIC, sizeof(CVEC_FILE_MAGIC));
+    h.version = CVEC_FILE_VERSION;
+    h.type = type;
+    h.layout = layout;
+    h.header_size = (uint32_t)_cvec_file_align(sizeof(h));
+    h.count = count;
+    h.stream_stride = layout == CVEC_LAYOUT_SOA ? _cvec_file_align(sizeof(float) * count) : 0;
+    h.bounds_min[0] = b.min.x;
+    h.bounds_min[1] = b.min.y;
+    h.bounds_min[2] = b.min.z;
+    h.bounds_max[0] = b.max.x;
+    h.bounds_max[1] = b.max.y;
+    h.bounds_max[2] = b.max.z;
+
+    fp = fopen(path, "wb");
+    if (!fp) {
+        return -1;
+    }
+
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 || _cvec_file_pad(fp, h.header_size - sizeof(h)) < 0) {
+        err = -1;
+    } else if (layout == CVEC_LAYOUT_AOS) {
+        if (count > 0 && fwrite(src, sizeof(float) * ncomp, count, fp) != count) {
+            err = -1;
+        }
+    } else {
+        float buf[1024];
+        for (c = 0; c < ncomp && err == 0; c++) {
+            size_t done = 0;
+            while (done < count && err == 0) {
+                size_t n = count - done < 1024 ? count - done : 1024;
+                for (i = 0; i < n; i++) {
+                    buf[i] = src[(done + i) * ncomp + c];
+                }
+                if (fwrite(buf, sizeof(float), n, fp) != n) {
+                    err = -1;
+                }
+                done += n;
+            }
+            if (err == 0 && c < ncomp - 1) {
+                err = _cvec_file_pad(fp, h.stream_stride - sizeof(float) * count);
+            }
+        }
+    }
+
+    if (fclose(fp) != 0) {
+        err = -1;
+    }
+    return err;
+}
+
+static inline void cvec_file_close(cvec_file *f)
+{
+    if (f->map) {
+        munmap(f->map, f->map_size);
+    }
+    memset(f, 0, sizeof(*f));
+}
+
+/* Maps 'path' read-only and validates its header. */
+static inline int cvec_file_open(cvec_file *f, const char *path)
+{
+    const cvec_file_header *h;
+    struct stat st;
+    uint64_t ncomp, avail;
+    int fd;
+
+    memset(f, 0, sizeof(*f));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if ((uint64_t)st.st_size < sizeof(cvec_file_header)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    f->map_size = st.st_size;
+    f->map = mmap(NULL, f->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (f->map == MAP_FAILED) {
+        f->map = NULL;
+        return -1;
+    }
+
+    h = f->map;
+    ncomp = cvec_type_components(h->type);
+    avail = f->map_size - h->header_size;
+
+    if (memcmp(h->magic, CVEC_FILE_MAGIC, sizeof(CVEC_FILE_MAGIC)) != 0 ||
+        h->version != CVEC_FILE_VERSION ||
+        ncomp == 0 ||
+        (h->layout != CVEC_LAYOUT_AOS && h->layout != CVEC_LAYOUT_SOA) ||
+        h->header_size < sizeof(*h) || h->header_size % CVEC_FILE_ALIGN != 0 ||
+        h->header_size > f->map_size ||
+        h->count > avail / (sizeof(float) * ncomp) ||
+        (h->layout == CVEC_LAYOUT_SOA &&
+         (h->stream_stride % CVEC_FILE_ALIGN != 0 ||
+          h->stream_stride < sizeof(float) * h->count ||
+          h->stream_stride > avail ||
+          h->stream_stride * (ncomp - 1) + sizeof(float) * h->count > avail))) {
+        cvec_file_close(f);
+        errno = EINVAL;
+        return -1;
+    }
+
+    f->header = *h;
+    f->data = (const unsigned char *)f->map + h->header_size;
+    return 0;
+}
+
+static inline size_t cvec_file_count(const cvec_file *f)
+{
+    return (size_t)f->header.count;
+}
+
+static inline aabb cvec_file_bounds(const cvec_file *f)
+{
+    return Aabb(Vec3(f->header.bounds_min[0], f->header.bounds_min[1], f->header.bounds_min[2]),
+                Vec3(f->header.bounds_max[0], f->header.bounds_max[1], f->header.bounds_max[2]));
+}
+
+/*
+ * Returns a pointer to the AoS element array if the file holds 'type' in
+ * AoS layout, otherwise NULL.
+ */
+static inline const void *cvec_file_aos(const cvec_file *f, int type)
+{
+    if (f->header.type != (uint32_t)type || f->header.layout != CVEC_LAYOUT_AOS) {
+        return NULL;
+    }
+    return f->data;
+}
+
+/*
+ * Returns the stream for one component of an SoA file, or NULL if the
+ * file is not SoA or the component is out of range.
+ */
+static inline const float *cvec_file_stream(const cvec_file *f, int component)
+{
+    if (f->header.layout != CVEC_LAYOUT_SOA || component < 0 ||
+        component >= cvec_type_components(f->header.type)) {
+        return NULL;
+    }
+    return (const float *)(f->data + f->header.stream_stride * component);
+}
+
+static inline const vec2 *cvec_file_vec2(const cvec_file *f) { return cvec_file_aos(f, CVEC_TYPE_VEC2); }
+static inline const vec3 *cvec_file_vec3(const cvec_file *f) { return cvec_file_aos(f, CVEC_TYPE_VEC3); }
+static inline const vec4 *cvec_file_vec4(const cvec_file *f) { return cvec_file_aos(f, CVEC_TYPE_VEC4); }
+static inline const mat2 *cvec_file_mat2(const cvec_file *f) { return cvec_file_aos(f, CVEC_TYPE_MAT2); }
+static inline const mat3 *cvec_file_mat3(const cvec_file *f) { return cvec_file_aos(f, CVEC_TYPE_MAT3); }
+static inline const mat4 *cvec_file_mat4(const cvec_file *f) { return cvec_file_aos(f, CVEC_TYPE_MAT4); }
+
+#endif
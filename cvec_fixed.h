@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_FIXED_H
+#define CVEC_FIXED_H
+
+/*
+ * Fixed-point vectors and matrices for targets without a fast FPU and for
+ * simulations that need bit-identical results on every machine.
+ *
+ * Two formats are provided, Q16.16 (q16, int32_t) and Q32.32 (q32,
+ * int64_t). Each has the same vector and matrix API as the float types
+ * with a q16/q32 prefix: q16vec3_add(), q32mat4_mult(), Q16Vec3(), and so
+ * on. Both are generated from cvec_fixed_template.h.
+ *
+ * All arithmetic is integer-only, including sqrt, sin and cos, and every
+ * operation rounds the same way on every platform:
+ *
+ *   mul   rounds to nearest, ties toward +infinity
+ *   div   truncates toward zero; division by zero is undefined
+ *   sqrt  truncates; negative inputs return 0
+ *   sin, cos
+ *         absolute error within 2 units in the last place for
+ *         arguments up to a few thousand radians
+ *
+ * Addition and subtraction overflow exactly as the underlying integer
+ * type would (which is undefined behaviour in C), so keep values in range.
+ * The conversions to and from float are the only functions that touch
+ * the FPU.
+ *
+ * Normalizing a zero vector returns it unchanged rather than dividing by
+ * zero.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cvec.h"
+
+typedef int32_t q16;
+typedef int64_t q32;
+
+#define Q16_ONE ((q16)1 << 16)
+#define Q32_ONE ((q32)1 << 32)
+
+
+/* Q16.16 scalars */
+
+static inline q16 q16_from_int(int a)
+{
+    return (q16)a * Q16_ONE;
+}
+
+static inline q16 q16_from_float(float a)
+{
+    return (q16)floor(a * 65536.0 + 0.5);
+}
+
+static inline float q16_to_float(q16 a)
+{
+    return a * (1.0f / 65536.0f);
+}
+
+static inline q16 q16_mul(q16 a, q16 b)
+{
+    return (q16)(((int64_t)a * b + 0x8000) >> 16);
+}
+
+static inline q16 q16_div(q16 a, q16 b)
+{
+    return (q16)(((int64_t)a * 65536) / b);
+}
+
+static inline q16 q16_sqrt(q16 a)
+{
+    uint64_t num = (uint64_t)(a > 0 ? a : 0) << 16;
+    uint64_t res = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while (bit > num) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (num >= res + bit) {
+            num -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (q16)res;
+}
+
+
+/*
+ * Q32.32 scalars
+ *
+ * These need 128-bit intermediates, which are emulated with pairs of
+ * uint64_t so that the results do not depend on compiler support for
+ * __int128.
+ */
+
+typedef struct _q128 {
+    uint64_t hi;
+    uint64_t lo;
+} _q128;
+
+static inline _q128 _q128_mul(uint64_t a, uint64_t b)
+{
+    uint64_t a_lo = a & 0xffffffff, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xffffffff, b_hi = b >> 32;
+    uint64_t ll = a_lo * b_lo;
+    uint64_t lh = a_lo * b_hi;
+    uint64_t hl = a_hi * b_lo;
+    uint64_t hh = a_hi * b_hi;
+    uint64_t mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+    _q128 r;
+    r.lo = (mid << 32) | (ll & 0xffffffff);
+    r.hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return r;
+}
+
+static inline _q128 _q128_neg(_q128 a)
+{
+    a.lo = ~a.lo + 1;
+    a.hi = ~a.hi + (a.lo == 0);
+    return a;
+}
+
+static inline int _q128_ge(_q128 a, _q128 b)
+{
+    return a.hi > b.hi || (a.hi == b.hi && a.lo >= b.lo);
+}
+
+static inline _q128 _q128_add(_q128 a, _q128 b)
+{
+    _q128 r;
+    r.lo = a.lo + b.lo;
+    r.hi = a.hi + b.hi + (r.lo < a.lo);
+    return r;
+}
+
+static inline _q128 _q128_sub(_q128 a, _q128 b)
+{
+    _q128 r;
+    r.lo = a.lo - b.lo;
+    r.hi = a.hi - b.hi - (a.lo < b.lo);
+    return r;
+}
+
+static inline _q128 _q128_shr(_q128 a, int n)
+{
+    if (n >= 64) {
+        a.lo = a.hi >> (n - 64);
+        a.hi = 0;
+    } else if (n > 0) {
+        a.lo = (a.lo >> n) | (a.hi << (64 - n));
+        a.hi >>= n;
+    }
+    return a;
+}
+
+static inline uint64_t _q64_abs(int64_t a)
+{
+    return a < 0 ? 0 - (uint64_t)a : (uint64_t)a;
+}
+
+static inline q32 q32_from_int(int a)
+{
+    return (q32)a * Q32_ONE;
+}
+
+static inline q32 q32_from_float(float a)
+{
+    return (q32)floor(a * 4294967296.0 + 0.5);
+}
+
+static inline q32 q32_from_double(double a)
+{
+    return (q32)floor(a * 4294967296.0 + 0.5);
+}
+
+static inline float q32_to_float(q32 a)
+{
+    return (float)(a * (1.0 / 4294967296.0));
+}
+
+static inline double q32_to_double(q32 a)
+{
+    return a * (1.0 / 4294967296.0);
+}
+
+static inline q32 q32_mul(q32 a, q32 b)
+{
+    _q128 p = _q128_mul(_q64_abs(a), _q64_abs(b));
+    _q128 half = { 0, (uint64_t)1 << 31 };
+    if ((a < 0) != (b < 0)) {
+        p = _q128_neg(p);
+    }
+    /* Two's complement 128-bit product, so this is floor((a*b + 2^31) / 2^32). */
+    p = _q128_add(p, half);
+    return (q32)((p.hi << 32) | (p.lo >> 32));
+}
+
+static inline q32 q32_div(q32 a, q32 b)
+{
+    uint64_t ua = _q64_abs(a), ub = _q64_abs(b);
+    uint64_t num_hi = ua >> 32, num_lo = ua << 32;
+    uint64_t rem = 0, q = 0;
+    int i;
+
+    for (i = 127; i >= 0; i--) {
+        int top = rem >> 63;
+        rem = (rem << 1) | ((i >= 64 ? num_hi >> (i - 64) : num_lo >> i) & 1);
+        if (top || rem >= ub) {
+            rem -= ub;
+            if (i < 64) {
+                q |= (uint64_t)1 << i;
+            }
+        }
+    }
+    return (a < 0) != (b < 0) ? -(q32)q : (q32)q;
+}
+
+static inline q32 q32_sqrt(q32 a)
+{
+    _q128 num, res = { 0, 0 }, bit = { (uint64_t)1 << 62, 0 };
+
+    if (a <= 0) {
+        return 0;
+    }
+    num.hi = (uint64_t)a >> 32;
+    num.lo = (uint64_t)a << 32;
+
+    while (!_q128_ge(num, bit)) {
+        bit = _q128_shr(bit, 2);
+    }
+    while (bit.hi != 0 || bit.lo != 0) {
+        _q128 t = _q128_add(res, bit);
+        res = _q128_shr(res, 1);
+        if (_q128_ge(num, t)) {
+            num = _q128_sub(num, t);
+            res = _q128_add(res, bit);
+        }
+        bit = _q128_shr(bit, 2);
+    }
+    return (q32)res.lo;
+}
+
+
+/* Vector and matrix types and functions */
+
+#define CVEC_Q q16
+#define CVEC_QONE_D 65536.0
+#define CVEC_QHALFPI_HI INT64_C(0x1921f)
+#define CVEC_QHALFPI_LO INT64_C(0xb54442d2)
+#define CVEC_(name) q16##name
+#define CVEC_C_(name) Q16##name
+#include "cvec_fixed_template.h"
+#undef CVEC_Q
+#undef CVEC_QONE_D
+#undef CVEC_QHALFPI_HI
+#undef CVEC_QHALFPI_LO
+#undef CVEC_
+#undef CVEC_C_
+
+#define CVEC_Q q32
+#define CVEC_QONE_D 4294967296.0
+#define CVEC_QHALFPI_HI INT64_C(0x1921fb544)
+#define CVEC_QHALFPI_LO INT64_C(0x42d1846a)
+#define CVEC_(name) q32##name
+#define CVEC_C_(name) Q32##name
+#include "cvec_fixed_template.h"
+#undef CVEC_Q
+#undef CVEC_QONE_D
+#undef CVEC_QHALFPI_HI
+#undef CVEC_QHALFPI_LO
+#undef CVEC_
+#undef CVEC_C_
+
+
+/*
+ * Batch kernels
+ *
+ * The Q16.16 transform accumulates the three products in 64 bits and
+ * rounds once, so it is slightly more accurate than composing
+ * q16mat4_transform(). The loop is plain integer code that compilers
+ * vectorize with 32x32->64 multiplies (e.g. vpmuldq with -mavx2).
+ */
+
+static inline void q16mat4_transform_point_batch(const q16mat4 *m, const q16vec3 *in,
+                                                 q16vec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    const q16 *a = m->data;
+    int64_t m00 = a[0], m10 = a[1], m20 = a[2];
+    int64_t m01 = a[4], m11 = a[5], m21 = a[6];
+    int64_t m02 = a[8], m12 = a[9], m22 = a[10];
+    int64_t t0 = (int64_t)a[12] * 65536 + 0x8000;
+    int64_t t1 = (int64_t)a[13] * 65536 + 0x8000;
+    int64_t t2 = (int64_t)a[14] * 65536 + 0x8000;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        int64_t x = in[i].x, y = in[i].y, z = in[i].z;
+        out[i].x = (q16)((m00*x + m01*y + m02*z + t0) >> 16);
+        out[i].y = (q16)((m10*x + m11*y + m12*z + t1) >> 16);
+        out[i].z = (q16)((m20*x + m21*y + m22*z + t2) >> 16);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void q32mat4_transform_point_batch(const q32mat4 *m, const q32vec3 *in,
+                                                 q32vec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        q32vec4 r = q32mat4_transform(m, Q32Vec4(in[i].x, in[i].y, in[i].z, Q32_ONE));
+        out[i] = Q32Vec3(r.x, r.y, r.z);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void q16vec3_from_vec3_batch(const vec3 *restrict in, q16vec3 *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = q16vec3_from_vec3(in[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void q16vec3_to_vec3_batch(const q16vec3 *restrict in, vec3 *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = q16vec3_to_vec3(in[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+#endif
@@ -0,0 +1,784 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Type-generic part of cvec_fixed.h. Do not include this file directly.
+ *
+ * cvec_fixed.h includes it once per fixed-point format with these macros
+ * defined:
+ *
+ *   CVEC_Q          the raw scalar type (q16 or q32)
+ *   CVEC_QONE_D     the value of one as a double, used for constants
+ *   CVEC_QHALFPI_HI, CVEC_QHALFPI_LO
+ *                   pi/2 in CVEC_Q, truncated, and the next 32 bits of
+ *                   its fraction, for argument reduction
+ *   CVEC_(name)     a type or function name with the format's prefix
+ *                   (vec3_add becomes q16vec3_add or q32vec3_add,
+ *                   _mul becomes q16_mul or q32_mul)
+ *   CVEC_C_(name)   a constructor name (Vec3 becomes Q16Vec3 or Q32Vec3)
+ *
+ * The scalar functions CVEC_(_mul), CVEC_(_div), CVEC_(_sqrt),
+ * CVEC_(_from_float) and CVEC_(_to_float) must already be defined.
+ */
+
+#define _CVEC_QCONST(x) ((CVEC_Q)((x) * CVEC_QONE_D + ((x) < 0 ? -0.5 : 0.5)))
+#define _CVEC_QMUL(a, b) CVEC_(_mul)(a, b)
+
+typedef struct CVEC_(vec2) {
+    CVEC_Q x;
+    CVEC_Q y;
+} CVEC_(vec2);
+
+typedef struct CVEC_(vec3) {
+    CVEC_Q x;
+    CVEC_Q y;
+    CVEC_Q z;
+} CVEC_(vec3);
+
+typedef struct CVEC_(vec4) {
+    CVEC_Q x;
+    CVEC_Q y;
+    CVEC_Q z;
+    CVEC_Q w;
+} CVEC_(vec4);
+
+typedef struct CVEC_(mat2) {
+    CVEC_Q data[4];
+} CVEC_(mat2);
+
+typedef struct CVEC_(mat3) {
+    CVEC_Q data[9];
+} CVEC_(mat3);
+
+typedef struct CVEC_(mat4) {
+    CVEC_Q data[16];
+} CVEC_(mat4);
+
+
+/*
+ * Trigonometry
+ *
+ * The argument is reduced to [-pi/4, pi/4] with a pi/2 that carries 32
+ * extra fraction bits, then sin and cos are evaluated with Taylor
+ * polynomials in Horner form. Every step is an integer operation, so the
+ * result is the same on every platform.
+ */
+
+static inline void CVEC_(_sincos)(CVEC_Q angle, CVEC_Q *s_out, CVEC_Q *c_out)
+{
+    int64_t hi = CVEC_QHALFPI_HI;
+    int64_t k = ((int64_t)angle + (angle < 0 ? -hi/2 : hi/2)) / hi;
+    CVEC_Q r = (CVEC_Q)((int64_t)angle - k*hi - ((k*CVEC_QHALFPI_LO + 0x80000000) >> 32));
+    CVEC_Q r2 = _CVEC_QMUL(r, r);
+    CVEC_Q s, c;
+
+    s = _CVEC_QCONST(-1.0/39916800);
+    s = _CVEC_QCONST(1.0/362880) + _CVEC_QMUL(r2, s);
+    s = _CVEC_QCONST(-1.0/5040) + _CVEC_QMUL(r2, s);
+    s = _CVEC_QCONST(1.0/120) + _CVEC_QMUL(r2, s);
+    s = _CVEC_QCONST(-1.0/6) + _CVEC_QMUL(r2, s);
+    s = r + _CVEC_QMUL(r, _CVEC_QMUL(r2, s));
+
+    c = _CVEC_QCONST(1.0/479001600);
+    c = _CVEC_QCONST(-1.0/3628800) + _CVEC_QMUL(r2, c);
+    c = _CVEC_QCONST(1.0/40320) + _CVEC_QMUL(r2, c);
+    c = _CVEC_QCONST(-1.0/720) + _CVEC_QMUL(r2, c);
+    c = _CVEC_QCONST(1.0/24) + _CVEC_QMUL(r2, c);
+    c = _CVEC_QCONST(-1.0/2) + _CVEC_QMUL(r2, c);
+    c = _CVEC_QCONST(1.0) + _CVEC_QMUL(r2, c);
+
+    switch (k & 3) {
+    case 0: *s_out = s;  *c_out = c;  break;
+    case 1: *s_out = c;  *c_out = -s; break;
+    case 2: *s_out = -s; *c_out = -c; break;
+    default: *s_out = -c; *c_out = s; break;
+    }
+}
+
+static inline CVEC_Q CVEC_(_sin)(CVEC_Q angle)
+{
+    CVEC_Q s, c;
+    CVEC_(_sincos)(angle, &s, &c);
+    return s;
+}
+
+static inline CVEC_Q CVEC_(_cos)(CVEC_Q angle)
+{
+    CVEC_Q s, c;
+    CVEC_(_sincos)(angle, &s, &c);
+    return c;
+}
+
+/* vec2 functions */
+
+static inline CVEC_(vec2) CVEC_C_(Vec2)(CVEC_Q x, CVEC_Q y)
+{
+    CVEC_(vec2) r;
+    r.x = x;
+    r.y = y;
+    return r;
+}
+
+static inline CVEC_(vec2) CVEC_(vec2_add)(CVEC_(vec2) a, CVEC_(vec2) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec2)(a.x+b.x, a.y+b.y);
+}
+
+static inline CVEC_(vec2) CVEC_(vec2_sub)(CVEC_(vec2) a, CVEC_(vec2) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec2)(a.x-b.x, a.y-b.y);
+}
+
+static inline CVEC_(vec2) CVEC_(vec2_scale)(CVEC_(vec2) a, CVEC_Q c)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec2)(_CVEC_QMUL(a.x, c), _CVEC_QMUL(a.y, c));
+}
+
+static inline CVEC_Q CVEC_(vec2_dot)(CVEC_(vec2) a, CVEC_(vec2) b)
+{
+    CVEC_PROFILE_CALL();
+    return _CVEC_QMUL(a.x, b.x) + _CVEC_QMUL(a.y, b.y);
+}
+
+static inline CVEC_Q CVEC_(vec2_length)(CVEC_(vec2) a)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(_sqrt)(CVEC_(vec2_dot)(a, a));
+}
+
+static inline CVEC_Q CVEC_(vec2_distance)(CVEC_(vec2) a, CVEC_(vec2) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(vec2_length)(CVEC_(vec2_sub)(a, b));
+}
+
+static inline CVEC_(vec2) CVEC_(vec2_normalize)(CVEC_(vec2) a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_Q len = CVEC_(vec2_length)(a);
+    if (len == 0) {
+        return a;
+    }
+    return CVEC_C_(Vec2)(CVEC_(_div)(a.x, len), CVEC_(_div)(a.y, len));
+}
+
+
+/* vec3 functions */
+
+static inline CVEC_(vec3) CVEC_C_(Vec3)(CVEC_Q x, CVEC_Q y, CVEC_Q z)
+{
+    CVEC_(vec3) r;
+    r.x = x;
+    r.y = y;
+    r.z = z;
+    return r;
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_add)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(a.x+b.x, a.y+b.y, a.z+b.z);
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_sub)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(a.x-b.x, a.y-b.y, a.z-b.z);
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_scale)(CVEC_(vec3) a, CVEC_Q c)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(_CVEC_QMUL(a.x, c), _CVEC_QMUL(a.y, c), _CVEC_QMUL(a.z, c));
+}
+
+static inline CVEC_Q CVEC_(vec3_dot)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return _CVEC_QMUL(a.x, b.x) + _CVEC_QMUL(a.y, b.y) + _CVEC_QMUL(a.z, b.z);
+}
+
+static inline CVEC_Q CVEC_(vec3_length)(CVEC_(vec3) a)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(_sqrt)(CVEC_(vec3_dot)(a, a));
+}
+
+static inline CVEC_Q CVEC_(vec3_distance)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(vec3_length)(CVEC_(vec3_sub)(a, b));
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_normalize)(CVEC_(vec3) a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_Q len = CVEC_(vec3_length)(a);
+    if (len == 0) {
+        return a;
+    }
+    return CVEC_C_(Vec3)(CVEC_(_div)(a.x, len), CVEC_(_div)(a.y, len), CVEC_(_div)(a.z, len));
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_cross)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(_CVEC_QMUL(a.y, b.z) - _CVEC_QMUL(a.z, b.y),
+                         _CVEC_QMUL(a.z, b.x) - _CVEC_QMUL(a.x, b.z),
+                         _CVEC_QMUL(a.x, b.y) - _CVEC_QMUL(a.y, b.x));
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_min)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(a.x < b.x ? a.x : b.x,
+                         a.y < b.y ? a.y : b.y,
+                         a.z < b.z ? a.z : b.z);
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_max)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(a.x > b.x ? a.x : b.x,
+                         a.y > b.y ? a.y : b.y,
+                         a.z > b.z ? a.z : b.z);
+}
+
+
+/* vec4 functions */
+
+static inline CVEC_(vec4) CVEC_C_(Vec4)(CVEC_Q x, CVEC_Q y, CVEC_Q z, CVEC_Q w)
+{
+    CVEC_(vec4) r;
+    r.x = x;
+    r.y = y;
+    r.z = z;
+    r.w = w;
+    return r;
+}
+
+static inline CVEC_(vec4) CVEC_(vec4_add)(CVEC_(vec4) a, CVEC_(vec4) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(a.x+b.x, a.y+b.y, a.z+b.z, a.w+b.w);
+}
+
+static inline CVEC_(vec4) CVEC_(vec4_sub)(CVEC_(vec4) a, CVEC_(vec4) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w);
+}
+
+static inline CVEC_(vec4) CVEC_(vec4_scale)(CVEC_(vec4) a, CVEC_Q c)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(_CVEC_QMUL(a.x, c), _CVEC_QMUL(a.y, c), _CVEC_QMUL(a.z, c), _CVEC_QMUL(a.w, c));
+}
+
+static inline CVEC_Q CVEC_(vec4_dot)(CVEC_(vec4) a, CVEC_(vec4) b)
+{
+    CVEC_PROFILE_CALL();
+    return _CVEC_QMUL(a.x, b.x) + _CVEC_QMUL(a.y, b.y) + _CVEC_QMUL(a.z, b.z) + _CVEC_QMUL(a.w, b.w);
+}
+
+static inline CVEC_Q CVEC_(vec4_length)(CVEC_(vec4) a)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(_sqrt)(CVEC_(vec4_dot)(a, a));
+}
+
+static inline CVEC_Q CVEC_(vec4_distance)(CVEC_(vec4) a, CVEC_(vec4) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(vec4_length)(CVEC_(vec4_sub)(a, b));
+}
+
+static inline CVEC_(vec4) CVEC_(vec4_normalize)(CVEC_(vec4) a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_Q len = CVEC_(vec4_length)(a);
+    if (len == 0) {
+        return a;
+    }
+    return CVEC_C_(Vec4)(CVEC_(_div)(a.x, len), CVEC_(_div)(a.y, len),
+                         CVEC_(_div)(a.z, len), CVEC_(_div)(a.w, len));
+}
+
+
+/* 
+ * Generic (square) matrix functions
+ *
+ * The compiler is expected to inline these into the caller and
+ * optimize away the generic loops. Once the library is stable
+ * we could inline and optimize them by hand to save the
+ * compiler some work.
+ */
+
+
+static inline CVEC_Q CVEC_(mat_get)(const CVEC_Q *a, int i, int j, int n)
+{
+    return a[i + n*j];
+}
+
+static inline void CVEC_(mat_set)(CVEC_Q *a, int i, int j, CVEC_Q value, int n)
+{
+    a[i + n*j] = value;
+}
+
+static inline void CVEC_(mat_init_zero)(CVEC_Q *a, int n)
+{
+    int i;
+    for (i = 0; i < n*n; i++) {
+        a[i] = 0;
+    }
+}
+
+static inline void CVEC_(mat_init_identity)(CVEC_Q *a, int n)
+{
+    int i, j;
+    for (j = 0; j < n; j++) {
+        for (i = 0; i < n; i++) {
+            CVEC_Q value = i == j ? _CVEC_QCONST(1.0) : 0;
+            CVEC_(mat_set)(a, i, j, value, n);
+        }
+    }
+}
+
+static inline void CVEC_(mat_init_scale)(CVEC_Q *a, CVEC_Q value, int n)
+{
+    int i, j;
+    for (j = 0; j < n; j++) {
+        for (i = 0; i < n; i++) {
+            CVEC_Q _value = i == j ? value : 0;
+            CVEC_(mat_set)(a, i, j, _value, n);
+        }
+    }
+}
+
+static inline void CVEC_(mat_transpose)(CVEC_Q *a, int n)
+{
+    int i, j;
+    for (j = 0; j < n; j++) {
+        for (i = 0; i < n; i++) {
+            if (i < j) {
+                CVEC_Q value1 = CVEC_(mat_get)(a, i, j, n);
+                CVEC_Q value2 = CVEC_(mat_get)(a, j, i, n);
+                CVEC_(mat_set)(a, i, j, value2, n);
+                CVEC_(mat_set)(a, j, i, value1, n);
+            }
+        }
+    }
+}
+
+static inline void CVEC_(mat_transform)(const CVEC_Q *m, const CVEC_Q *v, CVEC_Q *r, int n)
+{
+    int i, j;
+    for (i = 0; i < n; i++) {
+        CVEC_Q sum = 0;
+        for (j = 0; j < n; j++) {
+            sum += _CVEC_QMUL(v[j], CVEC_(mat_get)(m, i, j, n));
+        }
+        r[i] = sum;
+    }
+}
+
+static inline void CVEC_(mat_mult)(const CVEC_Q *a, const CVEC_Q *b, CVEC_Q *r, int n)
+{
+    int i, j, k;
+    for (j = 0; j < n; j++) {
+        for (i = 0; i < n; i++) {
+            CVEC_Q sum = 0;
+            for (k = 0; k < n; k++) {
+                sum += _CVEC_QMUL(CVEC_(mat_get)(a, i, k, n), CVEC_(mat_get)(b, k, j, n));
+            }
+            CVEC_(mat_set)(r, i, j, sum, n);
+        }
+    }
+}
+
+
+/* mat2 functions */
+
+static inline CVEC_Q CVEC_(mat2_get)(const CVEC_(mat2) *a, int i, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(mat_get)(a->data, i, j, 2);
+}
+
+static inline void CVEC_(mat2_set)(CVEC_(mat2) *a, int i, int j, CVEC_Q value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_set)(a->data, i, j, value, 2);
+}
+
+static inline CVEC_(vec2) CVEC_(mat2_row)(const CVEC_(mat2) *a, int i)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec2)(CVEC_(mat2_get)(a, i, 0), CVEC_(mat2_get)(a, i, 1));
+}
+
+static inline CVEC_(vec2) CVEC_(mat2_col)(const CVEC_(mat2) *a, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec2)(CVEC_(mat2_get)(a, 0, j), CVEC_(mat2_get)(a, 1, j));
+}
+
+static inline void CVEC_(mat2_init)(CVEC_(mat2) *a, CVEC_Q v00, CVEC_Q v01, CVEC_Q v10, CVEC_Q v11)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat2_set)(a, 0, 0, v00);
+    CVEC_(mat2_set)(a, 0, 1, v01);
+    CVEC_(mat2_set)(a, 1, 0, v10);
+    CVEC_(mat2_set)(a, 1, 1, v11);
+}
+
+static inline void CVEC_(mat2_init_zero)(CVEC_(mat2) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_zero)(a->data, 2);
+}
+
+static inline void CVEC_(mat2_init_identity)(CVEC_(mat2) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_identity)(a->data, 2);
+}
+
+static inline void CVEC_(mat2_init_scale)(CVEC_(mat2) *a, CVEC_Q value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_scale)(a->data, value, 2);
+}
+
+static inline void CVEC_(mat2_init_rotate)(CVEC_(mat2) *a, CVEC_Q angle)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_Q s, c;
+    CVEC_(_sincos)(angle, &s, &c);
+    CVEC_(mat2_init)(a, c, -s,
+                        s, c);
+}
+
+static inline void CVEC_(mat2_transpose)(CVEC_(mat2) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_transpose)(a->data, 2);
+}
+
+static inline CVEC_(vec2) CVEC_(mat2_transform)(const CVEC_(mat2) *m, CVEC_(vec2) v)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(vec2) r;
+    CVEC_(mat_transform)(m->data, (CVEC_Q *)&v, (CVEC_Q *)&r, 2);
+    return r;
+}
+
+static inline void CVEC_(mat2_mult)(const CVEC_(mat2) *a, const CVEC_(mat2) *b, CVEC_(mat2) *r)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_mult)(a->data, b->data, r->data, 2);
+}
+
+
+/* mat3 functions */
+
+static inline CVEC_Q CVEC_(mat3_get)(const CVEC_(mat3) *a, int i, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(mat_get)(a->data, i, j, 3);
+}
+
+static inline void CVEC_(mat3_set)(CVEC_(mat3) *a, int i, int j, CVEC_Q value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_set)(a->data, i, j, value, 3);
+}
+
+static inline CVEC_(vec3) CVEC_(mat3_row)(const CVEC_(mat3) *a, int i)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(CVEC_(mat3_get)(a, i, 0), CVEC_(mat3_get)(a, i, 1), CVEC_(mat3_get)(a, i, 2));
+}
+
+static inline CVEC_(vec3) CVEC_(mat3_col)(const CVEC_(mat3) *a, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(CVEC_(mat3_get)(a, 0, j), CVEC_(mat3_get)(a, 1, j), CVEC_(mat3_get)(a, 2, j));
+}
+
+static inline void CVEC_(mat3_init)(CVEC_(mat3) *a, CVEC_Q v00, CVEC_Q v01, CVEC_Q v02,
+                                                    CVEC_Q v10, CVEC_Q v11, CVEC_Q v12,
+                                                    CVEC_Q v20, CVEC_Q v21, CVEC_Q v22)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat3_set)(a, 0, 0, v00);
+    CVEC_(mat3_set)(a, 0, 1, v01);
+    CVEC_(mat3_set)(a, 0, 2, v02);
+    CVEC_(mat3_set)(a, 1, 0, v10);
+    CVEC_(mat3_set)(a, 1, 1, v11);
+    CVEC_(mat3_set)(a, 1, 2, v12);
+    CVEC_(mat3_set)(a, 2, 0, v20);
+    CVEC_(mat3_set)(a, 2, 1, v21);
+    CVEC_(mat3_set)(a, 2, 2, v22);
+}
+
+static inline void CVEC_(mat3_init_zero)(CVEC_(mat3) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_zero)(a->data, 3);
+}
+
+static inline void CVEC_(mat3_init_identity)(CVEC_(mat3) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_identity)(a->data, 3);
+}
+
+static inline void CVEC_(mat3_init_scale)(CVEC_(mat3) *a, CVEC_Q value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_scale)(a->data, value, 3);
+}
+
+static inline void CVEC_(mat3_init_rotate)(CVEC_(mat3) *a, CVEC_(vec3) axis, CVEC_Q angle)
+{
+    CVEC_PROFILE_CALL();
+    if (CVEC_(vec3_length)(axis) == 0) {
+        CVEC_(mat3_init_identity)(a);
+        return;
+    }
+
+    axis = CVEC_(vec3_normalize)(axis);
+
+    CVEC_Q x = axis.x;
+    CVEC_Q y = axis.y;
+    CVEC_Q z = axis.z;
+    CVEC_Q s, c;
+    CVEC_(_sincos)(angle, &s, &c);
+    CVEC_Q t = _CVEC_QCONST(1.0) - c;
+    CVEC_Q tx = _CVEC_QMUL(t, x), ty = _CVEC_QMUL(t, y), tz = _CVEC_QMUL(t, z);
+    CVEC_Q sx = _CVEC_QMUL(s, x), sy = _CVEC_QMUL(s, y), sz = _CVEC_QMUL(s, z);
+
+    CVEC_(mat3_init)(a, _CVEC_QMUL(tx, x) + c,  _CVEC_QMUL(ty, x) - sz, _CVEC_QMUL(tz, x) + sy,
+                        _CVEC_QMUL(tx, y) + sz, _CVEC_QMUL(ty, y) + c,  _CVEC_QMUL(tz, y) - sx,
+                        _CVEC_QMUL(tx, z) - sy, _CVEC_QMUL(ty, z) + sx, _CVEC_QMUL(tz, z) + c);
+}
+
+static inline void CVEC_(mat3_transpose)(CVEC_(mat3) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_transpose)(a->data, 3);
+}
+
+static inline CVEC_(vec3) CVEC_(mat3_transform)(const CVEC_(mat3) *m, CVEC_(vec3) v)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(vec3) r;
+    CVEC_(mat_transform)(m->data, (CVEC_Q *)&v, (CVEC_Q *)&r, 3);
+    return r;
+}
+
+static inline void CVEC_(mat3_mult)(const CVEC_(mat3) *a, const CVEC_(mat3) *b, CVEC_(mat3) *r)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_mult)(a->data, b->data, r->data, 3);
+}
+
+
+/* mat4 functions */
+
+static inline CVEC_Q CVEC_(mat4_get)(const CVEC_(mat4) *a, int i, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(mat_get)(a->data, i, j, 4);
+}
+
+static inline void CVEC_(mat4_set)(CVEC_(mat4) *a, int i, int j, CVEC_Q value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_set)(a->data, i, j, value, 4);
+}
+
+static inline CVEC_(vec4) CVEC_(mat4_row)(const CVEC_(mat4) *a, int i)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(CVEC_(mat4_get)(a, i, 0), CVEC_(mat4_get)(a, i, 1), CVEC_(mat4_get)(a, i, 2), CVEC_(mat4_get)(a, i, 3));
+}
+
+static inline CVEC_(vec4) CVEC_(mat4_col)(const CVEC_(mat4) *a, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(CVEC_(mat4_get)(a, 0, j), CVEC_(mat4_get)(a, 1, j), CVEC_(mat4_get)(a, 2, j), CVEC_(mat4_get)(a, 3, j));
+}
+
+static inline void CVEC_(mat4_init)(CVEC_(mat4) *a, CVEC_Q v00, CVEC_Q v01, CVEC_Q v02, CVEC_Q v03,
+                                                    CVEC_Q v10, CVEC_Q v11, CVEC_Q v12, CVEC_Q v13,
+                                                    CVEC_Q v20, CVEC_Q v21, CVEC_Q v22, CVEC_Q v23,
+                                                    CVEC_Q v30, CVEC_Q v31, CVEC_Q v32, CVEC_Q v33)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat4_set)(a, 0, 0, v00);
+    CVEC_(mat4_set)(a, 0, 1, v01);
+    CVEC_(mat4_set)(a, 0, 2, v02);
+    CVEC_(mat4_set)(a, 0, 3, v03);
+    CVEC_(mat4_set)(a, 1, 0, v10);
+    CVEC_(mat4_set)(a, 1, 1, v11);
+    CVEC_(mat4_set)(a, 1, 2, v12);
+    CVEC_(mat4_set)(a, 1, 3, v13);
+    CVEC_(mat4_set)(a, 2, 0, v20);
+    CVEC_(mat4_set)(a, 2, 1, v21);
+    CVEC_(mat4_set)(a, 2, 2, v22);
+    CVEC_(mat4_set)(a, 2, 3, v23);
+    CVEC_(mat4_set)(a, 3, 0, v30);
+    CVEC_(mat4_set)(a, 3, 1, v31);
+    CVEC_(mat4_set)(a, 3, 2, v32);
+    CVEC_(mat4_set)(a, 3, 3, v33);
+}
+
+static inline void CVEC_(mat4_init_zero)(CVEC_(mat4) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_zero)(a->data, 4);
+}
+
+static inline void CVEC_(mat4_init_identity)(CVEC_(mat4) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_identity)(a->data, 4);
+}
+
+static inline void CVEC_(mat4_init_scale)(CVEC_(mat4) *a, CVEC_Q value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_scale)(a->data, value, 4);
+    CVEC_(mat4_set)(a, 3, 3, _CVEC_QCONST(1.0));
+}
+
+/* Only supports rotation in 3 dimensions, not 4. */
+static inline void CVEC_(mat4_init_rotate)(CVEC_(mat4) *a, CVEC_(vec3) axis, CVEC_Q angle)
+{
+    CVEC_PROFILE_CALL();
+    if (CVEC_(vec3_length)(axis) == 0) {
+        CVEC_(mat4_init_identity)(a);
+        return;
+    }
+
+    axis = CVEC_(vec3_normalize)(axis);
+
+    CVEC_Q x = axis.x;
+    CVEC_Q y = axis.y;
+    CVEC_Q z = axis.z;
+    CVEC_Q s, c;
+    CVEC_(_sincos)(angle, &s, &c);
+    CVEC_Q t = _CVEC_QCONST(1.0) - c;
+    CVEC_Q tx = _CVEC_QMUL(t, x), ty = _CVEC_QMUL(t, y), tz = _CVEC_QMUL(t, z);
+    CVEC_Q sx = _CVEC_QMUL(s, x), sy = _CVEC_QMUL(s, y), sz = _CVEC_QMUL(s, z);
+
+    CVEC_(mat4_init)(a, _CVEC_QMUL(tx, x) + c,  _CVEC_QMUL(ty, x) - sz, _CVEC_QMUL(tz, x) + sy, 0,
+                        _CVEC_QMUL(tx, y) + sz, _CVEC_QMUL(ty, y) + c,  _CVEC_QMUL(tz, y) - sx, 0,
+                        _CVEC_QMUL(tx, z) - sy, _CVEC_QMUL(ty, z) + sx, _CVEC_QMUL(tz, z) + c,  0,
+                        0,                      0,                      0,                      _CVEC_QCONST(1.0));
+}
+
+static inline void CVEC_(mat4_init_translate)(CVEC_(mat4) *m, CVEC_(vec3) v)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_Q one = _CVEC_QCONST(1.0);
+    CVEC_(mat4_init)(m, one, 0,   0,   v.x,
+                        0,   one, 0,   v.y,
+                        0,   0,   one, v.z,
+                        0,   0,   0,   one);
+}
+
+static inline void CVEC_(mat4_transpose)(CVEC_(mat4) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_transpose)(a->data, 4);
+}
+
+static inline CVEC_(vec4) CVEC_(mat4_transform)(const CVEC_(mat4) *m, CVEC_(vec4) v)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(vec4) r;
+    CVEC_(mat_transform)(m->data, (CVEC_Q *)&v, (CVEC_Q *)&r, 4);
+    return r;
+}
+
+static inline void CVEC_(mat4_mult)(const CVEC_(mat4) *a, const CVEC_(mat4) *b, CVEC_(mat4) *r)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_mult)(a->data, b->data, r->data, 4);
+}
+
+
+/* conversions to and from float */
+
+static inline CVEC_(vec3) CVEC_(vec3_from_vec3)(vec3 v)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(CVEC_(_from_float)(v.x), CVEC_(_from_float)(v.y), CVEC_(_from_float)(v.z));
+}
+
+static inline vec3 CVEC_(vec3_to_vec3)(CVEC_(vec3) v)
+{
+    CVEC_PROFILE_CALL();
+    return Vec3(CVEC_(_to_float)(v.x), CVEC_(_to_float)(v.y), CVEC_(_to_float)(v.z));
+}
+
+static inline CVEC_(vec4) CVEC_(vec4_from_vec4)(vec4 v)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(CVEC_(_from_float)(v.x), CVEC_(_from_float)(v.y),
+                         CVEC_(_from_float)(v.z), CVEC_(_from_float)(v.w));
+}
+
+static inline vec4 CVEC_(vec4_to_vec4)(CVEC_(vec4) v)
+{
+    CVEC_PROFILE_CALL();
+    return Vec4(CVEC_(_to_float)(v.x), CVEC_(_to_float)(v.y),
+                CVEC_(_to_float)(v.z), CVEC_(_to_float)(v.w));
+}
+
+static inline void CVEC_(mat4_from_mat4)(const mat4 *a, CVEC_(mat4) *r)
+{
+    CVEC_PROFILE_CALL();
+    int i;
+    for (i = 0; i < 16; i++) {
+        r->data[i] = CVEC_(_from_float)(a->data[i]);
+    }
+}
+
+static inline void CVEC_(mat4_to_mat4)(const CVEC_(mat4) *a, mat4 *r)
+{
+    CVEC_PROFILE_CALL();
+    int i;
+    for (i = 0; i < 16; i++) {
+        r->data[i] = CVEC_(_to_float)(a->data[i]);
+    }
+}
+
+#undef _CVEC_QCONST
+#undef _CVEC_QMUL
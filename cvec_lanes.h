@@ -0,0 +1,547 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_LANES_H
+#define CVEC_LANES_H
+
+/*
+ * Batch operations on many independent small matrices.
+ *
+ * A loop calling mat4_mult() on each of a million pairs of matrices does
+ * the same arithmetic a million times, but the compiler cannot vectorize
+ * across the calls. The "lanes" types interleave CVEC_LANES matrices:
+ * mat4_lanes.data[e][l] is element e (in the usual column-major order)
+ * of matrix l, so each operation is a loop over the lanes of one block
+ * that does the arithmetic of one matrix on CVEC_LANES matrices at once.
+ *
+ * An array of n matrices takes CVEC_LANES_BLOCKS(n) blocks. The batch
+ * functions take the number of matrices n. Mult, transpose and inverse
+ * work on whole blocks. mat*_to_lanes() fills the unused lanes of the
+ * last block with the identity. Vectors and determinants are only read
+ * and written for the first n lanes.
+ *
+ * mat*_lanes_mult() and mat*_lanes_transform() add their terms in the
+ * same order as mat*_mult() and mat*_transform() do. When the compiler
+ * does not contract multiply-adds, the results are identical.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include "cvec.h"
+#include "cvec_batch.h"
+
+/* Matrices per block: 4, 8 or 16, e.g. to match the SIMD width. */
+#ifndef CVEC_LANES
+#define CVEC_LANES 8
+#endif
+
+#define CVEC_LANES_BLOCKS(n) (((n) + CVEC_LANES - 1) / CVEC_LANES)
+
+typedef struct mat2_lanes {
+    float data[4][CVEC_LANES];
+} mat2_lanes;
+
+typedef struct mat3_lanes {
+    float data[9][CVEC_LANES];
+} mat3_lanes;
+
+typedef struct mat4_lanes {
+    float data[16][CVEC_LANES];
+} mat4_lanes;
+
+/*
+ * Dimension-generic kernels. The matrix arguments point to the first
+ * float of an array of blocks of d*d*CVEC_LANES floats.
+ */
+
+static inline void _lanes_pack(const float *in, float *out, size_t n, int d)
+{
+    size_t blocks = CVEC_LANES_BLOCKS(n), b, cnt;
+    int e, l;
+
+    for (b = 0; b < blocks; b++) {
+        const float *src = in + b * CVEC_LANES * d * d;
+        float *block = out + b * d * d * CVEC_LANES;
+        cnt = n - b * CVEC_LANES < CVEC_LANES ? n - b * CVEC_LANES : CVEC_LANES;
+        for (l = 0; l < (int)cnt; l++) {
+            for (e = 0; e < d * d; e++) {
+                block[e * CVEC_LANES + l] = src[l * d * d + e];
+            }
+        }
+        for (; l < CVEC_LANES; l++) {
+            for (e = 0; e < d * d; e++) {
+                block[e * CVEC_LANES + l] = e % (d + 1) == 0;
+            }
+        }
+    }
+}
+
+static inline void _lanes_unpack(const float *in, float *out, size_t n, int d)
+{
+    size_t i;
+    int e;
+
+    for (i = 0; i < n; i++) {
+        const float *block = in + i / CVEC_LANES * d * d * CVEC_LANES;
+        for (e = 0; e < d * d; e++) {
+            out[i * d * d + e] = block[e * CVEC_LANES + i % CVEC_LANES];
+        }
+    }
+}
+
+static inline void _lanes_mult(const float *restrict a, const float *restrict b,
+                               float *restrict r, size_t n, int d)
+{
+    size_t blocks = CVEC_LANES_BLOCKS(n), blk;
+    int i, j, k, l;
+
+    for (blk = 0; blk < blocks; blk++) {
+        const float *pa = a + blk * d * d * CVEC_LANES;
+        const float *pb = b + blk * d * d * CVEC_LANES;
+        float *pr = r + blk * d * d * CVEC_LANES;
+        for (j = 0; j < d; j++) {
+            for (l = 0; l < CVEC_LANES; l++) {
+                float col[4];
+                for (k = 0; k < d; k++) {
+                    col[k] = pb[(k + d*j) * CVEC_LANES + l];
+                }
+                for (i = 0; i < d; i++) {
+                    float sum = 0;
+                    for (k = 0; k < d; k++) {
+                        sum += pa[(i + d*k) * CVEC_LANES + l] * col[k];
+                    }
+                    pr[(i + d*j) * CVEC_LANES + l] = sum;
+                }
+            }
+        }
+    }
+}
+
+/* in and out hold d component arrays each; out may be the same as in. */
+static inline void _lanes_transform(const float *m, float *const *in, float *const *out,
+                                    size_t n, int d)
+{
+    size_t base, cnt;
+    int i, k, l;
+
+    for (base = 0; base < n; base += CVEC_LANES) {
+        const float *pm = m + base * d * d;
+        float r[4][CVEC_LANES];
+        cnt = n - base < CVEC_LANES ? n - base : CVEC_LANES;
+        for (i = 0; i < d; i++) {
+            for (l = 0; l < CVEC_LANES; l++) {
+                r[i][l] = 0;
+            }
+            for (k = 0; k < d; k++) {
+                const float *v = in[k] + base;
+                const float *x = pm + (i + d*k) * CVEC_LANES;
+                for (l = 0; l < (int)cnt; l++) {
+                    r[i][l] += v[l] * x[l];
+                }
+            }
+        }
+        for (i = 0; i < d; i++) {
+            memcpy(out[i] + base, r[i], sizeof(float) * cnt);
+        }
+    }
+}
+
+static inline void _lanes_transpose_copy(const float *restrict a, float *restrict r, size_t n, int d)
+{
+    size_t blocks = CVEC_LANES_BLOCKS(n), blk;
+    int i, j;
+
+    for (blk = 0; blk < blocks; blk++) {
+        const float *p = a + blk * d * d * CVEC_LANES;
+        float *q = r + blk * d * d * CVEC_LANES;
+        for (j = 0; j < d; j++) {
+            for (i = 0; i < d; i++) {
+                memcpy(q + (j + d*i) * CVEC_LANES, p + (i + d*j) * CVEC_LANES, sizeof(float) * CVEC_LANES);
+            }
+        }
+    }
+}
+
+static inline void _lanes_transpose_in_place(float *a, size_t n, int d)
+{
+    size_t blocks = CVEC_LANES_BLOCKS(n), blk;
+    int i, j, l;
+
+    for (blk = 0; blk < blocks; blk++) {
+        float *p = a + blk * d * d * CVEC_LANES;
+        for (j = 0; j < d; j++) {
+            for (i = 0; i < j; i++) {
+                float *restrict x = p + (i + d*j) * CVEC_LANES;
+                float *restrict y = p + (j + d*i) * CVEC_LANES;
+                for (l = 0; l < CVEC_LANES; l++) {
+                    float t = x[l];
+                    x[l] = y[l];
+                    y[l] = t;
+                }
+            }
+        }
+    }
+}
+
+/* r may be the same as a. */
+static inline void _lanes_transpose(const float *a, float *r, size_t n, int d)
+{
+    if (a == r) {
+        _lanes_transpose_in_place(r, n, d);
+    } else {
+        _lanes_transpose_copy(a, r, n, d);
+    }
+}
+
+/*
+ * 1/det, or 0 if det is 0 so that a singular matrix inverts to zero.
+ * Arithmetic rather than a select so that the loops stay branch-free.
+ */
+static inline float _lanes_inv_det(float det)
+{
+    return (det != 0) / (det + (det == 0));
+}
+
+/* Conversion */
+
+static inline void mat2_to_lanes(const mat2 *in, mat2_lanes *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_pack(in->data, out->data[0], n, 2);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat3_to_lanes(const mat3 *in, mat3_lanes *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_pack(in->data, out->data[0], n, 3);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat4_to_lanes(const mat4 *in, mat4_lanes *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_pack(in->data, out->data[0], n, 4);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat2_from_lanes(const mat2_lanes *in, mat2 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_unpack(in->data[0], out->data, n, 2);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat3_from_lanes(const mat3_lanes *in, mat3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_unpack(in->data[0], out->data, n, 3);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat4_from_lanes(const mat4_lanes *in, mat4 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_unpack(in->data[0], out->data, n, 4);
+    CVEC_PROFILE_END(n);
+}
+
+/* Multiplication: r = a * b per matrix. r must not overlap a or b. */
+
+static inline void mat2_lanes_mult(const mat2_lanes *a, const mat2_lanes *b, mat2_lanes *r, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_mult(a->data[0], b->data[0], r->data[0], n, 2);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat3_lanes_mult(const mat3_lanes *a, const mat3_lanes *b, mat3_lanes *r, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_mult(a->data[0], b->data[0], r->data[0], n, 3);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat4_lanes_mult(const mat4_lanes *a, const mat4_lanes *b, mat4_lanes *r, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_mult(a->data[0], b->data[0], r->data[0], n, 4);
+    CVEC_PROFILE_END(n);
+}
+
+/* Transformation: vector i is transformed by matrix i. out may be in. */
+
+static inline void mat2_lanes_transform(const mat2_lanes *m, vec2_soa in, vec2_soa out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    float *const vin[2] = { in.x, in.y };
+    float *const vout[2] = { out.x, out.y };
+    _lanes_transform(m->data[0], vin, vout, n, 2);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat3_lanes_transform(const mat3_lanes *m, vec3_soa in, vec3_soa out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    float *const vin[3] = { in.x, in.y, in.z };
+    float *const vout[3] = { out.x, out.y, out.z };
+    _lanes_transform(m->data[0], vin, vout, n, 3);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat4_lanes_transform(const mat4_lanes *m, vec4_soa in, vec4_soa out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    float *const vin[4] = { in.x, in.y, in.z, in.w };
+    float *const vout[4] = { out.x, out.y, out.z, out.w };
+    _lanes_transform(m->data[0], vin, vout, n, 4);
+    CVEC_PROFILE_END(n);
+}
+
+/* Transposition. r may be a. */
+
+static inline void mat2_lanes_transpose(const mat2_lanes *a, mat2_lanes *r, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_transpose(a->data[0], r->data[0], n, 2);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat3_lanes_transpose(const mat3_lanes *a, mat3_lanes *r, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_transpose(a->data[0], r->data[0], n, 3);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat4_lanes_transpose(const mat4_lanes *a, mat4_lanes *r, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _lanes_transpose(a->data[0], r->data[0], n, 4);
+    CVEC_PROFILE_END(n);
+}
+
+/* Determinants: det[i] of matrix i. */
+
+static inline void mat2_lanes_determinant(const mat2_lanes *m, float *det, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t base;
+    int l;
+
+    for (base = 0; base < n; base += CVEC_LANES) {
+        const mat2_lanes *p = &m[base / CVEC_LANES];
+        float r[CVEC_LANES];
+        for (l = 0; l < CVEC_LANES; l++) {
+            r[l] = p->data[0][l] * p->data[3][l] - p->data[2][l] * p->data[1][l];
+        }
+        memcpy(det + base, r, sizeof(float) * (n - base < CVEC_LANES ? n - base : CVEC_LANES));
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void mat3_lanes_determinant(const mat3_lanes *m, float *det, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t base;
+    int l;
+
+    for (base = 0; base < n; base += CVEC_LANES) {
+        const mat3_lanes *p = &m[base / CVEC_LANES];
+        float r[CVEC_LANES];
+        for (l = 0; l < CVEC_LANES; l++) {
+            float a00 = p->data[0][l], a10 = p->data[1][l], a20 = p->data[2][l];
+            float a01 = p->data[3][l], a11 = p->data[4][l], a21 = p->data[5][l];
+            float a02 = p->data[6][l], a12 = p->data[7][l], a22 = p->data[8][l];
+            r[l] = a00 * (a11*a22 - a12*a21) +
+                   a01 * (a12*a20 - a10*a22) +
+                   a02 * (a10*a21 - a11*a20);
+        }
+        memcpy(det + base, r, sizeof(float) * (n - base < CVEC_LANES ? n - base : CVEC_LANES));
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/*
+ * The 4x4 determinant and inverse expand by the 2x2 minors of the top
+ * two rows (s*) and the bottom two rows (c*).
+ */
+static inline void mat4_lanes_determinant(const mat4_lanes *m, float *det, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t base;
+    int l;
+
+    for (base = 0; base < n; base += CVEC_LANES) {
+        const mat4_lanes *p = &m[base / CVEC_LANES];
+        float r[CVEC_LANES];
+        for (l = 0; l < CVEC_LANES; l++) {
+            float a00 = p->data[0][l], a10 = p->data[1][l], a20 = p->data[2][l], a30 = p->data[3][l];
+            float a01 = p->data[4][l], a11 = p->data[5][l], a21 = p->data[6][l], a31 = p->data[7][l];
+            float a02 = p->data[8][l], a12 = p->data[9][l], a22 = p->data[10][l], a32 = p->data[11][l];
+            float a03 = p->data[12][l], a13 = p->data[13][l], a23 = p->data[14][l], a33 = p->data[15][l];
+            float s0 = a00*a11 - a10*a01, s1 = a00*a12 - a10*a02, s2 = a00*a13 - a10*a03;
+            float s3 = a01*a12 - a11*a02, s4 = a01*a13 - a11*a03, s5 = a02*a13 - a12*a03;
+            float c0 = a20*a31 - a30*a21, c1 = a20*a32 - a30*a22, c2 = a20*a33 - a30*a23;
+            float c3 = a21*a32 - a31*a22, c4 = a21*a33 - a31*a23, c5 = a22*a33 - a32*a23;
+            r[l] = s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0;
+        }
+        memcpy(det + base, r, sizeof(float) * (n - base < CVEC_LANES ? n - base : CVEC_LANES));
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/*
+ * Inversion. A singular matrix inverts to all zeros; if any of the n
+ * matrices is singular the functions return -1 with errno set to EDOM,
+ * otherwise 0. r may be m.
+ */
+
+static inline int mat2_lanes_inverse(const mat2_lanes *m, mat2_lanes *r, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t blocks = CVEC_LANES_BLOCKS(n), b;
+    int l, singular = 0;
+
+    for (b = 0; b < blocks; b++) {
+        const mat2_lanes *p = &m[b];
+        mat2_lanes *q = &r[b];
+        int bad[CVEC_LANES];
+        for (l = 0; l < CVEC_LANES; l++) {
+            float a00 = p->data[0][l], a10 = p->data[1][l];
+            float a01 = p->data[2][l], a11 = p->data[3][l];
+            float det = a00*a11 - a01*a10;
+            float inv = _lanes_inv_det(det);
+            bad[l] = det == 0;
+            q->data[0][l] = a11 * inv;
+            q->data[1][l] = -a10 * inv;
+            q->data[2][l] = -a01 * inv;
+            q->data[3][l] = a00 * inv;
+        }
+        /* Only the first n lanes count. */
+        for (l = 0; l < CVEC_LANES && b * CVEC_LANES + l < n; l++) {
+            singular |= bad[l];
+        }
+    }
+    CVEC_PROFILE_END(n);
+    if (singular) {
+        errno = EDOM;
+        return -1;
+    }
+    return 0;
+}
+
+static inline int mat3_lanes_inverse(const mat3_lanes *m, mat3_lanes *r, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t blocks = CVEC_LANES_BLOCKS(n), b;
+    int l, singular = 0;
+
+    for (b = 0; b < blocks; b++) {
+        const mat3_lanes *p = &m[b];
+        mat3_lanes *q = &r[b];
+        int bad[CVEC_LANES];
+        for (l = 0; l < CVEC_LANES; l++) {
+            float a00 = p->data[0][l], a10 = p->data[1][l], a20 = p->data[2][l];
+            float a01 = p->data[3][l], a11 = p->data[4][l], a21 = p->data[5][l];
+            float a02 = p->data[6][l], a12 = p->data[7][l], a22 = p->data[8][l];
+            float c00 = a11*a22 - a12*a21, c01 = a12*a20 - a10*a22, c02 = a10*a21 - a11*a20;
+            float det = a00*c00 + a01*c01 + a02*c02;
+            float inv = _lanes_inv_det(det);
+            bad[l] = det == 0;
+            q->data[0][l] = c00 * inv;
+            q->data[1][l] = c01 * inv;
+            q->data[2][l] = c02 * inv;
+            q->data[3][l] = (a02*a21 - a01*a22) * inv;
+            q->data[4][l] = (a00*a22 - a02*a20) * inv;
+            q->data[5][l] = (a01*a20 - a00*a21) * inv;
+            q->data[6][l] = (a01*a12 - a02*a11) * inv;
+            q->data[7][l] = (a02*a10 - a00*a12) * inv;
+            q->data[8][l] = (a00*a11 - a01*a10) * inv;
+        }
+        /* Only the first n lanes count. */
+        for (l = 0; l < CVEC_LANES && b * CVEC_LANES + l < n; l++) {
+            singular |= bad[l];
+        }
+    }
+    CVEC_PROFILE_END(n);
+    if (singular) {
+        errno = EDOM;
+        return -1;
+    }
+    return 0;
+}
+
+static inline int mat4_lanes_inverse(const mat4_lanes *m, mat4_lanes *r, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t blocks = CVEC_LANES_BLOCKS(n), b;
+    int l, singular = 0;
+
+    for (b = 0; b < blocks; b++) {
+        const mat4_lanes *p = &m[b];
+        mat4_lanes *q = &r[b];
+        int bad[CVEC_LANES];
+        for (l = 0; l < CVEC_LANES; l++) {
+            float a00 = p->data[0][l], a10 = p->data[1][l], a20 = p->data[2][l], a30 = p->data[3][l];
+            float a01 = p->data[4][l], a11 = p->data[5][l], a21 = p->data[6][l], a31 = p->data[7][l];
+            float a02 = p->data[8][l], a12 = p->data[9][l], a22 = p->data[10][l], a32 = p->data[11][l];
+            float a03 = p->data[12][l], a13 = p->data[13][l], a23 = p->data[14][l], a33 = p->data[15][l];
+            float s0 = a00*a11 - a10*a01, s1 = a00*a12 - a10*a02, s2 = a00*a13 - a10*a03;
+            float s3 = a01*a12 - a11*a02, s4 = a01*a13 - a11*a03, s5 = a02*a13 - a12*a03;
+            float c0 = a20*a31 - a30*a21, c1 = a20*a32 - a30*a22, c2 = a20*a33 - a30*a23;
+            float c3 = a21*a32 - a31*a22, c4 = a21*a33 - a31*a23, c5 = a22*a33 - a32*a23;
+            float det = s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0;
+            float inv = _lanes_inv_det(det);
+            bad[l] = det == 0;
+            q->data[0][l] = (a11*c5 - a12*c4 + a13*c3) * inv;
+            q->data[1][l] = (-a10*c5 + a12*c2 - a13*c1) * inv;
+            q->data[2][l] = (a10*c4 - a11*c2 + a13*c0) * inv;
+            q->data[3][l] = (-a10*c3 + a11*c1 - a12*c0) * inv;
+            q->data[4][l] = (-a01*c5 + a02*c4 - a03*c3) * inv;
+            q->data[5][l] = (a00*c5 - a02*c2 + a03*c1) * inv;
+            q->data[6][l] = (-a00*c4 + a01*c2 - a03*c0) * inv;
+            q->data[7][l] = (a00*c3 - a01*c1 + a02*c0) * inv;
+            q->data[8][l] = (a31*s5 - a32*s4 + a33*s3) * inv;
+            q->data[9][l] = (-a30*s5 + a32*s2 - a33*s1) * inv;
+            q->data[10][l] = (a30*s4 - a31*s2 + a33*s0) * inv;
+            q->data[11][l] = (-a30*s3 + a31*s1 - a32*s0) * inv;
+            q->data[12][l] = (-a21*s5 + a22*s4 - a23*s3) * inv;
+            q->data[13][l] = (a20*s5 - a22*s2 + a23*s1) * inv;
+            q->data[14][l] = (-a20*s4 + a21*s2 - a23*s0) * inv;
+            q->data[15][l] = (a20*s3 - a21*s1 + a22*s0) * inv;
+        }
+        /* Only the first n lanes count. */
+        for (l = 0; l < CVEC_LANES && b * CVEC_LANES + l < n; l++) {
+            singular |= bad[l];
+        }
+    }
+    CVEC_PROFILE_END(n);
+    if (singular) {
+        errno = EDOM;
+        return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_MORTON_H
+#define CVEC_MORTON_H
+
+/*
+ * Morton (Z-order) codes for vec3 points.
+ *
+ * Points are quantized to a grid spanning 'bounds', 10 bits per axis for
+ * the 30-bit codes and 21 bits per axis for the 63-bit codes. Bit 0 of a
+ * code comes from x, bit 1 from y and bit 2 from z. Points outside the
+ * bounds are clamped to the nearest cell. Decoding returns the center of
+ * the cell, so the round trip error is at most half a cell per axis.
+ *
+ * The bit interleaving uses BMI2 pdep/pext when the compiler targets it
+ * (-mbmi2) and the usual shift-and-mask sequence otherwise, which
+ * vectorizes well in the batch loops.
+ *
+ * morton_sort_vec3() reorders a point array (and optionally a parallel
+ * array of fixed-size attributes) into Z-order with an LSD radix sort.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cvec.h"
+#include "cvec_parallel.h"
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+static inline uint32_t morton30_spread(uint32_t x)
+{
+#if defined(__BMI2__)
+    return _pdep_u32(x, 0x09249249);
+#else
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+#endif
+}
+
+static inline uint32_t morton30_compact(uint32_t x)
+{
+#if defined(__BMI2__)
+    return _pext_u32(x, 0x09249249);
+#else
+    x &= 0x09249249;
+    x = (x | (x >> 2)) & 0x030c30c3;
+    x = (x | (x >> 4)) & 0x0300f00f;
+    x = (x | (x >> 8)) & 0x030000ff;
+    x = (x | (x >> 16)) & 0x3ff;
+    return x;
+#endif
+}
+
+static inline uint64_t morton63_spread(uint64_t x)
+{
+#if defined(__BMI2__) && defined(__x86_64__)
+    return _pdep_u64(x, 0x1249249249249249ULL);
+#else
+    x &= 0x1fffff;
+    x = (x | (x << 32)) & 0x1f00000000ffffULL;
+    x = (x | (x << 16)) & 0x1f0000ff0000ffULL;
+    x = (x | (x << 8)) & 0x100f00f00f00f00fULL;
+    x = (x | (x << 4)) & 0x10c30c30c30c30c3ULL;
+    x = (x | (x << 2)) & 0x1249249249249249ULL;
+    return x;
+#endif
+}
+
+static inline uint64_t morton63_compact(uint64_t x)
+{
+#if defined(__BMI2__) && defined(__x86_64__)
+    return _pext_u64(x, 0x1249249249249249ULL);
+#else
+    x &= 0x1249249249249249ULL;
+    x = (x | (x >> 2)) & 0x10c30c30c30c30c3ULL;
+    x = (x | (x >> 4)) & 0x100f00f00f00f00fULL;
+    x = (x | (x >> 8)) & 0x1f0000ff0000ffULL;
+    x = (x | (x >> 16)) & 0x1f00000000ffffULL;
+    x = (x | (x >> 32)) & 0x1fffff;
+    return x;
+#endif
+}
+
+static inline uint32_t morton30_encode(uint32_t x, uint32_t y, uint32_t z)
+{
+    return morton30_spread(x) | (morton30_spread(y) << 1) | (morton30_spread(z) << 2);
+}
+
+static inline void morton30_decode(uint32_t code, uint32_t *x, uint32_t *y, uint32_t *z)
+{
+    *x = morton30_compact(code);
+    *y = morton30_compact(code >> 1);
+    *z = morton30_compact(code >> 2);
+}
+
+static inline uint64_t morton63_encode(uint64_t x, uint64_t y, uint64_t z)
+{
+    return morton63_spread(x) | (morton63_spread(y) << 1) | (morton63_spread(z) << 2);
+}
+
+static inline void morton63_decode(uint64_t code, uint64_t *x, uint64_t *y, uint64_t *z)
+{
+    *x = morton63_compact(code);
+    *y = morton63_compact(code >> 1);
+    *z = morton63_compact(code >> 2);
+}
+
+/* Scale from bounds to a grid of 'cells' cells per axis. */
+static inline vec3 _morton_scale(aabb bounds, float cells)
+{
+    vec3 d = aabb_size(bounds);
+    return Vec3(d.x > 0 ? cells / d.x : 0,
+                d.y > 0 ? cells / d.y : 0,
+                d.z > 0 ? cells / d.z : 0);
+}
+
+static inline float _morton_quantize(float v, float min, float scale, float max_cell)
+{
+    float q = (v - min) * scale;
+    q = q > 0 ? q : 0;
+    return q < max_cell ? q : max_cell;
+}
+
+static inline uint32_t morton30_encode_vec3(vec3 p, aabb bounds)
+{
+    vec3 s = _morton_scale(bounds, 1024.0f);
+    return morton30_encode((uint32_t)_morton_quantize(p.x, bounds.min.x, s.x, 1023.0f),
+                           (uint32_t)_morton_quantize(p.y, bounds.min.y, s.y, 1023.0f),
+                           (uint32_t)_morton_quantize(p.z, bounds.min.z, s.z, 1023.0f));
+}
+
+static inline vec3 morton30_decode_vec3(uint32_t code, aabb bounds)
+{
+    vec3 d = vec3_scale(aabb_size(bounds), 1.0f / 1024.0f);
+    uint32_t x, y, z;
+    morton30_decode(code, &x, &y, &z);
+    return Vec3(bounds.min.x + (x + 0.5f) * d.x,
+                bounds.min.y + (y + 0.5f) * d.y,
+                bounds.min.z + (z + 0.5f) * d.z);
+}
+
+/*
+ * The 63-bit quantization is done in double precision since float cannot
+ * represent all 2^21 cell indices near the top of the range.
+ */
+static inline uint64_t morton63_encode_vec3(vec3 p, aabb bounds)
+{
+    vec3 d = aabb_size(bounds);
+    double cells = 2097152.0, max_cell = 2097151.0;
+    double qx = d.x > 0 ? (p.x - (double)bounds.min.x) * (cells / d.x) : 0;
+    double qy = d.y > 0 ? (p.y - (double)bounds.min.y) * (cells / d.y) : 0;
+    double qz = d.z > 0 ? (p.z - (double)bounds.min.z) * (cells / d.z) : 0;
+    qx = qx > 0 ? (qx < max_cell ? qx : max_cell) : 0;
+    qy = qy > 0 ? (qy < max_cell ? qy : max_cell) : 0;
+    qz = qz > 0 ? (qz < max_cell ? qz : max_cell) : 0;
+    return morton63_encode((uint64_t)qx, (uint64_t)qy, (uint64_t)qz);
+}
+
+static inline vec3 morton63_decode_vec3(uint64_t code, aabb bounds)
+{
+    vec3 d = aabb_size(bounds);
+    uint64_t x, y, z;
+    morton63_decode(code, &x, &y, &z);
+    return Vec3(bounds.min.x + (x + 0.5) * (d.x / 2097152.0),
+                bounds.min.y + (y + 0.5) * (d.y / 2097152.0),
+                bounds.min.z + (z + 0.5) * (d.z / 2097152.0));
+}
+
+static inline void morton30_encode_batch(const vec3 *restrict p, uint32_t *restrict codes,
+                                         size_t n, aabb bounds)
+{
+    CVEC_PROFILE_BEGIN();
+    vec3 s = _morton_scale(bounds, 1024.0f);
+    size_t i;
+    for (i = 0; i < n; i++) {
+        uint32_t x = (uint32_t)_morton_quantize(p[i].x, bounds.min.x, s.x, 1023.0f);
+        uint32_t y = (uint32_t)_morton_quantize(p[i].y, bounds.min.y, s.y, 1023.0f);
+        uint32_t z = (uint32_t)_morton_quantize(p[i].z, bounds.min.z, s.z, 1023.0f);
+        codes[i] = morton30_encode(x, y, z);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void morton30_decode_batch(const uint32_t *restrict codes, vec3 *restrict p,
+                                         size_t n, aabb bounds)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        p[i] = morton30_decode_vec3(codes[i], bounds);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void morton63_encode_batch(const vec3 *restrict p, uint64_t *restrict codes,
+                                         size_t n, aabb bounds)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        codes[i] = morton63_encode_vec3(p[i], bounds);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void morton63_decode_batch(const uint64_t *restrict codes, vec3 *restrict p,
+                                         size_t n, aabb bounds)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        p[i] = morton63_decode_vec3(codes[i], bounds);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+
+/* Radix sort */
+
+#define CVEC_RADIX_BITS 8
+#define CVEC_RADIX_BUCKETS (1 << CVEC_RADIX_BITS)
+
+/* Chunks smaller than this are not worth a thread of their own. */
+#define CVEC_RADIX_GRAIN 65536
+
+struct _radix_ctx {
+    const uint64_t *keys_in;
+    const uint32_t *vals_in;
+    uint64_t *keys_out;
+    uint32_t *vals_out;
+    size_t n;
+    size_t chunks;
+    int shift;
+    size_t (*hist)[CVEC_RADIX_BUCKETS];
+};
+
+static inline void _radix_histogram(void *arg, size_t begin, size_t end)
+{
+    struct _radix_ctx *c = arg;
+    size_t chunk, i;
+    for (chunk = begin; chunk < end; chunk++) {
+        size_t *h = c->hist[chunk];
+        size_t lo = c->n * chunk / c->chunks;
+        size_t hi = c->n * (chunk + 1) / c->chunks;
+        memset(h, 0, sizeof(c->hist[chunk]));
+        for (i = lo; i < hi; i++) {
+            h[(c->keys_in[i] >> c->shift) & (CVEC_RADIX_BUCKETS - 1)]++;
+        }
+    }
+}
+
+static inline void _radix_scatter(void *arg, size_t begin, size_t end)
+{
+    struct _radix_ctx *c = arg;
+    size_t chunk, i;
+    for (chunk = begin; chunk < end; chunk++) {
+        size_t *offset = c->hist[chunk];
+        size_t lo = c->n * chunk / c->chunks;
+        size_t hi = c->n * (chunk + 1) / c->chunks;
+        for (i = lo; i < hi; i++) {
+            size_t dst = offset[(c->keys_in[i] >> c->shift) & (CVEC_RADIX_BUCKETS - 1)]++;
+            c->keys_out[dst] = c->keys_in[i];
+            c->vals_out[dst] = c->vals_in[i];
+        }
+    }
+}
+
+/*
+ * Stable sort of n keys, carrying vals along, using 'threads' threads.
+ * Only the low key_bits bits of each key are compared. Returns -1 if
+ * scratch memory could not be allocated.
+ */
+static inline int cvec_radix_sort(uint64_t *keys, uint32_t *vals, size_t n, int key_bits, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    struct _radix_ctx c;
+    uint64_t *keys_tmp;
+    uint32_t *vals_tmp;
+    size_t bucket, chunk;
+    int shift;
+
+    c.chunks = n / CVEC_RADIX_GRAIN;
+    if (c.chunks > (size_t)threads) {
+        c.chunks = threads;
+    }
+    if (c.chunks > CVEC_MAX_THREADS) {
+        c.chunks = CVEC_MAX_THREADS;
+    }
+    if (c.chunks < 1) {
+        c.chunks = 1;
+    }
+
+    keys_tmp = malloc(sizeof(uint64_t) * (n > 0 ? n : 1));
+    vals_tmp = malloc(sizeof(uint32_t) * (n > 0 ? n : 1));
+    c.hist = malloc(sizeof(*c.hist) * c.chunks);
+    if (!keys_tmp || !vals_tmp || !c.hist) {
+        free(keys_tmp);
+        free(vals_tmp);
+        free(c.hist);
+        CVEC_PROFILE_END(n);
+        return -1;
+    }
+
+    c.n = n;
+    c.keys_in = keys;
+    c.vals_in = vals;
+    c.keys_out = keys_tmp;
+    c.vals_out = vals_tmp;
+
+    for (shift = 0; shift < key_bits; shift += CVEC_RADIX_BITS) {
+        size_t sum = 0;
+        const uint64_t *k;
+        const uint32_t *v;
+
+        c.shift = shift;
+        cvec_parallel_for(c.chunks, 1, threads, _radix_histogram, &c);
+
+        /* Skip passes where every key has the same digit. */
+        for (bucket = 0; bucket < CVEC_RADIX_BUCKETS; bucket++) {
+            size_t total = 0;
+            for (chunk = 0; chunk < c.chunks; chunk++) {
+                total += c.hist[chunk][bucket];
+            }
+            if (total == n) {
+                break;
+            }
+        }
+        if (bucket < CVEC_RADIX_BUCKETS) {
+            continue;
+        }
+
+        /* Turn the histograms into per-chunk output offsets. */
+        for (bucket = 0; bucket < CVEC_RADIX_BUCKETS; bucket++) {
+            for (chunk = 0; chunk < c.chunks; chunk++) {
+                size_t count = c.hist[chunk][bucket];
+                c.hist[chunk][bucket] = sum;
+                sum += count;
+            }
+        }
+
+        cvec_parallel_for(c.chunks, 1, threads, _radix_scatter, &c);
+
+        k = c.keys_in;
+        v = c.vals_in;
+        c.keys_in = c.keys_out;
+        c.vals_in = c.vals_out;
+        c.keys_out = (uint64_t *)k;
+        c.vals_out = (uint32_t *)v;
+    }
+
+    if (c.keys_in != keys) {
+        memcpy(keys, c.keys_in, sizeof(uint64_t) * n);
+        memcpy(vals, c.vals_in, sizeof(uint32_t) * n);
+    }
+
+    free(keys_tmp);
+    free(vals_tmp);
+    free(c.hist);
+    CVEC_PROFILE_END(n);
+    return 0;
+}
+
+/*
+ * Sorts n points into Z-order of their 63-bit Morton codes within
+ * 'bounds'. If payload is not NULL it points to n attributes of
+ * payload_size bytes each which are reordered the same way. If perm is
+ * not NULL, perm[i] receives the original index of the point now at i.
+ * The permutation is 32 bits, so n is limited to UINT32_MAX. Returns -1
+ * with errno EINVAL beyond that, and -1 if scratch memory could not be
+ * allocated.
+ */
+static inline int morton_sort_vec3(vec3 *points, size_t n, aabb bounds,
+                                   void *payload, size_t payload_size,
+                                   uint32_t *perm, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    uint64_t *keys = NULL;
+    uint32_t *order = perm;
+    size_t tmp_size = sizeof(vec3) > payload_size ? sizeof(vec3) : payload_size;
+    unsigned char *tmp = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (n > UINT32_MAX) {
+        errno = EINVAL;
+        goto out;
+    }
+    /* tmp_size is at least sizeof(uint64_t), so this bounds every buffer. */
+    if (n > SIZE_MAX / tmp_size) {
+        errno = ENOMEM;
+        goto out;
+    }
+    keys = malloc(sizeof(uint64_t) * (n > 0 ? n : 1));
+    if (!perm) {
+        order = malloc(sizeof(uint32_t) * (n > 0 ? n : 1));
+    }
+    if (!keys || !order) {
+        goto out;
+    }
+
+    morton63_encode_batch(points, keys, n, bounds);
+    for (i = 0; i < n; i++) {
+        order[i] = (uint32_t)i;
+    }
+
+    if (cvec_radix_sort(keys, order, n, 63, threads) < 0) {
+        goto out;
+    }
+
+    tmp = malloc(tmp_size * (n > 0 ? n : 1));
+    if (!tmp) {
+        goto out;
+    }
+
+    for (i = 0; i < n; i++) {
+        ((vec3 *)tmp)[i] = points[order[i]];
+    }
+    memcpy(points, tmp, sizeof(vec3) * n);
+
+    if (payload) {
+        const unsigned char *src = payload;
+        for (i = 0; i < n; i++) {
+            memcpy(tmp + i * payload_size, src + order[i] * payload_size, payload_size);
+        }
+        memcpy(payload, tmp, payload_size * n);
+    }
+
+    ret = 0;
+out:
+    free(keys);
+    if (order != perm) {
+        free(order);
+    }
+    free(tmp);
+    CVEC_PROFILE_END(n);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_PARALLEL_H
+#define CVEC_PARALLEL_H
+
+/*
+ * Minimal work-stealing scheduler for batch kernels.
+ *
+ * cvec_parallel_for() splits [0, n) among at most 'threads' participants
+ * (the calling thread plus pooled workers), giving each a contiguous
+ * range of at least 'grain' elements. A participant runs its range
+ * 'grain' elements at a time and, once it runs dry, steals the back half
+ * of another participant's remaining range. The call returns once every
+ * element has been processed.
+ *
+ * Workers are started lazily and live for the rest of the process (or
+ * until cvec_parallel_shutdown()). A call made from inside a range
+ * callback, or while another thread owns the pool, runs inline on the
+ * calling thread, so nesting never deadlocks. If no worker can be
+ * started the whole range runs inline.
+ *
+ * Pinning is opt-in through cvec_parallel_init(). It is only available
+ * on Linux when _GNU_SOURCE is defined before the first system header;
+ * elsewhere define CVEC_PARALLEL_SET_AFFINITY(thread, index) to supply
+ * your own, returning 0 on success.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#include <sched.h>
+#endif
+
+#ifndef CVEC_MAX_THREADS
+#define CVEC_MAX_THREADS 64
+#endif
+
+typedef void (*cvec_range_fn)(void *ctx, size_t begin, size_t end);
+
+struct _cvec_parallel_deque {
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+};
+
+struct _cvec_parallel_job {
+    cvec_range_fn fn;
+    void *ctx;
+    size_t grain;
+    int participants;
+    struct _cvec_parallel_deque deques[CVEC_MAX_THREADS];
+};
+
+struct _cvec_parallel_state {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    pthread_mutex_t submit;
+    pthread_t workers[CVEC_MAX_THREADS];
+    int nworkers;
+    int pin;
+    int busy;
+    int shutdown;
+    unsigned long generation;
+    struct _cvec_parallel_job *job;
+};
+
+/* Shared between translation units where the compiler supports it. */
+#if defined(__GNUC__)
+__attribute__((weak)) struct _cvec_parallel_state _cvec_parallel = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, { 0 }, 0, 0, 0, 0, 0, NULL
+};
+__attribute__((weak)) __thread int _cvec_parallel_depth;
+#else
+static struct _cvec_parallel_state _cvec_parallel = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, { 0 }, 0, 0, 0, 0, 0, NULL
+};
+static __thread int _cvec_parallel_depth;
+#endif
+
+#ifndef CVEC_PARALLEL_SET_AFFINITY
+#if defined(__linux__) && defined(CPU_SET)
+#define CVEC_PARALLEL_SET_AFFINITY(thread, index) _cvec_parallel_set_affinity(thread, index)
+
+/* Pin to the index'th CPU of the process's allowed set. */
+static inline int _cvec_parallel_set_affinity(pthread_t thread, int index)
+{
+    cpu_set_t allowed, set;
+    int count, cpu;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+    count = CPU_COUNT(&allowed);
+    if (count <= 0) {
+        return -1;
+    }
+    index %= count;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0) {
+            break;
+        }
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0 ? 0 : -1;
+}
+#else
+#define CVEC_PARALLEL_SET_AFFINITY(thread, index) ((void)(thread), (void)(index), -1)
+#endif
+#endif
+
+/* Take up to 'grain' elements from the front of our own range. */
+static inline int _cvec_parallel_pop(struct _cvec_parallel_deque *d, size_t grain,
+                                     size_t *begin, size_t *end)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->begin < d->end) {
+        *begin = d->begin;
+        *end = d->end - d->begin > grain ? d->begin + grain : d->end;
+        d->begin = *end;
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+/* Move the back half of another participant's range into ours. */
+static inline int _cvec_parallel_steal(struct _cvec_parallel_job *job, int self)
+{
+    struct _cvec_parallel_deque *own = &job->deques[self];
+    size_t begin = 0, end = 0;
+    int i;
+
+    for (i = 1; i < job->participants && begin == end; i++) {
+        struct _cvec_parallel_deque *victim = &job->deques[(self + i) % job->participants];
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->begin < victim->end) {
+            size_t left = victim->end - victim->begin;
+            begin = left > job->grain ? victim->end - left / 2 : victim->begin;
+            end = victim->end;
+            victim->end = begin;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    if (begin == end) {
+        return 0;
+    }
+    pthread_mutex_lock(&own->lock);
+    own->begin = begin;
+    own->end = end;
+    pthread_mutex_unlock(&own->lock);
+    return 1;
+}
+
+static inline void _cvec_parallel_work(struct _cvec_parallel_job *job, int self)
+{
+    size_t begin, end;
+
+    _cvec_parallel_depth++;
+    do {
+        while (_cvec_parallel_pop(&job->deques[self], job->grain, &begin, &end)) {
+            job->fn(job->ctx, begin, end);
+        }
+    } while (_cvec_parallel_steal(job, self));
+    _cvec_parallel_depth--;
+}
+
+static inline void *_cvec_parallel_worker(void *arg)
+{
+    struct _cvec_parallel_state *s = &_cvec_parallel;
+    int self = (int)(size_t)arg;
+    unsigned long seen;
+    struct _cvec_parallel_job *job;
+
+    /* Calls from inside a worker always run inline. */
+    _cvec_parallel_depth = 1;
+
+    pthread_mutex_lock(&s->lock);
+    seen = s->generation;
+    for (;;) {
+        while (!s->shutdown && (s->job == NULL || s->generation == seen)) {
+            pthread_cond_wait(&s->wake, &s->lock);
+        }
+        if (s->shutdown) {
+            break;
+        }
+        seen = s->generation;
+        job = s->job;
+        if (self >= job->participants) {
+            continue;
+        }
+        s->busy++;
+        pthread_mutex_unlock(&s->lock);
+
+        _cvec_parallel_work(job, self);
+
+        pthread_mutex_lock(&s->lock);
+        if (--s->busy == 0) {
+            pthread_cond_broadcast(&s->idle);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/* Grow the pool to 'count' workers. Called with s->submit held. */
+static inline int _cvec_parallel_grow(struct _cvec_parallel_state *s, int count)
+{
+    if (count > CVEC_MAX_THREADS - 1) {
+        count = CVEC_MAX_THREADS - 1;
+    }
+    while (s->nworkers < count) {
+        /* Worker i is participant i + 1; the caller is participant 0. */
+        void *arg = (void *)(size_t)(s->nworkers + 1);
+        if (pthread_create(&s->workers[s->nworkers], NULL, _cvec_parallel_worker, arg) != 0) {
+            break;
+        }
+        if (s->pin) {
+            (void)CVEC_PARALLEL_SET_AFFINITY(s->workers[s->nworkers], s->nworkers + 1);
+        }
+        s->nworkers++;
+    }
+    return s->nworkers;
+}
+
+/*
+ * Start the pool with threads - 1 workers, optionally pinning each
+ * worker to its own CPU. Returns -1 with errno set if no worker could be
+ * started or pinning was requested but is unsupported. Calling this is
+ * optional; cvec_parallel_for() starts workers as it needs them.
+ */
+static inline int cvec_parallel_init(int threads, int pin)
+{
+    struct _cvec_parallel_state *s = &_cvec_parallel;
+    int i, err = 0;
+
+    pthread_mutex_lock(&s->submit);
+    s->pin = s->pin || pin;
+    if (threads > 1 && _cvec_parallel_grow(s, threads - 1) == 0) {
+        err = EAGAIN;
+    }
+    for (i = 0; pin && i < s->nworkers; i++) {
+        if (CVEC_PARALLEL_SET_AFFINITY(s->workers[i], i + 1) != 0) {
+            err = ENOTSUP;
+        }
+    }
+    pthread_mutex_unlock(&s->submit);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Number of pooled worker threads currently running. */
+static inline int cvec_parallel_workers(void)
+{
+    struct _cvec_parallel_state *s = &_cvec_parallel;
+    int n;
+
+    pthread_mutex_lock(&s->submit);
+    n = s->nworkers;
+    pthread_mutex_unlock(&s->submit);
+    return n;
+}
+
+/* Stop and join all workers. The pool restarts on the next call. */
+static inline void cvec_parallel_shutdown(void)
+{
+    struct _cvec_parallel_state *s = &_cvec_parallel;
+    int i;
+
+    pthread_mutex_lock(&s->submit);
+    pthread_mutex_lock(&s->lock);
+    s->shutdown = 1;
+    pthread_cond_broadcast(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+    for (i = 0; i < s->nworkers; i++) {
+        pthread_join(s->workers[i], NULL);
+    }
+    s->nworkers = 0;
+    s->shutdown = 0;
+    s->pin = 0;
+    pthread_mutex_unlock(&s->submit);
+}
+
+static inline void cvec_parallel_for(size_t n, size_t grain, int threads,
+                                     cvec_range_fn fn, void *ctx)
+{
+    struct _cvec_parallel_state *s = &_cvec_parallel;
+    struct _cvec_parallel_job job;
+    size_t chunks;
+    int i;
+
+    if (n == 0) {
+        return;
+    }
+
+    chunks = grain > 0 ? n / grain : n;
+    if (chunks > (size_t)threads) {
+        chunks = threads;
+    }
+    if (chunks > CVEC_MAX_THREADS) {
+        chunks = CVEC_MAX_THREADS;
+    }
+    if (chunks <= 1 || _cvec_parallel_depth > 0 || pthread_mutex_trylock(&s->submit) != 0) {
+        fn(ctx, 0, n);
+        return;
+    }
+
+    job.participants = _cvec_parallel_grow(s, (int)chunks - 1) + 1;
+    if (job.participants > (int)chunks) {
+        job.participants = (int)chunks;
+    }
+    if (job.participants <= 1) {
+        pthread_mutex_unlock(&s->submit);
+        fn(ctx, 0, n);
+        return;
+    }
+
+    job.fn = fn;
+    job.ctx = ctx;
+    job.grain = grain > 0 ? grain : 1;
+    for (i = 0; i < job.participants; i++) {
+        pthread_mutex_init(&job.deques[i].lock, NULL);
+        job.deques[i].begin = n * i / job.participants;
+        job.deques[i].end = n * (i + 1) / job.participants;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->job = &job;
+    s->generation++;
+    pthread_cond_broadcast(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+
+    _cvec_parallel_work(&job, 0);
+
+    /* All work is claimed; wait for workers still running their last range. */
+    pthread_mutex_lock(&s->lock);
+    s->job = NULL;
+    while (s->busy > 0) {
+        pthread_cond_wait(&s->idle, &s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    for (i = 0; i < job.participants; i++) {
+        pthread_mutex_destroy(&job.deques[i].lock);
+    }
+    pthread_mutex_unlock(&s->submit);
+}
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_PARTICLE_H
+#define CVEC_PARTICLE_H
+
+/*
+ * Particle integrators over structure-of-arrays positions, velocities and
+ * accelerations.
+ *
+ * Each integrator makes a single pass over the arrays with the
+ * multiply-adds fused, instead of the several passes that composing
+ * vec3_add() and vec3_scale() per particle costs. The acceleration array
+ * may be NULL, in which case only params->gravity is applied. Work is
+ * split across up to 'threads' threads in chunks of CVEC_PARTICLE_GRAIN
+ * particles; the result does not depend on the thread count.
+ *
+ * Damping is the fraction of velocity lost per second, applied to the
+ * new velocity as v * (1 - damping * dt). A zeroed particle_params has
+ * no gravity and no damping.
+ *
+ * The position, velocity and acceleration arrays must not overlap.
+ */
+
+#include <stddef.h>
+#include "cvec.h"
+#include "cvec_batch.h"
+#include "cvec_parallel.h"
+
+#ifndef CVEC_PARTICLE_GRAIN
+#define CVEC_PARTICLE_GRAIN 16384
+#endif
+
+typedef struct particle_params {
+    float dt;
+    float damping;
+    vec3 gravity;
+} particle_params;
+
+enum {
+    _PARTICLE_EULER,
+    _PARTICLE_EULER_SEMI,
+    _PARTICLE_VERLET_POSITION,
+    _PARTICLE_VERLET_VELOCITY,
+};
+
+struct _particle_ctx {
+    int method;
+    vec3_soa pos;
+    vec3_soa vel;
+    const vec3_soa *acc;
+    float dt;
+    float k;
+    vec3 gravity;
+};
+
+/* p += v*dt, v = k*(v + (a+g)*dt) */
+static inline void _particle_euler(float *restrict p, float *restrict v, const float *restrict a,
+                                   float g, float dt, float k, size_t n)
+{
+    size_t i;
+    if (a) {
+        for (i = 0; i < n; i++) {
+            float vi = v[i];
+            p[i] = _CVEC_FMAF(vi, dt, p[i]);
+            v[i] = k * _CVEC_FMAF(a[i] + g, dt, vi);
+        }
+    } else {
+        float dv = g * dt;
+        for (i = 0; i < n; i++) {
+            float vi = v[i];
+            p[i] = _CVEC_FMAF(vi, dt, p[i]);
+            v[i] = k * (vi + dv);
+        }
+    }
+}
+
+/* v = k*(v + (a+g)*dt), p += v*dt */
+static inline void _particle_euler_semi(float *restrict p, float *restrict v, const float *restrict a,
+                                        float g, float dt, float k, size_t n)
+{
+    size_t i;
+    if (a) {
+        for (i = 0; i < n; i++) {
+            float vi = k * _CVEC_FMAF(a[i] + g, dt, v[i]);
+            v[i] = vi;
+            p[i] = _CVEC_FMAF(vi, dt, p[i]);
+        }
+    } else {
+        float dv = g * dt;
+        for (i = 0; i < n; i++) {
+            float vi = k * (v[i] + dv);
+            v[i] = vi;
+            p[i] = _CVEC_FMAF(vi, dt, p[i]);
+        }
+    }
+}
+
+/* v += (a+g)*dt/2, p += v*dt */
+static inline void _particle_verlet_position(float *restrict p, float *restrict v, const float *restrict a,
+                                             float g, float dt, size_t n)
+{
+    float h = 0.5f * dt;
+    size_t i;
+    if (a) {
+        for (i = 0; i < n; i++) {
+            float vi = _CVEC_FMAF(a[i] + g, h, v[i]);
+            v[i] = vi;
+            p[i] = _CVEC_FMAF(vi, dt, p[i]);
+        }
+    } else {
+        float dv = g * h;
+        for (i = 0; i < n; i++) {
+            float vi = v[i] + dv;
+            v[i] = vi;
+            p[i] = _CVEC_FMAF(vi, dt, p[i]);
+        }
+    }
+}
+
+/* v = k*(v + (a+g)*dt/2) */
+static inline void _particle_verlet_velocity(float *restrict v, const float *restrict a,
+                                             float g, float dt, float k, size_t n)
+{
+    float h = 0.5f * dt;
+    size_t i;
+    if (a) {
+        for (i = 0; i < n; i++) {
+            v[i] = k * _CVEC_FMAF(a[i] + g, h, v[i]);
+        }
+    } else {
+        float dv = g * h;
+        for (i = 0; i < n; i++) {
+            v[i] = k * (v[i] + dv);
+        }
+    }
+}
+
+static inline float *_particle_comp(vec3_soa s, int c)
+{
+    return c == 0 ? s.x : c == 1 ? s.y : s.z;
+}
+
+static inline void _particle_range(void *arg, size_t begin, size_t end)
+{
+    struct _particle_ctx *ctx = arg;
+    size_t n = end - begin;
+    int c;
+
+    for (c = 0; c < 3; c++) {
+        float *p = ctx->pos.x ? _particle_comp(ctx->pos, c) + begin : NULL;
+        float *v = _particle_comp(ctx->vel, c) + begin;
+        const float *a = ctx->acc ? _particle_comp(*ctx->acc, c) + begin : NULL;
+        float g = c == 0 ? ctx->gravity.x : c == 1 ? ctx->gravity.y : ctx->gravity.z;
+
+        switch (ctx->method) {
+        case _PARTICLE_EULER:
+            _particle_euler(p, v, a, g, ctx->dt, ctx->k, n);
+            break;
+        case _PARTICLE_EULER_SEMI:
+            _particle_euler_semi(p, v, a, g, ctx->dt, ctx->k, n);
+            break;
+        case _PARTICLE_VERLET_POSITION:
+            _particle_verlet_position(p, v, a, g, ctx->dt, n);
+            break;
+        default:
+            _particle_verlet_velocity(v, a, g, ctx->dt, ctx->k, n);
+            break;
+        }
+    }
+}
+
+static inline void _particle_run(int method, vec3_soa pos, vec3_soa vel, const vec3_soa *acc,
+                                 size_t n, const particle_params *params, int threads)
+{
+    struct _particle_ctx ctx;
+    float k = 1 - params->damping * params->dt;
+
+    ctx.method = method;
+    ctx.pos = pos;
+    ctx.vel = vel;
+    ctx.acc = acc;
+    ctx.dt = params->dt;
+    ctx.k = k > 0 ? k : 0;
+    ctx.gravity = params->gravity;
+    cvec_parallel_for(n, CVEC_PARTICLE_GRAIN, threads, _particle_range, &ctx);
+}
+
+/* Explicit (forward) Euler: position is advanced with the old velocity. */
+static inline void particle_euler(vec3_soa pos, vec3_soa vel, const vec3_soa *acc,
+                                  size_t n, const particle_params *params, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    _particle_run(_PARTICLE_EULER, pos, vel, acc, n, params, threads);
+    CVEC_PROFILE_END(n);
+}
+
+/* Semi-implicit (symplectic) Euler: position is advanced with the new velocity. */
+static inline void particle_euler_semi(vec3_soa pos, vec3_soa vel, const vec3_soa *acc,
+                                       size_t n, const particle_params *params, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    _particle_run(_PARTICLE_EULER_SEMI, pos, vel, acc, n, params, threads);
+    CVEC_PROFILE_END(n);
+}
+
+/*
+ * Velocity Verlet, split around the force evaluation:
+ *
+ *   particle_verlet_position(pos, vel, acc, ...);    acc is a(t)
+ *   ... recompute acc from the new positions ...
+ *   particle_verlet_velocity(vel, acc, ...);         acc is a(t + dt)
+ *
+ * The first call applies half the velocity change and the whole position
+ * change, the second applies the other half and damping.
+ */
+static inline void particle_verlet_position(vec3_soa pos, vec3_soa vel, const vec3_soa *acc,
+                                            size_t n, const particle_params *params, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    _particle_run(_PARTICLE_VERLET_POSITION, pos, vel, acc, n, params, threads);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void particle_verlet_velocity(vec3_soa vel, const vec3_soa *acc,
+                                            size_t n, const particle_params *params, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    _particle_run(_PARTICLE_VERLET_VELOCITY, Vec3Soa(NULL, NULL, NULL), vel, acc, n, params, threads);
+    CVEC_PROFILE_END(n);
+}
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_POLYGON_H
+#define CVEC_POLYGON_H
+
+/*
+ * 2D polygon kernels on vec2: convex hulls and point-in-polygon tests.
+ *
+ * convex_hull_vec2() sorts the points with the threaded radix sort from
+ * cvec_morton.h and then runs Andrew's monotone chain over them, which
+ * is linear once the points are sorted.
+ *
+ * point_in_polygon_batch() tests many points against one polygon with
+ * the even-odd rule. It loops over edges for a block of points at a
+ * time, so the inner loop has no branches and vectorizes; each edge's
+ * slope is divided out once per block instead of once per point.
+ *
+ * Points exactly on the boundary may be classed either way.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cvec.h"
+#include "cvec_morton.h"
+
+#define _CVEC_POLYGON_BLOCK 256
+
+/* Kernels, defined below or in libcvec; see CVEC_KERNEL in cvec.h. */
+
+CVEC_KERNEL int convex_hull_vec2(const vec2 *points, size_t n, vec2 *hull, size_t *count,
+                                 int threads);
+CVEC_KERNEL int point_in_polygon(const vec2 *poly, size_t m, vec2 p);
+CVEC_KERNEL void point_in_polygon_batch(const vec2 *poly, size_t m, const vec2 *points,
+                                        uint8_t *inside, size_t n);
+
+#if _CVEC_KERNEL_BODY
+
+/* Convex hull */
+
+/* Maps a float to a uint32_t with the same order (-0 and +0 alike). */
+static inline uint32_t _polygon_order(float f)
+{
+    union { float f; uint32_t u; } v;
+    v.f = f + 0.0f;
+    return v.u ^ (-(v.u >> 31) | 0x80000000u);
+}
+
+static inline void _polygon_sort_keys(const vec2 *restrict points, uint64_t *restrict keys,
+                                      uint32_t *restrict order, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        keys[i] = (uint64_t)_polygon_order(points[i].x) << 32 | _polygon_order(points[i].y);
+        order[i] = (uint32_t)i;
+    }
+}
+
+/* Twice the signed area of triangle o, a, b; positive if counter-clockwise. */
+static inline float _polygon_cross(vec2 o, vec2 a, vec2 b)
+{
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+/*
+ * Convex hull of n points. Writes the hull vertices to 'hull', which must
+ * have room for n points, in counter-clockwise order starting from the
+ * point with the lowest x (then lowest y), and their number to *count.
+ * Collinear and duplicate points are dropped, so a hull may have fewer
+ * than three vertices. The sort uses up to 'threads' threads. Returns -1
+ * with errno set if n is too large or scratch memory ran out. The points
+ * must not be NaN.
+ */
+CVEC_KERNEL int convex_hull_vec2(const vec2 *points, size_t n, vec2 *hull, size_t *count,
+                                 int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    uint64_t *keys;
+    uint32_t *order, *stack;
+    size_t i, m, k, lower;
+
+    *count = 0;
+    if (n > UINT32_MAX) {
+        errno = EINVAL;
+        CVEC_PROFILE_END(n);
+        return -1;
+    }
+
+    keys = malloc(sizeof(uint64_t) * (n > 0 ? n : 1));
+    order = malloc(sizeof(uint32_t) * (n > 0 ? n : 1));
+    /* The chain can hold lower hull points again while building the upper. */
+    stack = malloc(sizeof(uint32_t) * 2 * (n > 0 ? n : 1));
+    if (!keys || !order || !stack) {
+        goto fail;
+    }
+    _polygon_sort_keys(points, keys, order, n);
+    if (cvec_radix_sort(keys, order, n, 64, threads) < 0) {
+        goto fail;
+    }
+
+    /* Drop duplicates; equal keys are equal points. */
+    m = 0;
+    for (i = 0; i < n; i++) {
+        if (m == 0 || keys[i] != keys[m - 1]) {
+            keys[m] = keys[i];
+            order[m] = order[i];
+            m++;
+        }
+    }
+
+    if (m <= 2) {
+        for (i = 0; i < m; i++) {
+            hull[i] = points[order[i]];
+        }
+        *count = m;
+        goto out;
+    }
+
+    k = 0;
+    for (i = 0; i < m; i++) {
+        vec2 p = points[order[i]];
+        while (k >= 2 && _polygon_cross(points[stack[k - 2]], points[stack[k - 1]], p) <= 0) {
+            k--;
+        }
+        stack[k++] = order[i];
+    }
+    lower = k + 1;
+    for (i = m - 1; i-- > 0;) {
+        vec2 p = points[order[i]];
+        while (k >= lower && _polygon_cross(points[stack[k - 2]], points[stack[k - 1]], p) <= 0) {
+            k--;
+        }
+        stack[k++] = order[i];
+    }
+
+    /* The last point closes the loop back to the first. */
+    for (i = 0; i < k - 1; i++) {
+        hull[i] = points[stack[i]];
+    }
+    *count = k - 1;
+
+out:
+    free(keys);
+    free(order);
+    free(stack);
+    CVEC_PROFILE_END(n);
+    return 0;
+
+fail:
+    free(keys);
+    free(order);
+    free(stack);
+    errno = ENOMEM;
+    CVEC_PROFILE_END(n);
+    return -1;
+}
+
+/* Point in polygon */
+
+/*
+ * Toggles inside[i] for each point whose rightward ray crosses the edge
+ * from (ax, ay) to (bx, by). slope is dx/dy of the edge.
+ */
+static inline void _polygon_crossings(const float *restrict px, const float *restrict py,
+                                      uint8_t *restrict inside, size_t n,
+                                      float ax, float ay, float by, float slope)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        uint8_t spans = (py[i] < ay) != (py[i] < by);
+        uint8_t left = px[i] < ax + (py[i] - ay) * slope;
+        inside[i] ^= spans & left;
+    }
+}
+
+/* Whether p is inside the polygon of m vertices, by the even-odd rule. */
+CVEC_KERNEL int point_in_polygon(const vec2 *poly, size_t m, vec2 p)
+{
+    size_t i, j;
+    uint8_t inside = 0;
+
+    for (i = 0, j = m - 1; i < m; j = i++) {
+        float slope = (poly[j].x - poly[i].x) / (poly[j].y - poly[i].y);
+        _polygon_crossings(&p.x, &p.y, &inside, 1, poly[i].x, poly[i].y, poly[j].y, slope);
+    }
+    return inside;
+}
+
+/*
+ * inside[i] = point_in_polygon(poly, m, points[i]) as 0 or 1. The
+ * polygon is closed implicitly and may be concave or self-intersecting.
+ */
+CVEC_KERNEL void point_in_polygon_batch(const vec2 *poly, size_t m, const vec2 *points,
+                                        uint8_t *inside, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    float px[_CVEC_POLYGON_BLOCK], py[_CVEC_POLYGON_BLOCK];
+    size_t base, b, i, j;
+
+    for (base = 0; base < n; base += b) {
+        b = n - base < _CVEC_POLYGON_BLOCK ? n - base : _CVEC_POLYGON_BLOCK;
+        for (i = 0; i < b; i++) {
+            px[i] = points[base + i].x;
+            py[i] = points[base + i].y;
+        }
+        memset(inside + base, 0, b);
+        for (i = 0, j = m - 1; i < m; j = i++) {
+            float slope = (poly[j].x - poly[i].x) / (poly[j].y - poly[i].y);
+            _polygon_crossings(px, py, inside + base, b, poly[i].x, poly[i].y, poly[j].y, slope);
+        }
+    }
+    CVEC_PROFILE_END(n);
+}
+
+#endif /* _CVEC_KERNEL_BODY */
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_PROFILE_H
+#define CVEC_PROFILE_H
+
+/*
+ * Opt-in profiling of cvec entry points.
+ *
+ * Build with -DCVEC_PROFILE to make the public vec*_ and mat*_ functions
+ * and the batch kernels record, per function name:
+ *
+ *   calls     number of calls
+ *   elements  number of vectors, points, particles, ... processed
+ *   cycles    time spent inside the function, in TSC cycles on x86 and
+ *             nanoseconds elsewhere
+ *
+ * Scalar functions such as vec3_add() only count calls: they run in a few
+ * cycles, so timing them would measure the timer. Counters are kept per
+ * thread and summed when read. cvec_profile_report() prints them sorted
+ * by cycles (then calls), and the same report goes to stderr at exit
+ * unless CVEC_PROFILE_NO_ATEXIT is defined.
+ *
+ * The profiling build needs GCC or Clang (thread-local storage, atomics
+ * and weak symbols, the latter so all translation units share one set of
+ * counters) and POSIX threads. Without CVEC_PROFILE every macro here
+ * expands to nothing.
+ *
+ * Instrumenting a function:
+ *
+ *   CVEC_PROFILE_CALL();          count a call to the enclosing function
+ *   CVEC_PROFILE_BEGIN();         start timing (declares locals)
+ *   ...
+ *   CVEC_PROFILE_END(n);          record a call over n elements
+ */
+
+#if defined(CVEC_PROFILE)
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef CVEC_PROFILE_MAX_SITES
+#define CVEC_PROFILE_MAX_SITES 512
+#endif
+
+struct _cvec_profile_counter {
+    uint64_t calls;
+    uint64_t elements;
+    uint64_t cycles;
+};
+
+struct _cvec_profile_thread {
+    struct _cvec_profile_counter counters[CVEC_PROFILE_MAX_SITES];
+    struct _cvec_profile_thread *next;
+};
+
+struct _cvec_profile_state {
+    pthread_mutex_t lock;
+    int num_sites;
+    int atexit_registered;
+    const char *names[CVEC_PROFILE_MAX_SITES];
+    struct _cvec_profile_thread *threads;
+};
+
+__attribute__((weak)) struct _cvec_profile_state _cvec_profile = { PTHREAD_MUTEX_INITIALIZER, 0, 0, { 0 }, 0 };
+__attribute__((weak)) __thread struct _cvec_profile_thread *_cvec_profile_self;
+
+static inline uint64_t _cvec_profile_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void cvec_profile_report(FILE *fp);
+
+static inline void _cvec_profile_atexit(void)
+{
+    cvec_profile_report(stderr);
+}
+
+static inline int _cvec_profile_register(int *site, const char *name)
+{
+    int id;
+
+    pthread_mutex_lock(&_cvec_profile.lock);
+    id = *site;
+    if (id < 0) {
+        for (id = 0; id < _cvec_profile.num_sites; id++) {
+            if (strcmp(_cvec_profile.names[id], name) == 0) {
+                break;
+            }
+        }
+        if (id == _cvec_profile.num_sites && id < CVEC_PROFILE_MAX_SITES) {
+            _cvec_profile.names[_cvec_profile.num_sites++] = name;
+        }
+        __atomic_store_n(site, id, __ATOMIC_RELEASE);
+    }
+#if !defined(CVEC_PROFILE_NO_ATEXIT)
+    if (!_cvec_profile.atexit_registered) {
+        _cvec_profile.atexit_registered = 1;
+        atexit(_cvec_profile_atexit);
+    }
+#endif
+    pthread_mutex_unlock(&_cvec_profile.lock);
+    return id;
+}
+
+static inline struct _cvec_profile_thread *_cvec_profile_thread(void)
+{
+    struct _cvec_profile_thread *t = _cvec_profile_self;
+    if (!t) {
+        t = (struct _cvec_profile_thread *)calloc(1, sizeof(*t));
+        if (!t) {
+            return NULL;
+        }
+        pthread_mutex_lock(&_cvec_profile.lock);
+        t->next = _cvec_profile.threads;
+        _cvec_profile.threads = t;
+        pthread_mutex_unlock(&_cvec_profile.lock);
+        _cvec_profile_self = t;
+    }
+    return t;
+}
+
+static inline void _cvec_profile_record(int *site, const char *name, uint64_t elements, uint64_t cycles)
+{
+    struct _cvec_profile_thread *t;
+    int id = __atomic_load_n(site, __ATOMIC_ACQUIRE);
+
+    if (id < 0) {
+        id = _cvec_profile_register(site, name);
+    }
+    if (id >= CVEC_PROFILE_MAX_SITES || !(t = _cvec_profile_thread())) {
+        return;
+    }
+    t->counters[id].calls++;
+    t->counters[id].elements += elements;
+    t->counters[id].cycles += cycles;
+}
+
+/* Sums the counters of every thread; the caller holds the lock. */
+static inline void _cvec_profile_sum(int id, struct _cvec_profile_counter *r)
+{
+    struct _cvec_profile_thread *t;
+    memset(r, 0, sizeof(*r));
+    for (t = _cvec_profile.threads; t; t = t->next) {
+        r->calls += t->counters[id].calls;
+        r->elements += t->counters[id].elements;
+        r->cycles += t->counters[id].cycles;
+    }
+}
+
+/* Returns 0 and the totals for 'name', or -1 if it has never been called. */
+static inline int cvec_profile_get(const char *name, uint64_t *calls, uint64_t *elements, uint64_t *cycles)
+{
+    struct _cvec_profile_counter c;
+    int id, ret = -1;
+
+    pthread_mutex_lock(&_cvec_profile.lock);
+    for (id = 0; id < _cvec_profile.num_sites; id++) {
+        if (strcmp(_cvec_profile.names[id], name) == 0) {
+            _cvec_profile_sum(id, &c);
+            if (calls) {
+                *calls = c.calls;
+            }
+            if (elements) {
+                *elements = c.elements;
+            }
+            if (cycles) {
+                *cycles = c.cycles;
+            }
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_cvec_profile.lock);
+    return ret;
+}
+
+static inline void cvec_profile_reset(void)
+{
+    struct _cvec_profile_thread *t;
+    pthread_mutex_lock(&_cvec_profile.lock);
+    for (t = _cvec_profile.threads; t; t = t->next) {
+        memset(t->counters, 0, sizeof(t->counters));
+    }
+    pthread_mutex_unlock(&_cvec_profile.lock);
+}
+
+static inline void cvec_profile_report(FILE *fp)
+{
+    static struct _cvec_profile_counter totals[CVEC_PROFILE_MAX_SITES];
+    int order[CVEC_PROFILE_MAX_SITES];
+    int n, i, j;
+
+    pthread_mutex_lock(&_cvec_profile.lock);
+    n = _cvec_profile.num_sites;
+    for (i = 0; i < n; i++) {
+        _cvec_profile_sum(i, &totals[i]);
+        order[i] = i;
+    }
+
+    /* Insertion sort by cycles, then calls, descending. */
+    for (i = 1; i < n; i++) {
+        int id = order[i];
+        for (j = i; j > 0; j--) {
+            struct _cvec_profile_counter *a = &totals[order[j-1]], *b = &totals[id];
+            if (a->cycles > b->cycles || (a->cycles == b->cycles && a->calls >= b->calls)) {
+                break;
+            }
+            order[j] = order[j-1];
+        }
+        order[j] = id;
+    }
+
+    fprintf(fp, "%-32s %14s %14s %16s %10s\n", "function", "calls", "elements", "cycles", "cyc/elem");
+    for (i = 0; i < n; i++) {
+        struct _cvec_profile_counter *c = &totals[order[i]];
+        if (c->calls == 0) {
+            continue;
+        }
+        fprintf(fp, "%-32s %14llu %14llu %16llu %10.2f\n", _cvec_profile.names[order[i]],
+                (unsigned long long)c->calls, (unsigned long long)c->elements,
+                (unsigned long long)c->cycles, c->elements ? (double)c->cycles / c->elements : 0.0);
+    }
+    pthread_mutex_unlock(&_cvec_profile.lock);
+}
+
+#define CVEC_PROFILE_CALL() \
+    do { \
+        static int _cvec_profile_site = -1; \
+        _cvec_profile_record(&_cvec_profile_site, __func__, 1, 0); \
+    } while (0)
+
+#define CVEC_PROFILE_BEGIN() \
+    static int _cvec_profile_site = -1; \
+    uint64_t _cvec_profile_t0 = _cvec_profile_cycles()
+
+#define CVEC_PROFILE_END(n) \
+    _cvec_profile_record(&_cvec_profile_site, __func__, (n), _cvec_profile_cycles() - _cvec_profile_t0)
+
+#else
+
+#define CVEC_PROFILE_CALL() ((void)0)
+#define CVEC_PROFILE_BEGIN() ((void)0)
+#define CVEC_PROFILE_END(n) ((void)0)
+
+#define cvec_profile_report(fp) ((void)(fp))
+#define cvec_profile_reset() ((void)0)
+#define cvec_profile_get(name, calls, elements, cycles) (-1)
+
+#endif
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_QUANT_H
+#define CVEC_QUANT_H
+
+/*
+ * Compact storage formats for vector arrays.
+ *
+ * half: IEEE 754 binary16, 2 bytes per component. Conversion rounds to
+ *   nearest even. For |v| in [6.1e-5, 65504] the relative error is at most
+ *   2^-11 (4.9e-4); below that the absolute error is at most 2^-25 (3e-8).
+ *   Larger magnitudes become infinity. Uses F16C when built with -mf16c.
+ *
+ * oct32: unit vectors in octahedral encoding, two snorm16 values packed
+ *   in a uint32_t (x in the low half). The angular error after decoding
+ *   is below 1e-4 radians (0.006 degrees). Inputs must be normalized.
+ *
+ * pos16: positions as three uint16_t quantized against an aabb. The
+ *   per-axis error is at most size/131070, where size is the extent of
+ *   the bounds along that axis. Points outside the bounds are clamped.
+ *
+ * The mat*_transform_*_batch() kernels consume the packed formats
+ * directly, folding dequantization into the transform so there is no
+ * separate decode pass over memory.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "cvec.h"
+
+#if defined(__F16C__) && defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+
+/* half */
+
+static inline uint16_t half_encode(float f)
+{
+    const uint32_t f16max = (127 + 16) << 23;
+    const uint32_t f32inf = 255 << 23;
+    const uint32_t denorm_magic_bits = ((127 - 15) + (23 - 10) + 1) << 23;
+    uint32_t u, sign;
+    uint16_t r;
+
+    memcpy(&u, &f, sizeof(u));
+    sign = u & 0x80000000u;
+    u ^= sign;
+
+    if (u >= f16max) {
+        /* Infinity, NaN, or too large for a half. */
+        r = u > f32inf ? 0x7e00 : 0x7c00;
+    } else if (u < (113u << 23)) {
+        /* Subnormal or zero: let the FPU do the rounding. */
+        float denorm_magic;
+        memcpy(&denorm_magic, &denorm_magic_bits, sizeof(denorm_magic));
+        memcpy(&f, &u, sizeof(f));
+        f += denorm_magic;
+        memcpy(&u, &f, sizeof(u));
+        r = (uint16_t)(u - denorm_magic_bits);
+    } else {
+        uint32_t mant_odd = (u >> 13) & 1;
+        u += ((uint32_t)(15 - 127) << 23) + 0xfff;
+        u += mant_odd;
+        r = (uint16_t)(u >> 13);
+    }
+
+    return r | (uint16_t)(sign >> 16);
+}
+
+static inline float half_decode(uint16_t h)
+{
+    const uint32_t shifted_exp = 0x7c00 << 13;
+    const uint32_t magic_bits = 113 << 23;
+    uint32_t u = (uint32_t)(h & 0x7fff) << 13;
+    uint32_t exp = u & shifted_exp;
+    float f;
+
+    u += (127 - 15) << 23;
+    if (exp == shifted_exp) {
+        /* Infinity or NaN */
+        u += (128 - 16) << 23;
+    } else if (exp == 0) {
+        /* Zero or subnormal */
+        float magic;
+        memcpy(&magic, &magic_bits, sizeof(magic));
+        u += 1 << 23;
+        memcpy(&f, &u, sizeof(f));
+        f -= magic;
+        memcpy(&u, &f, sizeof(u));
+    }
+    u |= (uint32_t)(h & 0x8000) << 16;
+
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/* Converts n floats. vec3/vec4 arrays can be passed as 3n/4n floats. */
+static inline void half_encode_batch(const float *restrict in, uint16_t *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(out + i), h);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = half_encode(in[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void half_decode_batch(const uint16_t *restrict in, float *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = half_decode(in[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec3_encode_half_batch(const vec3 *in, uint16_t *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    half_encode_batch((const float *)in, out, 3*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec3_decode_half_batch(const uint16_t *in, vec3 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    half_decode_batch(in, (float *)out, 3*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec4_encode_half_batch(const vec4 *in, uint16_t *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    half_encode_batch((const float *)in, out, 4*n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void vec4_decode_half_batch(const uint16_t *in, vec4 *out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    half_decode_batch(in, (float *)out, 4*n);
+    CVEC_PROFILE_END(n);
+}
+
+
+/* oct32 */
+
+static inline float _quant_sign(float v)
+{
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+static inline int16_t _quant_snorm16(float v)
+{
+    v = v < -1.0f ? -1.0f : v > 1.0f ? 1.0f : v;
+    return (int16_t)(v * 32767.0f + (v >= 0.0f ? 0.5f : -0.5f));
+}
+
+static inline uint32_t oct32_encode(vec3 n)
+{
+    float inv_l1 = 1.0f / (fabsf(n.x) + fabsf(n.y) + fabsf(n.z));
+    float u = n.x * inv_l1;
+    float v = n.y * inv_l1;
+    float fu = (1.0f - fabsf(v)) * _quant_sign(u);
+    float fv = (1.0f - fabsf(u)) * _quant_sign(v);
+
+    /* Fold the lower hemisphere over the diagonals. */
+    u = n.z < 0.0f ? fu : u;
+    v = n.z < 0.0f ? fv : v;
+
+    return (uint16_t)_quant_snorm16(u) | ((uint32_t)(uint16_t)_quant_snorm16(v) << 16);
+}
+
+static inline vec3 oct32_decode(uint32_t e)
+{
+    float u = (int16_t)(e & 0xffff) * (1.0f / 32767.0f);
+    float v = (int16_t)(e >> 16) * (1.0f / 32767.0f);
+    float z = 1.0f - fabsf(u) - fabsf(v);
+    float t = z < 0.0f ? -z : 0.0f;
+    u += u >= 0.0f ? -t : t;
+    v += v >= 0.0f ? -t : t;
+    return vec3_normalize(Vec3(u, v, z));
+}
+
+static inline void oct32_encode_batch(const vec3 *restrict in, uint32_t *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = oct32_encode(in[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void oct32_decode_batch(const uint32_t *restrict in, vec3 *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = oct32_decode(in[i]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+
+/* pos16 */
+
+static inline vec3 _pos16_scale(aabb bounds)
+{
+    vec3 d = aabb_size(bounds);
+    return Vec3(d.x > 0 ? 65535.0f / d.x : 0,
+                d.y > 0 ? 65535.0f / d.y : 0,
+                d.z > 0 ? 65535.0f / d.z : 0);
+}
+
+static inline uint16_t _pos16_quantize(float v, float min, float scale)
+{
+    float q = (v - min) * scale + 0.5f;
+    q = q > 0.0f ? q : 0.0f;
+    q = q < 65535.0f ? q : 65535.0f;
+    return (uint16_t)q;
+}
+
+/* Writes 3n values to out. */
+static inline void pos16_encode_batch(const vec3 *restrict in, uint16_t *restrict out,
+                                      size_t n, aabb bounds)
+{
+    CVEC_PROFILE_BEGIN();
+    vec3 s = _pos16_scale(bounds);
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[3*i+0] = _pos16_quantize(in[i].x, bounds.min.x, s.x);
+        out[3*i+1] = _pos16_quantize(in[i].y, bounds.min.y, s.y);
+        out[3*i+2] = _pos16_quantize(in[i].z, bounds.min.z, s.z);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void pos16_decode_batch(const uint16_t *restrict in, vec3 *restrict out,
+                                      size_t n, aabb bounds)
+{
+    CVEC_PROFILE_BEGIN();
+    vec3 d = vec3_scale(aabb_size(bounds), 1.0f / 65535.0f);
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = Vec3(bounds.min.x + in[3*i+0] * d.x,
+                      bounds.min.y + in[3*i+1] * d.y,
+                      bounds.min.z + in[3*i+2] * d.z);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+
+/* Transforms of packed data */
+
+/*
+ * Transforms n pos16 points by the affine matrix m, treating them as
+ * (x, y, z, 1) and dropping w. The dequantization scale and offset are
+ * folded into a single 3x4 matrix up front.
+ */
+static inline void mat4_transform_pos16_batch(const mat4 *m, const uint16_t *restrict in,
+                                              vec3 *restrict out, size_t n, aabb bounds)
+{
+    CVEC_PROFILE_BEGIN();
+    vec3 d = vec3_scale(aabb_size(bounds), 1.0f / 65535.0f);
+    float a[3][4];
+    size_t i;
+    int r;
+
+    for (r = 0; r < 3; r++) {
+        vec4 row = mat4_row(m, r);
+        a[r][0] = row.x * d.x;
+        a[r][1] = row.y * d.y;
+        a[r][2] = row.z * d.z;
+        a[r][3] = row.w + vec3_dot(Vec3(row.x, row.y, row.z), bounds.min);
+    }
+
+    for (i = 0; i < n; i++) {
+        float x = in[3*i+0], y = in[3*i+1], z = in[3*i+2];
+        out[i] = Vec3(a[0][0]*x + a[0][1]*y + a[0][2]*z + a[0][3],
+                      a[1][0]*x + a[1][1]*y + a[1][2]*z + a[1][3],
+                      a[2][0]*x + a[2][1]*y + a[2][2]*z + a[2][3]);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/*
+ * Decodes and transforms n oct32 normals by m, renormalizing the result.
+ * m should be the inverse transpose of the position transform if that
+ * has non-uniform scale.
+ */
+static inline void mat3_transform_oct32_batch(const mat3 *m, const uint32_t *restrict in,
+                                              vec3 *restrict out, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = vec3_normalize(mat3_transform(m, oct32_decode(in[i])));
+    }
+    CVEC_PROFILE_END(n);
+}
+
+#endif
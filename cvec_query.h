@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_QUERY_H
+#define CVEC_QUERY_H
+
+/*
+ * Closest-point queries of points against segments, triangles and boxes.
+ *
+ * Each query returns the squared distance and stores the closest point
+ * on the primitive. The kernels have no data-dependent branches: region
+ * tests become selects and blends, so the batch loops vectorize and run
+ * at the same speed whichever side of a primitive the points fall on.
+ *
+ * The batch versions pair point i with primitive i. The AoS versions take
+ * segments as 2 consecutive vec3s and triangles as 3, the same layout as
+ * bvh_build_triangles(). The SoA versions take one vec3_soa per vertex.
+ * A degenerate segment or triangle still yields its closest point.
+ */
+
+#include <stddef.h>
+#include "cvec.h"
+#include "cvec_batch.h"
+
+/*
+ * The per-element kernels must be inlined into the batch loops for those
+ * to vectorize, and GCC stops inlining the triangle kernel in large
+ * translation units without a nudge.
+ */
+#if defined(__GNUC__)
+#define _CVEC_QUERY_KERNEL static inline __attribute__((always_inline))
+#else
+#define _CVEC_QUERY_KERNEL static inline
+#endif
+
+/*
+ * num/den clamped to [0, 1]; 0 if den <= 0. Clamping num before the
+ * divide, rather than the quotient, lets GCC if-convert the loops that
+ * use it. For den <= 0 the clamps leave num at 0 and the divisor is
+ * |den| + 1, never 0, so the result is 0 rather than NaN.
+ */
+_CVEC_QUERY_KERNEL float _query_ratio(float num, float den)
+{
+    num = num < den ? num : den;
+    num = num > 0 ? num : 0;
+    return num / (fabsf(den) + (den <= 0));
+}
+
+/* Closest point to p on segment ab, as a + t*(b - a). */
+_CVEC_QUERY_KERNEL float _query_segment(float px, float py, float pz,
+                                   float ax, float ay, float az,
+                                   float bx, float by, float bz,
+                                   float *cx, float *cy, float *cz)
+{
+    float ex = bx - ax, ey = by - ay, ez = bz - az;
+    float t = _query_ratio((px - ax)*ex + (py - ay)*ey + (pz - az)*ez, ex*ex + ey*ey + ez*ez);
+    float x = ax + t*ex, y = ay + t*ey, z = az + t*ez;
+    float dx = px - x, dy = py - y, dz = pz - z;
+
+    *cx = x;
+    *cy = y;
+    *cz = z;
+    return dx*dx + dy*dy + dz*dz;
+}
+
+/*
+ * Ericson's Voronoi region test (Real-Time Collision Detection, 5.1.5)
+ * without the early returns: every candidate point is computed and the
+ * region masks pick one. Later blends override earlier ones, so they run
+ * in reverse order of the branchy version's tests. Blending instead of
+ * selecting keeps GCC from sinking each candidate into its own branch,
+ * which it then refuses to if-convert.
+ */
+_CVEC_QUERY_KERNEL float _query_triangle(float px, float py, float pz,
+                                    float ax, float ay, float az,
+                                    float bx, float by, float bz,
+                                    float qx, float qy, float qz,
+                                    float *cx, float *cy, float *cz)
+{
+    float abx = bx - ax, aby = by - ay, abz = bz - az;
+    float acx = qx - ax, acy = qy - ay, acz = qz - az;
+    float bcx = qx - bx, bcy = qy - by, bcz = qz - bz;
+    float apx = px - ax, apy = py - ay, apz = pz - az;
+    float bpx = px - bx, bpy = py - by, bpz = pz - bz;
+    float cpx = px - qx, cpy = py - qy, cpz = pz - qz;
+    float d1 = abx*apx + aby*apy + abz*apz, d2 = acx*apx + acy*apy + acz*apz;
+    float d3 = abx*bpx + aby*bpy + abz*bpz, d4 = acx*bpx + acy*bpy + acz*bpz;
+    float d5 = abx*cpx + aby*cpy + abz*cpz, d6 = acx*cpx + acy*cpy + acz*cpz;
+    float va = d3*d6 - d5*d4, vb = d5*d2 - d1*d6, vc = d1*d4 - d3*d2;
+    float v = _query_ratio(vb, va + vb + vc), w = _query_ratio(vc, va + vb + vc);
+    float tab = _query_ratio(d1, d1 - d3);
+    float tac = _query_ratio(d2, d2 - d6);
+    float tbc = _query_ratio(d4 - d3, (d4 - d3) + (d5 - d6));
+    float k_a = (d1 <= 0) & (d2 <= 0);
+    float k_b = (d3 >= 0) & (d4 <= d3);
+    float k_ab = (vc <= 0) & (d1 >= 0) & (d3 <= 0);
+    float k_c = (d6 >= 0) & (d5 <= d6);
+    float k_ac = (vb <= 0) & (d2 >= 0) & (d6 <= 0);
+    float k_bc = (va <= 0) & (d4 - d3 >= 0) & (d5 - d6 >= 0);
+    float x = ax + v*abx + w*acx, y = ay + v*aby + w*acy, z = az + v*abz + w*acz;
+    float dx, dy, dz;
+
+    x += k_bc * (bx + tbc*bcx - x);
+    y += k_bc * (by + tbc*bcy - y);
+    z += k_bc * (bz + tbc*bcz - z);
+    x += k_ac * (ax + tac*acx - x);
+    y += k_ac * (ay + tac*acy - y);
+    z += k_ac * (az + tac*acz - z);
+    x += k_c * (qx - x);
+    y += k_c * (qy - y);
+    z += k_c * (qz - z);
+    x += k_ab * (ax + tab*abx - x);
+    y += k_ab * (ay + tab*aby - y);
+    z += k_ab * (az + tab*abz - z);
+    x += k_b * (bx - x);
+    y += k_b * (by - y);
+    z += k_b * (bz - z);
+    x += k_a * (ax - x);
+    y += k_a * (ay - y);
+    z += k_a * (az - z);
+
+    dx = px - x;
+    dy = py - y;
+    dz = pz - z;
+    *cx = x;
+    *cy = y;
+    *cz = z;
+    return dx*dx + dy*dy + dz*dz;
+}
+
+_CVEC_QUERY_KERNEL float _query_aabb(float px, float py, float pz,
+                                float lx, float ly, float lz,
+                                float hx, float hy, float hz,
+                                float *cx, float *cy, float *cz)
+{
+    /* Written as max then min so that scalar code gets maxss/minss. */
+    float x = px > lx ? px : lx;
+    float y = py > ly ? py : ly;
+    float z = pz > lz ? pz : lz;
+    float dx, dy, dz;
+
+    x = x < hx ? x : hx;
+    y = y < hy ? y : hy;
+    z = z < hz ? z : hz;
+    dx = px - x;
+    dy = py - y;
+    dz = pz - z;
+    *cx = x;
+    *cy = y;
+    *cz = z;
+    return dx*dx + dy*dy + dz*dz;
+}
+
+/* Returns the squared distance from p to segment ab. */
+static inline float closest_point_segment(vec3 p, vec3 a, vec3 b, vec3 *closest)
+{
+    return _query_segment(p.x, p.y, p.z, a.x, a.y, a.z, b.x, b.y, b.z,
+                          &closest->x, &closest->y, &closest->z);
+}
+
+/* Returns the squared distance from p to triangle abc. */
+static inline float closest_point_triangle(vec3 p, vec3 a, vec3 b, vec3 c, vec3 *closest)
+{
+    return _query_triangle(p.x, p.y, p.z, a.x, a.y, a.z, b.x, b.y, b.z, c.x, c.y, c.z,
+                           &closest->x, &closest->y, &closest->z);
+}
+
+/* Returns the squared distance from p to box; zero if p is inside. */
+static inline float closest_point_aabb(vec3 p, aabb box, vec3 *closest)
+{
+    return _query_aabb(p.x, p.y, p.z, box.min.x, box.min.y, box.min.z,
+                       box.max.x, box.max.y, box.max.z,
+                       &closest->x, &closest->y, &closest->z);
+}
+
+/*
+ * Batch loops over component arrays. They take restrict pointers, which
+ * is what lets them vectorize.
+ */
+static inline void _query_segment_soa(const float *restrict px, const float *restrict py, const float *restrict pz,
+                                      const float *restrict ax, const float *restrict ay, const float *restrict az,
+                                      const float *restrict bx, const float *restrict by, const float *restrict bz,
+                                      float *restrict cx, float *restrict cy, float *restrict cz,
+                                      float *restrict dist2, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        float x, y, z;
+        dist2[i] = _query_segment(px[i], py[i], pz[i], ax[i], ay[i], az[i], bx[i], by[i], bz[i],
+                                  &x, &y, &z);
+        cx[i] = x;
+        cy[i] = y;
+        cz[i] = z;
+    }
+}
+
+static inline void _query_triangle_soa(const float *restrict px, const float *restrict py, const float *restrict pz,
+                                       const float *restrict ax, const float *restrict ay, const float *restrict az,
+                                       const float *restrict bx, const float *restrict by, const float *restrict bz,
+                                       const float *restrict qx, const float *restrict qy, const float *restrict qz,
+                                       float *restrict cx, float *restrict cy, float *restrict cz,
+                                       float *restrict dist2, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        float x, y, z;
+        dist2[i] = _query_triangle(px[i], py[i], pz[i], ax[i], ay[i], az[i], bx[i], by[i], bz[i],
+                                   qx[i], qy[i], qz[i], &x, &y, &z);
+        cx[i] = x;
+        cy[i] = y;
+        cz[i] = z;
+    }
+}
+
+static inline void _query_aabb_soa(const float *restrict px, const float *restrict py, const float *restrict pz,
+                                   const float *restrict lx, const float *restrict ly, const float *restrict lz,
+                                   const float *restrict hx, const float *restrict hy, const float *restrict hz,
+                                   float *restrict cx, float *restrict cy, float *restrict cz,
+                                   float *restrict dist2, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        float x, y, z;
+        dist2[i] = _query_aabb(px[i], py[i], pz[i], lx[i], ly[i], lz[i], hx[i], hy[i], hz[i],
+                               &x, &y, &z);
+        cx[i] = x;
+        cy[i] = y;
+        cz[i] = z;
+    }
+}
+
+/*
+ * The AoS segment and triangle versions transpose blocks of
+ * _CVEC_QUERY_BLOCK queries into stack buffers and run the SoA loops on
+ * them; gathering the vec3s costs far less than the scalar kernel.
+ */
+#define _CVEC_QUERY_BLOCK 256
+
+static inline void _query_gather(const vec3 *v, size_t stride, float *x, float *y, float *z, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        x[i] = v[i*stride].x;
+        y[i] = v[i*stride].y;
+        z[i] = v[i*stride].z;
+    }
+}
+
+static inline void _query_scatter(const float *x, const float *y, const float *z, vec3 *v, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        v[i] = Vec3(x[i], y[i], z[i]);
+    }
+}
+
+/* segs holds 2*n vec3s. */
+static inline void closest_point_segment_batch(const vec3 *p, const vec3 *segs,
+                                               vec3 *closest, float *dist2, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    float buf[12][_CVEC_QUERY_BLOCK];
+    size_t base, m;
+
+    for (base = 0; base < n; base += m) {
+        m = n - base < _CVEC_QUERY_BLOCK ? n - base : _CVEC_QUERY_BLOCK;
+        _query_gather(p + base, 1, buf[0], buf[1], buf[2], m);
+        _query_gather(segs + 2*base, 2, buf[3], buf[4], buf[5], m);
+        _query_gather(segs + 2*base + 1, 2, buf[6], buf[7], buf[8], m);
+        _query_segment_soa(buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[6], buf[7], buf[8],
+                           buf[9], buf[10], buf[11], dist2 + base, m);
+        _query_scatter(buf[9], buf[10], buf[11], closest + base, m);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/* tris holds 3*n vec3s. */
+static inline void closest_point_triangle_batch(const vec3 *p, const vec3 *tris,
+                                                vec3 *closest, float *dist2, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    float buf[15][_CVEC_QUERY_BLOCK];
+    size_t base, m;
+
+    for (base = 0; base < n; base += m) {
+        m = n - base < _CVEC_QUERY_BLOCK ? n - base : _CVEC_QUERY_BLOCK;
+        _query_gather(p + base, 1, buf[0], buf[1], buf[2], m);
+        _query_gather(tris + 3*base, 3, buf[3], buf[4], buf[5], m);
+        _query_gather(tris + 3*base + 1, 3, buf[6], buf[7], buf[8], m);
+        _query_gather(tris + 3*base + 2, 3, buf[9], buf[10], buf[11], m);
+        _query_triangle_soa(buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[6], buf[7], buf[8],
+                            buf[9], buf[10], buf[11], buf[12], buf[13], buf[14], dist2 + base, m);
+        _query_scatter(buf[12], buf[13], buf[14], closest + base, m);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void closest_point_aabb_batch(const vec3 *p, const aabb *boxes,
+                                            vec3 *closest, float *dist2, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t i;
+    for (i = 0; i < n; i++) {
+        dist2[i] = _query_aabb(p[i].x, p[i].y, p[i].z,
+                               boxes[i].min.x, boxes[i].min.y, boxes[i].min.z,
+                               boxes[i].max.x, boxes[i].max.y, boxes[i].max.z,
+                               &closest[i].x, &closest[i].y, &closest[i].z);
+    }
+    CVEC_PROFILE_END(n);
+}
+
+/* SoA versions. The outputs must not overlap the inputs. */
+static inline void closest_point_segment_soa_batch(vec3_soa p, vec3_soa a, vec3_soa b,
+                                                   vec3_soa closest, float *dist2, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _query_segment_soa(p.x, p.y, p.z, a.x, a.y, a.z, b.x, b.y, b.z,
+                       closest.x, closest.y, closest.z, dist2, n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void closest_point_triangle_soa_batch(vec3_soa p, vec3_soa a, vec3_soa b, vec3_soa c,
+                                                    vec3_soa closest, float *dist2, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _query_triangle_soa(p.x, p.y, p.z, a.x, a.y, a.z, b.x, b.y, b.z, c.x, c.y, c.z,
+                        closest.x, closest.y, closest.z, dist2, n);
+    CVEC_PROFILE_END(n);
+}
+
+static inline void closest_point_aabb_soa_batch(vec3_soa p, vec3_soa min, vec3_soa max,
+                                                vec3_soa closest, float *dist2, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    _query_aabb_soa(p.x, p.y, p.z, min.x, min.y, min.z, max.x, max.y, max.z,
+                    closest.x, closest.y, closest.z, dist2, n);
+    CVEC_PROFILE_END(n);
+}
+
+#endif
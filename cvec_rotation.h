@@ -0,0 +1,575 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_ROTATION_H
+#define CVEC_ROTATION_H
+
+/*
+ * Rotations by multiples of a fixed step angle, without libm calls per
+ * rotation.
+ *
+ * A rot_table holds the rotations by 2*pi*k/steps about one axis for
+ * k in [0, steps). Lookups wrap k, so any int step works, and build a
+ * mat2, mat3 or quaternion from the stored cosines and sines with a few
+ * multiplies. The table is computed in double precision and rounded, so
+ * each stored value is within 0.5 ulp of exact. Calling
+ * mat2_init_rotate() with the float angle 2*pi*k/steps is less accurate,
+ * because the angle itself is rounded to float first. regress measures
+ * both paths for 4096 steps: the direct path is off by up to 2 ulp of
+ * 1.0, the table by at most 0.25.
+ *
+ * A rot_sweep walks the rotations start, start + step, ... for sweeps
+ * that do not line up with a table. It advances (cos, sin) of the half
+ * angle by one complex multiply in double precision. It rescales that
+ * pair to unit length every CVEC_ROTATION_RENORM steps with a Newton
+ * step, which needs no sqrt. Every matrix it yields is then orthonormal
+ * to float precision. The angle drifts by about 1e-16 rad per step, so
+ * over 10^5 steps regress still finds it as accurate as the table.
+ *
+ * Both use the conventions of mat2_init_rotate(), mat3_init_rotate()
+ * and quat_from_axis_angle(). A zero axis means no rotation.
+ *
+ * Rotations built up by repeated multiplication drift away from
+ * orthonormal. mat3_orthonormal_error() measures that drift as the
+ * largest entry of |M^T M - I|. Two corrections are provided:
+ *
+ *  - mat3_orthonormalize() is Gram-Schmidt. It keeps the direction of
+ *    the first column, and the result is always right-handed. It works
+ *    for any matrix whose first two columns are independent.
+ *  - mat3_orthonormalize_polar() moves all three columns evenly to the
+ *    nearest orthonormal matrix, with CVEC_ROTATION_POLAR_STEPS Newton
+ *    steps and no sqrt. Each step squares the error, so two are enough
+ *    for drift up to about 1e-2. It is meant for drift, not for
+ *    matrices far from orthonormal (error near 1 or more).
+ *
+ * The _batch versions work on whole arrays in blocks. They measure
+ * every matrix, correct only those whose error is above 'tol', and
+ * return how many they corrected. A block with nothing to correct costs
+ * only the measurement. The mat4 versions of all of these work on the
+ * upper-left 3x3 and leave the other entries alone.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include "cvec.h"
+
+#ifndef CVEC_ROTATION_RENORM
+#define CVEC_ROTATION_RENORM 64
+#endif
+
+#ifndef CVEC_ROTATION_POLAR_STEPS
+#define CVEC_ROTATION_POLAR_STEPS 2
+#elif !_CVEC_KERNEL_BODY
+#error "CVEC_ROTATION_POLAR_STEPS must match libcvec, which uses the default; see CVEC_EXTERN in cvec.h"
+#endif
+
+#define _CVEC_ROTATION_BLOCK 256
+
+typedef struct rot_table {
+    vec3 axis;
+    int steps;
+    /* cos and sin of the angle, then of the half angle */
+    vec4 *entries;
+} rot_table;
+
+typedef struct rot_sweep {
+    vec3 axis;
+    /* cos and sin of the current half angle, and of the half step */
+    double ch, sh;
+    double dch, dsh;
+    int count;
+} rot_sweep;
+
+static inline vec3 _rot_axis(vec3 axis)
+{
+    if (vec3_length(axis) == 0) {
+        return Vec3(0, 0, 0);
+    }
+    return vec3_normalize(axis);
+}
+
+static inline void _rot_mat2(float c, float s, mat2 *m)
+{
+    mat2_init(m, c, -s,
+                 s, c);
+}
+
+/* As mat3_init_rotate() given the cosine and sine. */
+static inline void _rot_mat3(vec3 axis, float c, float s, mat3 *m)
+{
+    float x = axis.x, y = axis.y, z = axis.z;
+    float t = 1 - c;
+
+    if (x == 0 && y == 0 && z == 0) {
+        mat3_init_identity(m);
+        return;
+    }
+    mat3_init(m, t*x*x + c,   t*y*x - s*z, t*z*x + s*y,
+                 t*x*y + s*z, t*y*y + c,   t*z*y - s*x,
+                 t*x*z - s*y, t*y*z + s*x, t*z*z + c);
+}
+
+static inline vec4 _rot_quat(vec3 axis, float ch, float sh)
+{
+    if (axis.x == 0 && axis.y == 0 && axis.z == 0) {
+        return Vec4(0, 0, 0, 1);
+    }
+    return Vec4(axis.x * sh, axis.y * sh, axis.z * sh, ch);
+}
+
+/* Tables */
+
+/*
+ * Initializes a table of 'steps' rotations about 'axis'. Returns -1 with
+ * errno set to EINVAL if steps < 1 or ENOMEM.
+ */
+static inline int rot_table_init(rot_table *t, vec3 axis, int steps)
+{
+    const double pi = 3.14159265358979323846;
+    int k;
+
+    t->entries = NULL;
+    if (steps < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    t->entries = malloc(sizeof(vec4) * steps);
+    if (!t->entries) {
+        errno = ENOMEM;
+        return -1;
+    }
+    t->axis = _rot_axis(axis);
+    t->steps = steps;
+    for (k = 0; k < steps; k++) {
+        double a = 2 * pi * k / steps;
+        t->entries[k] = Vec4(cos(a), sin(a), cos(a / 2), sin(a / 2));
+    }
+    return 0;
+}
+
+static inline void rot_table_free(rot_table *t)
+{
+    free(t->entries);
+    t->entries = NULL;
+}
+
+static inline const vec4 *_rot_table_entry(const rot_table *t, int step)
+{
+    int k = step % t->steps;
+    return &t->entries[k < 0 ? k + t->steps : k];
+}
+
+/* The angle of 'step' in radians, in [0, 2*pi). */
+static inline float rot_table_angle(const rot_table *t, int step)
+{
+    const vec4 *e = _rot_table_entry(t, step);
+    return (float)(2 * (e - t->entries) * (3.14159265358979323846 / t->steps));
+}
+
+static inline void rot_table_mat2(const rot_table *t, int step, mat2 *m)
+{
+    CVEC_PROFILE_CALL();
+    const vec4 *e = _rot_table_entry(t, step);
+    _rot_mat2(e->x, e->y, m);
+}
+
+static inline void rot_table_mat3(const rot_table *t, int step, mat3 *m)
+{
+    CVEC_PROFILE_CALL();
+    const vec4 *e = _rot_table_entry(t, step);
+    _rot_mat3(t->axis, e->x, e->y, m);
+}
+
+/*
+ * Unit quaternion of 'step'. Steps k and k + steps give the same
+ * quaternion rather than its negation.
+ */
+static inline vec4 rot_table_quat(const rot_table *t, int step)
+{
+    CVEC_PROFILE_CALL();
+    const vec4 *e = _rot_table_entry(t, step);
+    return _rot_quat(t->axis, e->z, e->w);
+}
+
+/* Sweeps */
+
+/*
+ * Starts a sweep at angle 'start' advancing by 'step' radians. They are
+ * doubles because rounding a step like 2*pi/4096 to float would make
+ * the sweep drift by about 1e-11 rad per step.
+ */
+static inline void rot_sweep_init(rot_sweep *w, vec3 axis, double start, double step)
+{
+    w->axis = _rot_axis(axis);
+    w->ch = cos(start / 2.0);
+    w->sh = sin(start / 2.0);
+    w->dch = cos(step / 2.0);
+    w->dsh = sin(step / 2.0);
+    w->count = 0;
+}
+
+static inline void rot_sweep_next(rot_sweep *w)
+{
+    double ch = w->ch * w->dch - w->sh * w->dsh;
+    double sh = w->sh * w->dch + w->ch * w->dsh;
+
+    if (++w->count == CVEC_ROTATION_RENORM) {
+        /* One Newton step towards 1/sqrt(ch^2 + sh^2), which is near 1. */
+        double k = (3 - (ch*ch + sh*sh)) / 2;
+        ch *= k;
+        sh *= k;
+        w->count = 0;
+    }
+    w->ch = ch;
+    w->sh = sh;
+}
+
+static inline void rot_sweep_mat2(const rot_sweep *w, mat2 *m)
+{
+    CVEC_PROFILE_CALL();
+    _rot_mat2(w->ch*w->ch - w->sh*w->sh, 2*w->ch*w->sh, m);
+}
+
+static inline void rot_sweep_mat3(const rot_sweep *w, mat3 *m)
+{
+    CVEC_PROFILE_CALL();
+    _rot_mat3(w->axis, w->ch*w->ch - w->sh*w->sh, 2*w->ch*w->sh, m);
+}
+
+static inline vec4 rot_sweep_quat(const rot_sweep *w)
+{
+    CVEC_PROFILE_CALL();
+    return _rot_quat(w->axis, w->ch, w->sh);
+}
+
+/* Orthonormalization */
+
+/* Column j of the 3x3 part of a matrix whose columns are d floats apart. */
+static inline vec3 _rot_column(const float *a, int d, int j)
+{
+    return Vec3(a[d*j], a[d*j + 1], a[d*j + 2]);
+}
+
+static inline void _rot_set_column(float *a, int d, int j, vec3 v)
+{
+    a[d*j] = v.x;
+    a[d*j + 1] = v.y;
+    a[d*j + 2] = v.z;
+}
+
+static inline float _rot_max(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+static inline float _rot_error(const float *a, int d)
+{
+    vec3 c0 = _rot_column(a, d, 0), c1 = _rot_column(a, d, 1), c2 = _rot_column(a, d, 2);
+    float e = fabsf(vec3_dot(c0, c0) - 1);
+    e = _rot_max(e, fabsf(vec3_dot(c1, c1) - 1));
+    e = _rot_max(e, fabsf(vec3_dot(c2, c2) - 1));
+    e = _rot_max(e, fabsf(vec3_dot(c0, c1)));
+    e = _rot_max(e, fabsf(vec3_dot(c0, c2)));
+    return _rot_max(e, fabsf(vec3_dot(c1, c2)));
+}
+
+static inline void _rot_gram_schmidt(float *a, int d)
+{
+    vec3 c0 = vec3_normalize(_rot_column(a, d, 0));
+    vec3 c1 = _rot_column(a, d, 1);
+
+    c1 = vec3_normalize(vec3_sub(c1, vec3_scale(c0, vec3_dot(c0, c1))));
+    _rot_set_column(a, d, 0, c0);
+    _rot_set_column(a, d, 1, c1);
+    _rot_set_column(a, d, 2, vec3_cross(c0, c1));
+}
+
+/* Newton-Schulz steps C = C (3I - C^T C) / 2 towards the polar factor. */
+static inline void _rot_polar(float *a, int d)
+{
+    vec3 c0 = _rot_column(a, d, 0), c1 = _rot_column(a, d, 1), c2 = _rot_column(a, d, 2);
+    int step;
+
+    for (step = 0; step < CVEC_ROTATION_POLAR_STEPS; step++) {
+        float t00 = (3 - vec3_dot(c0, c0)) * 0.5f;
+        float t11 = (3 - vec3_dot(c1, c1)) * 0.5f;
+        float t22 = (3 - vec3_dot(c2, c2)) * 0.5f;
+        float t01 = vec3_dot(c0, c1) * -0.5f;
+        float t02 = vec3_dot(c0, c2) * -0.5f;
+        float t12 = vec3_dot(c1, c2) * -0.5f;
+        vec3 r0 = vec3_add(vec3_add(vec3_scale(c0, t00), vec3_scale(c1, t01)), vec3_scale(c2, t02));
+        vec3 r1 = vec3_add(vec3_add(vec3_scale(c0, t01), vec3_scale(c1, t11)), vec3_scale(c2, t12));
+        vec3 r2 = vec3_add(vec3_add(vec3_scale(c0, t02), vec3_scale(c1, t12)), vec3_scale(c2, t22));
+        c0 = r0;
+        c1 = r1;
+        c2 = r2;
+    }
+    _rot_set_column(a, d, 0, c0);
+    _rot_set_column(a, d, 1, c1);
+    _rot_set_column(a, d, 2, c2);
+}
+
+/* Largest entry of |M^T M - I|; 0 for an exact rotation. */
+static inline float mat3_orthonormal_error(const mat3 *m)
+{
+    CVEC_PROFILE_CALL();
+    return _rot_error(m->data, 3);
+}
+
+static inline float mat4_orthonormal_error(const mat4 *m)
+{
+    CVEC_PROFILE_CALL();
+    return _rot_error(m->data, 4);
+}
+
+static inline void mat3_orthonormalize(mat3 *m)
+{
+    CVEC_PROFILE_CALL();
+    _rot_gram_schmidt(m->data, 3);
+}
+
+static inline void mat4_orthonormalize(mat4 *m)
+{
+    CVEC_PROFILE_CALL();
+    _rot_gram_schmidt(m->data, 4);
+}
+
+static inline void mat3_orthonormalize_polar(mat3 *m)
+{
+    CVEC_PROFILE_CALL();
+    _rot_polar(m->data, 3);
+}
+
+static inline void mat4_orthonormalize_polar(mat4 *m)
+{
+    CVEC_PROFILE_CALL();
+    _rot_polar(m->data, 4);
+}
+
+/* Kernels, defined below or in libcvec; see CVEC_KERNEL in cvec.h. */
+
+CVEC_KERNEL size_t mat3_orthonormalize_batch(mat3 *m, size_t n, float tol);
+CVEC_KERNEL size_t mat4_orthonormalize_batch(mat4 *m, size_t n, float tol);
+CVEC_KERNEL size_t mat3_orthonormalize_polar_batch(mat3 *m, size_t n, float tol);
+CVEC_KERNEL size_t mat4_orthonormalize_polar_batch(mat4 *m, size_t n, float tol);
+
+#if _CVEC_KERNEL_BODY
+
+/*
+ * The batch kernels copy a block of matrices into x, with entry (i, j)
+ * of matrix k at x[i + 3*j][k], so that every loop below runs across
+ * matrices and vectorizes. They do the same arithmetic in the same order
+ * as the single-matrix versions, so the results match bit for bit.
+ */
+
+static inline void _rot_gather(const float *data, size_t stride, int d,
+                               float (*restrict x)[_CVEC_ROTATION_BLOCK], size_t n)
+{
+    size_t k;
+    int i, j;
+    for (k = 0; k < n; k++) {
+        const float *a = data + stride*k;
+        for (j = 0; j < 3; j++) {
+            for (i = 0; i < 3; i++) {
+                x[i + 3*j][k] = a[i + d*j];
+            }
+        }
+    }
+}
+
+/* Writes back the matrices with err[k] > tol. */
+static inline void _rot_scatter(float *data, size_t stride, int d,
+                                float (*restrict x)[_CVEC_ROTATION_BLOCK],
+                                const float *restrict err, float tol, size_t n)
+{
+    size_t k;
+    int i, j;
+    for (k = 0; k < n; k++) {
+        float *a = data + stride*k;
+        if (!(err[k] > tol)) {
+            continue;
+        }
+        for (j = 0; j < 3; j++) {
+            for (i = 0; i < 3; i++) {
+                a[i + d*j] = x[i + 3*j][k];
+            }
+        }
+    }
+}
+
+/* Stores each matrix's error in err and returns how many exceed tol. */
+static inline size_t _rot_error_block(float (*restrict x)[_CVEC_ROTATION_BLOCK],
+                                      float *restrict err, float tol, size_t n)
+{
+    size_t k, count = 0;
+    for (k = 0; k < n; k++) {
+        float a0 = x[0][k], a1 = x[1][k], a2 = x[2][k];
+        float b0 = x[3][k], b1 = x[4][k], b2 = x[5][k];
+        float c0 = x[6][k], c1 = x[7][k], c2 = x[8][k];
+        float e = fabsf(a0*a0 + a1*a1 + a2*a2 - 1);
+        e = _rot_max(e, fabsf(b0*b0 + b1*b1 + b2*b2 - 1));
+        e = _rot_max(e, fabsf(c0*c0 + c1*c1 + c2*c2 - 1));
+        e = _rot_max(e, fabsf(a0*b0 + a1*b1 + a2*b2));
+        e = _rot_max(e, fabsf(a0*c0 + a1*c1 + a2*c2));
+        e = _rot_max(e, fabsf(b0*c0 + b1*c1 + b2*c2));
+        err[k] = e;
+        count += e > tol;
+    }
+    return count;
+}
+
+/* sqrtf sets errno, so GCC will not vectorize it; keep it in its own loop. */
+static inline void _rot_sqrt(float *len, size_t n)
+{
+    size_t k;
+    for (k = 0; k < n; k++) {
+        len[k] = sqrtf(len[k]);
+    }
+}
+
+static inline void _rot_gram_schmidt_block(float (*restrict x)[_CVEC_ROTATION_BLOCK],
+                                           float *restrict len, size_t n)
+{
+    size_t k;
+
+    for (k = 0; k < n; k++) {
+        len[k] = x[0][k]*x[0][k] + x[1][k]*x[1][k] + x[2][k]*x[2][k];
+    }
+    _rot_sqrt(len, n);
+    for (k = 0; k < n; k++) {
+        float a0 = x[0][k] / len[k], a1 = x[1][k] / len[k], a2 = x[2][k] / len[k];
+        float d = a0*x[3][k] + a1*x[4][k] + a2*x[5][k];
+        float b0 = x[3][k] - a0*d, b1 = x[4][k] - a1*d, b2 = x[5][k] - a2*d;
+        x[0][k] = a0;
+        x[1][k] = a1;
+        x[2][k] = a2;
+        x[3][k] = b0;
+        x[4][k] = b1;
+        x[5][k] = b2;
+        len[k] = b0*b0 + b1*b1 + b2*b2;
+    }
+    _rot_sqrt(len, n);
+    for (k = 0; k < n; k++) {
+        float a0 = x[0][k], a1 = x[1][k], a2 = x[2][k];
+        float b0 = x[3][k] / len[k], b1 = x[4][k] / len[k], b2 = x[5][k] / len[k];
+        x[3][k] = b0;
+        x[4][k] = b1;
+        x[5][k] = b2;
+        x[6][k] = a1*b2 - a2*b1;
+        x[7][k] = a2*b0 - a0*b2;
+        x[8][k] = a0*b1 - a1*b0;
+    }
+}
+
+static inline void _rot_polar_block(float (*restrict x)[_CVEC_ROTATION_BLOCK], size_t n)
+{
+    size_t k;
+    int step;
+
+    for (step = 0; step < CVEC_ROTATION_POLAR_STEPS; step++) {
+        for (k = 0; k < n; k++) {
+            float a0 = x[0][k], a1 = x[1][k], a2 = x[2][k];
+            float b0 = x[3][k], b1 = x[4][k], b2 = x[5][k];
+            float c0 = x[6][k], c1 = x[7][k], c2 = x[8][k];
+            float t00 = (3 - (a0*a0 + a1*a1 + a2*a2)) * 0.5f;
+            float t11 = (3 - (b0*b0 + b1*b1 + b2*b2)) * 0.5f;
+            float t22 = (3 - (c0*c0 + c1*c1 + c2*c2)) * 0.5f;
+            float t01 = (a0*b0 + a1*b1 + a2*b2) * -0.5f;
+            float t02 = (a0*c0 + a1*c1 + a2*c2) * -0.5f;
+            float t12 = (b0*c0 + b1*c1 + b2*c2) * -0.5f;
+            x[0][k] = a0*t00 + b0*t01 + c0*t02;
+            x[1][k] = a1*t00 + b1*t01 + c1*t02;
+            x[2][k] = a2*t00 + b2*t01 + c2*t02;
+            x[3][k] = a0*t01 + b0*t11 + c0*t12;
+            x[4][k] = a1*t01 + b1*t11 + c1*t12;
+            x[5][k] = a2*t01 + b2*t11 + c2*t12;
+            x[6][k] = a0*t02 + b0*t12 + c0*t22;
+            x[7][k] = a1*t02 + b1*t12 + c1*t22;
+            x[8][k] = a2*t02 + b2*t12 + c2*t22;
+        }
+    }
+}
+
+static inline size_t _rot_orthonormalize_batch(float *data, size_t stride, int d, size_t n,
+                                               float tol, int polar)
+{
+    float x[9][_CVEC_ROTATION_BLOCK];
+    float err[_CVEC_ROTATION_BLOCK], len[_CVEC_ROTATION_BLOCK];
+    size_t b, len_b, count, total = 0;
+
+    for (b = 0; b < n; b += len_b) {
+        float *block = data + stride*b;
+        len_b = n - b < _CVEC_ROTATION_BLOCK ? n - b : _CVEC_ROTATION_BLOCK;
+        _rot_gather(block, stride, d, x, len_b);
+        count = _rot_error_block(x, err, tol, len_b);
+        if (count == 0) {
+            continue;
+        }
+        if (polar) {
+            _rot_polar_block(x, len_b);
+        } else {
+            _rot_gram_schmidt_block(x, len, len_b);
+        }
+        _rot_scatter(block, stride, d, x, err, tol, len_b);
+        total += count;
+    }
+    return total;
+}
+
+/* Gram-Schmidt on each matrix with error above tol; returns how many. */
+CVEC_KERNEL size_t mat3_orthonormalize_batch(mat3 *m, size_t n, float tol)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t count = _rot_orthonormalize_batch(m->data, 9, 3, n, tol, 0);
+    CVEC_PROFILE_END(n);
+    return count;
+}
+
+CVEC_KERNEL size_t mat4_orthonormalize_batch(mat4 *m, size_t n, float tol)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t count = _rot_orthonormalize_batch(m->data, 16, 4, n, tol, 0);
+    CVEC_PROFILE_END(n);
+    return count;
+}
+
+/* mat3_orthonormalize_polar() on each matrix with error above tol. */
+CVEC_KERNEL size_t mat3_orthonormalize_polar_batch(mat3 *m, size_t n, float tol)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t count = _rot_orthonormalize_batch(m->data, 9, 3, n, tol, 1);
+    CVEC_PROFILE_END(n);
+    return count;
+}
+
+CVEC_KERNEL size_t mat4_orthonormalize_polar_batch(mat4 *m, size_t n, float tol)
+{
+    CVEC_PROFILE_BEGIN();
+    size_t count = _rot_orthonormalize_batch(m->data, 16, 4, n, tol, 1);
+    CVEC_PROFILE_END(n);
+    return count;
+}
+
+#endif /* _CVEC_KERNEL_BODY */
+
+#endif
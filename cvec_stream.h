@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_STREAM_H
+#define CVEC_STREAM_H
+
+/*
+ * Out-of-core streaming over raw vec3 files.
+ *
+ * cvec_stream_fd() reads packed vec3 values from one descriptor in
+ * chunks of chunk_size points, runs a kernel over each chunk in place
+ * and writes the result to another descriptor. A reader thread fills one
+ * of two chunk buffers while the calling thread runs the kernel on the
+ * other and writes it out, so disk and CPU stay busy at the same time.
+ * Memory use is two chunks regardless of the input size.
+ *
+ * Functions returning int return 0 on success and -1 with errno set on
+ * failure. An input whose length is not a multiple of sizeof(vec3)
+ * fails with EINVAL after the complete points have been written. A
+ * chunk_size of 0, or one too large for a buffer of that many points,
+ * fails with EINVAL before anything is read.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cvec.h"
+#include "cvec_batch.h"
+
+typedef void (*cvec_stream_kernel)(void *ctx, vec3 *points, size_t n);
+
+typedef struct cvec_stream_stats {
+    uint64_t points;
+    double seconds;          /* wall time for the whole stream */
+    double compute_seconds;  /* time spent in the kernel */
+    double write_seconds;    /* time spent writing output */
+    double stall_seconds;    /* time spent waiting for the reader */
+} cvec_stream_stats;
+
+/* Sustained throughput in points per second. */
+static inline double cvec_stream_throughput(const cvec_stream_stats *s)
+{
+    return s->seconds > 0 ? s->points / s->seconds : 0;
+}
+
+struct _stream_buf {
+    vec3 *points;
+    size_t count;   /* points in the buffer */
+    int full;
+    int last;       /* no more data after this buffer */
+    int error;      /* errno from the reader, or 0 */
+};
+
+struct _stream_state {
+    int fd;
+    size_t chunk_size;
+    struct _stream_buf bufs[2];
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static inline double _stream_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Reads until 'size' bytes or end of file. Returns bytes read or -1. */
+static inline ssize_t _stream_read_full(int fd, void *buf, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t r = read(fd, (char *)buf + done, size - done);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (r == 0) {
+            break;
+        }
+        done += r;
+    }
+    return done;
+}
+
+static inline int _stream_write_full(int fd, const void *buf, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t r = write(fd, (const char *)buf + done, size - done);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += r;
+    }
+    return 0;
+}
+
+static inline void *_stream_reader(void *arg)
+{
+    struct _stream_state *s = arg;
+    int i = 0;
+
+    for (;;) {
+        struct _stream_buf *b = &s->bufs[i];
+        size_t size = sizeof(vec3) * s->chunk_size;
+        ssize_t r;
+
+        pthread_mutex_lock(&s->lock);
+        while (b->full && !s->stop) {
+            pthread_cond_wait(&s->cond, &s->lock);
+        }
+        if (s->stop) {
+            pthread_mutex_unlock(&s->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        r = _stream_read_full(s->fd, b->points, size);
+
+        pthread_mutex_lock(&s->lock);
+        b->error = 0;
+        b->last = 0;
+        if (r < 0) {
+            b->error = errno;
+            b->count = 0;
+            b->last = 1;
+        } else {
+            b->count = r / sizeof(vec3);
+            if ((size_t)r < size) {
+                b->last = 1;
+                if (r % sizeof(vec3) != 0) {
+                    b->error = EINVAL;
+                }
+            }
+        }
+        b->full = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+
+        if (b->last) {
+            return NULL;
+        }
+        i ^= 1;
+    }
+}
+
+/*
+ * Streams in_fd through fn to out_fd. 'stats' may be NULL.
+ */
+static inline int cvec_stream_fd(int in_fd, int out_fd, size_t chunk_size,
+                                 cvec_stream_kernel fn, void *ctx,
+                                 cvec_stream_stats *stats)
+{
+    struct _stream_state s;
+    cvec_stream_stats st = { 0, 0, 0, 0, 0 };
+    pthread_t reader;
+    double start = _stream_now();
+    int i = 0, err = 0, ret;
+
+    if (stats) {
+        *stats = st;
+    }
+    if (chunk_size == 0 || chunk_size > SIZE_MAX / sizeof(vec3)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.fd = in_fd;
+    s.chunk_size = chunk_size;
+    s.bufs[0].points = malloc(sizeof(vec3) * chunk_size);
+    s.bufs[1].points = malloc(sizeof(vec3) * chunk_size);
+    if (!s.bufs[0].points || !s.bufs[1].points) {
+        free(s.bufs[0].points);
+        free(s.bufs[1].points);
+        errno = ENOMEM;
+        return -1;
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+
+    ret = pthread_create(&reader, NULL, _stream_reader, &s);
+    if (ret != 0) {
+        err = ret;
+        goto out;
+    }
+
+    for (;;) {
+        struct _stream_buf *b = &s.bufs[i];
+        double t0 = _stream_now(), t1, t2;
+        int last;
+
+        pthread_mutex_lock(&s.lock);
+        while (!b->full) {
+            pthread_cond_wait(&s.cond, &s.lock);
+        }
+        pthread_mutex_unlock(&s.lock);
+
+        t1 = _stream_now();
+        st.stall_seconds += t1 - t0;
+
+        if (b->count > 0) {
+            fn(ctx, b->points, b->count);
+            t2 = _stream_now();
+            st.compute_seconds += t2 - t1;
+            if (_stream_write_full(out_fd, b->points, sizeof(vec3) * b->count) < 0) {
+                err = errno;
+            }
+            st.write_seconds += _stream_now() - t2;
+            st.points += b->count;
+        }
+
+        if (!err) {
+            err = b->error;
+        }
+        last = b->last;
+
+        pthread_mutex_lock(&s.lock);
+        b->full = 0;
+        s.stop = err != 0;
+        pthread_cond_broadcast(&s.cond);
+        pthread_mutex_unlock(&s.lock);
+
+        if (last || err) {
+            break;
+        }
+        i ^= 1;
+    }
+
+    pthread_join(reader, NULL);
+
+out:
+    pthread_mutex_destroy(&s.lock);
+    pthread_cond_destroy(&s.cond);
+    free(s.bufs[0].points);
+    free(s.bufs[1].points);
+
+    st.seconds = _stream_now() - start;
+    if (stats) {
+        *stats = st;
+    }
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void _stream_transform_kernel(void *ctx, vec3 *points, size_t n)
+{
+    mat4_transform_point_batch(ctx, points, points, n);
+}
+
+/* Streams points through mat4_transform_point_batch(). */
+static inline int cvec_stream_transform_fd(int in_fd, int out_fd, size_t chunk_size,
+                                           const mat4 *m, cvec_stream_stats *stats)
+{
+    return cvec_stream_fd(in_fd, out_fd, chunk_size, _stream_transform_kernel, (void *)m, stats);
+}
+
+static inline int cvec_stream_file(const char *in_path, const char *out_path, size_t chunk_size,
+                                   cvec_stream_kernel fn, void *ctx, cvec_stream_stats *stats)
+{
+    int in_fd, out_fd, ret, err;
+
+    in_fd = open(in_path, O_RDONLY);
+    if (in_fd < 0) {
+        return -1;
+    }
+    out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        err = errno;
+        close(in_fd);
+        errno = err;
+        return -1;
+    }
+
+    ret = cvec_stream_fd(in_fd, out_fd, chunk_size, fn, ctx, stats);
+    err = errno;
+    close(in_fd);
+    if (close(out_fd) < 0 && ret == 0) {
+        return -1;
+    }
+    errno = err;
+    return ret;
+}
+
+static inline int cvec_stream_transform_file(const char *in_path, const char *out_path,
+                                             size_t chunk_size, const mat4 *m,
+                                             cvec_stream_stats *stats)
+{
+    return cvec_stream_file(in_path, out_path, chunk_size, _stream_transform_kernel, (void *)m, stats);
+}
+
+#endif
@@ -0,0 +1,782 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Type-generic part of cvec.h. Do not include this file directly.
+ *
+ * cvec.h includes it once per scalar type with these macros defined:
+ *
+ *   CVEC_T          the scalar type
+ *   CVEC_(name)     a type or function name with the type's prefix
+ *                   (vec3_add becomes vec3_add or dvec3_add)
+ *   CVEC_C_(name)   a constructor name (Vec3 becomes Vec3 or DVec3)
+ *   CVEC_SQRT, CVEC_SIN, CVEC_COS
+ *                   libm functions for CVEC_T
+ */
+
+typedef struct CVEC_(vec2) {
+    CVEC_T x;
+    CVEC_T y;
+} CVEC_(vec2);
+
+typedef struct CVEC_(vec3) {
+    CVEC_T x;
+    CVEC_T y;
+    CVEC_T z;
+} CVEC_(vec3);
+
+typedef struct CVEC_(vec4) {
+    CVEC_T x;
+    CVEC_T y;
+    CVEC_T z;
+    CVEC_T w;
+} CVEC_(vec4);
+
+typedef struct CVEC_(mat2) {
+    CVEC_T data[4];
+} CVEC_(mat2);
+
+typedef struct CVEC_(mat3) {
+    CVEC_T data[9];
+} CVEC_(mat3);
+
+typedef struct CVEC_(mat4) {
+    CVEC_T data[16];
+} CVEC_(mat4);
+
+/* vec2 functions */
+
+static inline CVEC_(vec2) CVEC_C_(Vec2)(CVEC_T x, CVEC_T y)
+{
+    CVEC_(vec2) r;
+    r.x = x;
+    r.y = y;
+    return r;
+}
+
+static inline CVEC_(vec2) CVEC_(vec2_add)(CVEC_(vec2) a, CVEC_(vec2) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec2)(a.x+b.x, a.y+b.y);
+}
+
+static inline CVEC_(vec2) CVEC_(vec2_sub)(CVEC_(vec2) a, CVEC_(vec2) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec2)(a.x-b.x, a.y-b.y);
+}
+
+static inline CVEC_(vec2) CVEC_(vec2_scale)(CVEC_(vec2) a, CVEC_T c)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec2)(a.x*c, a.y*c);
+}
+
+static inline CVEC_T CVEC_(vec2_dot)(CVEC_(vec2) a, CVEC_(vec2) b)
+{
+    CVEC_PROFILE_CALL();
+    return a.x*b.x + a.y*b.y;
+}
+
+static inline CVEC_T CVEC_(vec2_length)(CVEC_(vec2) a)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_SQRT(a.x*a.x + a.y*a.y);
+}
+
+static inline CVEC_T CVEC_(vec2_distance)(CVEC_(vec2) a, CVEC_(vec2) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(vec2_length)(CVEC_(vec2_sub)(a, b));
+}
+
+static inline CVEC_(vec2) CVEC_(vec2_normalize)(CVEC_(vec2) a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_T len = CVEC_(vec2_length)(a);
+    return CVEC_C_(Vec2)(a.x/len, a.y/len);
+}
+
+
+/* vec3 functions */
+
+static inline CVEC_(vec3) CVEC_C_(Vec3)(CVEC_T x, CVEC_T y, CVEC_T z)
+{
+    CVEC_(vec3) r;
+    r.x = x;
+    r.y = y;
+    r.z = z;
+    return r;
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_add)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(a.x+b.x, a.y+b.y, a.z+b.z);
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_sub)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(a.x-b.x, a.y-b.y, a.z-b.z);
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_scale)(CVEC_(vec3) a, CVEC_T c)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(a.x*c, a.y*c, a.z*c);
+}
+
+static inline CVEC_T CVEC_(vec3_dot)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+static inline CVEC_T CVEC_(vec3_length)(CVEC_(vec3) a)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_SQRT(a.x*a.x + a.y*a.y + a.z*a.z);
+}
+
+static inline CVEC_T CVEC_(vec3_distance)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(vec3_length)(CVEC_(vec3_sub)(a, b));
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_normalize)(CVEC_(vec3) a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_T len = CVEC_(vec3_length)(a);
+    return CVEC_C_(Vec3)(a.x/len, a.y/len, a.z/len);
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_cross)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(a.y*b.z - a.z*b.y,
+                         a.z*b.x - a.x*b.z,
+                         a.x*b.y - a.y*b.x);
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_min)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(a.x < b.x ? a.x : b.x,
+                         a.y < b.y ? a.y : b.y,
+                         a.z < b.z ? a.z : b.z);
+}
+
+static inline CVEC_(vec3) CVEC_(vec3_max)(CVEC_(vec3) a, CVEC_(vec3) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(a.x > b.x ? a.x : b.x,
+                         a.y > b.y ? a.y : b.y,
+                         a.z > b.z ? a.z : b.z);
+}
+
+
+/* vec4 functions */
+
+static inline CVEC_(vec4) CVEC_C_(Vec4)(CVEC_T x, CVEC_T y, CVEC_T z, CVEC_T w)
+{
+    CVEC_(vec4) r;
+    r.x = x;
+    r.y = y;
+    r.z = z;
+    r.w = w;
+    return r;
+}
+
+static inline CVEC_(vec4) CVEC_(vec4_add)(CVEC_(vec4) a, CVEC_(vec4) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(a.x+b.x, a.y+b.y, a.z+b.z, a.w+b.w);
+}
+
+static inline CVEC_(vec4) CVEC_(vec4_sub)(CVEC_(vec4) a, CVEC_(vec4) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w);
+}
+
+static inline CVEC_(vec4) CVEC_(vec4_scale)(CVEC_(vec4) a, CVEC_T c)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(a.x*c, a.y*c, a.z*c, a.w*c);
+}
+
+static inline CVEC_T CVEC_(vec4_dot)(CVEC_(vec4) a, CVEC_(vec4) b)
+{
+    CVEC_PROFILE_CALL();
+    return a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w;
+}
+
+static inline CVEC_T CVEC_(vec4_length)(CVEC_(vec4) a)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_SQRT(a.x*a.x + a.y*a.y + a.z*a.z + a.w*a.w);
+}
+
+static inline CVEC_T CVEC_(vec4_distance)(CVEC_(vec4) a, CVEC_(vec4) b)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(vec4_length)(CVEC_(vec4_sub)(a, b));
+}
+
+static inline CVEC_(vec4) CVEC_(vec4_normalize)(CVEC_(vec4) a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_T len = CVEC_(vec4_length)(a);
+    return CVEC_C_(Vec4)(a.x/len, a.y/len, a.z/len, a.w/len);
+}
+
+
+/* 
+ * Generic (square) matrix functions
+ *
+ * The compiler is expected to inline these into the caller and
+ * optimize away the generic loops. Once the library is stable
+ * we could inline and optimize them by hand to save the
+ * compiler some work.
+ */
+
+
+static inline CVEC_T CVEC_(mat_get)(const CVEC_T *a, int i, int j, int n)
+{
+    return a[i + n*j];
+}
+
+static inline void CVEC_(mat_set)(CVEC_T *a, int i, int j, CVEC_T value, int n)
+{
+    a[i + n*j] = value;
+}
+
+static inline void CVEC_(mat_init_zero)(CVEC_T *a, int n)
+{
+    int i;
+    for (i = 0; i < n*n; i++) {
+        a[i] = 0;
+    }
+}
+
+static inline void CVEC_(mat_init_identity)(CVEC_T *a, int n)
+{
+    int i, j;
+    for (j = 0; j < n; j++) {
+        for (i = 0; i < n; i++) {
+            CVEC_T value = i == j ? 1 : 0;
+            CVEC_(mat_set)(a, i, j, value, n);
+        }
+    }
+}
+
+static inline void CVEC_(mat_init_scale)(CVEC_T *a, CVEC_T value, int n)
+{
+    int i, j;
+    for (j = 0; j < n; j++) {
+        for (i = 0; i < n; i++) {
+            CVEC_T _value = i == j ? value : 0;
+            CVEC_(mat_set)(a, i, j, _value, n);
+        }
+    }
+}
+
+static inline void CVEC_(mat_transpose)(CVEC_T *a, int n)
+{
+    int i, j;
+    for (j = 0; j < n; j++) {
+        for (i = 0; i < n; i++) {
+            if (i < j) {
+                CVEC_T value1 = CVEC_(mat_get)(a, i, j, n);
+                CVEC_T value2 = CVEC_(mat_get)(a, j, i, n);
+                CVEC_(mat_set)(a, i, j, value2, n);
+                CVEC_(mat_set)(a, j, i, value1, n);
+            }
+        }
+    }
+}
+
+static inline void CVEC_(mat_transform)(const CVEC_T *m, const CVEC_T *v, CVEC_T *r, int n)
+{
+    int i, j;
+    for (i = 0; i < n; i++) {
+        CVEC_T sum = 0;
+        for (j = 0; j < n; j++) {
+            sum += v[j] * CVEC_(mat_get)(m, i, j, n);
+        }
+        r[i] = sum;
+    }
+}
+
+static inline void CVEC_(mat_mult)(const CVEC_T *a, const CVEC_T *b, CVEC_T *r, int n)
+{
+    int i, j, k;
+    for (j = 0; j < n; j++) {
+        for (i = 0; i < n; i++) {
+            CVEC_T sum = 0;
+            for (k = 0; k < n; k++) {
+                sum += CVEC_(mat_get)(a, i, k, n) * CVEC_(mat_get)(b, k, j, n);
+            }
+            CVEC_(mat_set)(r, i, j, sum, n);
+        }
+    }
+}
+
+
+/* mat2 functions */
+
+static inline CVEC_T CVEC_(mat2_get)(const CVEC_(mat2) *a, int i, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(mat_get)(a->data, i, j, 2);
+}
+
+static inline void CVEC_(mat2_set)(CVEC_(mat2) *a, int i, int j, CVEC_T value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_set)(a->data, i, j, value, 2);
+}
+
+static inline CVEC_(vec2) CVEC_(mat2_row)(const CVEC_(mat2) *a, int i)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec2)(CVEC_(mat2_get)(a, i, 0), CVEC_(mat2_get)(a, i, 1));
+}
+
+static inline CVEC_(vec2) CVEC_(mat2_col)(const CVEC_(mat2) *a, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec2)(CVEC_(mat2_get)(a, 0, j), CVEC_(mat2_get)(a, 1, j));
+}
+
+static inline void CVEC_(mat2_init)(CVEC_(mat2) *a, CVEC_T v00, CVEC_T v01, CVEC_T v10, CVEC_T v11)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat2_set)(a, 0, 0, v00);
+    CVEC_(mat2_set)(a, 0, 1, v01);
+    CVEC_(mat2_set)(a, 1, 0, v10);
+    CVEC_(mat2_set)(a, 1, 1, v11);
+}
+
+static inline void CVEC_(mat2_init_zero)(CVEC_(mat2) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_zero)(a->data, 2);
+}
+
+static inline void CVEC_(mat2_init_identity)(CVEC_(mat2) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_identity)(a->data, 2);
+}
+
+static inline void CVEC_(mat2_init_scale)(CVEC_(mat2) *a, CVEC_T value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_scale)(a->data, value, 2);
+}
+
+static inline void CVEC_(mat2_init_rotate)(CVEC_(mat2) *a, CVEC_T angle)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat2_init)(a, CVEC_COS(angle), -CVEC_SIN(angle),
+                        CVEC_SIN(angle), CVEC_COS(angle));
+}
+
+static inline void CVEC_(mat2_transpose)(CVEC_(mat2) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_transpose)(a->data, 2);
+}
+
+static inline CVEC_(vec2) CVEC_(mat2_transform)(const CVEC_(mat2) *m, CVEC_(vec2) v)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(vec2) r;
+    CVEC_(mat_transform)(m->data, (CVEC_T *)&v, (CVEC_T *)&r, 2);
+    return r;
+}
+
+static inline void CVEC_(mat2_mult)(const CVEC_(mat2) *a, const CVEC_(mat2) *b, CVEC_(mat2) *r)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_mult)(a->data, b->data, r->data, 2);
+}
+
+
+/* mat3 functions */
+
+static inline CVEC_T CVEC_(mat3_get)(const CVEC_(mat3) *a, int i, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(mat_get)(a->data, i, j, 3);
+}
+
+static inline void CVEC_(mat3_set)(CVEC_(mat3) *a, int i, int j, CVEC_T value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_set)(a->data, i, j, value, 3);
+}
+
+static inline CVEC_(vec3) CVEC_(mat3_row)(const CVEC_(mat3) *a, int i)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(CVEC_(mat3_get)(a, i, 0), CVEC_(mat3_get)(a, i, 1), CVEC_(mat3_get)(a, i, 2));
+}
+
+static inline CVEC_(vec3) CVEC_(mat3_col)(const CVEC_(mat3) *a, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec3)(CVEC_(mat3_get)(a, 0, j), CVEC_(mat3_get)(a, 1, j), CVEC_(mat3_get)(a, 2, j));
+}
+
+static inline void CVEC_(mat3_init)(CVEC_(mat3) *a, CVEC_T v00, CVEC_T v01, CVEC_T v02,
+                                                    CVEC_T v10, CVEC_T v11, CVEC_T v12,
+                                                    CVEC_T v20, CVEC_T v21, CVEC_T v22)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat3_set)(a, 0, 0, v00);
+    CVEC_(mat3_set)(a, 0, 1, v01);
+    CVEC_(mat3_set)(a, 0, 2, v02);
+    CVEC_(mat3_set)(a, 1, 0, v10);
+    CVEC_(mat3_set)(a, 1, 1, v11);
+    CVEC_(mat3_set)(a, 1, 2, v12);
+    CVEC_(mat3_set)(a, 2, 0, v20);
+    CVEC_(mat3_set)(a, 2, 1, v21);
+    CVEC_(mat3_set)(a, 2, 2, v22);
+}
+
+static inline void CVEC_(mat3_init_zero)(CVEC_(mat3) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_zero)(a->data, 3);
+}
+
+static inline void CVEC_(mat3_init_identity)(CVEC_(mat3) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_identity)(a->data, 3);
+}
+
+static inline void CVEC_(mat3_init_scale)(CVEC_(mat3) *a, CVEC_T value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_scale)(a->data, value, 3);
+}
+
+static inline void CVEC_(mat3_init_rotate)(CVEC_(mat3) *a, CVEC_(vec3) axis, CVEC_T angle)
+{
+    CVEC_PROFILE_CALL();
+    if (CVEC_(vec3_length)(axis) == 0) {
+        CVEC_(mat3_init_identity)(a);
+        return;
+    }
+
+    axis = CVEC_(vec3_normalize)(axis);
+
+    CVEC_T x = axis.x;
+    CVEC_T y = axis.y;
+    CVEC_T z = axis.z;
+    CVEC_T s = CVEC_SIN(angle);
+    CVEC_T c = CVEC_COS(angle);
+    CVEC_T t = 1 - c;
+
+    CVEC_(mat3_init)(a, t*x*x + c,   t*y*x - s*z, t*z*x + s*y,
+                        t*x*y + s*z, t*y*y + c,   t*z*y - s*x,
+                        t*x*z - s*y, t*y*z + s*x, t*z*z + c);
+}
+
+static inline void CVEC_(mat3_transpose)(CVEC_(mat3) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_transpose)(a->data, 3);
+}
+
+static inline CVEC_(vec3) CVEC_(mat3_transform)(const CVEC_(mat3) *m, CVEC_(vec3) v)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(vec3) r;
+    CVEC_(mat_transform)(m->data, (CVEC_T *)&v, (CVEC_T *)&r, 3);
+    return r;
+}
+
+static inline void CVEC_(mat3_mult)(const CVEC_(mat3) *a, const CVEC_(mat3) *b, CVEC_(mat3) *r)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_mult)(a->data, b->data, r->data, 3);
+}
+
+
+/* mat4 functions */
+
+static inline CVEC_T CVEC_(mat4_get)(const CVEC_(mat4) *a, int i, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_(mat_get)(a->data, i, j, 4);
+}
+
+static inline void CVEC_(mat4_set)(CVEC_(mat4) *a, int i, int j, CVEC_T value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_set)(a->data, i, j, value, 4);
+}
+
+static inline CVEC_(vec4) CVEC_(mat4_row)(const CVEC_(mat4) *a, int i)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(CVEC_(mat4_get)(a, i, 0), CVEC_(mat4_get)(a, i, 1), CVEC_(mat4_get)(a, i, 2), CVEC_(mat4_get)(a, i, 3));
+}
+
+static inline CVEC_(vec4) CVEC_(mat4_col)(const CVEC_(mat4) *a, int j)
+{
+    CVEC_PROFILE_CALL();
+    return CVEC_C_(Vec4)(CVEC_(mat4_get)(a, 0, j), CVEC_(mat4_get)(a, 1, j), CVEC_(mat4_get)(a, 2, j), CVEC_(mat4_get)(a, 3, j));
+}
+
+static inline void CVEC_(mat4_init)(CVEC_(mat4) *a, CVEC_T v00, CVEC_T v01, CVEC_T v02, CVEC_T v03,
+                                                    CVEC_T v10, CVEC_T v11, CVEC_T v12, CVEC_T v13,
+                                                    CVEC_T v20, CVEC_T v21, CVEC_T v22, CVEC_T v23,
+                                                    CVEC_T v30, CVEC_T v31, CVEC_T v32, CVEC_T v33)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat4_set)(a, 0, 0, v00);
+    CVEC_(mat4_set)(a, 0, 1, v01);
+    CVEC_(mat4_set)(a, 0, 2, v02);
+    CVEC_(mat4_set)(a, 0, 3, v03);
+    CVEC_(mat4_set)(a, 1, 0, v10);
+    CVEC_(mat4_set)(a, 1, 1, v11);
+    CVEC_(mat4_set)(a, 1, 2, v12);
+    CVEC_(mat4_set)(a, 1, 3, v13);
+    CVEC_(mat4_set)(a, 2, 0, v20);
+    CVEC_(mat4_set)(a, 2, 1, v21);
+    CVEC_(mat4_set)(a, 2, 2, v22);
+    CVEC_(mat4_set)(a, 2, 3, v23);
+    CVEC_(mat4_set)(a, 3, 0, v30);
+    CVEC_(mat4_set)(a, 3, 1, v31);
+    CVEC_(mat4_set)(a, 3, 2, v32);
+    CVEC_(mat4_set)(a, 3, 3, v33);
+}
+
+static inline void CVEC_(mat4_init_zero)(CVEC_(mat4) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_zero)(a->data, 4);
+}
+
+static inline void CVEC_(mat4_init_identity)(CVEC_(mat4) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_identity)(a->data, 4);
+}
+
+static inline void CVEC_(mat4_init_scale)(CVEC_(mat4) *a, CVEC_T value)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_init_scale)(a->data, value, 4);
+    CVEC_(mat4_set)(a, 3, 3, 1);
+}
+
+/* Only supports rotation in 3 dimensions, not 4. */
+static inline void CVEC_(mat4_init_rotate)(CVEC_(mat4) *a, CVEC_(vec3) axis, CVEC_T angle)
+{
+    CVEC_PROFILE_CALL();
+    if (CVEC_(vec3_length)(axis) == 0) {
+        CVEC_(mat4_init_identity)(a);
+        return;
+    }
+
+    axis = CVEC_(vec3_normalize)(axis);
+
+    CVEC_T x = axis.x;
+    CVEC_T y = axis.y;
+    CVEC_T z = axis.z;
+    CVEC_T s = CVEC_SIN(angle);
+    CVEC_T c = CVEC_COS(angle);
+    CVEC_T t = 1 - c;
+
+    CVEC_(mat4_init)(a, t*x*x + c,   t*y*x - s*z, t*z*x + s*y, 0,
+                        t*x*y + s*z, t*y*y + c,   t*z*y - s*x, 0,
+                        t*x*z - s*y, t*y*z + s*x, t*z*z + c,   0,
+                        0,           0,           0,           1);
+}
+
+static inline void CVEC_(mat4_init_translate)(CVEC_(mat4) *m, CVEC_(vec3) v)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat4_init)(m, 1, 0, 0, v.x,
+                        0, 1, 0, v.y,
+                        0, 0, 1, v.z,
+                        0, 0, 0, 1);
+}
+
+static inline void CVEC_(mat4_transpose)(CVEC_(mat4) *a)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_transpose)(a->data, 4);
+}
+
+static inline CVEC_(vec4) CVEC_(mat4_transform)(const CVEC_(mat4) *m, CVEC_(vec4) v)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(vec4) r;
+    CVEC_(mat_transform)(m->data, (CVEC_T *)&v, (CVEC_T *)&r, 4);
+    return r;
+}
+
+static inline void CVEC_(mat4_mult)(const CVEC_(mat4) *a, const CVEC_(mat4) *b, CVEC_(mat4) *r)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(mat_mult)(a->data, b->data, r->data, 4);
+}
+
+
+
+/*
+ * Translation/rotation/scale
+ *
+ * Quaternions are stored in a vec4 as (x, y, z, w) with w the real part.
+ */
+
+static inline CVEC_(vec4) CVEC_(quat_from_axis_angle)(CVEC_(vec3) axis, CVEC_T angle)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_T len = CVEC_(vec3_length)(axis);
+    if (len == 0) {
+        return CVEC_C_(Vec4)(0, 0, 0, 1);
+    }
+    CVEC_T s = CVEC_SIN(angle / 2) / len;
+    return CVEC_C_(Vec4)(axis.x * s, axis.y * s, axis.z * s, CVEC_COS(angle / 2));
+}
+
+/* mat4_init_trs() on components, shared with mat4_init_trs_batch(). */
+static inline void CVEC_(_mat4_trs)(CVEC_T *a, CVEC_T tx, CVEC_T ty, CVEC_T tz,
+                                    CVEC_T qx, CVEC_T qy, CVEC_T qz, CVEC_T qw,
+                                    CVEC_T sx, CVEC_T sy, CVEC_T sz)
+{
+    CVEC_T n = qx*qx + qy*qy + qz*qz + qw*qw;
+    CVEC_T k = n > 0 ? 2 / n : 0;
+    CVEC_T xx = k*qx*qx, yy = k*qy*qy, zz = k*qz*qz;
+    CVEC_T xy = k*qx*qy, xz = k*qx*qz, yz = k*qy*qz;
+    CVEC_T xw = k*qx*qw, yw = k*qy*qw, zw = k*qz*qw;
+
+    a[0] = (1 - yy - zz) * sx;
+    a[1] = (xy + zw) * sx;
+    a[2] = (xz - yw) * sx;
+    a[3] = 0;
+    a[4] = (xy - zw) * sy;
+    a[5] = (1 - xx - zz) * sy;
+    a[6] = (yz + xw) * sy;
+    a[7] = 0;
+    a[8] = (xz + yw) * sz;
+    a[9] = (yz - xw) * sz;
+    a[10] = (1 - xx - yy) * sz;
+    a[11] = 0;
+    a[12] = tx;
+    a[13] = ty;
+    a[14] = tz;
+    a[15] = 1;
+}
+
+/*
+ * Equivalent to translate * rotate * scale but without the two matrix
+ * products. q need not be unit length; a zero q means no rotation.
+ */
+static inline void CVEC_(mat4_init_trs)(CVEC_(mat4) *m, CVEC_(vec3) t, CVEC_(vec4) q, CVEC_(vec3) s)
+{
+    CVEC_PROFILE_CALL();
+    CVEC_(_mat4_trs)(m->data, t.x, t.y, t.z, q.x, q.y, q.z, q.w, s.x, s.y, s.z);
+}
+
+/* Unit quaternion of the rotation with orthonormal columns c0, c1, c2. */
+static inline CVEC_(vec4) CVEC_(_quat_from_columns)(CVEC_(vec3) c0, CVEC_(vec3) c1, CVEC_(vec3) c2)
+{
+    CVEC_T trace = c0.x + c1.y + c2.z;
+    CVEC_T s;
+    CVEC_(vec4) q;
+
+    /* Divide by the largest of the four candidates to keep precision. */
+    if (trace > 0) {
+        s = CVEC_SQRT(trace + 1) * 2;
+        q = CVEC_C_(Vec4)((c1.z - c2.y) / s, (c2.x - c0.z) / s, (c0.y - c1.x) / s, s / 4);
+    } else if (c0.x > c1.y && c0.x > c2.z) {
+        s = CVEC_SQRT(1 + c0.x - c1.y - c2.z) * 2;
+        q = CVEC_C_(Vec4)(s / 4, (c1.x + c0.y) / s, (c2.x + c0.z) / s, (c1.z - c2.y) / s);
+    } else if (c1.y > c2.z) {
+        s = CVEC_SQRT(1 + c1.y - c0.x - c2.z) * 2;
+        q = CVEC_C_(Vec4)((c1.x + c0.y) / s, s / 4, (c2.y + c1.z) / s, (c2.x - c0.z) / s);
+    } else {
+        s = CVEC_SQRT(1 + c2.z - c0.x - c1.y) * 2;
+        q = CVEC_C_(Vec4)((c2.x + c0.z) / s, (c2.y + c1.z) / s, s / 4, (c0.y - c1.x) / s);
+    }
+    return CVEC_(vec4_normalize)(q);
+}
+
+/*
+ * Splits an affine matrix into translation, rotation and scale so that
+ * mat4_init_trs() rebuilds it. A reflection is returned as a negative
+ * x scale. Shear is discarded: the rotation comes from Gram-Schmidt on
+ * the columns and the scale is the column lengths. Returns -1 with errno
+ * set to EDOM if the matrix is projective or has a zero-length column.
+ */
+static inline int CVEC_(mat4_decompose)(const CVEC_(mat4) *m, CVEC_(vec3) *t, CVEC_(vec4) *q, CVEC_(vec3) *s)
+{
+    CVEC_PROFILE_CALL();
+    const CVEC_T *a = m->data;
+    CVEC_(vec3) c0, c1, c2;
+    CVEC_T w, sx, sy, sz;
+
+    if (a[3] != 0 || a[7] != 0 || a[11] != 0 || a[15] == 0) {
+        errno = EDOM;
+        return -1;
+    }
+    w = 1 / a[15];
+    c0 = CVEC_C_(Vec3)(a[0] * w, a[1] * w, a[2] * w);
+    c1 = CVEC_C_(Vec3)(a[4] * w, a[5] * w, a[6] * w);
+    c2 = CVEC_C_(Vec3)(a[8] * w, a[9] * w, a[10] * w);
+    sx = CVEC_(vec3_length)(c0);
+    sy = CVEC_(vec3_length)(c1);
+    sz = CVEC_(vec3_length)(c2);
+    if (sx == 0 || sy == 0 || sz == 0) {
+        errno = EDOM;
+        return -1;
+    }
+
+    if (CVEC_(vec3_dot)(c0, CVEC_(vec3_cross)(c1, c2)) < 0) {
+        sx = -sx;
+    }
+    c0 = CVEC_(vec3_scale)(c0, 1 / sx);
+    c1 = CVEC_(vec3_sub)(c1, CVEC_(vec3_scale)(c0, CVEC_(vec3_dot)(c0, c1)));
+    if (CVEC_(vec3_length)(c1) == 0) {
+        errno = EDOM;
+        return -1;
+    }
+    c1 = CVEC_(vec3_normalize)(c1);
+    c2 = CVEC_(vec3_cross)(c0, c1);
+
+    *t = CVEC_C_(Vec3)(a[12] * w, a[13] * w, a[14] * w);
+    *q = CVEC_(_quat_from_columns)(c0, c1, c2);
+    *s = CVEC_C_(Vec3)(sx, sy, sz);
+    return 0;
+}
@@ -0,0 +1,587 @@
+/*
+ * Copyright (c) 2013 Rich Lane
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CVEC_VOXEL_H
+#define CVEC_VOXEL_H
+
+/*
+ * Voxel binning of vec3 point clouds.
+ *
+ * Points are binned into cubic cells of side 'cell_size' whose corner
+ * lattice starts at 'origin'. Each cell accumulates a point count, the
+ * sum of its points (voxel_cell_centroid() divides it out) and their
+ * bounding box, which is what downsampling a scan needs.
+ *
+ * voxel_grid is a dense nx * ny * nz array of cells; points outside it
+ * are skipped. voxel_hash is a sparse open-addressing table keyed by
+ * the integer cell coordinates, which may range over [-2^20, 2^20) on
+ * each axis; points beyond that are skipped.
+ *
+ * Binning with threads > 1 splits the points into one chunk per thread.
+ * Each chunk fills a private grid or table and the partial results are
+ * merged at the end, so no atomics are needed. Dense private grids are
+ * only used while they fit in CVEC_VOXEL_PRIVATE_BYTES in total; beyond
+ * that fewer chunks are used. Sums are added in chunk order, so results
+ * depend on the number of chunks only through float rounding.
+ *
+ * Cell index and key computation runs over blocks of points in loops
+ * written to vectorize; the scatter into cells is scalar. De-interleaving
+ * the vec3 loads needs SSSE3 shuffles, so GCC only vectorizes these loops
+ * with SSSE3 or later enabled (-mssse3, -msse4.1, -mavx2 or
+ * -march=native); with the default x86-64 flags they stay scalar.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cvec.h"
+#include "cvec_parallel.h"
+
+#ifndef CVEC_VOXEL_PRIVATE_BYTES
+#define CVEC_VOXEL_PRIVATE_BYTES (64 << 20)
+#endif
+
+#define _CVEC_VOXEL_BLOCK 256
+
+/* Unused hash slot, and the key of a point outside the addressable range. */
+#define VOXEL_KEY_NONE UINT64_MAX
+
+#define _VOXEL_KEY_BITS 21
+#define _VOXEL_KEY_BIAS (1 << (_VOXEL_KEY_BITS - 1))
+#define _VOXEL_KEY_MASK ((1 << _VOXEL_KEY_BITS) - 1)
+
+typedef struct voxel_cell {
+    uint32_t count;
+    vec3 sum;
+    aabb bounds;
+} voxel_cell;
+
+typedef struct voxel_grid {
+    vec3 origin;
+    float cell_size;
+    int dims[3];
+    voxel_cell *cells;
+} voxel_grid;
+
+typedef struct voxel_hash {
+    vec3 origin;
+    float cell_size;
+    size_t capacity;
+    size_t count;
+    uint64_t *keys;
+    voxel_cell *cells;
+} voxel_hash;
+
+/* Cell functions */
+
+static inline void _voxel_cell_clear(voxel_cell *c)
+{
+    c->count = 0;
+    c->sum = Vec3(0, 0, 0);
+    c->bounds = aabb_empty();
+}
+
+static inline void _voxel_cell_add(voxel_cell *c, vec3 p)
+{
+    c->count++;
+    c->sum.x += p.x;
+    c->sum.y += p.y;
+    c->sum.z += p.z;
+    c->bounds = aabb_extend(c->bounds, p);
+}
+
+static inline void _voxel_cell_merge(voxel_cell *c, const voxel_cell *o)
+{
+    c->count += o->count;
+    c->sum.x += o->sum.x;
+    c->sum.y += o->sum.y;
+    c->sum.z += o->sum.z;
+    c->bounds = aabb_union(c->bounds, o->bounds);
+}
+
+/* Mean of the cell's points; the zero vector for an empty cell. */
+static inline vec3 voxel_cell_centroid(const voxel_cell *c)
+{
+    if (c->count == 0) {
+        return Vec3(0, 0, 0);
+    }
+    return vec3_scale(c->sum, 1.0f / c->count);
+}
+
+/*
+ * f if keep is 1, +0.0f if keep is 0. Used to zero out-of-range values
+ * before converting them to integers. It works on the bits because GCC
+ * turns a select, or a clamp to constants, into a branch around the
+ * rest of the loop body and then will not vectorize the loop.
+ */
+static inline float _voxel_keep(float f, uint32_t keep)
+{
+    union { float f; uint32_t u; } v;
+    v.f = f;
+    v.u &= -keep;
+    return v.f;
+}
+
+/*
+ * floor() for the key computation: truncate, then step down for negative
+ * non-integers. Unlike floorf() this vectorizes without SSE4.1.
+ */
+static inline int32_t _voxel_floor(float f)
+{
+    int32_t i = (int32_t)f;
+    return i - (f < (float)i);
+}
+
+/* Dense grids */
+
+static inline int voxel_grid_init(voxel_grid *g, vec3 origin, float cell_size, int nx, int ny, int nz)
+{
+    size_t n, i;
+
+    if (!(cell_size > 0) || nx <= 0 || ny <= 0 || nz <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    n = (size_t)nx * ny * nz;
+    if (n / nx / ny != (size_t)nz || n > INT32_MAX || n > SIZE_MAX / sizeof(voxel_cell)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    g->cells = malloc(n * sizeof(voxel_cell));
+    if (!g->cells) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        _voxel_cell_clear(&g->cells[i]);
+    }
+    g->origin = origin;
+    g->cell_size = cell_size;
+    g->dims[0] = nx;
+    g->dims[1] = ny;
+    g->dims[2] = nz;
+    return 0;
+}
+
+static inline void voxel_grid_free(voxel_grid *g)
+{
+    free(g->cells);
+    g->cells = NULL;
+}
+
+static inline size_t voxel_grid_num_cells(const voxel_grid *g)
+{
+    return (size_t)g->dims[0] * g->dims[1] * g->dims[2];
+}
+
+static inline void voxel_grid_clear(voxel_grid *g)
+{
+    size_t i, n = voxel_grid_num_cells(g);
+    for (i = 0; i < n; i++) {
+        _voxel_cell_clear(&g->cells[i]);
+    }
+}
+
+static inline voxel_cell *voxel_grid_cell(const voxel_grid *g, int x, int y, int z)
+{
+    return &g->cells[((size_t)z * g->dims[1] + y) * g->dims[0] + x];
+}
+
+/*
+ * Linear cell index (x fastest) of each point, or -1 for points outside
+ * the grid or NaN.
+ */
+static inline void voxel_grid_index_batch(const voxel_grid *g, const vec3 *restrict points,
+                                          int32_t *restrict index, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    float inv = 1.0f / g->cell_size;
+    float ox = g->origin.x, oy = g->origin.y, oz = g->origin.z;
+    float fnx = g->dims[0], fny = g->dims[1], fnz = g->dims[2];
+    int32_t nx = g->dims[0], nxy = g->dims[0] * g->dims[1];
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        float fx = (points[i].x - ox) * inv;
+        float fy = (points[i].y - oy) * inv;
+        float fz = (points[i].z - oz) * inv;
+        uint32_t inside = (fx >= 0) & (fx < fnx) & (fy >= 0) & (fy < fny) & (fz >= 0) & (fz < fnz);
+        int32_t x = (int32_t)_voxel_keep(fx, inside);
+        int32_t y = (int32_t)_voxel_keep(fy, inside);
+        int32_t z = (int32_t)_voxel_keep(fz, inside);
+        index[i] = (x + nx*y + nxy*z) | -(int32_t)!inside;
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline void _voxel_grid_bin_serial(voxel_cell *cells, const voxel_grid *g,
+                                          const vec3 *points, size_t n)
+{
+    int32_t index[_CVEC_VOXEL_BLOCK];
+    size_t base, m, i;
+
+    for (base = 0; base < n; base += m) {
+        m = n - base < _CVEC_VOXEL_BLOCK ? n - base : _CVEC_VOXEL_BLOCK;
+        voxel_grid_index_batch(g, points + base, index, m);
+        for (i = 0; i < m; i++) {
+            if (index[i] >= 0) {
+                _voxel_cell_add(&cells[index[i]], points[base + i]);
+            }
+        }
+    }
+}
+
+struct _voxel_grid_ctx {
+    const voxel_grid *grid;
+    const vec3 *points;
+    size_t n;
+    size_t chunks;
+    voxel_cell *partial;
+};
+
+static inline void _voxel_grid_bin_chunk(void *arg, size_t begin, size_t end)
+{
+    struct _voxel_grid_ctx *c = arg;
+    size_t cells = voxel_grid_num_cells(c->grid);
+    size_t chunk, i;
+
+    for (chunk = begin; chunk < end; chunk++) {
+        voxel_cell *partial = c->partial + chunk * cells;
+        size_t lo = c->n * chunk / c->chunks;
+        size_t hi = c->n * (chunk + 1) / c->chunks;
+        for (i = 0; i < cells; i++) {
+            _voxel_cell_clear(&partial[i]);
+        }
+        _voxel_grid_bin_serial(partial, c->grid, c->points + lo, hi - lo);
+    }
+}
+
+static inline void _voxel_grid_merge(void *arg, size_t begin, size_t end)
+{
+    struct _voxel_grid_ctx *c = arg;
+    size_t cells = voxel_grid_num_cells(c->grid);
+    size_t chunk, i;
+
+    for (i = begin; i < end; i++) {
+        for (chunk = 0; chunk < c->chunks; chunk++) {
+            const voxel_cell *o = &c->partial[chunk * cells + i];
+            if (o->count) {
+                _voxel_cell_merge(&c->grid->cells[i], o);
+            }
+        }
+    }
+}
+
+/*
+ * Adds the points to the grid's cells, using up to 'threads' threads.
+ * Returns -1 if the private grids could not be allocated, in which case
+ * the grid is unchanged.
+ */
+static inline int voxel_grid_bin(voxel_grid *g, const vec3 *points, size_t n, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    struct _voxel_grid_ctx c;
+    size_t cells = voxel_grid_num_cells(g);
+    size_t max_chunks = CVEC_VOXEL_PRIVATE_BYTES / (cells * sizeof(voxel_cell));
+
+    c.chunks = n / (cells > _CVEC_VOXEL_BLOCK ? cells : _CVEC_VOXEL_BLOCK);
+    if (c.chunks > (size_t)threads) {
+        c.chunks = threads;
+    }
+    if (c.chunks > max_chunks) {
+        c.chunks = max_chunks;
+    }
+    if (c.chunks <= 1) {
+        _voxel_grid_bin_serial(g->cells, g, points, n);
+        CVEC_PROFILE_END(n);
+        return 0;
+    }
+
+    c.partial = malloc(c.chunks * cells * sizeof(voxel_cell));
+    if (!c.partial) {
+        CVEC_PROFILE_END(n);
+        return -1;
+    }
+    c.grid = g;
+    c.points = points;
+    c.n = n;
+    cvec_parallel_for(c.chunks, 1, threads, _voxel_grid_bin_chunk, &c);
+    cvec_parallel_for(cells, 4096, threads, _voxel_grid_merge, &c);
+    free(c.partial);
+    CVEC_PROFILE_END(n);
+    return 0;
+}
+
+/* Sparse grids */
+
+static inline uint64_t voxel_key(int32_t x, int32_t y, int32_t z)
+{
+    return (uint64_t)(x + _VOXEL_KEY_BIAS) |
+           (uint64_t)(y + _VOXEL_KEY_BIAS) << _VOXEL_KEY_BITS |
+           (uint64_t)(z + _VOXEL_KEY_BIAS) << 2*_VOXEL_KEY_BITS;
+}
+
+static inline void voxel_key_coords(uint64_t key, int32_t *x, int32_t *y, int32_t *z)
+{
+    *x = (int32_t)(key & _VOXEL_KEY_MASK) - _VOXEL_KEY_BIAS;
+    *y = (int32_t)(key >> _VOXEL_KEY_BITS & _VOXEL_KEY_MASK) - _VOXEL_KEY_BIAS;
+    *z = (int32_t)(key >> 2*_VOXEL_KEY_BITS & _VOXEL_KEY_MASK) - _VOXEL_KEY_BIAS;
+}
+
+/* Cell key of each point, or VOXEL_KEY_NONE if it is out of range or NaN. */
+static inline void voxel_key_batch(vec3 origin, float cell_size, const vec3 *restrict points,
+                                   uint64_t *restrict keys, size_t n)
+{
+    CVEC_PROFILE_BEGIN();
+    const float lo = -_VOXEL_KEY_BIAS, hi = _VOXEL_KEY_BIAS;
+    float inv = 1.0f / cell_size;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        float fx = (points[i].x - origin.x) * inv;
+        float fy = (points[i].y - origin.y) * inv;
+        float fz = (points[i].z - origin.z) * inv;
+        uint32_t inside = (fx >= lo) & (fx < hi) & (fy >= lo) & (fy < hi) & (fz >= lo) & (fz < hi);
+        uint64_t x = _voxel_floor(_voxel_keep(fx, inside)) + _VOXEL_KEY_BIAS;
+        uint64_t y = _voxel_floor(_voxel_keep(fy, inside)) + _VOXEL_KEY_BIAS;
+        uint64_t z = _voxel_floor(_voxel_keep(fz, inside)) + _VOXEL_KEY_BIAS;
+        keys[i] = (x | y << _VOXEL_KEY_BITS | z << 2*_VOXEL_KEY_BITS) | -(uint64_t)!inside;
+    }
+    CVEC_PROFILE_END(n);
+}
+
+static inline size_t _voxel_hash_slot(uint64_t key, size_t capacity)
+{
+    return (size_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & (capacity - 1);
+}
+
+/* On failure h is left empty, so voxel_hash_free() on it is safe. */
+static inline int _voxel_hash_alloc(voxel_hash *h, size_t capacity)
+{
+    size_t i;
+
+    if (capacity > SIZE_MAX / sizeof(voxel_cell)) {
+        h->keys = NULL;
+        h->cells = NULL;
+    } else {
+        h->keys = malloc(capacity * sizeof(uint64_t));
+        h->cells = malloc(capacity * sizeof(voxel_cell));
+    }
+    if (!h->keys || !h->cells) {
+        free(h->keys);
+        free(h->cells);
+        h->keys = NULL;
+        h->cells = NULL;
+        h->capacity = h->count = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < capacity; i++) {
+        h->keys[i] = VOXEL_KEY_NONE;
+    }
+    h->capacity = capacity;
+    h->count = 0;
+    return 0;
+}
+
+static inline int voxel_hash_init(voxel_hash *h, vec3 origin, float cell_size)
+{
+    if (!(cell_size > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    h->origin = origin;
+    h->cell_size = cell_size;
+    return _voxel_hash_alloc(h, 64);
+}
+
+static inline void voxel_hash_free(voxel_hash *h)
+{
+    free(h->keys);
+    free(h->cells);
+    h->keys = NULL;
+    h->cells = NULL;
+    h->capacity = h->count = 0;
+}
+
+static inline voxel_cell *_voxel_hash_insert(voxel_hash *h, uint64_t key)
+{
+    size_t i = _voxel_hash_slot(key, h->capacity);
+
+    while (h->keys[i] != key) {
+        if (h->keys[i] == VOXEL_KEY_NONE) {
+            h->keys[i] = key;
+            h->count++;
+            _voxel_cell_clear(&h->cells[i]);
+            break;
+        }
+        i = (i + 1) & (h->capacity - 1);
+    }
+    return &h->cells[i];
+}
+
+/* Keeps the load factor at or below 1/2 for 'extra' more cells. */
+static inline int _voxel_hash_reserve(voxel_hash *h, size_t extra)
+{
+    voxel_hash old = *h;
+    size_t capacity = h->capacity;
+    size_t i;
+
+    while ((h->count + extra) * 2 > capacity) {
+        capacity *= 2;
+    }
+    if (capacity == h->capacity) {
+        return 0;
+    }
+    if (_voxel_hash_alloc(h, capacity) != 0) {
+        *h = old;
+        return -1;
+    }
+    for (i = 0; i < old.capacity; i++) {
+        if (old.keys[i] != VOXEL_KEY_NONE) {
+            *_voxel_hash_insert(h, old.keys[i]) = old.cells[i];
+        }
+    }
+    free(old.keys);
+    free(old.cells);
+    return 0;
+}
+
+static inline voxel_cell *voxel_hash_find(const voxel_hash *h, int32_t x, int32_t y, int32_t z)
+{
+    uint64_t key = voxel_key(x, y, z);
+    size_t i = _voxel_hash_slot(key, h->capacity);
+
+    while (h->keys[i] != VOXEL_KEY_NONE) {
+        if (h->keys[i] == key) {
+            return &h->cells[i];
+        }
+        i = (i + 1) & (h->capacity - 1);
+    }
+    return NULL;
+}
+
+static inline int _voxel_hash_bin_serial(voxel_hash *h, const vec3 *points, size_t n)
+{
+    uint64_t keys[_CVEC_VOXEL_BLOCK];
+    size_t base, m, i;
+
+    for (base = 0; base < n; base += m) {
+        m = n - base < _CVEC_VOXEL_BLOCK ? n - base : _CVEC_VOXEL_BLOCK;
+        if (_voxel_hash_reserve(h, m) != 0) {
+            return -1;
+        }
+        voxel_key_batch(h->origin, h->cell_size, points + base, keys, m);
+        for (i = 0; i < m; i++) {
+            if (keys[i] != VOXEL_KEY_NONE) {
+                _voxel_cell_add(_voxel_hash_insert(h, keys[i]), points[base + i]);
+            }
+        }
+    }
+    return 0;
+}
+
+struct _voxel_hash_ctx {
+    const vec3 *points;
+    size_t n;
+    size_t chunks;
+    voxel_hash *partial;
+    int failed;
+};
+
+static inline void _voxel_hash_bin_chunk(void *arg, size_t begin, size_t end)
+{
+    struct _voxel_hash_ctx *c = arg;
+    size_t chunk;
+
+    for (chunk = begin; chunk < end; chunk++) {
+        size_t lo = c->n * chunk / c->chunks;
+        size_t hi = c->n * (chunk + 1) / c->chunks;
+        if (_voxel_hash_bin_serial(&c->partial[chunk], c->points + lo, hi - lo) != 0) {
+            c->failed = 1;
+        }
+    }
+}
+
+/*
+ * Adds the points to the table, using up to 'threads' threads. Returns
+ * -1 if memory ran out; the table then holds only some of the points.
+ */
+static inline int voxel_hash_bin(voxel_hash *h, const vec3 *points, size_t n, int threads)
+{
+    CVEC_PROFILE_BEGIN();
+    struct _voxel_hash_ctx c;
+    size_t chunk, i;
+    int ret = 0;
+
+    c.chunks = n / (16 * _CVEC_VOXEL_BLOCK);
+    if (c.chunks > (size_t)threads) {
+        c.chunks = threads;
+    }
+    if (c.chunks <= 1) {
+        ret = _voxel_hash_bin_serial(h, points, n);
+        CVEC_PROFILE_END(n);
+        return ret;
+    }
+
+    c.partial = calloc(c.chunks, sizeof(voxel_hash));
+    if (!c.partial) {
+        CVEC_PROFILE_END(n);
+        return -1;
+    }
+    c.points = points;
+    c.n = n;
+    c.failed = 0;
+    for (chunk = 0; chunk < c.chunks; chunk++) {
+        if (voxel_hash_init(&c.partial[chunk], h->origin, h->cell_size) != 0) {
+            c.failed = 1;
+        }
+    }
+    if (!c.failed) {
+        cvec_parallel_for(c.chunks, 1, threads, _voxel_hash_bin_chunk, &c);
+    }
+
+    for (chunk = 0; chunk < c.chunks && !c.failed; chunk++) {
+        const voxel_hash *p = &c.partial[chunk];
+        if (_voxel_hash_reserve(h, p->count) != 0) {
+            c.failed = 1;
+            break;
+        }
+        for (i = 0; i < p->capacity; i++) {
+            if (p->keys[i] != VOXEL_KEY_NONE) {
+                _voxel_cell_merge(_voxel_hash_insert(h, p->keys[i]), &p->cells[i]);
+            }
+        }
+    }
+    for (chunk = 0; chunk < c.chunks; chunk++) {
+        voxel_hash_free(&c.partial[chunk]);
+    }
+    free(c.partial);
+    if (c.failed) {
+        errno = ENOMEM;
+        ret = -1;
+    }
+    CVEC_PROFILE_END(n);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,801 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cvec.h"
+#include "cvec_batch.h"
+#include "cvec_quant.h"
+#include "cvec_rotation.h"
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Accuracy and throughput regression harness.
+ *
+ * Every kernel is run on several classes of input and compared against
+ * a double precision reference computed from the same inputs. The error
+ * of each output component is measured in units in the last place of
+ * the element's scale: the magnitude of the result (or, for dot and
+ * cross products and matrix products, the sum of the magnitudes of the
+ * terms), so that cancellation that no float kernel could avoid is not
+ * counted against it. Elements whose reference does not fit in a float
+ * are skipped. A NaN or infinite result counts as an infinite error. A
+ * class with every element skipped, or a baseline error that is not
+ * finite, fails: such a row would check nothing.
+ *
+ * Each kernel is also timed on the "random" class. The results are
+ * compared against a baseline file; a kernel fails if its maximum error
+ * grows by more than max(1, 10%) ulp or if it gets more than 'tolerance'
+ * plus TIMING_FLOOR_NS per element slower. A kernel that looks slower is
+ * timed up to TIMING_RETRIES more times and judged on its best run, so
+ * one noisy measurement does not fail it. -u records the slowest of that
+ * many runs.
+ *
+ * Timings are machine specific. The baseline records the host it was
+ * made on, and on any other host a slowdown is only reported, not
+ * counted as a failure. A baseline that names no host gates timings
+ * everywhere. Regenerate the baseline with -u to gate timings on a new
+ * machine.
+ *
+ *   regress [-u] [-b baseline] [-t tolerance]
+ */
+
+#define DEFAULT_BASELINE "regress_baseline.txt"
+#define ACCURACY_N 100000
+/* Small enough to stay in cache, so memory traffic does not swamp the kernel. */
+#define TIMING_N (1 << 12)
+#define TIMING_REPEAT 201
+#define TIMING_RETRIES 4
+#define TIMING_FLOOR_NS 0.5
+
+enum {
+    CLASS_RANDOM,
+    CLASS_DENORMAL,
+    CLASS_SMALL,
+    CLASS_HUGE,
+    NUM_CLASSES,
+};
+
+static const char *class_names[NUM_CLASSES] = { "random", "denormal", "small", "huge" };
+/*
+ * "huge" is as large as it can be while the products of two inputs, and
+ * sums of a few of them, still fit in a float.
+ */
+static const double class_magnitudes[NUM_CLASSES] = { 10, 1e-39, 1e-20, 1e18 };
+
+#define ALL_CLASSES ((1 << NUM_CLASSES) - 1)
+
+struct kernel {
+    const char *name;
+    int in_floats;
+    int out_floats;
+    int mbits;
+    int classes;
+    void (*prepare)(float *in, size_t n);
+    void (*run)(const float *in, float *out, size_t n);
+    void (*ref)(const float *in, double *out, double *scale, size_t n);
+};
+
+struct result {
+    const char *name;
+    const char *class_name;
+    double max_ulp;
+    double mean_ulp;
+    double ns;
+};
+
+static uint64_t rng_state;
+
+/* xorshift64*, so that inputs are the same on every platform */
+static double rng_uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 2685821657736338717ULL >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double max3(double a, double b, double c)
+{
+    return a > b ? (a > c ? a : c) : (b > c ? b : c);
+}
+
+static double dlength3(const float *a)
+{
+    return sqrt((double)a[0]*a[0] + (double)a[1]*a[1] + (double)a[2]*a[2]);
+}
+
+
+/* Kernels and references */
+
+static const mat4 *point_matrix(void)
+{
+    static mat4 m[1];
+    mat4 rot[1], tr[1];
+    mat4_init_rotate(rot, Vec3(1, 2, 3), 0.7);
+    mat4_init_translate(tr, Vec3(1, 2, 3));
+    mat4_mult(tr, rot, m);
+    return m;
+}
+
+static void run_vec3_dot(const float *in, float *out, size_t n)
+{
+    const vec3 *v = (const vec3 *)in;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = vec3_dot(v[2*i], v[2*i+1]);
+    }
+}
+
+static void ref_vec3_dot(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        const float *a = in + 6*i, *b = a + 3;
+        out[i] = (double)a[0]*b[0] + (double)a[1]*b[1] + (double)a[2]*b[2];
+        scale[i] = fabs((double)a[0]*b[0]) + fabs((double)a[1]*b[1]) + fabs((double)a[2]*b[2]);
+    }
+}
+
+static void run_vec3_length(const float *in, float *out, size_t n)
+{
+    const vec3 *v = (const vec3 *)in;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = vec3_length(v[i]);
+    }
+}
+
+static void ref_vec3_length(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = scale[i] = dlength3(in + 3*i);
+    }
+}
+
+static void run_vec3_normalize(const float *in, float *out, size_t n)
+{
+    const vec3 *v = (const vec3 *)in;
+    vec3 *r = (vec3 *)out;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        r[i] = vec3_normalize(v[i]);
+    }
+}
+
+static void ref_vec3_normalize(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    int k;
+    for (i = 0; i < n; i++) {
+        double len = dlength3(in + 3*i);
+        for (k = 0; k < 3; k++) {
+            out[3*i+k] = in[3*i+k] / len;
+        }
+        scale[i] = 1;
+    }
+}
+
+static void run_vec3_cross(const float *in, float *out, size_t n)
+{
+    const vec3 *v = (const vec3 *)in;
+    vec3 *r = (vec3 *)out;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        r[i] = vec3_cross(v[2*i], v[2*i+1]);
+    }
+}
+
+static void ref_vec3_cross(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        const float *a = in + 6*i, *b = a + 3;
+        double *r = out + 3*i;
+        r[0] = (double)a[1]*b[2] - (double)a[2]*b[1];
+        r[1] = (double)a[2]*b[0] - (double)a[0]*b[2];
+        r[2] = (double)a[0]*b[1] - (double)a[1]*b[0];
+        scale[i] = max3(fabs((double)a[1]*b[2]) + fabs((double)a[2]*b[1]),
+                        fabs((double)a[2]*b[0]) + fabs((double)a[0]*b[2]),
+                        fabs((double)a[0]*b[1]) + fabs((double)a[1]*b[0]));
+    }
+}
+
+static void run_mat4_transform(const float *in, float *out, size_t n)
+{
+    vec4 *r = (vec4 *)out;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        const float *e = in + 20*i;
+        r[i] = mat4_transform((const mat4 *)e, *(const vec4 *)(e + 16));
+    }
+}
+
+static void ref_mat4_transform(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    int row, k;
+    for (i = 0; i < n; i++) {
+        const float *m = in + 20*i, *v = m + 16;
+        scale[i] = 0;
+        for (row = 0; row < 4; row++) {
+            double sum = 0, mag = 0;
+            for (k = 0; k < 4; k++) {
+                sum += (double)m[row + 4*k] * v[k];
+                mag += fabs((double)m[row + 4*k] * v[k]);
+            }
+            out[4*i+row] = sum;
+            scale[i] = mag > scale[i] ? mag : scale[i];
+        }
+    }
+}
+
+static void run_mat4_mult(const float *in, float *out, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        mat4_mult((const mat4 *)(in + 32*i), (const mat4 *)(in + 32*i + 16), (mat4 *)(out + 16*i));
+    }
+}
+
+static void ref_mat4_mult(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    int r, c, k;
+    for (i = 0; i < n; i++) {
+        const float *a = in + 32*i, *b = a + 16;
+        scale[i] = 0;
+        for (c = 0; c < 4; c++) {
+            for (r = 0; r < 4; r++) {
+                double sum = 0, mag = 0;
+                for (k = 0; k < 4; k++) {
+                    sum += (double)a[r + 4*k] * b[k + 4*c];
+                    mag += fabs((double)a[r + 4*k] * b[k + 4*c]);
+                }
+                out[16*i + r + 4*c] = sum;
+                scale[i] = mag > scale[i] ? mag : scale[i];
+            }
+        }
+    }
+}
+
+static void run_mat4_transform_point_batch(const float *in, float *out, size_t n)
+{
+    mat4_transform_point_batch(point_matrix(), (const vec3 *)in, (vec3 *)out, n);
+}
+
+static void ref_mat4_transform_point_batch(const float *in, double *out, double *scale, size_t n)
+{
+    const float *m = point_matrix()->data;
+    size_t i;
+    int row;
+    for (i = 0; i < n; i++) {
+        const float *v = in + 3*i;
+        scale[i] = 0;
+        for (row = 0; row < 3; row++) {
+            out[3*i+row] = (double)m[row]*v[0] + (double)m[row+4]*v[1] + (double)m[row+8]*v[2] + m[row+12];
+            scale[i] = fmax(scale[i], fabs((double)m[row]*v[0]) + fabs((double)m[row+4]*v[1]) +
+                                      fabs((double)m[row+8]*v[2]) + fabs((double)m[row+12]));
+        }
+    }
+}
+
+static void run_vec3_lerp_batch(const float *in, float *out, size_t n)
+{
+    /* The first n vec3s are a, the next n are b. */
+    vec3_lerp_batch((const vec3 *)in, (const vec3 *)in + n, 0.3f, (vec3 *)out, n);
+}
+
+static void ref_vec3_lerp_batch(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    int k;
+    for (i = 0; i < n; i++) {
+        scale[i] = 0;
+        for (k = 0; k < 3; k++) {
+            double a = in[3*i+k], b = in[3*(n+i)+k];
+            out[3*i+k] = a + 0.3f * (b - a);
+            scale[i] = max3(scale[i], fabs(a), fabs(b));
+        }
+    }
+}
+
+static void run_vec3_axpy_batch(const float *in, float *out, size_t n)
+{
+    memcpy(out, in + 3*n, sizeof(vec3) * n);
+    vec3_axpy_batch(0.7f, (const vec3 *)in, (vec3 *)out, n);
+}
+
+static void ref_vec3_axpy_batch(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    int k;
+    for (i = 0; i < n; i++) {
+        scale[i] = 0;
+        for (k = 0; k < 3; k++) {
+            double x = in[3*i+k], y = in[3*(n+i)+k];
+            out[3*i+k] = 0.7f * x + y;
+            scale[i] = fmax(scale[i], fabs(0.7f * x) + fabs(y));
+        }
+    }
+}
+
+static void run_vec3_madd_batch(const float *in, float *out, size_t n)
+{
+    const vec3 *v = (const vec3 *)in;
+    vec3_madd_batch(v, v + n, v + 2*n, (vec3 *)out, n);
+}
+
+static void ref_vec3_madd_batch(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    int k;
+    for (i = 0; i < n; i++) {
+        scale[i] = 0;
+        for (k = 0; k < 3; k++) {
+            double a = in[3*i+k], b = in[3*(n+i)+k], c = in[3*(2*n+i)+k];
+            out[3*i+k] = a * b + c;
+            scale[i] = fmax(scale[i], fabs(a * b) + fabs(c));
+        }
+    }
+}
+
+static const float weights[3] = { 0.2f, -0.3f, 0.5f };
+
+static void run_vec3_weighted_sum_batch(const float *in, float *out, size_t n)
+{
+    const vec3 *v = (const vec3 *)in;
+    const vec3 *arrays[3];
+    arrays[0] = v;
+    arrays[1] = v + n;
+    arrays[2] = v + 2*n;
+    vec3_weighted_sum_batch(arrays, weights, 3, (vec3 *)out, n);
+}
+
+static void ref_vec3_weighted_sum_batch(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    int j, k;
+    for (i = 0; i < n; i++) {
+        scale[i] = 0;
+        for (k = 0; k < 3; k++) {
+            double sum = 0, mag = 0;
+            for (j = 0; j < 3; j++) {
+                sum += (double)weights[j] * in[3*(j*n+i)+k];
+                mag += fabs((double)weights[j] * in[3*(j*n+i)+k]);
+            }
+            out[3*i+k] = sum;
+            scale[i] = fmax(scale[i], mag);
+        }
+    }
+}
+
+/* Reused between calls so that timings do not include page faults. */
+static void *scratch(size_t size)
+{
+    static void *buf;
+    static size_t buf_size;
+    if (size > buf_size) {
+        free(buf);
+        buf = malloc(size);
+        buf_size = size;
+        if (!buf) {
+            perror("malloc");
+            exit(2);
+        }
+    }
+    return buf;
+}
+
+static void run_half_roundtrip(const float *in, float *out, size_t n)
+{
+    uint16_t *h = scratch(sizeof(uint16_t) * n);
+    half_encode_batch(in, h, n);
+    half_decode_batch(h, out, n);
+}
+
+static void ref_identity(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        out[i] = in[i];
+        scale[i] = fabs(in[i]);
+    }
+}
+
+static void prepare_unit(float *in, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        double len = dlength3(in + 3*i);
+        if (len == 0) {
+            in[3*i] = len = 1;
+        }
+        in[3*i] /= len;
+        in[3*i+1] /= len;
+        in[3*i+2] /= len;
+    }
+}
+
+static void run_oct32_roundtrip(const float *in, float *out, size_t n)
+{
+    uint32_t *e = scratch(sizeof(uint32_t) * n);
+    oct32_encode_batch((const vec3 *)in, e, n);
+    oct32_decode_batch(e, (vec3 *)out, n);
+}
+
+static void ref_unit(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    for (i = 0; i < 3*n; i++) {
+        out[i] = in[i];
+    }
+    for (i = 0; i < n; i++) {
+        scale[i] = 1;
+    }
+}
+
+/* Rotations by 2*pi*k/ROT_STEPS, with k in the input. */
+#define ROT_STEPS 4096
+
+static void prepare_rot_step(float *in, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        in[i] = floor((in[i] / class_magnitudes[CLASS_RANDOM] + 1) / 2 * ROT_STEPS);
+    }
+}
+
+static void prepare_rot_sweep(float *in, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        in[i] = i % ROT_STEPS;
+    }
+}
+
+static void run_mat2_init_rotate(const float *in, float *out, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        mat2_init_rotate((mat2 *)(out + 4*i), (float)(2 * M_PI * in[i] / ROT_STEPS));
+    }
+}
+
+static void run_rot_table_mat2(const float *in, float *out, size_t n)
+{
+    static rot_table t;
+    size_t i;
+    if (!t.entries && rot_table_init(&t, Vec3(0, 0, 1), ROT_STEPS) < 0) {
+        perror("rot_table_init");
+        exit(2);
+    }
+    for (i = 0; i < n; i++) {
+        rot_table_mat2(&t, (int)in[i], (mat2 *)(out + 4*i));
+    }
+}
+
+static void run_rot_sweep_mat2(const float *in, float *out, size_t n)
+{
+    rot_sweep w;
+    size_t i;
+    (void)in;
+    rot_sweep_init(&w, Vec3(0, 0, 1), 0, 2 * M_PI / ROT_STEPS);
+    for (i = 0; i < n; i++) {
+        rot_sweep_mat2(&w, (mat2 *)(out + 4*i));
+        rot_sweep_next(&w);
+    }
+}
+
+static void ref_rot_mat2(const float *in, double *out, double *scale, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        double a = 2 * M_PI * in[i] / ROT_STEPS;
+        out[4*i] = cos(a);
+        out[4*i+1] = sin(a);
+        out[4*i+2] = -sin(a);
+        out[4*i+3] = cos(a);
+        scale[i] = 1;
+    }
+}
+
+static const struct kernel kernels[] = {
+    { "vec3_dot", 6, 1, 23, ALL_CLASSES, NULL, run_vec3_dot, ref_vec3_dot },
+    { "vec3_length", 3, 1, 23, ALL_CLASSES, NULL, run_vec3_length, ref_vec3_length },
+    /* The squared length of a denormal vector is 0, so normalize has no answer for it. */
+    { "vec3_normalize", 3, 3, 23, ALL_CLASSES & ~(1 << CLASS_DENORMAL), NULL,
+      run_vec3_normalize, ref_vec3_normalize },
+    { "vec3_cross", 6, 3, 23, ALL_CLASSES, NULL, run_vec3_cross, ref_vec3_cross },
+    { "mat4_transform", 20, 4, 23, ALL_CLASSES, NULL, run_mat4_transform, ref_mat4_transform },
+    { "mat4_mult", 32, 16, 23, ALL_CLASSES, NULL, run_mat4_mult, ref_mat4_mult },
+    { "mat4_transform_point_batch", 3, 3, 23, ALL_CLASSES, NULL,
+      run_mat4_transform_point_batch, ref_mat4_transform_point_batch },
+    { "vec3_lerp_batch", 6, 3, 23, ALL_CLASSES, NULL, run_vec3_lerp_batch, ref_vec3_lerp_batch },
+    { "vec3_axpy_batch", 6, 3, 23, ALL_CLASSES, NULL, run_vec3_axpy_batch, ref_vec3_axpy_batch },
+    { "vec3_madd_batch", 9, 3, 23, ALL_CLASSES, NULL, run_vec3_madd_batch, ref_vec3_madd_batch },
+    { "vec3_weighted_sum_batch", 9, 3, 23, ALL_CLASSES, NULL,
+      run_vec3_weighted_sum_batch, ref_vec3_weighted_sum_batch },
+    /* half and oct32 are lossy formats; their ulp is that of the format. */
+    { "half_roundtrip", 1, 1, 10, 1 << CLASS_RANDOM, NULL, run_half_roundtrip, ref_identity },
+    { "oct32_roundtrip", 3, 3, 15, 1 << CLASS_RANDOM, prepare_unit, run_oct32_roundtrip, ref_unit },
+    /* The same rotations three ways; see cvec_rotation.h. */
+    { "mat2_init_rotate", 1, 4, 23, 1 << CLASS_RANDOM, prepare_rot_step, run_mat2_init_rotate, ref_rot_mat2 },
+    { "rot_table_mat2", 1, 4, 23, 1 << CLASS_RANDOM, prepare_rot_step, run_rot_table_mat2, ref_rot_mat2 },
+    { "rot_sweep_mat2", 1, 4, 23, 1 << CLASS_RANDOM, prepare_rot_sweep, run_rot_sweep_mat2, ref_rot_mat2 },
+};
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+
+/* Measurement */
+
+static void generate(const struct kernel *k, int cls, float *in, size_t n)
+{
+    size_t i;
+    rng_state = 0x9e3779b97f4a7c15ULL ^ (uint64_t)(cls + 1) * 0x2545f4914f6cdd1dULL;
+    for (i = 0; i < n * k->in_floats; i++) {
+        in[i] = (float)((2 * rng_uniform() - 1) * class_magnitudes[cls]);
+    }
+    if (k->prepare) {
+        k->prepare(in, n);
+    }
+}
+
+static double ulp_at(double scale, int mbits)
+{
+    int e;
+    double ulp;
+    if (scale == 0) {
+        return ldexp(1, -149);
+    }
+    frexp(scale, &e);
+    ulp = ldexp(1, e - 1 - mbits);
+    return ulp > ldexp(1, -149) ? ulp : ldexp(1, -149);
+}
+
+static void measure_accuracy(const struct kernel *k, int cls, struct result *r)
+{
+    size_t n = ACCURACY_N, i, counted = 0;
+    float *in = malloc(sizeof(float) * n * k->in_floats);
+    float *out = malloc(sizeof(float) * n * k->out_floats);
+    double *ref = malloc(sizeof(double) * n * k->out_floats);
+    double *scale = malloc(sizeof(double) * n);
+    double sum = 0;
+    int j;
+
+    generate(k, cls, in, n);
+    k->run(in, out, n);
+    k->ref(in, ref, scale, n);
+
+    r->max_ulp = 0;
+    for (i = 0; i < n; i++) {
+        double ulp = ulp_at(scale[i], k->mbits);
+        double worst = 0;
+        int skip = scale[i] > FLT_MAX;
+        for (j = 0; j < k->out_floats; j++) {
+            skip |= fabs(ref[i*k->out_floats + j]) > FLT_MAX;
+        }
+        if (skip) {
+            continue;
+        }
+        for (j = 0; j < k->out_floats; j++) {
+            float v = out[i*k->out_floats + j];
+            double err = isfinite(v) ? fabs(v - ref[i*k->out_floats + j]) / ulp : INFINITY;
+            worst = err > worst ? err : worst;
+        }
+        r->max_ulp = worst > r->max_ulp ? worst : r->max_ulp;
+        sum += worst;
+        counted++;
+    }
+    r->mean_ulp = counted ? sum / counted : 0;
+    if (!counted) {
+        r->max_ulp = r->mean_ulp = NAN;
+    }
+
+    free(in);
+    free(out);
+    free(ref);
+    free(scale);
+}
+
+static double measure_time(const struct kernel *k)
+{
+    size_t n = TIMING_N;
+    float *in = malloc(sizeof(float) * n * k->in_floats);
+    float *out = malloc(sizeof(float) * n * k->out_floats);
+    double best = INFINITY;
+    int i;
+
+    generate(k, CLASS_RANDOM, in, n);
+    k->run(in, out, n);
+    for (i = 0; i < TIMING_REPEAT; i++) {
+        double t0 = now();
+        k->run(in, out, n);
+        t0 = now() - t0;
+        best = t0 < best ? t0 : best;
+    }
+
+    free(in);
+    free(out);
+    return best * 1e9 / n;
+}
+
+/*
+ * The slowest of 'first' and TIMING_RETRIES more timings. Checks take the
+ * best of as many runs, so a baseline made in a fast moment would fail
+ * every later check.
+ */
+static double slowest_time(const struct kernel *k, double first)
+{
+    int i;
+    for (i = 0; i < TIMING_RETRIES; i++) {
+        double t = measure_time(k);
+        first = t > first ? t : first;
+    }
+    return first;
+}
+
+
+/* Baseline */
+
+static int find_baseline(FILE *fp, const char *name, const char *cls, struct result *r)
+{
+    char line[256], bname[128], bcls[32];
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%127s %31s %lf %lf %lf", bname, bcls, &r->max_ulp, &r->mean_ulp, &r->ns) == 5 &&
+            strcmp(bname, name) == 0 && strcmp(bcls, cls) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Whether timings against the baseline count: it was recorded on this host
+ * or its "# host" line is missing.
+ */
+static int same_host(FILE *fp)
+{
+    char line[256], host[128], bhost[128];
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "# host %127s", bhost) == 1) {
+            if (gethostname(host, sizeof(host)) != 0) {
+                return 0;
+            }
+            host[sizeof(host) - 1] = 0;
+            return strcmp(host, bhost) == 0;
+        }
+    }
+    return 1;
+}
+
+static int slower(double ns, double base_ns, double tolerance)
+{
+    return ns > 0 && base_ns > 0 && ns > base_ns * (1 + tolerance) + TIMING_FLOOR_NS;
+}
+
+/* Accuracy always counts; timing only if strict_timing. */
+static int compare(const struct result *r, const struct result *base, double tolerance,
+                   int strict_timing, char *why, size_t len)
+{
+    double slack = base->max_ulp * 0.1 > 1 ? base->max_ulp * 0.1 : 1;
+    if (!isfinite(base->max_ulp)) {
+        snprintf(why, len, "baseline max ulp %.3g", base->max_ulp);
+        return -1;
+    }
+    if (!(r->max_ulp <= base->max_ulp + slack)) {
+        snprintf(why, len, "max ulp %.3g > %.3g", r->max_ulp, base->max_ulp);
+        return -1;
+    }
+    if (slower(r->ns, base->ns, tolerance)) {
+        snprintf(why, len, "%.2f ns > %.2f ns%s", r->ns, base->ns, strict_timing ? "" : " (other host)");
+        return strict_timing ? -1 : 0;
+    }
+    snprintf(why, len, "ok");
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: regress [-u] [-b baseline] [-t tolerance]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = DEFAULT_BASELINE;
+    double tolerance = 0.25;
+    int update = 0, failures = 0, strict_timing = 0;
+    FILE *fp = NULL;
+    size_t i;
+    int cls, a;
+
+    for (a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "-u") == 0) {
+            update = 1;
+        } else if (strcmp(argv[a], "-b") == 0 && a + 1 < argc) {
+            path = argv[++a];
+        } else if (strcmp(argv[a], "-t") == 0 && a + 1 < argc) {
+            tolerance = atof(argv[++a]);
+        } else {
+            usage();
+        }
+    }
+
+    fp = fopen(path, update ? "w" : "r");
+    if (!fp) {
+        perror(path);
+        return 2;
+    }
+    if (update) {
+        char host[128];
+        if (gethostname(host, sizeof(host)) == 0) {
+            host[sizeof(host) - 1] = 0;
+            fprintf(fp, "# host %s\n", host);
+        }
+        fprintf(fp, "# kernel class max_ulp mean_ulp ns_per_element\n");
+    } else {
+        strict_timing = same_host(fp);
+    }
+
+    printf("%-28s %-9s %10s %10s %9s  %s\n", "kernel", "class", "max ulp", "mean ulp", "ns/elem", "status");
+    for (i = 0; i < NUM_KERNELS; i++) {
+        const struct kernel *k = &kernels[i];
+        double ns = measure_time(k);
+        struct result timed;
+        int retry;
+
+        if (update) {
+            ns = slowest_time(k, ns);
+        } else if (find_baseline(fp, k->name, class_names[CLASS_RANDOM], &timed) == 0) {
+            for (retry = 0; retry < TIMING_RETRIES && slower(ns, timed.ns, tolerance); retry++) {
+                double again = measure_time(k);
+                ns = again < ns ? again : ns;
+            }
+        }
+        for (cls = 0; cls < NUM_CLASSES; cls++) {
+            struct result r, base;
+            char why[64] = "new";
+            if (!(k->classes & (1 << cls))) {
+                continue;
+            }
+            r.name = k->name;
+            r.class_name = class_names[cls];
+            measure_accuracy(k, cls, &r);
+            r.ns = cls == CLASS_RANDOM ? ns : 0;
+
+            if (update) {
+                fprintf(fp, "%s %s %.6g %.6g %.4g\n", r.name, r.class_name, r.max_ulp, r.mean_ulp, r.ns);
+                snprintf(why, sizeof(why), "recorded");
+            } else if (find_baseline(fp, r.name, r.class_name, &base) == 0) {
+                failures += compare(&r, &base, tolerance, strict_timing, why, sizeof(why)) < 0;
+            }
+            printf("%-28s %-9s %10.3g %10.3g %9.2f  %s\n", r.name, r.class_name,
+                   r.max_ulp, r.mean_ulp, r.ns, why);
+        }
+    }
+
+    fclose(fp);
+    if (failures) {
+        printf("%d regression%s against %s\n", failures, failures == 1 ? "" : "s", path);
+        return 1;
+    }
+    return 0;
+}
@@ -1,8 +1,45 @@
+#define _POSIX_C_SOURCE 200809L
 #include "cvec.h"
+#include "cvec_alloc.h"
+#include "cvec_batch.h"
+#include "cvec_bounds.h"
+#include "cvec_bvh.h"
+#include "cvec_command.h"
+#include "cvec_file.h"
+#include "cvec_fixed.h"
+#include "cvec_lanes.h"
+#include "cvec_morton.h"
+#include "cvec_parallel.h"
+#include "cvec_particle.h"
+#include "cvec_polygon.h"
+#include "cvec_quant.h"
+#include "cvec_query.h"
+#include "cvec_rotation.h"
+#include "cvec_stream.h"
+
+/*
+ * cvec_voxel.h allocates through voxel_malloc(), which fails the
+ * allocation after voxel_malloc_countdown more have succeeded. This
+ * tests the out-of-memory paths. -1 never fails.
+ */
+static int voxel_malloc_countdown = -1;
+
+static void *voxel_malloc(size_t size)
+{
+    if (voxel_malloc_countdown >= 0 && voxel_malloc_countdown-- == 0) {
+        return NULL;
+    }
+    return malloc(size);
+}
+
+#define malloc voxel_malloc
+#include "cvec_voxel.h"
+#undef malloc
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cvec_asserts.h"
 
@@ -140,6 +177,27 @@ static void test_vec3(void)
         assert_equal(4/sqrt(50), r.y);
         assert_equal(5/sqrt(50), r.z);
     }
+
+    {
+        vec3 r = vec3_cross(Vec3(1, 0, 0), Vec3(0, 1, 0));
+        assert_vec3_equal(Vec3(0, 0, 1), r);
+    }
+
+    {
+        vec3 a = { 1, 2, 3 };
+        vec3 b = { 4, 5, 6 };
+        vec3 r = vec3_cross(a, b);
+        assert_vec3_equal(Vec3(-3, 6, -3), r);
+        assert_equal(0, vec3_dot(r, a));
+        assert_equal(0, vec3_dot(r, b));
+    }
+
+    {
+        vec3 a = { 1, 5, 3 };
+        vec3 b = { 4, 2, 6 };
+        assert_vec3_equal(Vec3(1, 2, 3), vec3_min(a, b));
+        assert_vec3_equal(Vec3(4, 5, 6), vec3_max(a, b));
+    }
 }
 
 static void test_vec4(void)
@@ -545,6 +603,2247 @@ static void test_mat4(void)
     }
 }
 
+static void test_double(void)
+{
+    {
+        dvec3 a = { 1e8, 2, 3 };
+        dvec3 b = { 0.125, 5, 6 };
+        dvec3 r = dvec3_add(a, b);
+        assert_true(r.x == 100000000.125);
+        assert_dvec3_equal(DVec3(1e8 + 0.125, 7, 9), r);
+        assert_dvec3_equal(DVec3(1e8 - 0.125, -3, -3), dvec3_sub(a, b));
+        assert_equal(sqrt(50), dvec3_length(DVec3(3, 4, 5)));
+        assert_dvec3_equal(DVec3(-3, 6, -3), dvec3_cross(DVec3(1, 2, 3), DVec3(4, 5, 6)));
+    }
+
+    {
+        dvec2 a = DVec2(3, 4);
+        dvec4 b = DVec4(1, 2, 3, 4);
+        assert_equal(5, dvec2_length(a));
+        assert_equal(0.6, dvec2_normalize(a).x);
+        assert_equal(30, dvec4_dot(b, b));
+    }
+
+    {
+        dmat3 a[1], b[1], c[1];
+        dvec3 r;
+        dmat3_init_rotate(a, DVec3(2, 3, 4), M_PI/6);
+        dmat3_init_rotate(b, DVec3(2, 3, 4), M_PI/6);
+        dmat3_transpose(b);
+        dmat3_mult(a, b, c);
+        assert_true(fabs(dmat3_get(c, 0, 0) - 1) < 1e-15);
+        assert_true(fabs(dmat3_get(c, 0, 1)) < 1e-15);
+        dmat3_init_rotate(a, DVec3(0, 0, 1), M_PI/2);
+        r = dmat3_transform(a, DVec3(2, 3, 4));
+        assert_dvec3_equal(DVec3(-3, 2, 4), r);
+    }
+
+    {
+        dmat4 m[1];
+        mat4 f[1], g[1];
+        vec3 v = dvec3_to_vec3(DVec3(1, 2, 3));
+        assert_vec3_equal(Vec3(1, 2, 3), v);
+        assert_dvec3_equal(DVec3(1, 2, 3), vec3_to_dvec3(v));
+        mat4_init_rotate(f, Vec3(1, 2, 3), 0.3);
+        mat4_to_dmat4(f, m);
+        dmat4_to_mat4(m, g);
+        assert_mat4_equal(f, g);
+    }
+
+    {
+        dmat4 m[1], rot[1], tr[1];
+        dvec3 p[3] = { { 1, 2, 3 }, { -4, 5, 0.5 }, { 0, 0, 0 } };
+        dvec3 r[3];
+        dvec4 q[2] = { { 1, 2, 3, 1 }, { 1, 2, 3, 0 } };
+        int i;
+        dmat4_init_rotate(rot, DVec3(1, 0, 1), 1.1);
+        dmat4_init_translate(tr, DVec3(1e7, -2e7, 5));
+        dmat4_mult(tr, rot, m);
+        dmat4_transform_point_batch(m, p, r, 3);
+        for (i = 0; i < 3; i++) {
+            dvec4 t = dmat4_transform(m, DVec4(p[i].x, p[i].y, p[i].z, 1));
+            assert_dvec3_equal(DVec3(t.x, t.y, t.z), r[i]);
+        }
+        dmat4_transform_batch(m, q, q, 2);
+        assert_dvec3_equal(r[0], DVec3(q[0].x, q[0].y, q[0].z));
+        assert_equal(1, q[0].w);
+        assert_equal(0, q[1].w);
+    }
+
+    {
+        /* Camera-relative conversion keeps precision far from zero. */
+        dvec3 origin = { 1e7, 1e7, 0 };
+        dvec3 p[1] = { { 1e7 + 0.001, 1e7 - 0.002, 3 } };
+        vec3 r[1];
+        dmat4 m[1];
+        mat4 f[1];
+        vec4 t;
+        dvec3_to_vec3_relative_batch(p, origin, r, 1);
+        assert_true(fabs(r[0].x - 0.001) < 1e-9);
+        assert_true(fabs(r[0].y + 0.002) < 1e-9);
+        dmat4_init_translate(m, DVec3(1e7 + 0.5, 1e7 + 0.25, 1));
+        dmat4_to_mat4_relative_batch(m, origin, f, 1);
+        t = mat4_transform(f, Vec4(0.001, 0, 0, 1));
+        assert_vec4_equal(Vec4(0.501, 0.25, 1, 1), t);
+    }
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+    {
+        vec3 a = vec_add(Vec3(1, 2, 3), Vec3(4, 5, 6));
+        dvec3 b = vec_scale(DVec3(1, 2, 3), 2.0);
+        mat4 m[1];
+        dmat2 d[1];
+        assert_vec3_equal(Vec3(5, 7, 9), a);
+        assert_dvec3_equal(DVec3(2, 4, 6), b);
+        assert_equal(5, vec_length(Vec2(3, 4)));
+        assert_equal(32, vec_dot(DVec3(1, 2, 3), DVec3(4, 5, 6)));
+        assert_vec3_equal(Vec3(0, 0, 1), vec_cross(Vec3(1, 0, 0), Vec3(0, 1, 0)));
+        matrix_init_identity(m);
+        assert_vec4_equal(Vec4(1, 2, 3, 4), matrix_transform(m, Vec4(1, 2, 3, 4)));
+        dmat2_init(d, 1, 2, 3, 4);
+        matrix_transpose(d);
+        assert_equal(3, dmat2_get(d, 0, 1));
+    }
+#endif
+}
+
+static void test_aabb(void)
+{
+    {
+        aabb a = aabb_extend(aabb_empty(), Vec3(1, 2, 3));
+        assert_vec3_equal(Vec3(1, 2, 3), a.min);
+        assert_vec3_equal(Vec3(1, 2, 3), a.max);
+    }
+
+    {
+        aabb a = Aabb(Vec3(0, 0, 0), Vec3(1, 2, 3));
+        aabb b = Aabb(Vec3(-1, 1, 1), Vec3(0.5, 1.5, 4));
+        aabb r = aabb_union(a, b);
+        assert_vec3_equal(Vec3(-1, 0, 0), r.min);
+        assert_vec3_equal(Vec3(1, 2, 4), r.max);
+        assert_vec3_equal(Vec3(0, 1, 2), aabb_center(r));
+        assert_vec3_equal(Vec3(2, 2, 4), aabb_size(r));
+        assert_equal(2*(2*2 + 2*4 + 4*2), aabb_surface_area(r));
+    }
+
+    {
+        aabb a = Aabb(Vec3(0, 0, 0), Vec3(1, 1, 1));
+        assert_true(aabb_overlaps(a, Aabb(Vec3(1, 1, 1), Vec3(2, 2, 2))));
+        assert_true(!aabb_overlaps(a, Aabb(Vec3(1.5, 0, 0), Vec3(2, 1, 1))));
+        assert_true(!aabb_overlaps(a, aabb_empty()));
+    }
+}
+
+static float randf(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void random_triangles(vec3 *verts, int n, float size)
+{
+    int i, k;
+    for (i = 0; i < n; i++) {
+        vec3 c = Vec3(randf(-10, 10), randf(-10, 10), randf(-10, 10));
+        for (k = 0; k < 3; k++) {
+            verts[3*i+k] = vec3_add(c, Vec3(randf(-size, size), randf(-size, size), randf(-size, size)));
+        }
+    }
+}
+
+static int brute_query(const aabb *boxes, int n, aabb box)
+{
+    int i, found = 0;
+    for (i = 0; i < n; i++) {
+        found += aabb_overlaps(boxes[i], box);
+    }
+    return found;
+}
+
+static void test_bvh(void)
+{
+    {
+        bvh t;
+        int out[1];
+        assert_true(bvh_build(&t, NULL, 0, 1) == 0);
+        assert_true(bvh_query_aabb(&t, NULL, Aabb(Vec3(-1, -1, -1), Vec3(1, 1, 1)), out, 1) == 0);
+        bvh_free(&t);
+    }
+
+    {
+        bvh t;
+        aabb boxes[2];
+        int out[2];
+        boxes[0] = Aabb(Vec3(0, 0, 0), Vec3(1, 1, 1));
+        boxes[1] = Aabb(Vec3(5, 5, 5), Vec3(6, 6, 6));
+        assert_true(bvh_build(&t, boxes, 2, 1) == 0);
+        assert_true(bvh_query_aabb(&t, boxes, Aabb(Vec3(0.5, 0.5, 0.5), Vec3(2, 2, 2)), out, 2) == 1);
+        assert_true(out[0] == 0);
+        assert_vec3_equal(Vec3(0, 0, 0), t.bounds.min);
+        assert_vec3_equal(Vec3(6, 6, 6), t.bounds.max);
+        bvh_free(&t);
+    }
+
+    {
+        /* Queries and refit against brute force, serial and threaded. */
+        enum { N = 10000 };
+        static aabb boxes[N];
+        static int out[N];
+        int threads, i, j;
+        srand(1);
+        for (threads = 1; threads <= 4; threads *= 4) {
+            bvh t;
+            for (i = 0; i < N; i++) {
+                vec3 c = Vec3(randf(-10, 10), randf(-10, 10), randf(-10, 10));
+                boxes[i] = Aabb(c, vec3_add(c, Vec3(randf(0, 0.5), randf(0, 0.5), randf(0, 0.5))));
+            }
+            assert_true(bvh_build(&t, boxes, N, threads) == 0);
+            assert_true(t.num_prims == N);
+            for (j = 0; j < 100; j++) {
+                vec3 c = Vec3(randf(-10, 10), randf(-10, 10), randf(-10, 10));
+                aabb q = Aabb(c, vec3_add(c, Vec3(1, 1, 1)));
+                int found = bvh_query_aabb(&t, boxes, q, out, N);
+                assert_true(found == brute_query(boxes, N, q));
+                for (i = 0; i < found; i++) {
+                    assert_true(aabb_overlaps(boxes[out[i]], q));
+                }
+            }
+
+            for (i = 0; i < N; i++) {
+                vec3 d = Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1));
+                boxes[i] = Aabb(vec3_add(boxes[i].min, d), vec3_add(boxes[i].max, d));
+            }
+            bvh_refit(&t, boxes);
+            for (j = 0; j < 100; j++) {
+                vec3 c = Vec3(randf(-10, 10), randf(-10, 10), randf(-10, 10));
+                aabb q = Aabb(c, vec3_add(c, Vec3(1, 1, 1)));
+                assert_true(bvh_query_aabb(&t, boxes, q, out, N) == brute_query(boxes, N, q));
+            }
+            bvh_free(&t);
+        }
+    }
+
+    {
+        /* Nearest ray hits against brute force. */
+        enum { N = 2000 };
+        static vec3 verts[3*N];
+        bvh t;
+        int i, j;
+        srand(2);
+        random_triangles(verts, N, 1);
+        assert_true(bvh_build_triangles(&t, verts, N, 2) == 0);
+        for (j = 0; j < 200; j++) {
+            vec3 origin = Vec3(randf(-12, 12), randf(-12, 12), -20);
+            vec3 dir = vec3_normalize(Vec3(randf(-0.2, 0.2), randf(-0.2, 0.2), 1));
+            float best_t = INFINITY, tt = INFINITY;
+            int best = -1;
+            int hit = bvh_intersect_ray(&t, verts, origin, dir, INFINITY, &tt);
+            for (i = 0; i < N; i++) {
+                float d = _bvh_ray_triangle(origin, dir, verts[3*i], verts[3*i+1], verts[3*i+2]);
+                if (d < best_t) {
+                    best_t = d;
+                    best = i;
+                }
+            }
+            assert_true(hit == best);
+            if (hit >= 0) {
+                assert_equal(best_t, tt);
+            }
+        }
+
+        for (i = 0; i < 3*N; i++) {
+            verts[i] = vec3_add(verts[i], Vec3(0, 0, 1));
+        }
+        assert_true(bvh_refit_triangles(&t, verts) == 0);
+        {
+            vec3 origin = vec3_scale(vec3_add(vec3_add(verts[0], verts[1]), verts[2]), 1.0f/3);
+            float tt;
+            origin.z -= 100;
+            assert_true(bvh_intersect_ray(&t, verts, origin, Vec3(0, 0, 1), INFINITY, &tt) >= 0);
+        }
+        bvh_free(&t);
+    }
+}
+
+struct parallel_test {
+    unsigned char *hits;
+    size_t inner;
+    int nested;
+};
+
+static void parallel_count(void *ctx, size_t begin, size_t end)
+{
+    struct parallel_test *t = ctx;
+    size_t i;
+    for (i = begin; i < end; i++) {
+        t->hits[i]++;
+    }
+}
+
+static void parallel_nested(void *ctx, size_t begin, size_t end)
+{
+    struct parallel_test *t = ctx;
+    size_t i;
+    for (i = begin; i < end; i++) {
+        struct parallel_test inner = { t->hits + i * t->inner, 0, 0 };
+        cvec_parallel_for(t->inner, 1, 4, parallel_count, &inner);
+    }
+}
+
+static void *parallel_caller(void *arg)
+{
+    struct parallel_test *t = arg;
+    cvec_parallel_for(100000, 100, 4, parallel_count, t);
+    return NULL;
+}
+
+static void test_parallel(void)
+{
+    enum { N = 100000 };
+    static unsigned char hits[N], hits2[N];
+    static const size_t sizes[] = { 0, 1, 7, 1000, N };
+    static const size_t grains[] = { 0, 1, 64, 4096 };
+    struct parallel_test t = { hits, 0, 0 };
+    struct parallel_test t2 = { hits2, 0, 0 };
+    pthread_t thread;
+    size_t si, gi, i;
+    int threads;
+
+    for (si = 0; si < sizeof(sizes) / sizeof(sizes[0]); si++) {
+        for (gi = 0; gi < sizeof(grains) / sizeof(grains[0]); gi++) {
+            for (threads = 1; threads <= 8; threads *= 2) {
+                memset(hits, 0, sizes[si]);
+                cvec_parallel_for(sizes[si], grains[gi], threads, parallel_count, &t);
+                for (i = 0; i < sizes[si]; i++) {
+                    assert_true(hits[i] == 1);
+                }
+            }
+        }
+    }
+    assert_true(cvec_parallel_workers() >= 1);
+
+    /* Nested calls run inline instead of waiting on the pool. */
+    memset(hits, 0, N);
+    t.inner = 100;
+    cvec_parallel_for(N / t.inner, 1, 4, parallel_nested, &t);
+    for (i = 0; i < N; i++) {
+        assert_true(hits[i] == 1);
+    }
+
+    /* A second caller while the pool is busy runs inline. */
+    memset(hits, 0, N);
+    memset(hits2, 0, N);
+    assert_true(pthread_create(&thread, NULL, parallel_caller, &t2) == 0);
+    cvec_parallel_for(N, 100, 4, parallel_count, &t);
+    assert_true(pthread_join(thread, NULL) == 0);
+    for (i = 0; i < N; i++) {
+        assert_true(hits[i] == 1 && hits2[i] == 1);
+    }
+
+    cvec_parallel_shutdown();
+    assert_true(cvec_parallel_workers() == 0);
+    assert_true(cvec_parallel_init(3, 0) == 0);
+    assert_true(cvec_parallel_workers() == 2);
+    cvec_parallel_init(3, 1);
+    memset(hits, 0, N);
+    cvec_parallel_for(N, 1000, 3, parallel_count, &t);
+    for (i = 0; i < N; i++) {
+        assert_true(hits[i] == 1);
+    }
+    cvec_parallel_shutdown();
+}
+
+static void test_morton(void)
+{
+    {
+        assert_true(morton30_encode(1, 0, 0) == 1);
+        assert_true(morton30_encode(0, 1, 0) == 2);
+        assert_true(morton30_encode(0, 0, 1) == 4);
+        assert_true(morton30_encode(3, 0, 0) == 9);
+        assert_true(morton30_encode(1023, 1023, 1023) == 0x3fffffff);
+        assert_true(morton63_encode(1, 1, 1) == 7);
+        assert_true(morton63_encode(0x1fffff, 0x1fffff, 0x1fffff) == 0x7fffffffffffffffULL);
+    }
+
+    {
+        uint32_t x, y, z;
+        uint64_t x64, y64, z64;
+        morton30_decode(morton30_encode(123, 456, 789), &x, &y, &z);
+        assert_true(x == 123 && y == 456 && z == 789);
+        morton63_decode(morton63_encode(1234567, 7654, 2000000), &x64, &y64, &z64);
+        assert_true(x64 == 1234567 && y64 == 7654 && z64 == 2000000);
+    }
+
+    {
+        aabb bounds = Aabb(Vec3(-1, -2, -4), Vec3(1, 2, 4));
+        vec3 p = Vec3(0.3, -1.7, 3.9);
+        vec3 r30 = morton30_decode_vec3(morton30_encode_vec3(p, bounds), bounds);
+        vec3 r63 = morton63_decode_vec3(morton63_encode_vec3(p, bounds), bounds);
+        assert_true(fabs(r30.x - p.x) <= 1.0/1024 && fabs(r30.y - p.y) <= 2.0/1024 && fabs(r30.z - p.z) <= 4.0/1024);
+        assert_vec3_equal(p, r63);
+        assert_true(morton30_encode_vec3(Vec3(-5, -5, -5), bounds) == 0);
+        assert_true(morton30_encode_vec3(Vec3(5, 5, 5), bounds) == 0x3fffffff);
+    }
+
+    {
+        aabb bounds = Aabb(Vec3(0, 0, 0), Vec3(1, 1, 1));
+        vec3 p[3];
+        uint32_t codes[3];
+        vec3 r[3];
+        p[0] = Vec3(0, 0, 0);
+        p[1] = Vec3(0.999, 0, 0);
+        p[2] = Vec3(0.5, 0.5, 0.5);
+        morton30_encode_batch(p, codes, 3, bounds);
+        assert_true(codes[0] == 0);
+        assert_true(codes[1] == morton30_encode(1022, 0, 0));
+        assert_true(codes[2] == morton30_encode(512, 512, 512));
+        morton30_decode_batch(codes, r, 3, bounds);
+        assert_vec3_equal(Vec3(0.5/1024, 0.5/1024, 0.5/1024), r[0]);
+    }
+
+    {
+        enum { N = 200000 };
+        static vec3 p[N];
+        static int payload[N];
+        static uint32_t perm[N];
+        aabb bounds = Aabb(Vec3(-10, -10, -10), Vec3(10, 10, 10));
+        size_t i;
+        srand(3);
+        for (i = 0; i < N; i++) {
+            p[i] = Vec3(randf(-10, 10), randf(-10, 10), randf(-10, 10));
+            payload[i] = (int)i;
+        }
+        assert_true(morton_sort_vec3(p, N, bounds, payload, sizeof(int), perm, 4) == 0);
+        for (i = 0; i < N; i++) {
+            assert_true(perm[i] == (uint32_t)payload[i]);
+            if (i > 0) {
+                assert_true(morton63_encode_vec3(p[i-1], bounds) <= morton63_encode_vec3(p[i], bounds));
+            }
+        }
+
+        /* Too many points for the permutation, and too large a payload. */
+        if (SIZE_MAX > UINT32_MAX) {
+            errno = 0;
+            assert_true(morton_sort_vec3(NULL, (size_t)UINT32_MAX + 1, bounds, NULL, 0, NULL, 1) == -1);
+            assert_true(errno == EINVAL);
+        }
+        errno = 0;
+        assert_true(morton_sort_vec3(p, 4, bounds, payload, SIZE_MAX / 2, NULL, 1) == -1);
+        assert_true(errno == ENOMEM);
+    }
+
+    {
+        uint64_t keys[5] = { 5, 1, 0x300, 1, 0 };
+        uint32_t vals[5] = { 0, 1, 2, 3, 4 };
+        assert_true(cvec_radix_sort(keys, vals, 5, 16, 1) == 0);
+        assert_true(keys[0] == 0 && keys[1] == 1 && keys[2] == 1 && keys[3] == 5 && keys[4] == 0x300);
+        assert_true(vals[0] == 4 && vals[1] == 1 && vals[2] == 3 && vals[3] == 0 && vals[4] == 2);
+    }
+}
+
+static vec3 random_unit_vec3(void)
+{
+    vec3 v;
+    do {
+        v = Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1));
+    } while (vec3_length(v) < 0.01f || vec3_length(v) > 1);
+    return vec3_normalize(v);
+}
+
+static void test_quant(void)
+{
+    {
+        assert_true(half_encode(0.0f) == 0x0000);
+        assert_true(half_encode(-0.0f) == 0x8000);
+        assert_true(half_encode(1.0f) == 0x3c00);
+        assert_true(half_encode(-2.0f) == 0xc000);
+        assert_true(half_encode(65504.0f) == 0x7bff);
+        assert_true(half_encode(65520.0f) == 0x7c00);
+        assert_true(half_encode(INFINITY) == 0x7c00);
+        assert_true((half_encode(NAN) & 0x7c00) == 0x7c00 && (half_encode(NAN) & 0x3ff) != 0);
+        assert_true(half_encode(1.0f + 1.0f/2048) == 0x3c00);
+        assert_true(half_encode(1.0f + 3.0f/2048) == 0x3c02);
+        assert_true(half_encode(powf(2, -24)) == 0x0001);
+        assert_true(half_decode(0x3c00) == 1.0f);
+        assert_true(half_decode(0x0001) == powf(2, -24));
+        assert_true(half_decode(0x7c00) == INFINITY);
+        assert_true(isnan(half_decode(0x7e00)));
+    }
+
+    {
+        float in[19], out[19];
+        uint16_t h[19];
+        int i;
+        for (i = 0; i < 19; i++) {
+            in[i] = (i - 9) * 123.456f;
+        }
+        half_encode_batch(in, h, 19);
+        half_decode_batch(h, out, 19);
+        for (i = 0; i < 19; i++) {
+            assert_true(h[i] == half_encode(in[i]));
+            assert_true(fabsf(out[i] - in[i]) <= fabsf(in[i]) * (1.0f/2048));
+        }
+    }
+
+    {
+        vec4 in[3] = { { 1, 2, 3, 4 }, { 0.5, -0.25, 8, 16 }, { 0, 0, 0, 0 } };
+        vec4 out[3];
+        uint16_t h[12];
+        vec4_encode_half_batch(in, h, 3);
+        vec4_decode_half_batch(h, out, 3);
+        assert_vec4_equal(in[0], out[0]);
+        assert_vec4_equal(in[1], out[1]);
+        assert_vec4_equal(in[2], out[2]);
+    }
+
+    {
+        int i;
+        assert_vec3_equal(Vec3(0, 0, 1), oct32_decode(oct32_encode(Vec3(0, 0, 1))));
+        assert_vec3_equal(Vec3(0, 0, -1), oct32_decode(oct32_encode(Vec3(0, 0, -1))));
+        assert_vec3_equal(Vec3(1, 0, 0), oct32_decode(oct32_encode(Vec3(1, 0, 0))));
+        assert_vec3_equal(Vec3(0, -1, 0), oct32_decode(oct32_encode(Vec3(0, -1, 0))));
+        srand(4);
+        for (i = 0; i < 100000; i++) {
+            vec3 n = random_unit_vec3();
+            vec3 r = oct32_decode(oct32_encode(n));
+            vec3 c = vec3_cross(n, r);
+            double s = sqrt((double)c.x*c.x + (double)c.y*c.y + (double)c.z*c.z);
+            assert_true(atan2(s, vec3_dot(n, r)) < 1e-4);
+        }
+    }
+
+    {
+        aabb bounds = Aabb(Vec3(-100, 0, 5), Vec3(100, 10, 6));
+        vec3 in[4], out[4], ref[4];
+        uint16_t q[12];
+        mat4 m[1];
+        int i;
+        in[0] = Vec3(-100, 0, 5);
+        in[1] = Vec3(100, 10, 6);
+        in[2] = Vec3(12.345, 6.789, 5.5);
+        in[3] = Vec3(1000, -1000, 5.25);
+        pos16_encode_batch(in, q, 4, bounds);
+        pos16_decode_batch(q, out, 4, bounds);
+        assert_true(vec3_distance(in[0], out[0]) < 1e-4);
+        assert_true(vec3_distance(in[1], out[1]) < 1e-4);
+        assert_true(fabs(out[2].x - in[2].x) <= 200.0/131070);
+        assert_true(fabs(out[2].y - in[2].y) <= 10.0/131070);
+        assert_true(fabs(out[2].z - in[2].z) <= 1.0/131070);
+        assert_true(vec3_distance(Vec3(100, 0, 5.25), out[3]) < 1e-4);
+
+        mat4_init_rotate(m, Vec3(1, 2, 3), 0.5);
+        mat4_set(m, 0, 3, 7);
+        mat4_set(m, 2, 3, -3);
+        mat4_transform_pos16_batch(m, q, ref, 4, bounds);
+        for (i = 0; i < 4; i++) {
+            vec4 r = mat4_transform(m, Vec4(out[i].x, out[i].y, out[i].z, 1));
+            assert_true(vec3_distance(Vec3(r.x, r.y, r.z), ref[i]) < 1e-4);
+        }
+    }
+
+    {
+        vec3 n[2], out[2];
+        uint32_t e[2];
+        mat3 m[1];
+        n[0] = Vec3(1, 0, 0);
+        n[1] = vec3_normalize(Vec3(1, 1, 1));
+        oct32_encode_batch(n, e, 2);
+        mat3_init_rotate(m, Vec3(0, 0, 1), M_PI/2);
+        mat3_transform_oct32_batch(m, e, out, 2);
+        assert_vec3_equal(Vec3(0, 1, 0), out[0]);
+        oct32_decode_batch(e, out, 2);
+        assert_true(vec3_distance(n[1], out[1]) < 1e-4);
+    }
+}
+
+static void test_file(void)
+{
+    const char *path = "test_cvec_file.bin";
+
+    {
+        vec3 p[3] = { { 1, 2, 3 }, { -4, 5, 6 }, { 7, 8, -9 } };
+        cvec_file f;
+        const vec3 *r;
+        aabb b;
+        assert_true(cvec_file_write(path, CVEC_TYPE_VEC3, CVEC_LAYOUT_AOS, p, 3, NULL) == 0);
+        assert_true(cvec_file_open(&f, path) == 0);
+        assert_true(cvec_file_count(&f) == 3);
+        r = cvec_file_vec3(&f);
+        assert_true(r != NULL);
+        assert_true(((uintptr_t)r % CVEC_FILE_ALIGN) == 0);
+        assert_vec3_equal(p[0], r[0]);
+        assert_vec3_equal(p[2], r[2]);
+        b = cvec_file_bounds(&f);
+        assert_vec3_equal(Vec3(-4, 2, -9), b.min);
+        assert_vec3_equal(Vec3(7, 8, 6), b.max);
+        assert_true(cvec_file_vec4(&f) == NULL);
+        assert_true(cvec_file_stream(&f, 0) == NULL);
+        cvec_file_close(&f);
+    }
+
+    {
+        mat4 m[5];
+        cvec_file f;
+        int i, j;
+        for (i = 0; i < 5; i++) {
+            for (j = 0; j < 16; j++) {
+                m[i].data[j] = i * 100 + j;
+            }
+        }
+        assert_true(cvec_file_write(path, CVEC_TYPE_MAT4, CVEC_LAYOUT_SOA, m, 5, NULL) == 0);
+        assert_true(cvec_file_open(&f, path) == 0);
+        assert_true(cvec_file_mat4(&f) == NULL);
+        for (j = 0; j < 16; j++) {
+            const float *stream = cvec_file_stream(&f, j);
+            assert_true(((uintptr_t)stream % CVEC_FILE_ALIGN) == 0);
+            for (i = 0; i < 5; i++) {
+                assert_equal(i * 100 + j, stream[i]);
+            }
+        }
+        assert_true(cvec_file_stream(&f, 16) == NULL);
+        cvec_file_close(&f);
+    }
+
+    {
+        cvec_file f;
+        assert_true(cvec_file_write(path, CVEC_TYPE_VEC2, CVEC_LAYOUT_SOA, NULL, 0, NULL) == 0);
+        assert_true(cvec_file_open(&f, path) == 0);
+        assert_true(cvec_file_count(&f) == 0);
+        cvec_file_close(&f);
+    }
+
+    {
+        vec4 v[2] = { { 1, 2, 3, 4 }, { 5, 6, 7, 8 } };
+        cvec_file f;
+        FILE *fp;
+        assert_true(cvec_file_write(path, CVEC_TYPE_VEC4, CVEC_LAYOUT_AOS, v, 2, NULL) == 0);
+        /* Truncate the data so the header promises more than is there. */
+        fp = fopen(path, "r+b");
+        assert_true(fp);
+        fseek(fp, 16, SEEK_SET);
+        fwrite("\x01\x00\x00\x00\x07\x00\x00\x00", 8, 1, fp);
+        fclose(fp);
+        assert_true(cvec_file_open(&f, path) == -1);
+        assert_true(errno == EINVAL);
+        assert_true(cvec_file_write(path, 99, CVEC_LAYOUT_AOS, v, 2, NULL) == -1);
+    }
+
+    {
+        cvec_file f;
+        assert_true(cvec_file_open(&f, "does/not/exist") == -1);
+        assert_true(errno == ENOENT);
+    }
+
+    remove(path);
+}
+
+static void test_batch(void)
+{
+    {
+        vec3 p[3] = { { 1, 2, 3 }, { 0, 0, 0 }, { -1, 4, 2 } };
+        vec3 r[3];
+        mat4 m[1], rot[1], tr[1];
+        int i;
+        mat4_init_rotate(rot, Vec3(1, 1, 0), 0.7);
+        mat4_init_translate(tr, Vec3(10, 20, 30));
+        mat4_mult(tr, rot, m);
+        mat4_transform_point_batch(m, p, r, 3);
+        for (i = 0; i < 3; i++) {
+            vec4 t = mat4_transform(m, Vec4(p[i].x, p[i].y, p[i].z, 1));
+            assert_vec3_equal(Vec3(t.x, t.y, t.z), r[i]);
+        }
+        mat4_transform_point_batch(m, p, p, 3);
+        assert_vec3_equal(r[2], p[2]);
+    }
+
+    {
+        vec4 v[2] = { { 1, 2, 3, 1 }, { 4, 5, 6, 0 } };
+        vec3 u[2] = { { 1, 0, 0 }, { 0, 1, 0 } };
+        mat4 m[1];
+        mat3 n[1];
+        mat4_init_scale(m, 2);
+        mat4_transform_batch(m, v, v, 2);
+        assert_vec4_equal(Vec4(2, 4, 6, 1), v[0]);
+        assert_vec4_equal(Vec4(8, 10, 12, 0), v[1]);
+        mat3_init_rotate(n, Vec3(0, 0, 1), M_PI/2);
+        mat3_transform_batch(n, u, u, 2);
+        assert_vec3_equal(Vec3(0, 1, 0), u[0]);
+        assert_vec3_equal(Vec3(-1, 0, 0), u[1]);
+    }
+
+    {
+        vec2 p[3] = { { 1, 2 }, { 0, 0 }, { -3, 0.5f } };
+        vec2 r[3];
+        mat2 m[1];
+        int i;
+        mat2_init(m, 1, 2, -3, 4);
+        mat2_transform_batch(m, p, r, 3);
+        for (i = 0; i < 3; i++) {
+            assert_vec2_equal(mat2_transform(m, p[i]), r[i]);
+        }
+        mat2_init_rotate(m, M_PI/2);
+        mat2_transform_batch(m, p, p, 3);
+        assert_vec2_equal(Vec2(-2, 1), p[0]);
+        assert_vec2_equal(Vec2(-0.5f, -3), p[2]);
+    }
+
+    {
+        vec3 p[2] = { { 1, 2, 3 }, { 4, 5, 6 } };
+        vec3 r[2];
+        float x[2], y[2], z[2];
+        vec3_soa s = Vec3Soa(x, y, z);
+        vec3_soa_from_aos(p, s, 2);
+        assert_true(x[1] == 4 && y[1] == 5 && z[1] == 6);
+        assert_vec3_equal(p[0], vec3_soa_get(s, 0));
+        vec3_soa_set(s, 0, Vec3(7, 8, 9));
+        vec3_soa_to_aos(s, r, 2);
+        assert_vec3_equal(Vec3(7, 8, 9), r[0]);
+        assert_vec3_equal(p[1], r[1]);
+    }
+
+    {
+        vec3 a[3] = { { 1, 2, 3 }, { 0, 0, 0 }, { -1, 4, 2 } };
+        vec3 b[3] = { { 3, 2, 1 }, { 1, 1, 1 }, { 0, 0, 0 } };
+        vec3 c[3] = { { 1, 1, 1 }, { 2, 2, 2 }, { 3, 3, 3 } };
+        vec3 r[3];
+        float t[3] = { 0, 0.5f, 1 };
+        const vec3 *arrays[3] = { a, b, c };
+        float w[3] = { 1, 2, -1 };
+        vec4 v[2] = { { 1, 2, 3, 4 }, { -5, 6, -7, 8 } };
+        vec4 u[2];
+
+        vec3_lerp_batch(a, b, 0.25f, r, 3);
+        assert_vec3_equal(Vec3(1.5f, 2, 2.5f), r[0]);
+        vec3_lerp_each_batch(a, b, t, r, 3);
+        assert_vec3_equal(a[0], r[0]);
+        assert_vec3_equal(Vec3(0.5f, 0.5f, 0.5f), r[1]);
+        assert_vec3_equal(b[2], r[2]);
+        vec3_madd_batch(a, b, c, r, 3);
+        assert_vec3_equal(Vec3(4, 5, 4), r[0]);
+        assert_vec3_equal(Vec3(3, 3, 3), r[2]);
+        vec3_weighted_sum_batch(arrays, w, 3, r, 3);
+        assert_vec3_equal(Vec3(6, 5, 4), r[0]);
+        assert_vec3_equal(Vec3(-4, 1, -1), r[2]);
+        vec3_weighted_sum_batch(arrays, w, 0, r, 3);
+        assert_vec3_equal(Vec3(0, 0, 0), r[1]);
+        r[1] = Vec3(1, 1, 1);
+        vec3_weighted_sum_batch(arrays, w, -1, r, 3);
+        assert_vec3_equal(Vec3(0, 0, 0), r[1]);
+        {
+            const vec3 *arrays5[5] = { a, b, c, a, b };
+            float w5[5] = { 1, 1, 1, 1, -2 };
+            vec3_weighted_sum_batch(arrays5, w5, 5, r, 3);
+            assert_vec3_equal(Vec3(0, 3, 6), r[0]);
+        }
+        vec3_axpy_batch(2, b, a, 3);
+        assert_vec3_equal(Vec3(7, 6, 5), a[0]);
+        assert_vec3_equal(Vec3(-1, 4, 2), a[2]);
+        vec4_clamp_batch(v, Vec4(0, 0, -1, 0), Vec4(1, 5, 1, 10), u, 2);
+        assert_vec4_equal(Vec4(1, 2, 1, 4), u[0]);
+        assert_vec4_equal(Vec4(0, 5, -1, 8), u[1]);
+    }
+
+    {
+        /* Large enough to take the non-temporal store path. */
+        enum { N = (CVEC_BATCH_STREAM_BYTES / sizeof(vec3)) + 101 };
+        vec3 *a = malloc(sizeof(vec3) * N);
+        vec3 *b = malloc(sizeof(vec3) * N);
+        float *t = malloc(sizeof(float) * N);
+        int i;
+        for (i = 0; i < N; i++) {
+            a[i] = Vec3(i, 2*i, -i);
+            b[i] = Vec3(1, 1, 1);
+            t[i] = (i % 5) * 0.25f;
+        }
+        vec3_lerp_each_batch(b, b, t, b, N);
+        vec3_axpy_batch(0.5f, b, a + 1, N - 1);
+        for (i = 1; i < N; i++) {
+            assert_vec3_equal(Vec3(i + 0.5f, 2*i + 0.5f, -i + 0.5f), a[i]);
+        }
+        vec3_clamp_batch(a, Vec3(0, 0, 0), Vec3(10, 10, 10), a, N);
+        assert_vec3_equal(Vec3(10, 10, 0), a[N - 1]);
+        free(a);
+        free(b);
+        free(t);
+    }
+}
+
+static void assert_mat4_near(const mat4 *expected, const mat4 *value, float tolerance)
+{
+    int i;
+    for (i = 0; i < 16; i++) {
+        if (fabsf(expected->data[i] - value->data[i]) > tolerance) {
+            fprintf(stderr, "mat4 element %d: expected %g, got %g\n", i, expected->data[i], value->data[i]);
+            abort();
+        }
+    }
+}
+
+static void test_trs(void)
+{
+    enum { N = 1000 };
+    static vec3 t0[N], s0[N];
+    static vec4 q0[N];
+    static mat4 m[N], m2[N];
+    static float soa[10 * N];
+    vec3_soa ts = Vec3Soa(soa, soa + N, soa + 2*N);
+    vec4_soa qs = Vec4Soa(soa + 3*N, soa + 4*N, soa + 5*N, soa + 6*N);
+    vec3_soa ss = Vec3Soa(soa + 7*N, soa + 8*N, soa + 9*N);
+    int i;
+
+    {
+        vec4 q = quat_from_axis_angle(Vec3(0, 0, 2), M_PI/2);
+        assert_vec4_equal(Vec4(0, 0, sqrt(0.5), sqrt(0.5)), q);
+        assert_vec4_equal(Vec4(0, 0, 0, 1), quat_from_axis_angle(Vec3(0, 0, 0), 1));
+    }
+
+    /* Matches translate * rotate * scale. */
+    for (i = 0; i < 100; i++) {
+        vec3 t = Vec3(randf(-10, 10), randf(-10, 10), randf(-10, 10));
+        vec3 axis = Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1));
+        vec3 s = Vec3(randf(0.5, 2), randf(0.5, 2), randf(0.5, 2));
+        float angle = randf(-M_PI, M_PI);
+        mat4 tm, rm, sm, tr, expected, r;
+
+        mat4_init_translate(&tm, t);
+        mat4_init_rotate(&rm, axis, angle);
+        mat4_init(&sm, s.x, 0, 0, 0,
+                       0, s.y, 0, 0,
+                       0, 0, s.z, 0,
+                       0, 0, 0, 1);
+        mat4_mult(&tm, &rm, &tr);
+        mat4_mult(&tr, &sm, &expected);
+        mat4_init_trs(&r, t, quat_from_axis_angle(axis, angle), s);
+        assert_mat4_near(&expected, &r, 1e-5);
+    }
+
+    /* Round trip, including reflections and half turns. */
+    for (i = 0; i < N; i++) {
+        vec3 axis = i % 4 == 0 ? Vec3(i % 3 == 0, i % 3 == 1, i % 3 == 2)
+                               : Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1));
+        float angle = i % 8 == 0 ? M_PI : randf(-M_PI, M_PI);
+        t0[i] = Vec3(randf(-10, 10), randf(-10, 10), randf(-10, 10));
+        q0[i] = quat_from_axis_angle(axis, angle);
+        s0[i] = Vec3(randf(0.5, 2) * (i % 5 == 0 ? -1 : 1), randf(0.5, 2), randf(0.5, 2));
+        mat4_init_trs(&m[i], t0[i], q0[i], s0[i]);
+    }
+    for (i = 0; i < N; i++) {
+        vec3 t, s;
+        vec4 q;
+        mat4 r;
+        assert_true(mat4_decompose(&m[i], &t, &q, &s) == 0);
+        assert_vec3_equal(t0[i], t);
+        assert_true(fabsf(fabsf(vec4_dot(q, q0[i])) - 1) < 1e-5);
+        assert_true(fabsf(vec3_length(vec3_sub(s, s0[i]))) < 1e-5);
+        mat4_init_trs(&r, t, q, s);
+        assert_mat4_near(&m[i], &r, 1e-5);
+    }
+
+    /* Homogeneous w is divided out; shear is dropped. */
+    {
+        mat4 a, b;
+        vec3 t, s;
+        vec4 q;
+        mat4_init_trs(&a, Vec3(1, 2, 3), quat_from_axis_angle(Vec3(0, 1, 0), 1), Vec3(2, 3, 4));
+        b = a;
+        for (i = 0; i < 16; i++) {
+            b.data[i] *= 2;
+        }
+        assert_true(mat4_decompose(&b, &t, &q, &s) == 0);
+        assert_vec3_equal(Vec3(1, 2, 3), t);
+        assert_vec3_equal(Vec3(2, 3, 4), s);
+
+        mat4_init(&a, 1, 1, 0, 0,
+                      0, 1, 0, 0,
+                      0, 0, 1, 0,
+                      0, 0, 0, 1);
+        assert_true(mat4_decompose(&a, &t, &q, &s) == 0);
+        assert_vec4_equal(Vec4(0, 0, 0, 1), q);
+        assert_vec3_equal(Vec3(1, sqrt(2), 1), s);
+    }
+
+    /* Singular and projective matrices are rejected. */
+    {
+        mat4 a;
+        vec3 t, s;
+        vec4 q;
+        mat4_init_scale(&a, 0);
+        errno = 0;
+        assert_true(mat4_decompose(&a, &t, &q, &s) == -1 && errno == EDOM);
+        mat4_init_identity(&a);
+        mat4_set(&a, 3, 0, 1);
+        assert_true(mat4_decompose(&a, &t, &q, &s) == -1);
+        mat4_init(&a, 1, 2, 0, 0,
+                      2, 4, 0, 0,
+                      0, 0, 1, 0,
+                      0, 0, 0, 1);
+        assert_true(mat4_decompose(&a, &t, &q, &s) == -1);
+    }
+
+    /* Batch versions match the scalar ones. */
+    for (i = 0; i < N; i++) {
+        vec3_soa_set(ts, i, t0[i]);
+        vec4_soa_set(qs, i, q0[i]);
+        vec3_soa_set(ss, i, s0[i]);
+    }
+    mat4_init_trs_batch(ts, qs, ss, m2, N);
+    for (i = 0; i < N; i++) {
+        assert_true(memcmp(&m[i], &m2[i], sizeof(mat4)) == 0);
+    }
+    memset(soa, 0, sizeof(soa));
+    assert_true(mat4_decompose_batch(m, ts, qs, ss, N) == 0);
+    for (i = 0; i < N; i++) {
+        vec3 t, s;
+        vec4 q;
+        mat4_decompose(&m[i], &t, &q, &s);
+        assert_true(memcmp(&t, &(vec3){ ts.x[i], ts.y[i], ts.z[i] }, sizeof(t)) == 0);
+        assert_true(memcmp(&q, &(vec4){ qs.x[i], qs.y[i], qs.z[i], qs.w[i] }, sizeof(q)) == 0);
+        assert_true(memcmp(&s, &(vec3){ ss.x[i], ss.y[i], ss.z[i] }, sizeof(s)) == 0);
+    }
+    mat4_init_scale(&m[7], 0);
+    assert_true(mat4_decompose_batch(m, ts, qs, ss, N) == -1);
+    assert_vec4_equal(Vec4(0, 0, 0, 1), vec4_soa_get(qs, 7));
+    assert_vec3_equal(Vec3(0, 0, 0), vec3_soa_get(ss, 7));
+    assert_vec4_equal(q0[8], vec4_soa_get(qs, 8));
+
+    {
+        dmat4 a;
+        dvec3 t, s;
+        dvec4 q;
+        dmat4_init_trs(&a, DVec3(1e6, 2, 3), dquat_from_axis_angle(DVec3(1, 1, 0), 3), DVec3(1, -2, 3));
+        assert_true(dmat4_decompose(&a, &t, &q, &s) == 0);
+        assert_dvec3_equal(DVec3(1e6, 2, 3), t);
+        assert_dvec3_equal(DVec3(-1, 2, 3), s);
+    }
+}
+
+/* Branchy Voronoi-region version from Ericson, Real-Time Collision Detection. */
+static vec3 ref_closest_triangle(vec3 p, vec3 a, vec3 b, vec3 c)
+{
+    vec3 ab = vec3_sub(b, a), ac = vec3_sub(c, a), ap = vec3_sub(p, a);
+    vec3 bp, cp;
+    float d1 = vec3_dot(ab, ap), d2 = vec3_dot(ac, ap);
+    float d3, d4, d5, d6, va, vb, vc, v, w;
+
+    if (d1 <= 0 && d2 <= 0) {
+        return a;
+    }
+    bp = vec3_sub(p, b);
+    d3 = vec3_dot(ab, bp);
+    d4 = vec3_dot(ac, bp);
+    if (d3 >= 0 && d4 <= d3) {
+        return b;
+    }
+    vc = d1*d4 - d3*d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+        return vec3_add(a, vec3_scale(ab, d1 / (d1 - d3)));
+    }
+    cp = vec3_sub(p, c);
+    d5 = vec3_dot(ab, cp);
+    d6 = vec3_dot(ac, cp);
+    if (d6 >= 0 && d5 <= d6) {
+        return c;
+    }
+    vb = d5*d2 - d1*d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+        return vec3_add(a, vec3_scale(ac, d2 / (d2 - d6)));
+    }
+    va = d3*d6 - d5*d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+        return vec3_add(b, vec3_scale(vec3_sub(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6))));
+    }
+    v = vb / (va + vb + vc);
+    w = vc / (va + vb + vc);
+    return vec3_add(a, vec3_add(vec3_scale(ab, v), vec3_scale(ac, w)));
+}
+
+static void test_lanes(void)
+{
+    enum { N = 2 * CVEC_LANES + 3, B = CVEC_LANES_BLOCKS(N) };
+    static mat2 a2[N], b2[N], r2[N];
+    static mat3 a3[N], b3[N], r3[N];
+    static mat4 a4[N], b4[N], r4[N];
+    static mat2_lanes la2[B], lb2[B], lr2[B];
+    static mat3_lanes la3[B], lb3[B], lr3[B];
+    static mat4_lanes la4[B], lb4[B], lr4[B];
+    static float soa[8 * N], det[N];
+    vec4_soa v4 = Vec4Soa(soa, soa + N, soa + 2*N, soa + 3*N);
+    vec4_soa u4 = Vec4Soa(soa + 4*N, soa + 5*N, soa + 6*N, soa + 7*N);
+    vec3_soa v3 = Vec3Soa(soa, soa + N, soa + 2*N);
+    vec3_soa u3 = Vec3Soa(soa + 4*N, soa + 5*N, soa + 6*N);
+    vec2_soa v2 = Vec2Soa(soa, soa + N);
+    vec2_soa u2 = Vec2Soa(soa + 4*N, soa + 5*N);
+    mat4 id4;
+    int i, e;
+
+    for (i = 0; i < N; i++) {
+        for (e = 0; e < 16; e++) {
+            a4[i].data[e] = randf(-1, 1);
+            b4[i].data[e] = randf(-1, 1);
+        }
+        for (e = 0; e < 9; e++) {
+            a3[i].data[e] = a4[i].data[e];
+            b3[i].data[e] = b4[i].data[e];
+        }
+        for (e = 0; e < 4; e++) {
+            a2[i].data[e] = a4[i].data[e];
+            b2[i].data[e] = b4[i].data[e];
+            soa[e * N + i] = randf(-1, 1);
+        }
+    }
+
+    /* Round trip, with identity in the unused lanes. */
+    mat4_to_lanes(a4, la4, N);
+    mat4_from_lanes(la4, r4, N);
+    assert_true(memcmp(a4, r4, sizeof(a4)) == 0);
+    assert_true(la4[B - 1].data[0][CVEC_LANES - 1] == 1 && la4[B - 1].data[1][CVEC_LANES - 1] == 0);
+    assert_true(la4[1].data[5][2] == a4[CVEC_LANES + 2].data[5]);
+
+    mat4_to_lanes(b4, lb4, N);
+    mat4_lanes_mult(la4, lb4, lr4, N);
+    mat4_from_lanes(lr4, r4, N);
+    mat3_to_lanes(a3, la3, N);
+    mat3_to_lanes(b3, lb3, N);
+    mat3_lanes_mult(la3, lb3, lr3, N);
+    mat3_from_lanes(lr3, r3, N);
+    mat2_to_lanes(a2, la2, N);
+    mat2_to_lanes(b2, lb2, N);
+    mat2_lanes_mult(la2, lb2, lr2, N);
+    mat2_from_lanes(lr2, r2, N);
+    for (i = 0; i < N; i++) {
+        mat4 m4;
+        mat3 m3;
+        mat2 m2;
+        mat4_mult(&a4[i], &b4[i], &m4);
+        mat3_mult(&a3[i], &b3[i], &m3);
+        mat2_mult(&a2[i], &b2[i], &m2);
+        assert_mat4_equal(&m4, &r4[i]);
+        assert_mat3_equal(&m3, &r3[i]);
+        assert_mat2_equal(&m2, &r2[i]);
+    }
+
+    /* The vec2, vec3 and vec4 views share arrays. */
+    mat4_lanes_transform(la4, v4, u4, N);
+    for (i = 0; i < N; i++) {
+        assert_vec4_equal(mat4_transform(&a4[i], vec4_soa_get(v4, i)), vec4_soa_get(u4, i));
+    }
+    mat3_lanes_transform(la3, v3, u3, N);
+    for (i = 0; i < N; i++) {
+        assert_vec3_equal(mat3_transform(&a3[i], vec3_soa_get(v3, i)), vec3_soa_get(u3, i));
+    }
+    mat2_lanes_transform(la2, v2, u2, N);
+    for (i = 0; i < N; i++) {
+        assert_vec2_equal(mat2_transform(&a2[i], vec2_soa_get(v2, i)), vec2_soa_get(u2, i));
+    }
+    /* In place. */
+    {
+        vec4 expected = mat4_transform(&a4[N - 1], vec4_soa_get(u4, N - 1));
+        mat4_lanes_transform(la4, u4, u4, N);
+        assert_vec4_equal(expected, vec4_soa_get(u4, N - 1));
+    }
+
+    mat4_lanes_transpose(la4, lr4, N);
+    mat4_from_lanes(lr4, r4, N);
+    mat3_lanes_transpose(la3, la3, N);
+    mat3_from_lanes(la3, r3, N);
+    for (i = 0; i < N; i++) {
+        mat4 m4 = a4[i];
+        mat3 m3 = a3[i];
+        mat4_transpose(&m4);
+        mat3_transpose(&m3);
+        assert_mat4_equal(&m4, &r4[i]);
+        assert_mat3_equal(&m3, &r3[i]);
+    }
+    mat3_lanes_transpose(la3, la3, N);
+
+    /* det(TRS) is the product of the scales. */
+    for (i = 0; i < N; i++) {
+        mat4_init_trs(&r4[i], Vec3(i, 1, 2), quat_from_axis_angle(Vec3(1, 2, 3), i * 0.1f),
+                      Vec3(1 + i % 3, 0.5f, i % 2 ? -2 : 2));
+    }
+    mat4_to_lanes(r4, lr4, N);
+    mat4_lanes_determinant(lr4, det, N);
+    for (i = 0; i < N; i++) {
+        assert_true(fabsf(det[i] - (1 + i % 3) * (i % 2 ? -1.0f : 1.0f)) < 1e-5f);
+    }
+    mat2_lanes_determinant(la2, det, N);
+    assert_equal(a2[3].data[0] * a2[3].data[3] - a2[3].data[1] * a2[3].data[2], det[3]);
+    mat3_init_scale(&r3[0], 2);
+    mat3_to_lanes(r3, lr3, 1);
+    mat3_lanes_determinant(lr3, det, 1);
+    assert_equal(8, det[0]);
+
+    mat4_init_identity(&id4);
+    assert_true(mat4_lanes_inverse(la4, lr4, N) == 0);
+    mat4_from_lanes(lr4, r4, N);
+    assert_true(mat3_lanes_inverse(la3, lr3, N) == 0);
+    mat3_from_lanes(lr3, r3, N);
+    assert_true(mat2_lanes_inverse(la2, lr2, N) == 0);
+    mat2_from_lanes(lr2, r2, N);
+    for (i = 0; i < N; i++) {
+        mat4 m4;
+        mat3 m3;
+        mat2 m2;
+        float d;
+        mat4_mult(&a4[i], &r4[i], &m4);
+        assert_mat4_near(&id4, &m4, 1e-3f);
+        mat3_mult(&a3[i], &r3[i], &m3);
+        for (e = 0; e < 9; e++) {
+            assert_true(fabsf(m3.data[e] - (e % 4 == 0)) < 1e-3f);
+        }
+        mat2_mult(&r2[i], &a2[i], &m2);
+        d = a2[i].data[0] * a2[i].data[3] - a2[i].data[1] * a2[i].data[2];
+        assert_true(fabsf(r2[i].data[0] - a2[i].data[3] / d) <= 1e-5f * fabsf(r2[i].data[0]));
+        assert_true(fabsf(r2[i].data[1] + a2[i].data[1] / d) <= 1e-5f * fabsf(r2[i].data[1]));
+        assert_true(fabsf(m2.data[0] - 1) < 1e-3f && fabsf(m2.data[2]) < 1e-3f);
+    }
+    /* In place, and back. */
+    assert_true(mat4_lanes_inverse(lr4, lr4, N) == 0);
+    mat4_from_lanes(lr4, r4, N);
+    assert_mat4_near(&a4[5], &r4[5], 1e-2f);
+
+    mat4_init_zero(&a4[N - 1]);
+    mat4_to_lanes(a4, la4, N);
+    errno = 0;
+    assert_true(mat4_lanes_inverse(la4, lr4, N) == -1 && errno == EDOM);
+    mat4_from_lanes(lr4, r4, N);
+    assert_mat4_equal(&a4[N - 1], &r4[N - 1]);
+    /* Singular matrices past n do not count. */
+    assert_true(mat4_lanes_inverse(la4, lr4, N - 1) == 0);
+}
+
+static void assert_mat3_near(const mat3 *expected, const mat3 *value, float tolerance)
+{
+    int i;
+    for (i = 0; i < 9; i++) {
+        assert_true(fabsf(expected->data[i] - value->data[i]) <= tolerance);
+    }
+}
+
+static void test_rotation(void)
+{
+    enum { STEPS = 4096, N = 1000 };
+    vec3 axis = Vec3(1, 2, -2);
+    rot_table t;
+    rot_sweep w;
+    mat2 m2, r2;
+    mat3 m3, r3, step3;
+    mat4 m4, r4;
+    mat3 *a3 = malloc(sizeof(mat3) * N), *b3 = malloc(sizeof(mat3) * N);
+    mat4 *a4 = malloc(sizeof(mat4) * N), *b4 = malloc(sizeof(mat4) * N);
+    vec3 c0, c1, c2;
+    vec4 q;
+    size_t drifted;
+    int k, i;
+
+    assert_true(rot_table_init(&t, axis, 0) == -1 && errno == EINVAL);
+    assert_true(rot_table_init(&t, axis, STEPS) == 0);
+    assert_vec3_equal(Vec3(1.0f/3, 2.0f/3, -2.0f/3), t.axis);
+
+    for (k = -STEPS; k < 2 * STEPS; k += 37) {
+        float a = 2 * M_PI * k / STEPS;
+        rot_table_mat2(&t, k, &m2);
+        mat2_init_rotate(&r2, a);
+        assert_true(fabsf(m2.data[0] - r2.data[0]) < 1e-6f && fabsf(m2.data[1] - r2.data[1]) < 1e-6f);
+        assert_true(m2.data[2] == -m2.data[1] && m2.data[3] == m2.data[0]);
+        rot_table_mat3(&t, k, &m3);
+        mat3_init_rotate(&r3, axis, a);
+        assert_mat3_near(&r3, &m3, 1e-6f);
+        q = rot_table_quat(&t, k);
+        assert_true(fabsf(vec4_length(q) - 1) < 1e-6f);
+    }
+    assert_true(rot_table_angle(&t, -1) == (float)(2 * M_PI * (STEPS - 1) / STEPS));
+    assert_true(rot_table_angle(&t, STEPS) == 0);
+    q = rot_table_quat(&t, STEPS / 4);
+    assert_vec4_equal(quat_from_axis_angle(axis, M_PI / 2), q);
+    rot_table_free(&t);
+
+    assert_true(rot_table_init(&t, Vec3(0, 0, 0), 8) == 0);
+    rot_table_mat3(&t, 3, &m3);
+    mat3_init_identity(&r3);
+    assert_mat3_equal(&r3, &m3);
+    assert_vec4_equal(Vec4(0, 0, 0, 1), rot_table_quat(&t, 3));
+    rot_table_free(&t);
+
+    /* A million steps of a sweep that does not divide 2*pi. */
+    rot_sweep_init(&w, axis, 0.5, 0.001);
+    for (k = 0; k < 1000000; k++) {
+        rot_sweep_next(&w);
+    }
+    rot_sweep_mat3(&w, &m3);
+    mat3_init_rotate(&r3, axis, fmod(0.5 + 0.001 * 1000000, 2 * M_PI));
+    assert_mat3_near(&r3, &m3, 2e-6f);
+    rot_sweep_mat2(&w, &m2);
+    assert_true(fabsf(m2.data[0] * m2.data[0] + m2.data[1] * m2.data[1] - 1) < 1e-6f);
+    q = rot_sweep_quat(&w);
+    assert_true(fabsf(vec4_length(q) - 1) < 1e-6f);
+
+    /* Integrating a small rotation drifts away from orthonormal. */
+    mat3_init_rotate(&step3, axis, 0.01f);
+    mat3_init_identity(&r3);
+    assert_true(mat3_orthonormal_error(&r3) == 0);
+    for (k = 0; k < 20000; k++) {
+        mat3_mult(&step3, &r3, &m3);
+        r3 = m3;
+    }
+    assert_true(mat3_orthonormal_error(&m3) > 1e-5f);
+    mat3_orthonormalize(&r3);
+    assert_true(mat3_orthonormal_error(&r3) < 1e-6f);
+    c0 = Vec3(r3.data[0], r3.data[1], r3.data[2]);
+    assert_true(vec3_length(vec3_sub(c0, vec3_normalize(Vec3(m3.data[0], m3.data[1], m3.data[2])))) < 1e-7f);
+    mat3_init_rotate(&r3, axis, 0.01f * 20000);
+    assert_mat3_near(&r3, &m3, 1e-3f);
+
+    /* The polar step keeps right- and left-handed matrices as they are. */
+    for (i = 0; i < 9; i++) {
+        m3.data[i] = r3.data[i] + randf(-1e-2f, 1e-2f);
+    }
+    assert_true(mat3_orthonormal_error(&m3) > 1e-3f);
+    mat3_orthonormalize_polar(&m3);
+    assert_true(mat3_orthonormal_error(&m3) < 1e-6f);
+    assert_mat3_near(&r3, &m3, 2e-2f);
+    for (i = 0; i < 3; i++) {
+        m3.data[6 + i] = -r3.data[6 + i] + randf(-1e-3f, 1e-3f);
+    }
+    mat3_orthonormalize_polar(&m3);
+    assert_true(mat3_orthonormal_error(&m3) < 1e-6f);
+    c0 = Vec3(m3.data[0], m3.data[1], m3.data[2]);
+    c1 = Vec3(m3.data[3], m3.data[4], m3.data[5]);
+    c2 = Vec3(m3.data[6], m3.data[7], m3.data[8]);
+    assert_true(fabsf(vec3_dot(vec3_cross(c0, c1), c2) + 1) < 1e-6f);
+
+    /* Batches fix exactly the matrices past tol, as the scalar versions would. */
+    for (k = 0; k < N; k++) {
+        mat3_init_rotate(&a3[k], Vec3(randf(-1, 1), randf(-1, 1), 1), randf(-3, 3));
+        if (k % 3 == 0) {
+            for (i = 0; i < 9; i++) {
+                a3[k].data[i] += randf(-1e-3f, 1e-3f);
+            }
+        }
+        mat4_init_translate(&a4[k], Vec3(k, 2, 3));
+        for (i = 0; i < 3; i++) {
+            memcpy(&a4[k].data[4*i], &a3[k].data[3*i], sizeof(float) * 3);
+        }
+    }
+    for (k = 0; k < 2; k++) {
+        memcpy(b3, a3, sizeof(mat3) * N);
+        memcpy(b4, a4, sizeof(mat4) * N);
+        drifted = k ? mat3_orthonormalize_polar_batch(b3, N, 1e-5f)
+                    : mat3_orthonormalize_batch(b3, N, 1e-5f);
+        assert_true(drifted == (N + 2) / 3);
+        drifted = k ? mat4_orthonormalize_polar_batch(b4, N, 1e-5f)
+                    : mat4_orthonormalize_batch(b4, N, 1e-5f);
+        assert_true(drifted == (N + 2) / 3);
+        for (i = 0; i < N; i++) {
+            m3 = a3[i];
+            m4 = a4[i];
+            if (mat3_orthonormal_error(&m3) > 1e-5f) {
+                if (k) {
+                    mat3_orthonormalize_polar(&m3);
+                    mat4_orthonormalize_polar(&m4);
+                } else {
+                    mat3_orthonormalize(&m3);
+                    mat4_orthonormalize(&m4);
+                }
+                assert_true(mat3_orthonormal_error(&m3) < 1e-6f);
+            }
+            assert_true(!memcmp(&m3, &b3[i], sizeof(m3)));
+            assert_true(!memcmp(&m4, &b4[i], sizeof(m4)));
+            assert_true(mat4_orthonormal_error(&m4) == mat3_orthonormal_error(&m3));
+            mat4_init_translate(&r4, Vec3(i, 2, 3));
+            assert_true(!memcmp(&r4.data[12], &m4.data[12], sizeof(float) * 4));
+            assert_true(r4.data[3] == m4.data[3] && r4.data[7] == m4.data[7] && r4.data[11] == m4.data[11]);
+        }
+    }
+    assert_true(mat3_orthonormalize_batch(b3, N, 1e-5f) == 0);
+    free(a3);
+    free(b3);
+    free(a4);
+    free(b4);
+}
+
+static void test_query(void)
+{
+    enum { N = 10000 };
+    static vec3 p[N], segs[2*N], tris[3*N], closest[N];
+    static aabb boxes[N];
+    static float dist2[N], soa[17 * N];
+    vec3_soa ps = Vec3Soa(soa, soa + N, soa + 2*N);
+    vec3_soa as = Vec3Soa(soa + 3*N, soa + 4*N, soa + 5*N);
+    vec3_soa bs = Vec3Soa(soa + 6*N, soa + 7*N, soa + 8*N);
+    vec3_soa cs = Vec3Soa(soa + 9*N, soa + 10*N, soa + 11*N);
+    vec3_soa out = Vec3Soa(soa + 12*N, soa + 13*N, soa + 14*N);
+    float *soa_dist2 = soa + 15*N;
+    vec3 c;
+    int i;
+
+    assert_equal(4, closest_point_segment(Vec3(-2, 0, 0), Vec3(0, 0, 0), Vec3(4, 0, 0), &c));
+    assert_vec3_equal(Vec3(0, 0, 0), c);
+    assert_equal(1, closest_point_segment(Vec3(5, 0, 0), Vec3(0, 0, 0), Vec3(4, 0, 0), &c));
+    assert_vec3_equal(Vec3(4, 0, 0), c);
+    assert_equal(9, closest_point_segment(Vec3(1, 3, 0), Vec3(0, 0, 0), Vec3(4, 0, 0), &c));
+    assert_vec3_equal(Vec3(1, 0, 0), c);
+    assert_equal(2, closest_point_segment(Vec3(1, 1, 0), Vec3(0, 0, 0), Vec3(0, 0, 0), &c));
+    assert_vec3_equal(Vec3(0, 0, 0), c);
+
+    assert_equal(0, closest_point_aabb(Vec3(1, 1, 1), Aabb(Vec3(0, 0, 0), Vec3(2, 2, 2)), &c));
+    assert_vec3_equal(Vec3(1, 1, 1), c);
+    assert_equal(3, closest_point_aabb(Vec3(-1, 3, 3), Aabb(Vec3(0, 0, 0), Vec3(2, 2, 2)), &c));
+    assert_vec3_equal(Vec3(0, 2, 2), c);
+
+    assert_equal(4, closest_point_triangle(Vec3(0.25, 0.25, 2), Vec3(0, 0, 0), Vec3(1, 0, 0), Vec3(0, 1, 0), &c));
+    assert_vec3_equal(Vec3(0.25, 0.25, 0), c);
+    assert_equal(1, closest_point_triangle(Vec3(2, 0, 0), Vec3(0, 0, 0), Vec3(1, 0, 0), Vec3(0, 1, 0), &c));
+    assert_vec3_equal(Vec3(1, 0, 0), c);
+    /* Collinear triangle: closest point on its longest edge. */
+    assert_equal(1, closest_point_triangle(Vec3(1, 1, 0), Vec3(0, 0, 0), Vec3(1, 0, 0), Vec3(2, 0, 0), &c));
+    assert_vec3_equal(Vec3(1, 0, 0), c);
+
+    /* Non-positive denominators give 0, including -1. */
+    assert_true(_query_ratio(0.5f, -1) == 0);
+    assert_true(_query_ratio(-2, -1) == 0);
+    assert_true(_query_ratio(1, 0) == 0);
+    assert_true(_query_ratio(3, 4) == 0.75f);
+
+    for (i = 0; i < N; i++) {
+        vec3 lo = Vec3(randf(-2, 2), randf(-2, 2), randf(-2, 2));
+        p[i] = Vec3(randf(-3, 3), randf(-3, 3), randf(-3, 3));
+        segs[2*i] = Vec3(randf(-2, 2), randf(-2, 2), randf(-2, 2));
+        segs[2*i+1] = Vec3(randf(-2, 2), randf(-2, 2), randf(-2, 2));
+        tris[3*i] = Vec3(randf(-2, 2), randf(-2, 2), randf(-2, 2));
+        tris[3*i+1] = Vec3(randf(-2, 2), randf(-2, 2), randf(-2, 2));
+        tris[3*i+2] = Vec3(randf(-2, 2), randf(-2, 2), randf(-2, 2));
+        boxes[i] = Aabb(lo, vec3_add(lo, Vec3(randf(0, 2), randf(0, 2), randf(0, 2))));
+    }
+
+    for (i = 0; i < N; i++) {
+        vec3 ref = ref_closest_triangle(p[i], tris[3*i], tris[3*i+1], tris[3*i+2]);
+        float d = closest_point_triangle(p[i], tris[3*i], tris[3*i+1], tris[3*i+2], &c);
+        assert_true(vec3_length(vec3_sub(ref, c)) < 1e-4);
+        assert_true(fabsf(d - vec3_dot(vec3_sub(p[i], ref), vec3_sub(p[i], ref))) < 1e-4);
+    }
+
+    /* AoS and SoA batches match the scalar queries exactly. */
+    vec3_soa_from_aos(p, ps, N);
+    for (i = 0; i < N; i++) {
+        vec3_soa_set(as, i, segs[2*i]);
+        vec3_soa_set(bs, i, segs[2*i+1]);
+    }
+    closest_point_segment_batch(p, segs, closest, dist2, N);
+    closest_point_segment_soa_batch(ps, as, bs, out, soa_dist2, N);
+    for (i = 0; i < N; i++) {
+        float d = closest_point_segment(p[i], segs[2*i], segs[2*i+1], &c);
+        assert_true(d == dist2[i] && d == soa_dist2[i]);
+        assert_true(memcmp(&c, &closest[i], sizeof(c)) == 0);
+        assert_true(memcmp(&c, &(vec3){ out.x[i], out.y[i], out.z[i] }, sizeof(c)) == 0);
+    }
+
+    for (i = 0; i < N; i++) {
+        vec3_soa_set(as, i, tris[3*i]);
+        vec3_soa_set(bs, i, tris[3*i+1]);
+        vec3_soa_set(cs, i, tris[3*i+2]);
+    }
+    closest_point_triangle_batch(p, tris, closest, dist2, N);
+    closest_point_triangle_soa_batch(ps, as, bs, cs, out, soa_dist2, N);
+    for (i = 0; i < N; i++) {
+        float d = closest_point_triangle(p[i], tris[3*i], tris[3*i+1], tris[3*i+2], &c);
+        assert_true(d == dist2[i] && d == soa_dist2[i]);
+        assert_true(memcmp(&c, &closest[i], sizeof(c)) == 0);
+        assert_true(memcmp(&c, &(vec3){ out.x[i], out.y[i], out.z[i] }, sizeof(c)) == 0);
+    }
+
+    for (i = 0; i < N; i++) {
+        vec3_soa_set(as, i, boxes[i].min);
+        vec3_soa_set(bs, i, boxes[i].max);
+    }
+    closest_point_aabb_batch(p, boxes, closest, dist2, N);
+    closest_point_aabb_soa_batch(ps, as, bs, out, soa_dist2, N);
+    for (i = 0; i < N; i++) {
+        float d = closest_point_aabb(p[i], boxes[i], &c);
+        assert_true(d == dist2[i] && d == soa_dist2[i]);
+        assert_true(memcmp(&c, &closest[i], sizeof(c)) == 0);
+        assert_true(memcmp(&c, &(vec3){ out.x[i], out.y[i], out.z[i] }, sizeof(c)) == 0);
+    }
+}
+
+/* A random affine matrix: rotation, axis scale, shear and translation. */
+static void random_affine(mat4 *m)
+{
+    mat4 r, s;
+    mat4_init_rotate(&r, Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1)), randf(-3, 3));
+    mat4_init_identity(&s);
+    s.data[0] = randf(0.1, 3);
+    s.data[5] = randf(0.1, 3);
+    s.data[10] = randf(0.1, 3);
+    s.data[4] = randf(-1, 1);
+    mat4_mult(&r, &s, m);
+    m->data[12] = randf(-100, 100);
+    m->data[13] = randf(-100, 100);
+    m->data[14] = randf(-100, 100);
+}
+
+static void test_bounds(void)
+{
+    enum { N = 1000 };
+    static mat4 ms[N];
+    static aabb boxes[N], out[N], each[N];
+    static sphere spheres[N], sout[N], seach[N];
+    static float soa[12 * N];
+    vec3_soa lo = Vec3Soa(soa, soa + N, soa + 2*N);
+    vec3_soa hi = Vec3Soa(soa + 3*N, soa + 4*N, soa + 5*N);
+    vec3_soa olo = Vec3Soa(soa + 6*N, soa + 7*N, soa + 8*N);
+    vec3_soa ohi = Vec3Soa(soa + 9*N, soa + 10*N, soa + 11*N);
+    mat4 m;
+    mat3 m3;
+    aabb b;
+    sphere s;
+    int i, k;
+
+    /* A quarter turn about z with a translation is exact up to the padding. */
+    mat4_init_rotate(&m, Vec3(0, 0, 1), 3.14159265f / 2);
+    m.data[12] = 10;
+    b = mat4_transform_aabb(&m, Aabb(Vec3(0, 0, 0), Vec3(1, 2, 3)));
+    assert_true(vec3_length(vec3_sub(b.min, Vec3(8, 0, 0))) < 1e-4);
+    assert_true(vec3_length(vec3_sub(b.max, Vec3(10, 1, 3))) < 1e-4);
+    assert_true(b.min.x <= 8 && b.max.x >= 10 && b.min.y <= 0 && b.max.z >= 3);
+
+    /* Rotation times uniform scale gives the exact radius. */
+    mat3_init_rotate(&m3, Vec3(1, 2, 3), 0.7f);
+    for (i = 0; i < 9; i++) {
+        m3.data[i] *= 2;
+    }
+    s = mat3_transform_sphere(&m3, Sphere(Vec3(1, 0, 0), 1.5f));
+    assert_true(vec3_length(vec3_sub(s.center, mat3_transform(&m3, Vec3(1, 0, 0)))) < 1e-4);
+    assert_true(s.radius >= 3 && s.radius < 3 + 1e-4);
+
+    b = mat3_transform_aabb(&m3, Aabb(Vec3(-1, -1, -1), Vec3(1, 1, 1)));
+    assert_true(vec3_length(vec3_add(b.min, b.max)) < 1e-4);
+
+    assert_true(isnan(mat4_transform_aabb(&m, aabb_empty()).min.x));
+
+    for (i = 0; i < N; i++) {
+        vec3 c = Vec3(randf(-50, 50), randf(-50, 50), randf(-50, 50));
+        vec3 e = Vec3(randf(0, 5), randf(0, 5), randf(0, 5));
+        random_affine(&ms[i]);
+        boxes[i] = Aabb(vec3_sub(c, e), vec3_add(c, e));
+        spheres[i] = Sphere(c, randf(0, 5));
+    }
+
+    /*
+     * The corners of each box land inside its transformed box, which is
+     * no larger than their bounds. Points on each sphere land inside its
+     * transformed sphere.
+     */
+    for (i = 0; i < N; i++) {
+        aabb hull = aabb_empty();
+        b = mat4_transform_aabb(&ms[i], boxes[i]);
+        for (k = 0; k < 8; k++) {
+            vec4 p = Vec4(k & 1 ? boxes[i].max.x : boxes[i].min.x,
+                          k & 2 ? boxes[i].max.y : boxes[i].min.y,
+                          k & 4 ? boxes[i].max.z : boxes[i].min.z, 1);
+            p = mat4_transform(&ms[i], p);
+            hull = aabb_extend(hull, Vec3(p.x, p.y, p.z));
+        }
+        assert_true(b.min.x <= hull.min.x && b.min.y <= hull.min.y && b.min.z <= hull.min.z);
+        assert_true(b.max.x >= hull.max.x && b.max.y >= hull.max.y && b.max.z >= hull.max.z);
+        assert_true(vec3_length(vec3_sub(b.min, hull.min)) < 1e-3);
+        assert_true(vec3_length(vec3_sub(b.max, hull.max)) < 1e-3);
+
+        s = mat4_transform_sphere(&ms[i], spheres[i]);
+        for (k = 0; k < 16; k++) {
+            vec3 d = vec3_normalize(Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1)));
+            vec3 q = vec3_add(spheres[i].center, vec3_scale(d, spheres[i].radius));
+            vec4 p = mat4_transform(&ms[i], Vec4(q.x, q.y, q.z, 1));
+            assert_true(vec3_length(vec3_sub(Vec3(p.x, p.y, p.z), s.center)) <= s.radius);
+        }
+    }
+
+    /* The batches match the single-item versions exactly. */
+    mat4_transform_aabb_batch(&ms[0], boxes, out, N);
+    mat4_transform_aabb_each_batch(ms, boxes, each, N);
+    for (i = 0; i < N; i++) {
+        vec3_soa_set(lo, i, boxes[i].min);
+        vec3_soa_set(hi, i, boxes[i].max);
+    }
+    mat4_transform_aabb_soa_batch(&ms[0], lo, hi, olo, ohi, N);
+    for (i = 0; i < N; i++) {
+        b = mat4_transform_aabb(&ms[0], boxes[i]);
+        assert_true(memcmp(&b, &out[i], sizeof(b)) == 0);
+        assert_true(memcmp(&b, &(aabb){ vec3_soa_get(olo, i), vec3_soa_get(ohi, i) }, sizeof(b)) == 0);
+        b = mat4_transform_aabb(&ms[i], boxes[i]);
+        assert_true(memcmp(&b, &each[i], sizeof(b)) == 0);
+    }
+    mat3_transform_aabb_batch(&m3, boxes, out, N);
+    for (i = 0; i < N; i++) {
+        b = mat3_transform_aabb(&m3, boxes[i]);
+        assert_true(memcmp(&b, &out[i], sizeof(b)) == 0);
+    }
+
+    mat4_transform_sphere_batch(&ms[0], spheres, sout, N);
+    mat4_transform_sphere_each_batch(ms, spheres, seach, N);
+    for (i = 0; i < N; i++) {
+        s = mat4_transform_sphere(&ms[0], spheres[i]);
+        assert_true(memcmp(&s, &sout[i], sizeof(s)) == 0);
+        s = mat4_transform_sphere(&ms[i], spheres[i]);
+        assert_true(memcmp(&s, &seach[i], sizeof(s)) == 0);
+    }
+    mat3_transform_sphere_batch(&m3, spheres, sout, N);
+    for (i = 0; i < N; i++) {
+        s = mat3_transform_sphere(&m3, spheres[i]);
+        assert_true(memcmp(&s, &sout[i], sizeof(s)) == 0);
+    }
+
+    /* In place. */
+    memcpy(out, boxes, sizeof(boxes));
+    mat4_transform_aabb_batch(&ms[0], out, out, N);
+    for (i = 0; i < N; i++) {
+        b = mat4_transform_aabb(&ms[0], boxes[i]);
+        assert_true(memcmp(&b, &out[i], sizeof(b)) == 0);
+    }
+}
+
+static void test_particle(void)
+{
+    enum { N = 100000 };
+    static float px[N], py[N], pz[N], vx[N], vy[N], vz[N], ax[N], ay[N], az[N];
+    static vec3 p0[N], v0[N], a0[N], p1[N], v1[N];
+    vec3_soa pos = Vec3Soa(px, py, pz);
+    vec3_soa vel = Vec3Soa(vx, vy, vz);
+    vec3_soa acc = Vec3Soa(ax, ay, az);
+    particle_params params;
+    int i, step;
+
+    for (i = 0; i < N; i++) {
+        p0[i] = Vec3(randf(-10, 10), randf(-10, 10), randf(-10, 10));
+        v0[i] = Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1));
+        a0[i] = Vec3(randf(-1, 1), randf(-1, 1), randf(-1, 1));
+    }
+    vec3_soa_from_aos(a0, acc, N);
+    params.dt = 0.01f;
+    params.damping = 0.5f;
+    params.gravity = Vec3(0, -9.8f, 0);
+
+    {
+        /* Each integrator matches the per-element reference. */
+        float k = 1 - params.damping * params.dt;
+        int method;
+        for (method = 0; method < 3; method++) {
+            vec3_soa_from_aos(p0, pos, N);
+            vec3_soa_from_aos(v0, vel, N);
+            if (method == 0) {
+                particle_euler(pos, vel, &acc, N, &params, 4);
+            } else if (method == 1) {
+                particle_euler_semi(pos, vel, &acc, N, &params, 4);
+            } else {
+                particle_verlet_position(pos, vel, &acc, N, &params, 4);
+                particle_verlet_velocity(vel, &acc, N, &params, 4);
+            }
+            for (i = 0; i < N; i++) {
+                vec3 a = vec3_add(a0[i], params.gravity);
+                vec3 p, v;
+                if (method == 0) {
+                    p = vec3_add(p0[i], vec3_scale(v0[i], params.dt));
+                    v = vec3_scale(vec3_add(v0[i], vec3_scale(a, params.dt)), k);
+                } else if (method == 1) {
+                    v = vec3_scale(vec3_add(v0[i], vec3_scale(a, params.dt)), k);
+                    p = vec3_add(p0[i], vec3_scale(v, params.dt));
+                } else {
+                    v = vec3_add(v0[i], vec3_scale(a, params.dt * 0.5f));
+                    p = vec3_add(p0[i], vec3_scale(v, params.dt));
+                    v = vec3_scale(vec3_add(v, vec3_scale(a, params.dt * 0.5f)), k);
+                }
+                assert_true(vec3_distance(p, vec3_soa_get(pos, i)) < 1e-5);
+                assert_true(vec3_distance(v, vec3_soa_get(vel, i)) < 1e-5);
+            }
+        }
+    }
+
+    {
+        /* The thread count does not change the result. */
+        vec3_soa_from_aos(p0, pos, N);
+        vec3_soa_from_aos(v0, vel, N);
+        particle_euler_semi(pos, vel, &acc, N, &params, 1);
+        vec3_soa_to_aos(pos, p1, N);
+        vec3_soa_to_aos(vel, v1, N);
+        vec3_soa_from_aos(p0, pos, N);
+        vec3_soa_from_aos(v0, vel, N);
+        particle_euler_semi(pos, vel, &acc, N, &params, 8);
+        for (i = 0; i < N; i++) {
+            vec3 p = vec3_soa_get(pos, i), v = vec3_soa_get(vel, i);
+            assert_true(p.x == p1[i].x && p.y == p1[i].y && p.z == p1[i].z);
+            assert_true(v.x == v1[i].x && v.y == v1[i].y && v.z == v1[i].z);
+        }
+    }
+
+    {
+        /* Velocity Verlet is exact for constant acceleration. */
+        particle_params free_fall;
+        free_fall.dt = 0.125f;
+        free_fall.damping = 0;
+        free_fall.gravity = Vec3(0, -8, 0);
+        vec3_soa_from_aos(p0, pos, 1);
+        vec3_soa_from_aos(v0, vel, 1);
+        for (step = 0; step < 8; step++) {
+            particle_verlet_position(pos, vel, NULL, 1, &free_fall, 1);
+            particle_verlet_velocity(vel, NULL, 1, &free_fall, 1);
+        }
+        assert_true(vec3_distance(vec3_add(p0[0], vec3_add(v0[0], Vec3(0, -4, 0))),
+                             vec3_soa_get(pos, 0)) < 1e-5);
+        assert_true(vec3_distance(vec3_add(v0[0], Vec3(0, -8, 0)), vec3_soa_get(vel, 0)) < 1e-5);
+    }
+}
+
+static void count_kernel(void *ctx, vec3 *points, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        points[i] = vec3_scale(points[i], 2);
+    }
+    *(size_t *)ctx += n;
+}
+
+static void test_stream(void)
+{
+    const char *in_path = "test_cvec_stream_in.bin";
+    const char *out_path = "test_cvec_stream_out.bin";
+    enum { N = 1000 };
+    static vec3 p[N], r[N];
+    FILE *fp;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        p[i] = Vec3(i, -i, 0.5f * i);
+    }
+    fp = fopen(in_path, "wb");
+    assert_true(fp && fwrite(p, sizeof(vec3), N, fp) == N);
+    fclose(fp);
+
+    {
+        cvec_stream_stats stats;
+        mat4 m[1];
+        mat4_init_translate(m, Vec3(1, 2, 3));
+        assert_true(cvec_stream_transform_file(in_path, out_path, 64, m, &stats) == 0);
+        assert_true(stats.points == N);
+        assert_true(cvec_stream_throughput(&stats) > 0);
+        fp = fopen(out_path, "rb");
+        assert_true(fp && fread(r, sizeof(vec3), N + 1, fp) == N);
+        fclose(fp);
+        for (i = 0; i < N; i++) {
+            assert_vec3_equal(vec3_add(p[i], Vec3(1, 2, 3)), r[i]);
+        }
+    }
+
+    {
+        size_t count = 0;
+        assert_true(cvec_stream_file(in_path, out_path, N, count_kernel, &count, NULL) == 0);
+        assert_true(count == N);
+        fp = fopen(out_path, "rb");
+        assert_true(fp && fread(r, sizeof(vec3), N, fp) == N);
+        fclose(fp);
+        assert_vec3_equal(Vec3(2*(N-1), -2*(N-1), N-1), r[N-1]);
+    }
+
+    {
+        /* A trailing partial point is an error. */
+        size_t count = 0;
+        fp = fopen(in_path, "ab");
+        assert_true(fp && fwrite("x", 1, 1, fp) == 1);
+        fclose(fp);
+        assert_true(cvec_stream_file(in_path, out_path, 100, count_kernel, &count, NULL) == -1);
+        assert_true(errno == EINVAL);
+        assert_true(count == N);
+    }
+
+    {
+        /* Chunks whose buffer size would overflow are rejected up front. */
+        size_t count = 0;
+        assert_true(cvec_stream_file(in_path, out_path, SIZE_MAX / sizeof(vec3) + 1,
+                                     count_kernel, &count, NULL) == -1);
+        assert_true(errno == EINVAL);
+        assert_true(count == 0);
+    }
+
+    {
+        assert_true(cvec_stream_file("does/not/exist", out_path, 100, count_kernel, NULL, NULL) == -1);
+        assert_true(errno == ENOENT);
+    }
+
+    remove(in_path);
+    remove(out_path);
+}
+
+static void test_fixed(void)
+{
+    {
+        assert_true(q16_from_int(3) == 3 * Q16_ONE);
+        assert_true(q16_mul(q16_from_float(-1.5f), q16_from_float(2.25f)) == q16_from_float(-3.375f));
+        assert_true(q16_div(q16_from_int(-7), q16_from_int(2)) == q16_from_float(-3.5f));
+        assert_true(q16_sqrt(q16_from_int(9)) == q16_from_int(3));
+        assert_true(q16_sqrt(-Q16_ONE) == 0);
+        /* Rounds to nearest, ties toward +infinity. */
+        assert_true(q16_mul(1, Q16_ONE / 2) == 1);
+        assert_true(q16_mul(-1, Q16_ONE / 2) == 0);
+
+        assert_true(q32_mul(q32_from_double(-1.5), q32_from_double(2.25)) == q32_from_double(-3.375));
+        assert_true(q32_mul(q32_from_int(-40000), q32_from_int(40000)) == q32_from_int(-1600000000));
+        assert_true(q32_mul(1, Q32_ONE / 2) == 1);
+        assert_true(q32_mul(-1, Q32_ONE / 2) == 0);
+        assert_true(q32_div(q32_from_int(-7), q32_from_int(2)) == q32_from_double(-3.5));
+        assert_true(q32_div(Q32_ONE, q32_from_int(3)) == Q32_ONE / 3);
+        assert_true(q32_sqrt(q32_from_int(1 << 30)) == q32_from_int(1 << 15));
+        assert_true(fabs(q32_to_double(q32_sqrt(q32_from_int(2))) - sqrt(2)) < 1e-9);
+    }
+
+    {
+        /* sin and cos are within 2 ulp over a wide range. */
+        double a;
+        for (a = -1000; a < 1000; a += 0.37) {
+            q16 s16, c16;
+            q32 s32, c32;
+            double a16 = q16_to_float(q16_from_float(a));
+            double a32 = q32_to_double(q32_from_double(a));
+            q16_sincos(q16_from_float(a), &s16, &c16);
+            q32_sincos(q32_from_double(a), &s32, &c32);
+            assert_true(fabs(q16_to_float(s16) - sin(a16)) <= 2.0 / 65536);
+            assert_true(fabs(q16_to_float(c16) - cos(a16)) <= 2.0 / 65536);
+            assert_true(fabs(q32_to_double(s32) - sin(a32)) <= 2.0 / 4294967296.0);
+            assert_true(fabs(q32_to_double(c32) - cos(a32)) <= 2.0 / 4294967296.0);
+        }
+        assert_true(q16_sin(0) == 0);
+        assert_true(q16_cos(0) == Q16_ONE);
+    }
+
+    {
+        q16vec3 a = Q16Vec3(Q16_ONE, 0, 0);
+        q16vec3 b = Q16Vec3(0, Q16_ONE, 0);
+        q16vec3 c = q16vec3_cross(a, b);
+        assert_true(c.x == 0 && c.y == 0 && c.z == Q16_ONE);
+        assert_true(q16vec3_dot(a, b) == 0);
+        assert_true(q16vec3_length(Q16Vec3(q16_from_int(3), q16_from_int(4), 0)) == q16_from_int(5));
+        c = q16vec3_normalize(Q16Vec3(0, 0, q16_from_int(7)));
+        assert_true(c.z == Q16_ONE);
+        c = q16vec3_normalize(Q16Vec3(0, 0, 0));
+        assert_true(c.x == 0 && c.y == 0 && c.z == 0);
+        assert_vec3_equal(Vec3(1, 2, -3), q16vec3_to_vec3(q16vec3_from_vec3(Vec3(1, 2, -3))));
+    }
+
+    {
+        /* Fixed-point transforms track the float ones. */
+        vec3 p[3] = { { 1, 2, 3 }, { 0, 0, 0 }, { -1, 4, 2 } };
+        q16vec3 q[3], r16[3];
+        q32vec3 q32p[3], r32[3];
+        mat4 m[1], rot[1], tr[1];
+        q16mat4 m16[1], rot16[1], tr16[1];
+        q32mat4 m32[1];
+        int i;
+
+        mat4_init_rotate(rot, Vec3(1, 1, 0), 0.7);
+        mat4_init_translate(tr, Vec3(10, 20, 30));
+        mat4_mult(tr, rot, m);
+
+        q16mat4_init_rotate(rot16, Q16Vec3(Q16_ONE, Q16_ONE, 0), q16_from_float(0.7f));
+        q16mat4_init_translate(tr16, Q16Vec3(q16_from_int(10), q16_from_int(20), q16_from_int(30)));
+        q16mat4_mult(tr16, rot16, m16);
+        q32mat4_from_mat4(m, m32);
+
+        q16vec3_from_vec3_batch(p, q, 3);
+        for (i = 0; i < 3; i++) {
+            q32p[i] = Q32Vec3(q32_from_float(p[i].x), q32_from_float(p[i].y), q32_from_float(p[i].z));
+        }
+        q16mat4_transform_point_batch(m16, q, r16, 3);
+        q32mat4_transform_point_batch(m32, q32p, r32, 3);
+        for (i = 0; i < 3; i++) {
+            vec4 t = mat4_transform(m, Vec4(p[i].x, p[i].y, p[i].z, 1));
+            q16vec4 t16 = q16mat4_transform(m16, Q16Vec4(q[i].x, q[i].y, q[i].z, Q16_ONE));
+            vec3 f = Vec3(t.x, t.y, t.z);
+            assert_true(vec3_distance(f, q16vec3_to_vec3(r16[i])) < 1e-3);
+            assert_true(vec3_distance(f, Vec3(q32_to_float(r32[i].x), q32_to_float(r32[i].y),
+                                         q32_to_float(r32[i].z))) < 1e-4);
+            assert_true(abs(t16.x - r16[i].x) <= 2 && abs(t16.y - r16[i].y) <= 2 && abs(t16.z - r16[i].z) <= 2);
+        }
+        q16mat4_transform_point_batch(m16, q, q, 3);
+        assert_true(q[2].x == r16[2].x && q[2].y == r16[2].y && q[2].z == r16[2].z);
+
+        /* Negative translations. */
+        mat4_init_translate(tr, Vec3(-3, -20.5, -0.25));
+        mat4_mult(tr, rot, m);
+        q16mat4_init_translate(tr16, Q16Vec3(q16_from_int(-3), q16_from_float(-20.5f), q16_from_float(-0.25f)));
+        q16mat4_mult(tr16, rot16, m16);
+        q16vec3_from_vec3_batch(p, q, 3);
+        q16mat4_transform_point_batch(m16, q, r16, 3);
+        for (i = 0; i < 3; i++) {
+            vec4 t = mat4_transform(m, Vec4(p[i].x, p[i].y, p[i].z, 1));
+            q16vec4 t16 = q16mat4_transform(m16, Q16Vec4(q[i].x, q[i].y, q[i].z, Q16_ONE));
+            assert_true(vec3_distance(Vec3(t.x, t.y, t.z), q16vec3_to_vec3(r16[i])) < 1e-3);
+            assert_true(abs(t16.x - r16[i].x) <= 2 && abs(t16.y - r16[i].y) <= 2 && abs(t16.z - r16[i].z) <= 2);
+        }
+    }
+}
+
+static void test_profile(void)
+{
+#if defined(CVEC_PROFILE)
+    vec3 p[10] = { { 0, 0, 0 } };
+    uint64_t calls = 0, elements = 0, cycles = 0;
+    mat4 m[1];
+    FILE *fp;
+    char line[256];
+    int found = 0;
+
+    cvec_profile_reset();
+    mat4_init_identity(m);
+    mat4_transform_point_batch(m, p, p, 10);
+    mat4_transform_point_batch(m, p, p, 10);
+    p[0] = vec3_add(vec3_add(p[1], p[2]), p[3]);
+
+    assert_true(cvec_profile_get("mat4_transform_point_batch", &calls, &elements, &cycles) == 0);
+    assert_true(calls == 2 && elements == 20 && cycles > 0);
+    assert_true(cvec_profile_get("vec3_add", &calls, &elements, &cycles) == 0);
+    assert_true(calls == 2 && elements == 2 && cycles == 0);
+    assert_true(cvec_profile_get("dvec3_add", &calls, NULL, NULL) == 0 && calls == 0);
+    assert_true(cvec_profile_get("no_such_function", &calls, NULL, NULL) == -1);
+
+    fp = tmpfile();
+    assert_true(fp);
+    cvec_profile_report(fp);
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp)) {
+        found += strncmp(line, "mat4_transform_point_batch ", 27) == 0;
+    }
+    fclose(fp);
+    assert_true(found == 1);
+#else
+    assert_true(cvec_profile_get("vec3_add", NULL, NULL, NULL) == -1);
+    cvec_profile_reset();
+#endif
+}
+
+/* Checks that hull[0..k) is strictly convex, counter-clockwise and contains p[0..n). */
+static void assert_convex_hull(const vec2 *p, size_t n, const vec2 *hull, size_t k)
+{
+    size_t i, j;
+    for (i = 0; i < k; i++) {
+        vec2 a = hull[i], b = hull[(i + 1) % k], c = hull[(i + 2) % k];
+        assert_true(k < 3 || (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x) > 0);
+        for (j = 0; j < n; j++) {
+            assert_true((b.x - a.x) * (p[j].y - a.y) - (b.y - a.y) * (p[j].x - a.x) >= -1e-4f);
+        }
+    }
+}
+
+static void test_command(void)
+{
+    enum { MATS = 50, VECS = 200, CMDS = 5000 };
+    static mat4 mats[MATS];
+    static vec4 vecs[VECS];
+    cvec_cmdbuf b1, b4;
+    cvec_handle h;
+    int i, threads;
+
+    cvec_cmdbuf_init(&b1);
+    cvec_cmdbuf_init(&b4);
+    /* Rotations, so that products of them stay bounded. */
+    for (i = 0; i < MATS; i++) {
+        mat4_init_rotate(&mats[i], Vec3(randf(-1, 1), randf(-1, 1), 1), randf(-3, 3));
+        h = cvec_cmdbuf_new_mat4(&b1, &mats[i]);
+        assert_true(h == (cvec_handle)i && cvec_cmdbuf_new_mat4(&b4, &mats[i]) == h);
+    }
+    for (i = 0; i < VECS; i++) {
+        vecs[i] = vec4_normalize(Vec4(randf(-1, 1), randf(-1, 1), randf(-1, 1), 1));
+        h = cvec_cmdbuf_new_vec4(&b1, vecs[i]);
+        assert_true(h == (cvec_handle)i && cvec_cmdbuf_new_vec4(&b4, vecs[i]) == h);
+    }
+
+    assert_true(cvec_cmd_mat4_mult(&b1, 0, MATS, 0) == -1 && errno == EINVAL);
+    assert_true(cvec_cmd_vec4_normalize(&b1, VECS, 0) == -1 && errno == EINVAL);
+
+    /*
+     * Random commands with plenty of dependencies between them, run
+     * immediately on the reference copies. Results must match exactly.
+     */
+    for (i = 0; i < CMDS; i++) {
+        int op = rand() % 3, a = rand() % MATS, c = rand() % MATS;
+        int u = rand() % VECS, r = rand() % VECS;
+        if (op == 0) {
+            /* Products of products would drift away from rotations. */
+            mat4 m;
+            a %= MATS / 2;
+            c %= MATS / 2;
+            r = MATS / 2 + r % (MATS / 2);
+            mat4_mult(&mats[a], &mats[c], &m);
+            mats[r] = m;
+            assert_true(cvec_cmd_mat4_mult(&b1, a, c, r) == 0);
+            assert_true(cvec_cmd_mat4_mult(&b4, a, c, r) == 0);
+        } else if (op == 1) {
+            vecs[r] = mat4_transform(&mats[a], vecs[u]);
+            assert_true(cvec_cmd_mat4_transform(&b1, a, u, r) == 0);
+            assert_true(cvec_cmd_mat4_transform(&b4, a, u, r) == 0);
+        } else {
+            vecs[r] = vec4_normalize(vecs[u]);
+            assert_true(cvec_cmd_vec4_normalize(&b1, u, r) == 0);
+            assert_true(cvec_cmd_vec4_normalize(&b4, u, r) == 0);
+        }
+        /* Keep the values bounded. */
+        if (i % 7 == 0) {
+            vecs[u] = vec4_normalize(vecs[u]);
+            assert_true(cvec_cmd_vec4_normalize(&b1, u, u) == 0);
+            assert_true(cvec_cmd_vec4_normalize(&b4, u, u) == 0);
+        }
+        /* Inputs can be set between executions. */
+        if (i % 100 == 0) {
+            assert_true(cvec_cmdbuf_execute(&b1, 1) == 0);
+            assert_true(cvec_cmdbuf_execute(&b4, 4) == 0);
+            mat4_init_rotate(&mats[c], Vec3(1, 2, 3), i);
+            *cvec_cmdbuf_mat4(&b1, c) = mats[c];
+            *cvec_cmdbuf_mat4(&b4, c) = mats[c];
+        }
+    }
+    for (threads = 1; threads <= 4; threads += 3) {
+        cvec_cmdbuf *b = threads == 1 ? &b1 : &b4;
+        assert_true(cvec_cmdbuf_execute(b, threads) == 0);
+        for (i = 0; i < MATS; i++) {
+            assert_true(memcmp(&mats[i], cvec_cmdbuf_mat4(b, i), sizeof(mat4)) == 0);
+        }
+        for (i = 0; i < VECS; i++) {
+            assert_true(memcmp(&vecs[i], cvec_cmdbuf_vec4(b, i), sizeof(vec4)) == 0);
+            assert_true(fabsf(vec4_length(vecs[i]) - 1) < 1e-3f);
+        }
+        /* Nothing left to run. */
+        assert_true(cvec_cmdbuf_execute(b, threads) == 0);
+        assert_true(memcmp(&vecs[0], cvec_cmdbuf_vec4(b, 0), sizeof(vec4)) == 0);
+    }
+
+    cvec_cmdbuf_free(&b1);
+    cvec_cmdbuf_free(&b4);
+}
+
+static void test_polygon(void)
+{
+    enum { N = 5000 };
+    static vec2 p[N], hull[N], hull4[N];
+    static uint8_t inside[N];
+    vec2 square[4] = { { 0, 0 }, { 2, 0 }, { 2, 2 }, { 0, 2 } };
+    /* An L shape, clockwise. */
+    vec2 ell[6] = { { 0, 0 }, { 0, 3 }, { 1, 3 }, { 1, 1 }, { 3, 1 }, { 3, 0 } };
+    size_t k, k4, i;
+
+    p[0] = Vec2(1, 1);
+    p[1] = Vec2(0, 0);
+    p[2] = Vec2(2, 0);
+    p[3] = Vec2(1, 0);
+    p[4] = Vec2(2, 2);
+    p[5] = Vec2(0, 2);
+    p[6] = Vec2(2, 2);
+    p[7] = Vec2(0.5f, 1.5f);
+    assert_true(convex_hull_vec2(p, 8, hull, &k, 1) == 0);
+    assert_true(k == 4);
+    assert_vec2_equal(Vec2(0, 0), hull[0]);
+    assert_vec2_equal(Vec2(2, 0), hull[1]);
+    assert_vec2_equal(Vec2(2, 2), hull[2]);
+    assert_vec2_equal(Vec2(0, 2), hull[3]);
+
+    assert_true(convex_hull_vec2(p, 0, hull, &k, 1) == 0 && k == 0);
+    assert_true(convex_hull_vec2(p, 1, hull, &k, 1) == 0 && k == 1);
+    p[1] = Vec2(-0.0f, 0);
+    p[2] = Vec2(0, 0);
+    assert_true(convex_hull_vec2(p + 1, 2, hull, &k, 1) == 0 && k == 1);
+    for (i = 0; i < 10; i++) {
+        p[i] = Vec2(i, 2 * i + 1);
+    }
+    assert_true(convex_hull_vec2(p, 10, hull, &k, 1) == 0);
+    assert_true(k == 2);
+    assert_vec2_equal(Vec2(0, 1), hull[0]);
+    assert_vec2_equal(Vec2(9, 19), hull[1]);
+
+    for (i = 0; i < N; i++) {
+        float a = randf(0, 2 * M_PI), r = randf(0, 1);
+        p[i] = Vec2(r * cosf(a), r * sinf(a));
+    }
+    assert_true(convex_hull_vec2(p, N, hull, &k, 1) == 0);
+    assert_true(convex_hull_vec2(p, N, hull4, &k4, 4) == 0);
+    assert_true(k > 10 && k == k4);
+    assert_true(memcmp(hull, hull4, sizeof(vec2) * k) == 0);
+    assert_convex_hull(p, N, hull, k);
+
+    assert_true(point_in_polygon(square, 4, Vec2(1, 1)));
+    assert_true(!point_in_polygon(square, 4, Vec2(3, 1)));
+    assert_true(!point_in_polygon(square, 4, Vec2(1, -1)));
+    assert_true(point_in_polygon(ell, 6, Vec2(0.5f, 2.5f)));
+    assert_true(point_in_polygon(ell, 6, Vec2(2.5f, 0.5f)));
+    assert_true(!point_in_polygon(ell, 6, Vec2(2, 2)));
+    assert_true(!point_in_polygon(ell, 0, Vec2(2, 2)));
+
+    for (i = 0; i < N; i++) {
+        p[i] = Vec2(randf(-1, 4), randf(-1, 4));
+    }
+    point_in_polygon_batch(ell, 6, p, inside, N);
+    for (i = 0; i < N; i++) {
+        int expected = p[i].x > 0 && p[i].y > 0 &&
+                       ((p[i].x < 1 && p[i].y < 3) || (p[i].x < 3 && p[i].y < 1));
+        assert_true(inside[i] == point_in_polygon(ell, 6, p[i]));
+        assert_true(inside[i] == expected);
+    }
+}
+
+static void test_voxel(void)
+{
+    enum { N = 20000 };
+    static vec3 p[N];
+    static int32_t index[N];
+    static uint64_t keys[N];
+    voxel_grid g, g4;
+    voxel_hash h, h4;
+    voxel_cell *cell;
+    size_t total;
+    int32_t x, y, z;
+    int i;
+
+    assert_true(voxel_grid_init(&g, Vec3(0, 0, 0), 0, 1, 1, 1) == -1 && errno == EINVAL);
+    assert_true(voxel_grid_init(&g, Vec3(0, 0, 0), 1, 0, 1, 1) == -1 && errno == EINVAL);
+
+    assert_true(voxel_grid_init(&g, Vec3(-1, -1, -1), 0.5f, 4, 4, 4) == 0);
+    p[0] = Vec3(-1, -1, -1);
+    p[1] = Vec3(0.9f, -0.6f, 0.1f);
+    p[2] = Vec3(1, 0, 0);
+    p[3] = Vec3(-1.1f, 0, 0);
+    p[4] = Vec3(NAN, 0, 0);
+    p[5] = Vec3(0.99f, 0.99f, 0.99f);
+    voxel_grid_index_batch(&g, p, index, 6);
+    assert_true(index[0] == 0);
+    assert_true(index[1] == 3 + 4*0 + 16*2);
+    assert_true(index[2] == -1);
+    assert_true(index[3] == -1);
+    assert_true(index[4] == -1);
+    assert_true(index[5] == 63);
+
+    p[0] = Vec3(0.1f, 0.1f, 0.1f);
+    p[1] = Vec3(0.3f, 0.2f, 0.4f);
+    p[2] = Vec3(-0.9f, 0.1f, 0.1f);
+    p[3] = Vec3(5, 5, 5);
+    assert_true(voxel_grid_bin(&g, p, 4, 1) == 0);
+    cell = voxel_grid_cell(&g, 2, 2, 2);
+    assert_true(cell->count == 2);
+    assert_vec3_equal(Vec3(0.2f, 0.15f, 0.25f), voxel_cell_centroid(cell));
+    assert_vec3_equal(Vec3(0.1f, 0.1f, 0.1f), cell->bounds.min);
+    assert_vec3_equal(Vec3(0.3f, 0.2f, 0.4f), cell->bounds.max);
+    assert_true(voxel_grid_cell(&g, 0, 2, 2)->count == 1);
+    assert_true(voxel_grid_cell(&g, 1, 1, 1)->count == 0);
+    assert_vec3_equal(Vec3(0, 0, 0), voxel_cell_centroid(voxel_grid_cell(&g, 1, 1, 1)));
+    voxel_grid_clear(&g);
+    assert_true(voxel_grid_cell(&g, 2, 2, 2)->count == 0);
+    voxel_grid_free(&g);
+
+    assert_true(voxel_key(0, 0, 0) != voxel_key(-1, 0, 0));
+    voxel_key_coords(voxel_key(-5, 7, -(1 << 20)), &x, &y, &z);
+    assert_true(x == -5 && y == 7 && z == -(1 << 20));
+    p[0] = Vec3(-0.5f, 0.5f, 2.5f);
+    p[1] = Vec3(-3, 0, 0);
+    p[2] = Vec3(1e30f, 0, 0);
+    p[3] = Vec3(0, NAN, 0);
+    voxel_key_batch(Vec3(0, 0, 0), 1, p, keys, 4);
+    assert_true(keys[0] == voxel_key(-1, 0, 2));
+    assert_true(keys[1] == voxel_key(-3, 0, 0));
+    assert_true(keys[2] == VOXEL_KEY_NONE);
+    assert_true(keys[3] == VOXEL_KEY_NONE);
+
+    /* Dense and sparse binning agree, with and without threads. */
+    for (i = 0; i < N; i++) {
+        p[i] = Vec3(randf(-1, 9), randf(-1, 5), randf(-1, 3));
+    }
+    assert_true(voxel_grid_init(&g, Vec3(0, 0, 0), 0.5f, 16, 8, 4) == 0);
+    assert_true(voxel_grid_init(&g4, Vec3(0, 0, 0), 0.5f, 16, 8, 4) == 0);
+    assert_true(voxel_hash_init(&h, Vec3(0, 0, 0), 0.5f) == 0);
+    assert_true(voxel_hash_init(&h4, Vec3(0, 0, 0), 0.5f) == 0);
+    assert_true(voxel_grid_bin(&g, p, N, 1) == 0);
+    assert_true(voxel_grid_bin(&g4, p, N, 4) == 0);
+    assert_true(voxel_hash_bin(&h, p, N, 1) == 0);
+    assert_true(voxel_hash_bin(&h4, p, N, 4) == 0);
+    assert_true(h.count == 20 * 12 * 8);
+    assert_true(h4.count == h.count);
+
+    total = 0;
+    for (z = 0; z < 4; z++) {
+        for (y = 0; y < 8; y++) {
+            for (x = 0; x < 16; x++) {
+                voxel_cell *a = voxel_grid_cell(&g, x, y, z);
+                voxel_cell *b = voxel_grid_cell(&g4, x, y, z);
+                voxel_cell *c = voxel_hash_find(&h, x, y, z);
+                voxel_cell *d = voxel_hash_find(&h4, x, y, z);
+                assert_true(c && d);
+                assert_true(a->count > 0);
+                assert_true(a->count == b->count && a->count == c->count && a->count == d->count);
+                assert_vec3_equal(a->sum, c->sum);
+                assert_vec3_equal(a->bounds.min, d->bounds.min);
+                assert_vec3_equal(a->bounds.max, d->bounds.max);
+                /* Threaded sums are added in a different order. */
+                assert_true(vec3_length(vec3_sub(voxel_cell_centroid(a), voxel_cell_centroid(b))) < 1e-5f);
+                assert_true(vec3_length(vec3_sub(voxel_cell_centroid(a), voxel_cell_centroid(d))) < 1e-5f);
+                assert_true(a->bounds.min.x >= x * 0.5f && a->bounds.max.x < (x + 1) * 0.5f);
+                total += a->count;
+            }
+        }
+    }
+    assert_true(voxel_hash_find(&h, -1, 0, 0) != NULL);
+    assert_true(voxel_hash_find(&h, 100, 0, 0) == NULL);
+    for (i = 0; i < N; i++) {
+        if (p[i].x >= 0 && p[i].x < 8 && p[i].y >= 0 && p[i].y < 4 && p[i].z >= 0 && p[i].z < 2) {
+            total--;
+        }
+    }
+    assert_true(total == 0);
+
+    voxel_grid_free(&g);
+    voxel_grid_free(&g4);
+    voxel_hash_free(&h);
+    voxel_hash_free(&h4);
+
+    /* A failed allocation leaves an empty table that is safe to free. */
+    voxel_malloc_countdown = 1;
+    assert_true(voxel_hash_init(&h, Vec3(0, 0, 0), 0.5f) == -1 && errno == ENOMEM);
+    assert_true(h.keys == NULL && h.cells == NULL && h.capacity == 0);
+    voxel_hash_free(&h);
+
+    /*
+     * The second private table of a threaded bin gets its keys but not
+     * its cells. The bin fails and frees each table once.
+     */
+    assert_true(voxel_hash_init(&h, Vec3(0, 0, 0), 0.5f) == 0);
+    voxel_malloc_countdown = 3;
+    errno = 0;
+    assert_true(voxel_hash_bin(&h, p, N, 4) == -1 && errno == ENOMEM);
+    assert_true(voxel_malloc_countdown == -1 && h.count == 0);
+    assert_true(voxel_hash_bin(&h, p, N, 4) == 0 && h.count == 20 * 12 * 8);
+    voxel_hash_free(&h);
+}
+
+static void *thread_arena_worker(void *arg)
+{
+    cvec_arena *a = cvec_thread_arena();
+    assert_true(a && a != arg);
+    assert_true(cvec_arena_vec4(a, 100) != NULL);
+    return a;
+}
+
+static void test_alloc(void)
+{
+    {
+        void *p = cvec_aligned_alloc(100, 64);
+        assert_true(p && ((uintptr_t)p & 63) == 0);
+        cvec_aligned_free(p);
+        cvec_aligned_free(NULL);
+    }
+
+    {
+        cvec_arena a;
+        vec4 *v;
+        mat4 *m;
+        size_t mark;
+        assert_true(cvec_arena_init(&a, 4096) == 0);
+        v = cvec_arena_vec4(&a, 3);
+        m = cvec_arena_mat4(&a, 2);
+        assert_true(v && m && ((uintptr_t)v & (CVEC_ALIGN - 1)) == 0 && ((uintptr_t)m & (CVEC_ALIGN - 1)) == 0);
+        assert_true((char *)m >= (char *)(v + 3));
+        mat4_init_identity(&m[1]);
+        mark = cvec_arena_mark(&a);
+        assert_true(cvec_arena_alloc(&a, 1000, 4) != NULL);
+        cvec_arena_rewind(&a, mark);
+        assert_true(cvec_arena_mark(&a) == mark);
+        assert_true(cvec_arena_vec4(&a, 1000) == NULL);
+        assert_true(errno == ENOMEM);
+        assert_true(cvec_arena_array(&a, SIZE_MAX / 2, 4) == NULL);
+        cvec_arena_reset(&a);
+        assert_true(cvec_arena_vec4(&a, 256) == (vec4 *)a.base);
+        cvec_arena_destroy(&a);
+    }
+
+    {
+        cvec_arena *a = cvec_thread_arena();
+        pthread_t thread;
+        void *other;
+        assert_true(a && a == cvec_thread_arena());
+        assert_true(pthread_create(&thread, NULL, thread_arena_worker, a) == 0);
+        assert_true(pthread_join(thread, &other) == 0);
+        assert_true(other != a);
+    }
+
+    {
+        cvec_pool p;
+        mat4 *blocks[100];
+        int i;
+        cvec_pool_init(&p, sizeof(mat4), 16);
+        for (i = 0; i < 100; i++) {
+            blocks[i] = cvec_pool_alloc(&p);
+            assert_true(blocks[i] && ((uintptr_t)blocks[i] & (CVEC_ALIGN - 1)) == 0);
+            mat4_init_scale(blocks[i], i);
+        }
+        for (i = 0; i < 100; i++) {
+            assert_true(mat4_get(blocks[i], 0, 0) == i);
+        }
+        cvec_pool_free(&p, blocks[42]);
+        assert_true(cvec_pool_alloc(&p) == blocks[42]);
+        cvec_pool_destroy(&p);
+    }
+
+    {
+        vec3_soa s;
+        cvec_arena a;
+        assert_true(vec3_soa_stride(1) == CVEC_ALIGN / sizeof(float));
+        assert_true(vec3_soa_alloc(&s, 1000) == 0);
+        assert_true(((uintptr_t)s.y & (CVEC_ALIGN - 1)) == 0 && ((uintptr_t)s.z & (CVEC_ALIGN - 1)) == 0);
+        assert_true(s.y - s.x == (ptrdiff_t)vec3_soa_stride(1000));
+        vec3_soa_set(s, 999, Vec3(1, 2, 3));
+        assert_vec3_equal(Vec3(1, 2, 3), vec3_soa_get(s, 999));
+        vec3_soa_free(&s);
+        assert_true(s.x == NULL);
+
+        assert_true(cvec_arena_init(&a, 1 << 16) == 0);
+        assert_true(cvec_arena_vec3_soa(&a, &s, 100) == 0);
+        assert_true(s.x == (float *)a.base && s.z - s.x == 2 * (ptrdiff_t)vec3_soa_stride(100));
+        assert_true(cvec_arena_vec3_soa(&a, &s, 1 << 20) == -1);
+        cvec_arena_destroy(&a);
+
+        /* Counts whose padded stride does not fit fail instead of wrapping. */
+        assert_true(vec3_soa_stride(SIZE_MAX - 1) == SIZE_MAX);
+        errno = 0;
+        assert_true(vec3_soa_alloc(&s, SIZE_MAX - 1) == -1 && errno == ENOMEM);
+        assert_true(cvec_arena_init(&a, 4096) == 0);
+        errno = 0;
+        assert_true(cvec_arena_vec3_soa(&a, &s, SIZE_MAX) == -1 && errno == ENOMEM);
+        assert_true(cvec_arena_mark(&a) == 0);
+        cvec_arena_destroy(&a);
+    }
+
+    {
+        vec2_soa s2;
+        vec4_soa s4;
+        cvec_arena a;
+        assert_true(vec2_soa_alloc(&s2, 100) == 0);
+        assert_true(s2.y - s2.x == (ptrdiff_t)vec2_soa_stride(100));
+        assert_true(((uintptr_t)s2.x & (CVEC_ALIGN - 1)) == 0 && ((uintptr_t)s2.y & (CVEC_ALIGN - 1)) == 0);
+        vec2_soa_set(s2, 99, Vec2(1, 2));
+        assert_vec2_equal(Vec2(1, 2), vec2_soa_get(s2, 99));
+        vec2_soa_free(&s2);
+        assert_true(s2.x == NULL);
+
+        assert_true(vec4_soa_alloc(&s4, 100) == 0);
+        assert_true(s4.w - s4.x == 3 * (ptrdiff_t)vec4_soa_stride(100));
+        assert_true(((uintptr_t)s4.w & (CVEC_ALIGN - 1)) == 0);
+        vec4_soa_set(s4, 99, Vec4(1, 2, 3, 4));
+        assert_vec4_equal(Vec4(1, 2, 3, 4), vec4_soa_get(s4, 99));
+        vec4_soa_free(&s4);
+        assert_true(s4.x == NULL);
+        errno = 0;
+        assert_true(vec4_soa_alloc(&s4, SIZE_MAX / 8) == -1 && errno == ENOMEM);
+
+        assert_true(cvec_arena_init(&a, 1 << 16) == 0);
+        assert_true(cvec_arena_vec2_soa(&a, &s2, 100) == 0);
+        assert_true(s2.x == (float *)a.base);
+        assert_true(cvec_arena_vec4_soa(&a, &s4, 100) == 0);
+        assert_true(s4.x == s2.x + 2 * vec2_soa_stride(100));
+        assert_true(cvec_arena_vec4_soa(&a, &s4, 1 << 20) == -1);
+        cvec_arena_destroy(&a);
+    }
+}
+
 int main(int argc, char **argv)
 {
     (void) argc;
@@ -555,5 +2854,26 @@ int main(int argc, char **argv)
     test_mat2();
     test_mat3();
     test_mat4();
+    test_double();
+    test_fixed();
+    test_aabb();
+    test_bvh();
+    test_parallel();
+    test_command();
+    test_morton();
+    test_quant();
+    test_batch();
+    test_trs();
+    test_lanes();
+    test_rotation();
+    test_query();
+    test_bounds();
+    test_polygon();
+    test_voxel();
+    test_alloc();
+    test_particle();
+    test_file();
+    test_stream();
+    test_profile();
     return 0;
 }
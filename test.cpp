@@ -0,0 +1,76 @@
+#include "cvec.hpp"
+#include <cstdlib>
+#include <vector>
+#include "cvec_asserts.h"
+
+static_assert(sizeof(cvec::Vec3) == sizeof(vec3), "Vec3 layout");
+static_assert(sizeof(cvec::Mat4) == sizeof(mat4), "Mat4 layout");
+
+/* Folded at compile time. */
+static constexpr cvec::Mat4 translate = cvec::Mat4::translate(1, 2, 3);
+static_assert(translate.data[12] == 1 && translate.data[14] == 3, "constexpr translate");
+static_assert(cvec::Mat4::identity().data[15] == 1, "constexpr identity");
+static_assert(cvec::Mat3::scale(2).data[4] == 2, "constexpr scale");
+
+static void test_vec(void)
+{
+    cvec::Vec3 a(1, 2, 3), b(4, 5, 6), c(1, 1, 1);
+    assert_vec3_equal(Vec3(5, 8, 11), a*2 + (b - c));
+    assert_vec3_equal(Vec3(-3, 6, -3), cross(a, b));
+    assert_vec3_equal(Vec3(-1, -2, -3), -a);
+    assert_vec3_equal(Vec3(0.5f, 1, 1.5f), a / 2);
+    assert_equal(32, dot(a, b));
+    assert_equal(1, length(normalize(b)));
+
+    a += c;
+    a *= 2;
+    assert_vec3_equal(Vec3(4, 6, 8), a);
+
+    /* Interchangeable with the C types. */
+    vec3 raw = vec3_add(a, b);
+    cvec::Vec3 wrapped = raw;
+    assert_vec3_equal(Vec3(8, 11, 14), wrapped);
+}
+
+static void test_mat(void)
+{
+    cvec::Mat4 m = cvec::Mat4::translate(cvec::Vec3(10, 20, 30)) * cvec::Mat4::rotate(cvec::Vec3(0, 0, 1), M_PI/2);
+    cvec::Vec4 r = m * cvec::Vec4(1, 0, 0, 1);
+    assert_vec4_equal(Vec4(10, 21, 30, 1), r);
+    assert_equal(10, m(0, 3));
+
+    cvec::Mat4 s = cvec::Mat4::scale(2);
+    cvec::Mat4 p = s * cvec::Mat4::identity();
+    assert_mat4_equal(&s, &p);
+    assert_equal(20, transpose(m)(3, 1));
+}
+
+static void test_span(void)
+{
+    const std::size_t n = 1001;
+    std::vector<cvec::Vec3> a(n), b(n), c(n), out(n);
+    for (std::size_t i = 0; i < n; i++) {
+        a[i] = cvec::Vec3(i, 2*i, 3*i);
+        b[i] = cvec::Vec3(1, 2, 3);
+        c[i] = cvec::Vec3(-1, 0, 1);
+    }
+
+    cvec::span(&out[0], n) = cvec::span(&a[0], n) * 2 + (cvec::span(&b[0], n) - cvec::span(&c[0], n));
+    for (std::size_t i = 0; i < n; i++) {
+        assert_vec3_equal(a[i]*2 + (b[i] - c[i]), out[i]);
+    }
+
+    cvec::span(&out[0], n) = -cvec::span(&b[0], n) * cvec::span(&c[0], n);
+    assert_vec3_equal(Vec3(1, 0, -3), out[n - 1]);
+
+    cvec::span(&out[0], n) = cvec::span(&a[0], n);
+    assert_vec3_equal(a[7], out[7]);
+}
+
+int main()
+{
+    test_vec();
+    test_mat();
+    test_span();
+    return 0;
+}